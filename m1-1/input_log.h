@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Kind of GLUT callback an input event goes to
+enum InputEventType : uint8_t
+{
+	InputKeyboard,	  // keyboard(key, x, y)
+	InputSpecial,	  // keyboard_special(key, x, y)
+	InputMouseButton, // mouseButton(button, state, x, y)
+	InputMotion,	  // motion(x, y)
+};
+
+// One recorded event, 12 bytes. The GLUT key codes, buttons and states all
+// fit in a byte, and window coordinates in 16 bits.
+struct InputEvent
+{
+	uint32_t time;	   // Microseconds since the recording started
+	uint8_t type;	   // InputEventType
+	uint8_t key;	   // Key or mouse button
+	uint8_t state;	   // GLUT_DOWN or GLUT_UP for mouse buttons
+	uint8_t modifiers; // glutGetModifiers() at the event, which a replay cannot ask GLUT for
+	int16_t x, y;	   // Mouse position in the window
+};
+static_assert(sizeof(InputEvent) == 12, "InputEvent is written to disk as is");
+
+// Every input event of a session with its time, so the same interaction can
+// be fed back later. The file is a small header followed by the raw events.
+class InputLog
+{
+public:
+	int width = 0, height = 0; // Window size when the recording started
+
+	const std::vector<InputEvent> &events() const { return log; }
+
+	// Start the clock and forget earlier events
+	void start(int windowWidth, int windowHeight)
+	{
+		width = windowWidth;
+		height = windowHeight;
+		log.clear();
+		origin = Clock::now();
+	}
+
+	void record(InputEventType type, int key, int state, int x, int y, int modifiers)
+	{
+		long long us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - origin).count();
+		InputEvent e;
+		e.time = (uint32_t)std::min<long long>(us, UINT32_MAX);
+		e.type = type;
+		e.key = (uint8_t)key;
+		e.state = (uint8_t)state;
+		e.modifiers = (uint8_t)modifiers;
+		e.x = (int16_t)std::max(-32768, std::min(x, 32767));
+		e.y = (int16_t)std::max(-32768, std::min(y, 32767));
+		log.push_back(e);
+	}
+
+	bool save(const std::string &path) const
+	{
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+		Header h = {{'I', 'N', 'P', 'U', 'T', 'L', 'O', 'G'}, version, (uint32_t)log.size(), width, height};
+		bool ok = fwrite(&h, sizeof(h), 1, file) == 1 &&
+				  fwrite(log.data(), sizeof(InputEvent), log.size(), file) == log.size();
+		return fclose(file) == 0 && ok;
+	}
+
+	// False if the file is missing, from another version or cut short
+	bool load(const std::string &path)
+	{
+		FILE *file = fopen(path.c_str(), "rb");
+		if (!file)
+			return false;
+		Header h;
+		bool ok = fread(&h, sizeof(h), 1, file) == 1 && memcmp(h.magic, "INPUTLOG", 8) == 0 && h.version == version;
+		if (ok)
+		{
+			log.resize(h.count);
+			ok = fread(log.data(), sizeof(InputEvent), h.count, file) == h.count;
+			width = h.width;
+			height = h.height;
+		}
+		fclose(file);
+		if (!ok)
+			log.clear();
+		return ok;
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+	static constexpr uint32_t version = 1;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version, count;
+		int32_t width, height;
+	};
+
+	std::vector<InputEvent> log;
+	Clock::time_point origin;
+};
+
+// Feeds a loaded log back one event at a time, either at the times it was
+// recorded or as fast as frames can be drawn, and times every frame drawn
+// along the way.
+class InputReplay
+{
+public:
+	InputLog log;
+	bool fast = false; // One event per frame instead of the recorded timing
+
+	bool active() const { return running; }
+	bool finished() const { return running && next >= log.events().size(); }
+
+	void start()
+	{
+		running = true;
+		next = 0;
+		frameTimes.clear();
+		origin = Clock::now();
+	}
+
+	// The next event if it is due, or null. Fast replays never wait.
+	const InputEvent *due()
+	{
+		if (next >= log.events().size())
+			return nullptr;
+		const InputEvent &e = log.events()[next];
+		if (!fast && elapsedUs() < e.time)
+			return nullptr;
+		++next;
+		return &e;
+	}
+
+	// Milliseconds until the next event is due
+	unsigned waitMs() const
+	{
+		if (fast || next >= log.events().size())
+			return 0;
+		long long left = (long long)log.events()[next].time - (long long)elapsedUs();
+		return left > 0 ? (unsigned)((left + 999) / 1000) : 0;
+	}
+
+	void beginFrame() { frameStart = Clock::now(); }
+	void endFrame()
+	{
+		if (running)
+			frameTimes.push_back(std::chrono::duration<double, std::milli>(Clock::now() - frameStart).count());
+	}
+
+	// Frame count and times, and how long the replay took against the recording
+	void print(FILE *out) const
+	{
+		std::vector<double> t = frameTimes;
+		std::sort(t.begin(), t.end());
+		double sum = 0;
+		for (double v : t)
+			sum += v;
+		auto percentile = [&](double p)
+		{ return t.empty() ? 0.0 : t[std::min(t.size() - 1, (size_t)(p * t.size()))]; };
+		double recorded = log.events().empty() ? 0.0 : log.events().back().time / 1000.0;
+		fprintf(out, "Replayed %zu events in %.1f ms (recorded %.1f ms, %s)\n", log.events().size(), elapsedUs() / 1000.0,
+				recorded, fast ? "as fast as possible" : "original timing");
+		fprintf(out, "%zu frames, ms: min %.3f avg %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f\n", t.size(),
+				t.empty() ? 0.0 : t.front(), t.empty() ? 0.0 : sum / t.size(), percentile(0.50), percentile(0.95),
+				percentile(0.99), t.empty() ? 0.0 : t.back());
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+	bool running = false;
+	size_t next = 0;
+	std::vector<double> frameTimes;
+	Clock::time_point origin, frameStart;
+
+	uint64_t elapsedUs() const
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - origin).count();
+	}
+};
+
+// FNV-1a hash of raw bytes, to compare the state two runs end in at a glance
+inline uint64_t stateHash(const void *data, size_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; ++i)
+		h = (h ^ ((const unsigned char *)data)[i]) * 0x100000001b3ull;
+	return h;
+}
@@ -1,283 +1,934 @@
-#include <iostream>
-#include <GL/freeglut.h>
-#include <vector>
-#include <tuple>
-#include <math.h>
-
-using vertex = std::tuple<double, double, double>;
-using vertex_list = std::vector<vertex>;
-using edge = std::pair<int, int>;
-using edge_list = std::vector<edge>;
-
-struct Polygon3D
-{
-	double sideLength;
-	vertex position;
-	vertex scale;
-	double rotX, rotY, rotZ;
-	vertex_list vertices;
-	edge_list edges;
-};
-
-Polygon3D create_cube(double cx, double cy, double cz, double side);
-void draw(const Polygon3D &polygon);
-void translate(Polygon3D &polygon, double distance, double angle, double dz);
-void scale_polygon(Polygon3D &polygon, double sx, double sy, double sz = 1.0);
-void rotate(Polygon3D &polygon, double angle, char axis);
-void display();
-void redraw(int value);
-void keyboard(unsigned char key, int x, int y);
-void keyboard_special(int key, int x, int y);
-
-Polygon3D cube;
-int delay = 10;
-
-int main(int argc, char **argv)
-{
-	cube = create_cube(0, 0, 0, 60); // centered
-
-	GLsizei height = 600;
-	GLsizei width = 600;
-	GLfloat aspect = (GLfloat)height / (GLfloat)width; // aspect ratio, so that the image is not distorted
-
-	glutInit(&argc, argv);
-	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-	glutInitWindowSize(width, height);
-	glutCreateWindow("3D Cube - Wireframe");
-
-	glClearColor(1.0, 1.0, 1.0, 1.0);
-	glEnable(GL_DEPTH_TEST); // Enable depth test
-
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(45.0, aspect, 1.0, 500.0);
-	glMatrixMode(GL_MODELVIEW);
-
-	glutDisplayFunc(display);
-	glutKeyboardFunc(keyboard);
-	glutSpecialFunc(keyboard_special);
-	glutTimerFunc(delay, redraw, 0);
-
-	glutMainLoop();
-	return 0;
-}
-
-void display()
-{
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glLoadIdentity();
-
-	gluLookAt(0.0, 0.0, 200.0, // camera position
-			  0.0, 0.0, 0.0,   // look at point
-			  0.0, 1.0, 0.0);  // up vector
-
-	draw(cube);
-	glutSwapBuffers();
-}
-
-void redraw(int value)
-{
-	GLsizei height = 600;
-	GLsizei width = 600;
-	if (height == 0)
-		height = 1;
-
-	GLfloat aspect = (GLfloat)width / (GLfloat)height;
-	glViewport(0, 0, width, height);
-	gluPerspective(45.0, aspect, 1.0, 500.0);
-
-	glutPostRedisplay();
-	glutTimerFunc(delay, redraw, 0);
-}
-
-Polygon3D create_cube(double cx, double cy, double cz, double side)
-{
-	Polygon3D cube;
-	cube.position = {cx, cy, cz};
-	cube.sideLength = side;
-	cube.scale = {1, 1, 1};
-	cube.rotX = cube.rotY = cube.rotZ = 0;
-
-	double h = side / 2.0;
-
-	cube.vertices = {
-		{-h, -h, -h}, {h, -h, -h}, {h, h, -h}, {-h, h, -h}, {-h, -h, h}, {h, -h, h}, {h, h, h}, {-h, h, h}};
-
-	cube.edges = {
-		{0, 1}, {1, 2}, {2, 3}, {3, 0}, {4, 5}, {5, 6}, {6, 7}, {7, 4}, {0, 4}, {1, 5}, {2, 6}, {3, 7}};
-
-	for (auto &v : cube.vertices)
-	{
-		std::get<0>(v) += cx;
-		std::get<1>(v) += cy;
-		std::get<2>(v) += cz;
-	}
-
-	return cube;
-}
-
-void draw(const Polygon3D &polygon)
-{
-	glColor3f(0.0, 0.0, 0.0);
-	glBegin(GL_LINES);
-	for (auto [i, j] : polygon.edges)
-	{
-		auto [x1, y1, z1] = polygon.vertices[i];
-		auto [x2, y2, z2] = polygon.vertices[j];
-		glVertex3f(x1, y1, z1);
-		glVertex3f(x2, y2, z2);
-	}
-	glEnd();
-}
-
-void translate(Polygon3D &polygon, double distance, double angle, double dz)
-{
-	double dx = cos(angle) * distance;
-	double dy = sin(angle) * distance;
-
-	std::get<0>(polygon.position) += dx;
-	std::get<1>(polygon.position) += dy;
-	std::get<2>(polygon.position) += dz;
-
-	for (auto &v : polygon.vertices)
-	{
-		std::get<0>(v) += dx;
-		std::get<1>(v) += dy;
-		std::get<2>(v) += dz;
-	}
-}
-
-void scale_polygon(Polygon3D &p, double sx, double sy, double sz)
-{
-	double cx = std::get<0>(p.position);
-	double cy = std::get<1>(p.position);
-	double cz = std::get<2>(p.position);
-
-	for (auto &v : p.vertices)
-	{
-		auto &x = std::get<0>(v);
-		auto &y = std::get<1>(v);
-		auto &z = std::get<2>(v);
-
-		x = cx + (x - cx) * sx;
-		y = cy + (y - cy) * sy;
-		z = cz + (z - cz) * sz;
-	}
-}
-
-void rotate(Polygon3D &p, double angle, char axis)
-{
-	double cx = std::get<0>(p.position);
-	double cy = std::get<1>(p.position);
-	double cz = std::get<2>(p.position);
-
-	for (auto &v : p.vertices)
-	{
-		double &x = std::get<0>(v);
-		double &y = std::get<1>(v);
-		double &z = std::get<2>(v);
-
-		double dx = x - cx;
-		double dy = y - cy;
-		double dz = z - cz;
-
-		if (axis == 'x')
-		{
-			double y_rot = dy * cos(angle) - dz * sin(angle);
-			double z_rot = dy * sin(angle) + dz * cos(angle);
-			y = cy + y_rot;
-			z = cz + z_rot;
-		}
-		else if (axis == 'y')
-		{
-			double x_rot = dx * cos(angle) + dz * sin(angle);
-			double z_rot = -dx * sin(angle) + dz * cos(angle);
-			x = cx + x_rot;
-			z = cz + z_rot;
-		}
-		else if (axis == 'z')
-		{
-			double x_rot = dx * cos(angle) - dy * sin(angle);
-			double y_rot = dx * sin(angle) + dy * cos(angle);
-			x = cx + x_rot;
-			y = cy + y_rot;
-		}
-	}
-}
-
-void keyboard(unsigned char key, int x, int y)
-{
-	switch (key)
-	{
-	case 27: // ESC key – exit the program
-		exit(0);
-
-	case 'w': // Rotate around X-axis (positive direction)
-		rotate(cube, 0.1, 'x');
-		break;
-
-	case 's': // Rotate around X-axis (negative direction)
-		rotate(cube, -0.1, 'x');
-		break;
-
-	case 'a': // Rotate around Y-axis (positive direction)
-		rotate(cube, 0.1, 'y');
-		break;
-
-	case 'd': // Rotate around Y-axis (negative direction)
-		rotate(cube, -0.1, 'y');
-		break;
-
-	case 'q': // Rotate around Z-axis (positive direction)
-		rotate(cube, 0.1, 'z');
-		break;
-
-	case 'e': // Rotate around Z-axis (negative direction)
-		rotate(cube, -0.1, 'z');
-		break;
-
-	case 'z': // Move into the screen (negative Z)
-		translate(cube, 0, 0, -10);
-		break;
-
-	case 'x': // Move out of the screen (positive Z)
-		translate(cube, 0, 0, 10);
-		break;
-
-	case '+':
-	case '=': // Scale up the cube by 10%
-		scale_polygon(cube, 1.1, 1.1, 1.1);
-		break;
-
-	case '-':
-	case '_': // Scale down the cube by 10%
-		scale_polygon(cube, 0.9, 0.9, 0.9);
-		break;
-
-	case ' ': // Spacebar – reset the cube to original state
-		cube = create_cube(0, 0, 0, 60);
-		break;
-	}
-}
-
-void keyboard_special(int key, int x, int y)
-{
-	switch (key)
-	{
-	case GLUT_KEY_UP: // Move upward along Y-axis
-		translate(cube, 10, M_PI / 2, 0);
-		break;
-
-	case GLUT_KEY_DOWN: // Move downward along Y-axis
-		translate(cube, 10, 3 * M_PI / 2, 0);
-		break;
-
-	case GLUT_KEY_LEFT: // Move left along X-axis
-		translate(cube, 10, M_PI, 0);
-		break;
-
-	case GLUT_KEY_RIGHT: // Move right along X-axis
-		translate(cube, 10, 0, 0);
-		break;
-	}
-}
+#include <iostream>
+#define GL_GLEXT_PROTOTYPES // Buffer object entry points (GL 1.5)
+#include <GL/freeglut.h>
+#include <vector>
+#include <tuple>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <set>
+#include <math.h>
+#include "vertex_transform.h"
+#include "wireframe_raster.h"
+#include "obj_edges.h"
+#include "input_log.h"
+
+using vertex = std::tuple<double, double, double>;
+using vertex_list = std::vector<vertex>;
+using edge = std::pair<int, int>;
+using edge_list = std::vector<edge>;
+static_assert(sizeof(edge) == 2 * sizeof(int), "edges are uploaded as they are, as pairs of GL_UNSIGNED_INT indices");
+
+// The base vertices are never modified: every move is folded into
+// `transform`, which draw() applies once per frame into `rendered`
+struct Polygon3D
+{
+	double sideLength;
+	vertex position;
+	Matrix4 transform;
+	VertexArrays base;
+	VertexArrays rendered;
+	edge_list edges;
+	std::vector<float> interleaved;			 // `rendered` as x, y, z per vertex, for the vertex buffer
+	unsigned int vertexBuffer = 0, indexBuffer = 0; // Of the GL_LINES path, made on the first draw
+};
+
+Polygon3D create_cube(double cx, double cy, double cz, double side);
+bool load_model(const std::string &path, Polygon3D &polygon);
+void reset_polygon(Polygon3D &polygon);
+void draw(Polygon3D &polygon);
+void translate(Polygon3D &polygon, double distance, double angle, double dz);
+void scale_polygon(Polygon3D &polygon, double sx, double sy, double sz = 1.0);
+void rotate(Polygon3D &polygon, double angle, char axis);
+void display();
+void reshape(int width, int height);
+void keyboard(unsigned char key, int x, int y);
+void keyboard_special(int key, int x, int y);
+std::vector<Polygon3D> create_cube_grid(int count);
+Matrix4 view_projection(int width, int height);
+bool render_to_file(const std::string &path, std::vector<Polygon3D> &scene, int width, int height);
+void bench_transform(const std::vector<size_t> &counts);
+void bench_raster(std::vector<Polygon3D> &scene, int width, int height, int frames);
+void bench_edges(const std::vector<std::string> &paths);
+void record_input(InputEventType type, int key, int x, int y);
+void save_input_log();
+void start_replay(const std::string &path);
+void finish_replay();
+
+Polygon3D shape; // The cube, or the model given on the command line
+
+bool softwareRaster = false; // --software draws with WireframeRasterizer instead of GL_LINES
+bool antialiasLines = false; // --antialias: Xiaolin Wu lines in the software renderer
+WireframeRasterizer rasterizer;
+int windowWidth = 600, windowHeight = 600;
+InputLog inputLog; // --record file: every key press of the session, written at exit
+std::string inputLogPath;
+InputReplay inputReplay; // --replay file: a recorded session fed back to the keyboard handlers
+
+int main(int argc, char **argv)
+{
+	// Options are read before glutInit, so renders and benchmarks need no display
+	std::string mode, outputPath, modelPath, replayPath;
+	std::vector<size_t> counts;
+	std::vector<std::string> models;
+	int cubes = 1, frames = 20;
+	int width = 600, height = 600;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--software")
+			softwareRaster = true;
+		else if (arg == "--antialias")
+			antialiasLines = true;
+		else if (arg == "--threads" && i + 1 < argc)
+			threadCount() = atoi(argv[++i]);
+		else if (arg == "--cubes" && i + 1 < argc)
+			cubes = std::max(1, atoi(argv[++i]));
+		else if (arg == "--frames" && i + 1 < argc)
+			frames = std::max(1, atoi(argv[++i]));
+		else if (arg == "--size" && i + 1 < argc)
+			sscanf(argv[++i], "%dx%d", &width, &height);
+		else if (arg == "--record" && i + 1 < argc)
+			inputLogPath = argv[++i];
+		else if (arg == "--replay" && i + 1 < argc)
+			replayPath = argv[++i];
+		else if (arg == "--replay-fast")
+			inputReplay.fast = true;
+		else if (arg == "--render" && i + 1 < argc)
+		{
+			mode = arg;
+			outputPath = argv[++i];
+		}
+		else if (arg == "--bench-transform" || arg == "--bench-raster" || arg == "--bench-edges")
+			mode = arg;
+		else if (mode == "--bench-transform")
+			counts.push_back(strtoull(argv[i], nullptr, 10));
+		else if (mode == "--bench-edges")
+			models.push_back(arg);
+		else
+			modelPath = arg;
+	}
+
+	// Usage: cube3d --bench-transform [vertex_count...]
+	if (mode == "--bench-transform")
+	{
+		if (counts.empty())
+			counts = {1000000, 10000000, 100000000};
+		bench_transform(counts);
+		return 0;
+	}
+	// Usage: cube3d --bench-raster [--cubes N] [--size WxH] [--frames N]
+	if (mode == "--bench-raster")
+	{
+		std::vector<Polygon3D> scene = create_cube_grid(cubes == 1 ? 1000 : cubes);
+		bench_raster(scene, width, height, frames);
+		return 0;
+	}
+	// Usage: cube3d --bench-edges [obj_file...]
+	if (mode == "--bench-edges")
+	{
+		if (models.empty())
+			models = {"3d-models/elepham.obj", "3d-models/radar.obj"};
+		bench_edges(models);
+		return 0;
+	}
+	// Usage: cube3d --render out.ppm [--cubes N] [--size WxH] [--antialias] [--threads N] [obj_file]
+	if (mode == "--render")
+	{
+		std::vector<Polygon3D> scene(1);
+		if (modelPath.empty())
+			scene = create_cube_grid(cubes);
+		else if (!load_model(modelPath, scene[0]))
+			return 1;
+		if (!render_to_file(outputPath, scene, width, height))
+		{
+			std::cerr << "Failed to write " << outputPath << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (modelPath.empty())
+		shape = create_cube(0, 0, 0, 60); // centered
+	else if (!load_model(modelPath, shape))
+		return 1;
+
+	glutInit(&argc, argv);
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+	glutInitWindowSize(width, height);
+	glutCreateWindow(modelPath.empty() ? "3D Cube - Wireframe" : "3D Model - Wireframe");
+
+	glClearColor(1.0, 1.0, 1.0, 1.0);
+	glEnable(GL_DEPTH_TEST); // Enable depth test
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Rows of the software image are tightly packed
+
+	// No timer: GLUT calls display() when the window needs repainting, and the
+	// keyboard handlers ask for a frame after moving the cube
+	glutDisplayFunc(display);
+	glutReshapeFunc(reshape);
+	glutKeyboardFunc(keyboard);
+	glutSpecialFunc(keyboard_special);
+
+	// Usage: cube3d --record log [obj_file], then cube3d --replay log [--replay-fast] [obj_file]
+	if (!inputLogPath.empty())
+	{
+		inputLog.start(width, height);
+		atexit(save_input_log);
+	}
+	if (!replayPath.empty())
+		start_replay(replayPath);
+
+	glutMainLoop();
+	return 0;
+}
+
+void display()
+{
+	inputReplay.beginFrame();
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (softwareRaster)
+	{
+		// The CPU image replaces the window contents, drawn from the bottom-left corner
+		static std::vector<unsigned char> pixels;
+		if (rasterizer.imageWidth() != windowWidth || rasterizer.imageHeight() != windowHeight)
+			rasterizer.resize(windowWidth, windowHeight);
+		rasterizer.clear(255, 255, 255);
+		draw(shape);
+		rasterizer.render(threadPool(), antialiasLines);
+		rasterizer.resolve(pixels, true);
+
+		glMatrixMode(GL_PROJECTION);
+		glPushMatrix();
+		glLoadIdentity();
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+		glRasterPos2f(-1, -1);
+		glDisable(GL_DEPTH_TEST);
+		glDrawPixels(windowWidth, windowHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+		glEnable(GL_DEPTH_TEST);
+		glMatrixMode(GL_PROJECTION);
+		glPopMatrix();
+		glMatrixMode(GL_MODELVIEW);
+	}
+	else
+	{
+		glLoadIdentity();
+
+		gluLookAt(0.0, 0.0, 200.0, // camera position
+				  0.0, 0.0, 0.0,   // look at point
+				  0.0, 1.0, 0.0);  // up vector
+
+		draw(shape);
+	}
+	glutSwapBuffers();
+	inputReplay.endFrame();
+	if (inputReplay.finished())
+		finish_replay();
+}
+
+// Called by GLUT when the window is created or resized. The projection is
+// replaced, not multiplied onto the current matrix.
+void reshape(int width, int height)
+{
+	if (height == 0)
+		height = 1;
+	windowWidth = width;
+	windowHeight = height;
+
+	GLfloat aspect = (GLfloat)width / (GLfloat)height; // aspect ratio, so that the image is not distorted
+	glViewport(0, 0, width, height);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluPerspective(45.0, aspect, 1.0, 500.0);
+	glMatrixMode(GL_MODELVIEW);
+}
+
+Polygon3D create_cube(double cx, double cy, double cz, double side)
+{
+	Polygon3D cube;
+	cube.position = {cx, cy, cz};
+	cube.sideLength = side;
+	cube.transform = Matrix4::translation(cx, cy, cz);
+
+	double h = side / 2.0;
+
+	// The six faces, whose shared sides leave the 12 edges
+	ObjFaces faces;
+	vertex_list corners = {
+		{-h, -h, -h}, {h, -h, -h}, {h, h, -h}, {-h, h, -h}, {-h, -h, h}, {h, -h, h}, {h, h, h}, {-h, h, h}};
+	for (auto [x, y, z] : corners)
+		faces.positions.push_back(x, y, z);
+	faces.corners = {0, 3, 2, 1, 4, 5, 6, 7, 0, 1, 5, 4, 2, 3, 7, 6, 0, 4, 7, 3, 1, 2, 6, 5};
+	faces.faceStart = {0, 4, 8, 12, 16, 20, 24};
+	cube.base = faces.positions;
+	extractEdges(faces, cube.edges);
+
+	return cube;
+}
+
+// Build `polygon` from the faces of a .obj file: centered on the origin and
+// scaled to the size of the cube, with every edge shared by two faces drawn once
+bool load_model(const std::string &path, Polygon3D &polygon)
+{
+	using clock = std::chrono::steady_clock;
+	auto t0 = clock::now();
+	ObjFaces faces;
+	if (!parseObjFaces(path, faces) || faces.positions.size() == 0)
+	{
+		std::cerr << "Failed to open file: " << path << std::endl;
+		return false;
+	}
+	auto t1 = clock::now();
+	size_t duplicates = extractEdges(faces, polygon.edges);
+	auto t2 = clock::now();
+
+	VertexArrays &v = faces.positions;
+	float lo[3] = {v.x[0], v.y[0], v.z[0]}, hi[3] = {v.x[0], v.y[0], v.z[0]};
+	for (size_t i = 0; i < v.size(); ++i)
+	{
+		lo[0] = std::min(lo[0], v.x[i]), hi[0] = std::max(hi[0], v.x[i]);
+		lo[1] = std::min(lo[1], v.y[i]), hi[1] = std::max(hi[1], v.y[i]);
+		lo[2] = std::min(lo[2], v.z[i]), hi[2] = std::max(hi[2], v.z[i]);
+	}
+	double extent = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]});
+	double fit = extent > 0 ? 60.0 / extent : 1.0;
+	polygon.position = {0, 0, 0};
+	polygon.sideLength = 60;
+	polygon.transform = Matrix4::identity();
+	polygon.base.resize(v.size());
+	for (size_t i = 0; i < v.size(); ++i)
+	{
+		polygon.base.x[i] = (v.x[i] - (lo[0] + hi[0]) / 2) * fit;
+		polygon.base.y[i] = (v.y[i] - (lo[1] + hi[1]) / 2) * fit;
+		polygon.base.z[i] = (v.z[i] - (lo[2] + hi[2]) / 2) * fit;
+	}
+
+	printf("%s: %zu vertices, %zu faces, %zu edges (%zu duplicates removed); parsed in %.1f ms, edges in %.2f ms\n",
+		   path.c_str(), v.size(), faces.faceCount(), polygon.edges.size(), duplicates,
+		   std::chrono::duration<double, std::milli>(t1 - t0).count(),
+		   std::chrono::duration<double, std::milli>(t2 - t1).count());
+	return true;
+}
+
+// Back to the untransformed shape; the vertices and GL buffers are kept
+void reset_polygon(Polygon3D &polygon)
+{
+	polygon.position = {0, 0, 0};
+	polygon.transform = Matrix4::identity();
+}
+
+// `count` cubes in a grid filling the view, each turned differently so their
+// edges cross and the depth test has work. A count of 1 is the usual cube.
+std::vector<Polygon3D> create_cube_grid(int count)
+{
+	if (count <= 1)
+		return {create_cube(0, 0, 0, 60)};
+
+	int n = (int)ceil(cbrt((double)count));
+	double spacing = 120.0 / n;
+	std::vector<Polygon3D> scene;
+	for (int i = 0; i < count; ++i)
+	{
+		double x = (i % n - (n - 1) / 2.0) * spacing;
+		double y = (i / n % n - (n - 1) / 2.0) * spacing;
+		double z = (i / (n * n) - (n - 1) / 2.0) * spacing;
+		scene.push_back(create_cube(x, y, z, spacing * 0.6));
+		rotate(scene.back(), 0.37 * i, 'x');
+		rotate(scene.back(), 0.21 * i, 'y');
+	}
+	return scene;
+}
+
+// The camera of display(): gluPerspective and gluLookAt from z = 200
+Matrix4 view_projection(int width, int height)
+{
+	return Matrix4::perspective(45.0, (double)width / height, 1.0, 500.0) * Matrix4::translation(0, 0, -200);
+}
+
+// Draw `scene` with the software renderer and write it as a PPM, no GL needed
+bool render_to_file(const std::string &path, std::vector<Polygon3D> &scene, int width, int height)
+{
+	softwareRaster = true;
+	rasterizer.resize(width, height);
+	for (auto &polygon : scene)
+		draw(polygon);
+	rasterizer.render(threadPool(), antialiasLines);
+	return rasterizer.writePpm(path);
+}
+
+void draw(Polygon3D &polygon)
+{
+	transformPoints(polygon.transform, polygon.base, polygon.rendered);
+	if (softwareRaster)
+	{
+		const unsigned char black[3] = {0, 0, 0};
+		rasterizer.addLines(view_projection(rasterizer.imageWidth(), rasterizer.imageHeight()), polygon.rendered,
+							polygon.edges, black);
+		return;
+	}
+
+	// One glDrawElements for every edge. The edges never change and are
+	// uploaded once; the transformed positions are streamed every frame.
+	if (!polygon.indexBuffer)
+	{
+		glGenBuffers(1, &polygon.vertexBuffer);
+		glGenBuffers(1, &polygon.indexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, polygon.indexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, polygon.edges.size() * sizeof(edge), polygon.edges.data(), GL_STATIC_DRAW);
+	}
+	const VertexArrays &v = polygon.rendered;
+	polygon.interleaved.resize(3 * v.size());
+	for (size_t i = 0; i < v.size(); ++i)
+	{
+		polygon.interleaved[3 * i] = v.x[i];
+		polygon.interleaved[3 * i + 1] = v.y[i];
+		polygon.interleaved[3 * i + 2] = v.z[i];
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, polygon.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, polygon.interleaved.size() * sizeof(float), polygon.interleaved.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, polygon.indexBuffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, nullptr);
+	glColor3f(0.0, 0.0, 0.0);
+	glDrawElements(GL_LINES, (GLsizei)(2 * polygon.edges.size()), GL_UNSIGNED_INT, nullptr);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Moves, rotations and scales are composed onto the accumulated transform
+// (applied after it, in world space). The base vertices stay exact, so a long
+// run of key presses cannot distort the cube.
+void translate(Polygon3D &polygon, double distance, double angle, double dz)
+{
+	double dx = cos(angle) * distance;
+	double dy = sin(angle) * distance;
+
+	std::get<0>(polygon.position) += dx;
+	std::get<1>(polygon.position) += dy;
+	std::get<2>(polygon.position) += dz;
+
+	polygon.transform = Matrix4::translation(dx, dy, dz) * polygon.transform;
+}
+
+// Apply `m` around the centre of the polygon instead of the origin
+static void transform_about_center(Polygon3D &p, const Matrix4 &m)
+{
+	auto [cx, cy, cz] = p.position;
+	p.transform = Matrix4::translation(cx, cy, cz) * m * Matrix4::translation(-cx, -cy, -cz) * p.transform;
+}
+
+void scale_polygon(Polygon3D &p, double sx, double sy, double sz)
+{
+	transform_about_center(p, Matrix4::scaling(sx, sy, sz));
+}
+
+void rotate(Polygon3D &p, double angle, char axis)
+{
+	transform_about_center(p, Matrix4::rotation(angle, axis));
+}
+
+void keyboard(unsigned char key, int x, int y)
+{
+	record_input(InputKeyboard, key, x, y);
+	switch (key)
+	{
+	case 27: // ESC key – exit the program
+		exit(0);
+
+	case 'w': // Rotate around X-axis (positive direction)
+		rotate(shape, 0.1, 'x');
+		break;
+
+	case 's': // Rotate around X-axis (negative direction)
+		rotate(shape, -0.1, 'x');
+		break;
+
+	case 'a': // Rotate around Y-axis (positive direction)
+		rotate(shape, 0.1, 'y');
+		break;
+
+	case 'd': // Rotate around Y-axis (negative direction)
+		rotate(shape, -0.1, 'y');
+		break;
+
+	case 'q': // Rotate around Z-axis (positive direction)
+		rotate(shape, 0.1, 'z');
+		break;
+
+	case 'e': // Rotate around Z-axis (negative direction)
+		rotate(shape, -0.1, 'z');
+		break;
+
+	case 'z': // Move into the screen (negative Z)
+		translate(shape, 0, 0, -10);
+		break;
+
+	case 'x': // Move out of the screen (positive Z)
+		translate(shape, 0, 0, 10);
+		break;
+
+	case '+':
+	case '=': // Scale up the cube by 10%
+		scale_polygon(shape, 1.1, 1.1, 1.1);
+		break;
+
+	case '-':
+	case '_': // Scale down the cube by 10%
+		scale_polygon(shape, 0.9, 0.9, 0.9);
+		break;
+
+	case ' ': // Spacebar – reset the shape to its original state
+		reset_polygon(shape);
+		break;
+
+	case 'b': // Switch between GL_LINES and the software renderer
+		softwareRaster = !softwareRaster;
+		break;
+
+	case 'l': // Antialiased lines in the software renderer
+		antialiasLines = !antialiasLines;
+		break;
+
+	default: // Nothing changed, no need to redraw
+		return;
+	}
+	glutPostRedisplay();
+}
+
+void keyboard_special(int key, int x, int y)
+{
+	record_input(InputSpecial, key, x, y);
+	switch (key)
+	{
+	case GLUT_KEY_UP: // Move upward along Y-axis
+		translate(shape, 10, M_PI / 2, 0);
+		break;
+
+	case GLUT_KEY_DOWN: // Move downward along Y-axis
+		translate(shape, 10, 3 * M_PI / 2, 0);
+		break;
+
+	case GLUT_KEY_LEFT: // Move left along X-axis
+		translate(shape, 10, M_PI, 0);
+		break;
+
+	case GLUT_KEY_RIGHT: // Move right along X-axis
+		translate(shape, 10, 0, 0);
+		break;
+
+	default:
+		return;
+	}
+	glutPostRedisplay();
+}
+
+// Add a key press to the --record log
+void record_input(InputEventType type, int key, int x, int y)
+{
+	if (!inputLogPath.empty() && !inputReplay.active())
+		inputLog.record(type, key, 0, x, y, glutGetModifiers());
+}
+
+void save_input_log()
+{
+	if (inputLog.save(inputLogPath))
+		std::cout << "Recorded " << inputLog.events().size() << " input events to " << inputLogPath << std::endl;
+	else
+		std::cerr << "Cannot write the input log " << inputLogPath << std::endl;
+}
+
+// Call the handler a key press was recorded for. ESC is left out: the end of
+// the log ends the replay.
+static void dispatch_input(const InputEvent &e)
+{
+	if (e.type == InputKeyboard && e.key != 27)
+		keyboard(e.key, e.x, e.y);
+	else if (e.type == InputSpecial)
+		keyboard_special(e.key, e.x, e.y);
+}
+
+// Original timing: send every key press that is due, then sleep until the
+// next. The last one is followed by one more frame, which ends the replay.
+static void replay_timer(int)
+{
+	while (const InputEvent *e = inputReplay.due())
+		dispatch_input(*e);
+	if (inputReplay.finished())
+		glutPostRedisplay();
+	else
+		glutTimerFunc(inputReplay.waitMs(), replay_timer, 0);
+}
+
+// As fast as possible: one key press, then one frame
+static void replay_idle()
+{
+	if (const InputEvent *e = inputReplay.due())
+		dispatch_input(*e);
+	glutPostRedisplay();
+}
+
+// Live key presses would change where the replay ends: only ESC still works,
+// to stop it early
+static void replay_keyboard(unsigned char key, int, int)
+{
+	if (key == 27)
+		exit(0);
+}
+
+// Load a log written by --record and start feeding it to the keyboard
+// handlers, in the window size it was recorded in
+void start_replay(const std::string &path)
+{
+	if (!inputReplay.log.load(path))
+	{
+		std::cerr << "Cannot read the input log " << path << std::endl;
+		exit(1);
+	}
+	glutReshapeWindow(inputReplay.log.width, inputReplay.log.height);
+	glutKeyboardFunc(replay_keyboard);
+	glutSpecialFunc(nullptr);
+	inputReplay.start();
+	if (inputReplay.fast)
+		glutIdleFunc(replay_idle);
+	else
+		glutTimerFunc(inputReplay.waitMs(), replay_timer, 0);
+}
+
+// Report the replay once its last key press has been drawn, with the exact
+// transform it ends in so two builds can be compared, and exit
+void finish_replay()
+{
+	inputReplay.print(stdout);
+	const double *m = shape.transform.m;
+	for (int row = 0; row < 4; ++row)
+		printf("%s%.17g %.17g %.17g %.17g\n", row ? "          " : "Transform ", m[row], m[4 + row], m[8 + row],
+			   m[12 + row]);
+	printf("State %016llx\n", (unsigned long long)stateHash(m, sizeof(shape.transform.m)));
+	fflush(stdout);
+	exit(0);
+}
+
+// The transforms before Polygon3D kept a matrix, kept as a baseline for
+// --bench-transform: each call walks every vertex tuple in place, and rotate
+// evaluates cos/sin and branches on the axis per vertex.
+struct LegacyPolygon
+{
+	vertex position;
+	vertex_list vertices;
+};
+
+void legacy_translate(LegacyPolygon &polygon, double distance, double angle, double dz)
+{
+	double dx = cos(angle) * distance;
+	double dy = sin(angle) * distance;
+
+	std::get<0>(polygon.position) += dx;
+	std::get<1>(polygon.position) += dy;
+	std::get<2>(polygon.position) += dz;
+
+	for (auto &v : polygon.vertices)
+	{
+		std::get<0>(v) += dx;
+		std::get<1>(v) += dy;
+		std::get<2>(v) += dz;
+	}
+}
+
+void legacy_scale_polygon(LegacyPolygon &p, double sx, double sy, double sz = 1.0)
+{
+	double cx = std::get<0>(p.position);
+	double cy = std::get<1>(p.position);
+	double cz = std::get<2>(p.position);
+
+	for (auto &v : p.vertices)
+	{
+		auto &x = std::get<0>(v);
+		auto &y = std::get<1>(v);
+		auto &z = std::get<2>(v);
+
+		x = cx + (x - cx) * sx;
+		y = cy + (y - cy) * sy;
+		z = cz + (z - cz) * sz;
+	}
+}
+
+void legacy_rotate(LegacyPolygon &p, double angle, char axis)
+{
+	double cx = std::get<0>(p.position);
+	double cy = std::get<1>(p.position);
+	double cz = std::get<2>(p.position);
+
+	for (auto &v : p.vertices)
+	{
+		double &x = std::get<0>(v);
+		double &y = std::get<1>(v);
+		double &z = std::get<2>(v);
+
+		double dx = x - cx;
+		double dy = y - cy;
+		double dz = z - cz;
+
+		if (axis == 'x')
+		{
+			double y_rot = dy * cos(angle) - dz * sin(angle);
+			double z_rot = dy * sin(angle) + dz * cos(angle);
+			y = cy + y_rot;
+			z = cz + z_rot;
+		}
+		else if (axis == 'y')
+		{
+			double x_rot = dx * cos(angle) + dz * sin(angle);
+			double z_rot = -dx * sin(angle) + dz * cos(angle);
+			x = cx + x_rot;
+			z = cz + z_rot;
+		}
+		else if (axis == 'z')
+		{
+			double x_rot = dx * cos(angle) - dy * sin(angle);
+			double y_rot = dx * sin(angle) + dy * cos(angle);
+			x = cx + x_rot;
+			y = cy + y_rot;
+		}
+	}
+}
+
+// Moves of one benchmark frame: two rotations, a step right and a scale
+static const int benchMoves = 4;
+
+static void legacy_frame(LegacyPolygon &p)
+{
+	legacy_rotate(p, 0.1, 'x');
+	legacy_rotate(p, 0.1, 'y');
+	legacy_translate(p, 10, 0, 0);
+	legacy_scale_polygon(p, 1.1, 1.1, 1.1);
+}
+
+static void matrix_frame(Polygon3D &p)
+{
+	rotate(p, 0.1, 'x');
+	rotate(p, 0.1, 'y');
+	translate(p, 10, 0, 0);
+	scale_polygon(p, 1.1, 1.1, 1.1);
+}
+
+// Largest distance of a cube edge from its original length after `presses`
+// rotations around X, with the tuple code and with the accumulated matrix
+static void bench_drift(int presses)
+{
+	Polygon3D cube = create_cube(0, 0, 0, 60);
+	LegacyPolygon legacy = {cube.position, {}};
+	for (size_t i = 0; i < cube.base.size(); ++i)
+		legacy.vertices.push_back({cube.base.x[i], cube.base.y[i], cube.base.z[i]});
+	for (int i = 0; i < presses; ++i)
+	{
+		legacy_rotate(legacy, 0.1, 'x');
+		rotate(cube, 0.1, 'x');
+	}
+	transformPoints(cube.transform, cube.base, cube.rendered);
+
+	double legacyError = 0, matrixError = 0;
+	for (auto [i, j] : cube.edges)
+	{
+		auto [x1, y1, z1] = legacy.vertices[i];
+		auto [x2, y2, z2] = legacy.vertices[j];
+		legacyError = std::max(legacyError, fabs(hypot(hypot(x2 - x1, y2 - y1), z2 - z1) - cube.sideLength));
+		const VertexArrays &v = cube.rendered;
+		double length = hypot(hypot(v.x[j] - v.x[i], v.y[j] - v.y[i]), v.z[j] - v.z[i]);
+		matrixError = std::max(matrixError, fabs(length - cube.sideLength));
+	}
+	printf("Edge length error after %d rotations: tuples %.3g, matrix %.3g\n", presses, legacyError, matrixError);
+}
+
+// Apply one frame of moves to 1M to 100M vertices with the tuple code (one
+// pass per move, in place) and with the accumulated matrix (one pass from the
+// base vertices into the render buffer, scalar and SIMD). Each size keeps the
+// best of up to five runs; the error column is the largest difference from
+// the tuple result.
+// Usage: cube3d --bench-transform [vertex_count...]
+void bench_transform(const std::vector<size_t> &counts)
+{
+	using clock = std::chrono::steady_clock;
+	printf("Kernel: %s, %d moves per frame\n", transformKernelName(), benchMoves);
+	bench_drift(100000);
+
+	printf("\n%12s %-14s %10s %12s %10s\n", "vertices", "pipeline", "best(ms)", "Mvertices/s", "max error");
+	for (size_t n : counts)
+	{
+		int runs = (int)std::max<size_t>(1, std::min<size_t>(5, 100000000 / std::max<size_t>(n, 1)));
+		auto position = [](size_t i, int axis)
+		{
+			// Scattered inside the starting cube, the same for both pipelines
+			unsigned h = (unsigned)(i * 2654435761u) ^ (unsigned)(axis * 40503u);
+			h = h * 1103515245u + 12345u;
+			return ((h >> 8) & 0xffff) * (60.0 / 65535.0) - 30.0;
+		};
+		auto report = [&](const char *name, double best)
+		{
+			printf("%12zu %-14s %10.2f %12.1f", n, name, best, n / best / 1000.0);
+			fflush(stdout);
+		};
+
+		// Checkpoints of the tuple result, to compare the matrix one against
+		const size_t samples = std::min<size_t>(n, 4096);
+		std::vector<vertex> expected(samples);
+		{
+			double best = 1e30;
+			for (int r = 0; r < runs; ++r)
+			{
+				LegacyPolygon p = {{0, 0, 0}, vertex_list(n)};
+				for (size_t i = 0; i < n; ++i)
+					p.vertices[i] = {position(i, 0), position(i, 1), position(i, 2)};
+				auto t0 = clock::now();
+				legacy_frame(p);
+				best = std::min(best, std::chrono::duration<double, std::milli>(clock::now() - t0).count());
+				for (size_t s = 0; s < samples; ++s)
+					expected[s] = p.vertices[s * (n / samples)];
+			}
+			report("tuples", best);
+			printf(" %10s\n", "-");
+		}
+
+		Polygon3D p;
+		p.position = {0, 0, 0};
+		p.transform = Matrix4::identity();
+		p.base.resize(n);
+		p.rendered.resize(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			p.base.x[i] = position(i, 0);
+			p.base.y[i] = position(i, 1);
+			p.base.z[i] = position(i, 2);
+		}
+		for (int simd = 0; simd <= 1; ++simd)
+		{
+			double best = 1e30;
+			for (int r = 0; r < runs; ++r)
+			{
+				p.position = {0, 0, 0};
+				p.transform = Matrix4::identity();
+				auto t0 = clock::now();
+				matrix_frame(p);
+				transformPoints(p.transform, p.base, p.rendered, simd);
+				best = std::min(best, std::chrono::duration<double, std::milli>(clock::now() - t0).count());
+			}
+			double error = 0;
+			for (size_t s = 0; s < samples; ++s)
+			{
+				size_t i = s * (n / samples);
+				auto [x, y, z] = expected[s];
+				error = std::max({error, fabs(p.rendered.x[i] - x), fabs(p.rendered.y[i] - y), fabs(p.rendered.z[i] - z)});
+			}
+			report(simd ? "matrix + SIMD" : "matrix scalar", best);
+			printf(" %10.2g\n", error);
+		}
+	}
+}
+
+// Render a scene of many cubes with the software renderer, with aliased and
+// antialiased lines, on 1 to max(4, cores) threads, and report the lines
+// drawn per second. Each frame clears, projects, bins and rasterizes.
+// Usage: cube3d --bench-raster [--cubes N] [--size WxH] [--frames N]
+void bench_raster(std::vector<Polygon3D> &scene, int width, int height, int frames)
+{
+	using clock = std::chrono::steady_clock;
+	softwareRaster = true;
+	rasterizer.resize(width, height);
+	size_t lines = 0;
+	for (auto &polygon : scene)
+		lines += polygon.edges.size();
+	printf("%zu cubes, %zu lines, %dx%d, %d frames\n", scene.size(), lines, width, height, frames);
+
+	printf("\n%-10s %8s %10s %14s\n", "lines", "threads", "avg(ms)", "Mlines/s");
+	int cores = (int)std::max(1u, std::thread::hardware_concurrency());
+	for (int antialias = 0; antialias <= 1; ++antialias)
+		for (int threads = 1; threads <= std::max(4, cores); threads *= 2)
+		{
+			ThreadPool pool(threads);
+			auto t0 = clock::now();
+			for (int f = 0; f < frames; ++f)
+			{
+				rasterizer.clear(255, 255, 255);
+				for (auto &polygon : scene)
+					draw(polygon);
+				rasterizer.render(pool, antialias);
+			}
+			double ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count() / frames;
+			printf("%-10s %8d %10.2f %14.2f\n", antialias ? "Wu" : "Bresenham", threads, ms, lines / ms / 1000.0);
+			fflush(stdout);
+		}
+}
+
+// Extract the unique edges of each model with the hash set of obj_edges.h,
+// with a std::set of the same pairs and by sorting every face edge and
+// dropping repeats (best of 5 runs each). All three must find the same edges.
+// Usage: cube3d --bench-edges [obj_file...]
+void bench_edges(const std::vector<std::string> &paths)
+{
+	using clock = std::chrono::steady_clock;
+	const int runs = 5;
+	printf("%-16s %9s %9s %10s %10s %10s %10s %12s %10s %6s\n", "model", "vertices", "faces", "face edges", "unique",
+		   "removed", "hash(ms)", "std::set(ms)", "sort(ms)", "same");
+	for (const std::string &path : paths)
+	{
+		ObjFaces faces;
+		if (!parseObjFaces(path, faces))
+		{
+			std::cerr << "Failed to open file: " << path << std::endl;
+			exit(1);
+		}
+		auto best = [&](auto extract)
+		{
+			double ms = 1e30;
+			for (int r = 0; r < runs; ++r)
+			{
+				auto t0 = clock::now();
+				extract();
+				ms = std::min(ms, std::chrono::duration<double, std::milli>(clock::now() - t0).count());
+			}
+			return ms;
+		};
+		auto faceEdges = [&](auto add)
+		{
+			for (size_t f = 0; f < faces.faceCount(); ++f)
+			{
+				int first = faces.faceStart[f], last = faces.faceStart[f + 1];
+				for (int c = first; c < last; ++c)
+				{
+					int a = faces.corners[c], b = faces.corners[c + 1 < last ? c + 1 : first];
+					if (a != b)
+						add(std::min(a, b), std::max(a, b));
+				}
+			}
+		};
+
+		edge_list edges;
+		size_t removed = 0;
+		double hashMs = best([&]
+							 { removed = extractEdges(faces, edges); });
+		std::set<edge> tree;
+		double setMs = best([&]
+							{
+								tree.clear();
+								faceEdges([&](int a, int b)
+										  { tree.emplace(a, b); }); });
+		edge_list sorted;
+		double sortMs = best([&]
+							 {
+								 sorted.clear();
+								 faceEdges([&](int a, int b)
+										   { sorted.emplace_back(a, b); });
+								 std::sort(sorted.begin(), sorted.end());
+								 sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end()); });
+
+		edge_list found;
+		for (auto [a, b] : edges)
+			found.emplace_back(std::min(a, b), std::max(a, b));
+		std::sort(found.begin(), found.end());
+		bool same = found == sorted && tree.size() == sorted.size();
+		std::string name = path.substr(path.find_last_of('/') + 1);
+		printf("%-16s %9zu %9zu %10zu %10zu %10zu %10.2f %12.2f %10.2f %6s\n", name.c_str(), faces.positions.size(),
+			   faces.faceCount(), edges.size() + removed, edges.size(), removed, hashMs, setMs, sortMs, same ? "yes" : "NO");
+		fflush(stdout);
+	}
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "vertex_transform.h"
+
+// Positions and polygon faces of a .obj file, without normals, texture
+// coordinates or materials: all a wireframe needs
+struct ObjFaces
+{
+	VertexArrays positions;
+	std::vector<int> corners;	// Vertex indices of every face, one face after another
+	std::vector<int> faceStart; // Where each face starts in `corners`, plus the end
+
+	size_t faceCount() const { return faceStart.empty() ? 0 : faceStart.size() - 1; }
+};
+
+// Read the `v` and `f` lines of a .obj file. Face corners may be written as
+// v, v/vt, v//vn or v/vt/vn, and negative indices count back from the last
+// vertex. Faces with an index out of range are dropped.
+inline bool parseObjFaces(const std::string &path, ObjFaces &out)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	const std::string text = buffer.str();
+
+	out = ObjFaces();
+	out.faceStart.push_back(0);
+	std::vector<long> face;
+	const char *p = text.c_str(), *end = p + text.size();
+	while (p < end)
+	{
+		const char *lineEnd = std::find(p, end, '\n');
+		while (p < lineEnd && (*p == ' ' || *p == '\t'))
+			++p;
+		if (lineEnd - p > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			char *next;
+			float x = strtof(p + 2, &next);
+			float y = strtof(next, &next);
+			float z = strtof(next, &next);
+			out.positions.push_back(x, y, z);
+		}
+		else if (lineEnd - p > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			face.clear();
+			const char *q = p + 2;
+			for (;;)
+			{
+				while (q < lineEnd && (*q == ' ' || *q == '\t' || *q == '\r'))
+					++q;
+				if (q >= lineEnd)
+					break;
+				char *next;
+				face.push_back(strtol(q, &next, 10));
+				if (next == q)
+					break;
+				q = next;
+				while (q < lineEnd && *q != ' ' && *q != '\t') // Skip /vt/vn
+					++q;
+			}
+			long count = (long)out.positions.size();
+			bool valid = face.size() >= 3;
+			for (long &v : face)
+			{
+				v = v < 0 ? count + v : v - 1;
+				valid = valid && v >= 0 && v < count;
+			}
+			if (valid)
+			{
+				out.corners.insert(out.corners.end(), face.begin(), face.end());
+				out.faceStart.push_back((int)out.corners.size());
+			}
+		}
+		p = lineEnd + 1;
+	}
+	return true;
+}
+
+// Set of undirected edges, where (a, b) and (b, a) are the same edge. Open
+// addressing with linear probing over one flat array of 64-bit keys, so a
+// lookup usually touches a single cache line; it grows past half full.
+class EdgeSet
+{
+public:
+	// Room for `edges` edges without growing
+	void reserve(size_t edges)
+	{
+		size_t capacity = 16;
+		while (capacity < 2 * edges)
+			capacity *= 2;
+		if (capacity > slots.size())
+			rehash(capacity);
+	}
+
+	// Add the edge between `a` and `b`; false if it was already there
+	bool insert(int a, int b)
+	{
+		if (2 * (count + 1) > slots.size())
+			rehash(std::max<size_t>(16, 2 * slots.size()));
+		uint64_t k = key(a, b);
+		for (size_t i = slot(k);; i = (i + 1) & (slots.size() - 1))
+		{
+			if (slots[i] == k)
+				return false;
+			if (slots[i] == emptySlot)
+			{
+				slots[i] = k;
+				++count;
+				return true;
+			}
+		}
+	}
+
+	size_t size() const { return count; }
+	size_t capacity() const { return slots.size(); }
+
+private:
+	static constexpr uint64_t emptySlot = ~0ull; // Never a key: indices are below 2^31
+	std::vector<uint64_t> slots;
+	size_t count = 0;
+	int shift = 64;
+
+	static uint64_t key(int a, int b)
+	{
+		return (uint64_t)(uint32_t)std::max(a, b) << 32 | (uint32_t)std::min(a, b);
+	}
+
+	// Fibonacci hashing: the top bits of the key times 2^64 / phi
+	size_t slot(uint64_t k) const { return (size_t)((k * 0x9E3779B97F4A7C15ull) >> shift); }
+
+	void rehash(size_t capacity)
+	{
+		std::vector<uint64_t> old(capacity, emptySlot);
+		old.swap(slots);
+		shift = 64;
+		for (size_t c = capacity; c > 1; c /= 2)
+			--shift;
+		count = 0;
+		for (uint64_t k : old)
+			if (k != emptySlot)
+				for (size_t i = slot(k);; i = (i + 1) & (slots.size() - 1))
+					if (slots[i] == emptySlot)
+					{
+						slots[i] = k;
+						++count;
+						break;
+					}
+	}
+};
+
+// The unique edges around the faces of `mesh`, in the order they are first
+// met. An edge shared by two faces is kept once. Returns how many duplicate
+// edges were dropped.
+inline size_t extractEdges(const ObjFaces &mesh, std::vector<std::pair<int, int>> &edges)
+{
+	// Each edge of a closed mesh is shared by two faces: half as many edges
+	// as face corners (3/2 per triangle, 2 per quad)
+	size_t expected = mesh.corners.size() / 2;
+	EdgeSet set;
+	set.reserve(expected);
+	edges.clear();
+	edges.reserve(expected);
+	size_t duplicates = 0;
+	for (size_t f = 0; f < mesh.faceCount(); ++f)
+	{
+		int first = mesh.faceStart[f], last = mesh.faceStart[f + 1];
+		for (int c = first; c < last; ++c)
+		{
+			int a = mesh.corners[c], b = mesh.corners[c + 1 < last ? c + 1 : first];
+			if (a == b)
+				continue;
+			if (set.insert(a, b))
+				edges.emplace_back(a, b);
+			else
+				++duplicates;
+		}
+	}
+	return duplicates;
+}
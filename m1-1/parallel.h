@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run parallel loops. The calling thread
+// takes part in every loop, so a pool of size 1 runs everything inline.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int threads = 0)
+	{
+		if (threads <= 0)
+			threads = (int)std::max(1u, std::thread::hardware_concurrency());
+		for (int i = 1; i < threads; ++i)
+			workers.emplace_back([this]
+								 { workerLoop(); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto &t : workers)
+			t.join();
+	}
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	int size() const { return (int)workers.size() + 1; }
+
+	// Run fn(i) for every i in [0, count) and return once all calls finished.
+	// Calls made from inside a task run serially on the calling thread.
+	void parallelFor(size_t count, const std::function<void(size_t)> &fn)
+	{
+		if (count == 0)
+			return;
+		if (insideTask() || workers.empty() || count == 1)
+		{
+			for (size_t i = 0; i < count; ++i)
+				fn(i);
+			return;
+		}
+
+		std::lock_guard<std::mutex> submit(submitMutex); // One loop at a time
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = &fn;
+			jobCount = count;
+			next = 0;
+			pending = count;
+			++generation;
+		}
+		wake.notify_all();
+
+		runTasks(fn, count);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this]
+					  { return pending == 0 && active == 0; });
+		job = nullptr;
+	}
+
+	// Run fn(i) for every i in [0, count) with work stealing, for items of
+	// very uneven cost. Each thread starts with its own contiguous share of
+	// the range and takes `grain` items at a time from its front. Once its
+	// share is done, it steals the back half of the largest share left.
+	// Returns the number of steals.
+	size_t parallelForStealing(size_t count, size_t grain, const std::function<void(size_t)> &fn)
+	{
+		struct alignas(64) Share
+		{
+			std::mutex mutex;
+			size_t begin = 0, end = 0;
+		};
+		size_t threads = insideTask() ? 1 : (size_t)size();
+		std::vector<Share> shares(threads);
+		for (size_t t = 0; t < threads; ++t)
+		{
+			shares[t].begin = count * t / threads;
+			shares[t].end = count * (t + 1) / threads;
+		}
+		grain = std::max<size_t>(grain, 1);
+		std::atomic<size_t> steals{0};
+
+		parallelFor(threads, [&](size_t self)
+					{
+						Share &own = shares[self];
+						for (;;)
+						{
+							size_t begin, end;
+							{
+								std::lock_guard<std::mutex> lock(own.mutex);
+								begin = own.begin;
+								end = std::min(own.end, begin + grain);
+								own.begin = end;
+							}
+							if (begin < end)
+							{
+								for (size_t i = begin; i < end; ++i)
+									fn(i);
+								continue;
+							}
+
+							// Out of work: find the largest share left, then check it
+							// again under the victim's lock since it may have shrunk
+							size_t victim = threads, most = 0;
+							for (size_t t = 0; t < threads; ++t)
+							{
+								if (t == self)
+									continue;
+								std::lock_guard<std::mutex> lock(shares[t].mutex);
+								size_t left = shares[t].end - std::min(shares[t].begin, shares[t].end);
+								if (left > most)
+									victim = t, most = left;
+							}
+							if (victim == threads)
+								return;
+							{
+								std::lock_guard<std::mutex> lock(shares[victim].mutex);
+								Share &v = shares[victim];
+								if (v.begin >= v.end)
+									continue;
+								end = v.end;
+								begin = v.end - (v.end - v.begin + 1) / 2;
+								v.end = begin;
+							}
+							std::lock_guard<std::mutex> lock(own.mutex);
+							own.begin = begin;
+							own.end = end;
+							++steals;
+						} });
+		return steals;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex submitMutex, mutex;
+	std::condition_variable wake, finished;
+	const std::function<void(size_t)> *job = nullptr;
+	size_t jobCount = 0;
+	std::atomic<size_t> next{0};
+	size_t pending = 0;
+	int active = 0; // Workers currently inside runTasks
+	unsigned long generation = 0;
+	bool stopping = false;
+
+	static bool &insideTask()
+	{
+		thread_local bool inside = false;
+		return inside;
+	}
+
+	void runTasks(const std::function<void(size_t)> &fn, size_t count)
+	{
+		insideTask() = true;
+		size_t done = 0;
+		for (size_t i = next++; i < count; i = next++)
+		{
+			fn(i);
+			++done;
+		}
+		insideTask() = false;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		pending -= done;
+		if (pending == 0)
+			finished.notify_all();
+	}
+
+	void workerLoop()
+	{
+		unsigned long seen = 0;
+		for (;;)
+		{
+			const std::function<void(size_t)> *fn;
+			size_t count;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&]
+						  { return stopping || (generation != seen && job); });
+				if (stopping)
+					return;
+				seen = generation;
+				fn = job;
+				count = jobCount;
+				++active;
+			}
+			runTasks(*fn, count);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--active == 0 && pending == 0)
+				finished.notify_all();
+		}
+	}
+};
+
+// Worker count requested on the command line (--threads); 0 = one per core
+inline int &threadCount()
+{
+	static int count = 0;
+	return count;
+}
+
+// Pool shared by every parallel stage of the viewer, created on first use
+inline ThreadPool &threadPool()
+{
+	static ThreadPool pool(threadCount());
+	return pool;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// Positions as three separate arrays (structure of arrays), so a SIMD
+// register loads the same coordinate of 4 or 8 consecutive vertices
+struct VertexArrays
+{
+	std::vector<float> x, y, z;
+
+	size_t size() const { return x.size(); }
+	void resize(size_t count)
+	{
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+	}
+	void push_back(float px, float py, float pz)
+	{
+		x.push_back(px);
+		y.push_back(py);
+		z.push_back(pz);
+	}
+};
+
+// 4x4 matrix stored column by column, the layout of glLoadMatrix. It is kept
+// in double so composing thousands of small steps does not drift.
+struct Matrix4
+{
+	double m[16];
+
+	static Matrix4 identity()
+	{
+		return {{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}};
+	}
+
+	static Matrix4 translation(double dx, double dy, double dz)
+	{
+		Matrix4 t = identity();
+		t.m[12] = dx;
+		t.m[13] = dy;
+		t.m[14] = dz;
+		return t;
+	}
+
+	static Matrix4 scaling(double sx, double sy, double sz)
+	{
+		Matrix4 s = identity();
+		s.m[0] = sx;
+		s.m[5] = sy;
+		s.m[10] = sz;
+		return s;
+	}
+
+	// Rotation by `angle` radians around the 'x', 'y' or 'z' axis
+	static Matrix4 rotation(double angle, char axis)
+	{
+		Matrix4 r = identity();
+		double c = cos(angle), s = sin(angle);
+		int a = axis == 'x' ? 1 : 0; // First of the two axes that turn
+		int b = axis == 'z' ? 1 : 2; // Second one
+		if (axis == 'y')
+			s = -s; // Right-handed: z turns towards x
+		r.m[5 * a] = c;
+		r.m[4 * b + a] = -s;
+		r.m[4 * a + b] = s;
+		r.m[5 * b] = c;
+		return r;
+	}
+
+	// The projection gluPerspective builds, `fovy` in degrees
+	static Matrix4 perspective(double fovy, double aspect, double zNear, double zFar)
+	{
+		double f = 1.0 / tan(fovy * M_PI / 360.0);
+		Matrix4 p = {};
+		p.m[0] = f / aspect;
+		p.m[5] = f;
+		p.m[10] = (zFar + zNear) / (zNear - zFar);
+		p.m[11] = -1;
+		p.m[14] = 2 * zFar * zNear / (zNear - zFar);
+		return p;
+	}
+
+	Matrix4 operator*(const Matrix4 &o) const
+	{
+		Matrix4 r;
+		for (int col = 0; col < 4; ++col)
+			for (int row = 0; row < 4; ++row)
+				r.m[4 * col + row] = m[row] * o.m[4 * col] + m[4 + row] * o.m[4 * col + 1] +
+									 m[8 + row] * o.m[4 * col + 2] + m[12 + row] * o.m[4 * col + 3];
+		return r;
+	}
+};
+
+// Apply the affine part of `m` (the bottom row is taken as 0 0 0 1) to `count`
+// points of x, y, z and write them to ox, oy, oz. Eight points per step with
+// AVX, four with SSE, and the scalar loop for the rest or when `simd` is off.
+inline void transformPoints(const Matrix4 &matrix, const float *x, const float *y, const float *z, float *ox,
+							float *oy, float *oz, size_t count, bool simd = true)
+{
+	float m[16];
+	for (int i = 0; i < 16; ++i)
+		m[i] = (float)matrix.m[i];
+
+	size_t i = 0;
+#if defined(__AVX__)
+	if (simd)
+	{
+		__m256 c[12];
+		for (int k = 0; k < 12; ++k)
+			c[k] = _mm256_set1_ps(m[k < 9 ? k + k / 3 : k + 3]); // Columns 0..2 without w, then the translation
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+			for (int row = 0; row < 3; ++row)
+			{
+				__m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[row], px), _mm256_mul_ps(c[3 + row], py)),
+										 _mm256_add_ps(_mm256_mul_ps(c[6 + row], pz), c[9 + row]));
+				_mm256_storeu_ps((row == 0 ? ox : row == 1 ? oy : oz) + i, v);
+			}
+		}
+	}
+#elif defined(__SSE__)
+	if (simd)
+	{
+		__m128 c[12];
+		for (int k = 0; k < 12; ++k)
+			c[k] = _mm_set1_ps(m[k < 9 ? k + k / 3 : k + 3]);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+			for (int row = 0; row < 3; ++row)
+			{
+				__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[row], px), _mm_mul_ps(c[3 + row], py)),
+									  _mm_add_ps(_mm_mul_ps(c[6 + row], pz), c[9 + row]));
+				_mm_storeu_ps((row == 0 ? ox : row == 1 ? oy : oz) + i, v);
+			}
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		float px = x[i], py = y[i], pz = z[i];
+		ox[i] = m[0] * px + m[4] * py + m[8] * pz + m[12];
+		oy[i] = m[1] * px + m[5] * py + m[9] * pz + m[13];
+		oz[i] = m[2] * px + m[6] * py + m[10] * pz + m[14];
+	}
+}
+
+inline void transformPoints(const Matrix4 &matrix, const VertexArrays &in, VertexArrays &out, bool simd = true)
+{
+	out.resize(in.size());
+	transformPoints(matrix, in.x.data(), in.y.data(), in.z.data(), out.x.data(), out.y.data(), out.z.data(), in.size(),
+					simd);
+}
+
+// Name of the widest kernel transformPoints was built with
+inline const char *transformKernelName()
+{
+#if defined(__AVX__)
+	return "AVX";
+#elif defined(__SSE__)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+#include "parallel.h"
+#include "vertex_transform.h"
+
+// Line in window coordinates: x right and y down in pixels, depth in [0, 1]
+struct ScreenLine
+{
+	float x0, y0, z0;
+	float x1, y1, z1;
+	unsigned char color[3];
+};
+
+// CPU renderer for wireframes, without an OpenGL context. Lines are projected
+// and clipped against the near plane, sorted into square tiles of the
+// framebuffer, and the tiles are rasterized in parallel with a depth test.
+// Each tile keeps its pixels together in memory, so a thread only touches
+// its own tile.
+class WireframeRasterizer
+{
+public:
+	static constexpr int tileSize = 64;
+
+	void resize(int w, int h)
+	{
+		width = std::max(w, 1);
+		height = std::max(h, 1);
+		tilesX = (width + tileSize - 1) / tileSize;
+		tilesY = (height + tileSize - 1) / tileSize;
+		color.assign((size_t)tilesX * tilesY * tileSize * tileSize * 3, 255);
+		depth.assign((size_t)tilesX * tilesY * tileSize * tileSize, 1.0f);
+		bins.assign((size_t)tilesX * tilesY, {});
+		lines.clear();
+	}
+
+	int imageWidth() const { return width; }
+	int imageHeight() const { return height; }
+	size_t queuedLines() const { return lines.size(); }
+
+	// Fill every pixel with `r, g, b` at the far plane
+	void clear(unsigned char r, unsigned char g, unsigned char b)
+	{
+		for (size_t i = 0; i < depth.size(); ++i)
+		{
+			color[3 * i] = r;
+			color[3 * i + 1] = g;
+			color[3 * i + 2] = b;
+			depth[i] = 1.0f;
+		}
+	}
+
+	// Queue the `edges` of `points` (world space) seen through `viewProjection`
+	void addLines(const Matrix4 &viewProjection, const VertexArrays &points,
+				  const std::vector<std::pair<int, int>> &edges, const unsigned char rgb[3])
+	{
+		// Clip-space corners, computed once per point rather than per edge
+		const double *m = viewProjection.m;
+		clip.resize(4 * points.size());
+		for (size_t i = 0; i < points.size(); ++i)
+			for (int row = 0; row < 4; ++row)
+				clip[4 * i + row] = m[row] * points.x[i] + m[4 + row] * points.y[i] + m[8 + row] * points.z[i] + m[12 + row];
+
+		for (auto [i, j] : edges)
+		{
+			float a[4], b[4];
+			std::copy(&clip[4 * i], &clip[4 * i + 4], a);
+			std::copy(&clip[4 * j], &clip[4 * j + 4], b);
+			// In front of the near plane where z > -w
+			float da = a[2] + a[3], db = b[2] + b[3];
+			if (da < 0 && db < 0)
+				continue;
+			if (da < 0 || db < 0)
+			{
+				float t = da / (da - db);
+				float *behind = da < 0 ? a : b;
+				for (int k = 0; k < 4; ++k)
+					behind[k] = a[k] + t * (b[k] - a[k]);
+			}
+			ScreenLine line;
+			toWindow(a, line.x0, line.y0, line.z0);
+			toWindow(b, line.x1, line.y1, line.z1);
+			std::copy(rgb, rgb + 3, line.color);
+			if (std::max(line.x0, line.x1) < 0 || std::min(line.x0, line.x1) > width ||
+				std::max(line.y0, line.y1) < 0 || std::min(line.y0, line.y1) > height)
+				continue;
+			lines.push_back(line);
+		}
+	}
+
+	// Rasterize the queued lines into their tiles, one tile per task, and
+	// empty the queue. `antialias` draws Xiaolin Wu lines instead of aliased
+	// (Bresenham-style) ones.
+	void render(ThreadPool &pool, bool antialias)
+	{
+		binLines();
+		pool.parallelFor(bins.size(), [&](size_t tile)
+						 {
+							 for (unsigned index : bins[tile])
+								 rasterize(lines[index], (int)tile, antialias);
+							 bins[tile].clear(); });
+		lines.clear();
+	}
+
+	// Framebuffer as packed R, G, B rows, the top row first unless `bottomUp`
+	// (the row order of glDrawPixels)
+	void resolve(std::vector<unsigned char> &rgb, bool bottomUp = false) const
+	{
+		rgb.resize((size_t)width * height * 3);
+		for (int y = 0; y < height; ++y)
+		{
+			unsigned char *out = &rgb[(size_t)(bottomUp ? height - 1 - y : y) * width * 3];
+			for (int x = 0; x < width; x += tileSize)
+			{
+				int count = std::min(tileSize, width - x);
+				std::copy_n(&color[3 * pixelIndex(x, y)], 3 * count, out + 3 * x);
+			}
+		}
+	}
+
+	// Write the framebuffer as a binary PPM; false if the file cannot be written
+	bool writePpm(const std::string &path) const
+	{
+		std::vector<unsigned char> rgb;
+		resolve(rgb);
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+		fprintf(file, "P6\n%d %d\n255\n", width, height);
+		bool ok = fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+		return fclose(file) == 0 && ok;
+	}
+
+private:
+	int width = 0, height = 0, tilesX = 0, tilesY = 0;
+	std::vector<unsigned char> color; // Tile after tile, rows of each tile together
+	std::vector<float> depth;
+	std::vector<ScreenLine> lines;
+	std::vector<std::vector<unsigned>> bins; // Lines that may cross each tile
+	std::vector<float> clip;
+
+	void toWindow(const float c[4], float &x, float &y, float &z) const
+	{
+		float w = std::max(c[3], 1e-6f);
+		x = (c[0] / w + 1.0f) * 0.5f * width;
+		y = (1.0f - c[1] / w) * 0.5f * height;
+		z = (c[2] / w + 1.0f) * 0.5f;
+	}
+
+	size_t pixelIndex(int x, int y) const
+	{
+		size_t tile = (size_t)(y / tileSize) * tilesX + x / tileSize;
+		return tile * tileSize * tileSize + (y % tileSize) * tileSize + x % tileSize;
+	}
+
+	// Add each line to the tiles its bounding box touches (one pixel wider,
+	// for the second pixel of antialiased lines)
+	void binLines()
+	{
+		for (unsigned i = 0; i < lines.size(); ++i)
+		{
+			const ScreenLine &l = lines[i];
+			int tx0 = std::max(0, (int)floorf(std::min(l.x0, l.x1) - 1.0f) / tileSize);
+			int tx1 = std::min(tilesX - 1, (int)std::max(0.0f, std::max(l.x0, l.x1) + 1.0f) / tileSize);
+			int ty0 = std::max(0, (int)floorf(std::min(l.y0, l.y1) - 1.0f) / tileSize);
+			int ty1 = std::min(tilesY - 1, (int)std::max(0.0f, std::max(l.y0, l.y1) + 1.0f) / tileSize);
+			for (int ty = ty0; ty <= ty1; ++ty)
+				for (int tx = tx0; tx <= tx1; ++tx)
+					bins[(size_t)ty * tilesX + tx].push_back(i);
+		}
+	}
+
+	// Blend `coverage` of the line colour into pixel x, y of `tile` if it is
+	// nearer than what the pixel holds. Partly covered pixels keep their depth.
+	void plot(int tile, int x, int y, float z, float coverage, const unsigned char rgb[3])
+	{
+		if (coverage <= 0.0f || z < 0.0f || z > 1.0f)
+			return;
+		size_t i = (size_t)tile * tileSize * tileSize + (size_t)y * tileSize + x;
+		if (z >= depth[i])
+			return;
+		unsigned char *c = &color[3 * i];
+		for (int k = 0; k < 3; ++k)
+			c[k] = (unsigned char)(c[k] + (rgb[k] - c[k]) * coverage + 0.5f);
+		if (coverage >= 0.5f)
+			depth[i] = z;
+	}
+
+	// Draw the part of `l` inside `tile`. The line is stepped one pixel at a
+	// time along its major axis, and each step picks its pixels from that
+	// position alone, so neighbouring tiles join up without gaps or overlaps.
+	void rasterize(const ScreenLine &l, int tile, bool antialias)
+	{
+		int left = (tile % tilesX) * tileSize, top = (tile / tilesX) * tileSize;
+		bool steep = fabsf(l.y1 - l.y0) > fabsf(l.x1 - l.x0);
+		// Major axis u, minor axis v
+		float u0 = steep ? l.y0 : l.x0, v0 = steep ? l.x0 : l.y0, z0 = l.z0;
+		float u1 = steep ? l.y1 : l.x1, v1 = steep ? l.x1 : l.y1, z1 = l.z1;
+		if (u1 < u0)
+		{
+			std::swap(u0, u1);
+			std::swap(v0, v1);
+			std::swap(z0, z1);
+		}
+		float du = u1 - u0;
+		if (du < 1e-6f)
+			return;
+		float slope = (v1 - v0) / du, zSlope = (z1 - z0) / du;
+		int uLow = steep ? top : left, vLow = steep ? left : top;
+		int uHigh = std::min(uLow + tileSize, steep ? height : width) - 1;
+		int vHigh = std::min(vLow + tileSize, steep ? width : height) - 1;
+
+		// Pixel centres u + 0.5 between the end points, inside the tile
+		int first = std::max(uLow, (int)ceilf(u0 - 0.5f)), last = std::min(uHigh, (int)floorf(u1 - 0.5f));
+		// and where v is within a pixel of the tile (the tile may only hold
+		// the bounding box of the line)
+		if (slope != 0.0f)
+		{
+			float ua = u0 - 0.5f + (vLow - 1 - v0) / slope, ub = u0 - 0.5f + (vHigh + 2 - v0) / slope;
+			// Clamped before the conversion, as a shallow slope puts them far away
+			first = (int)floorf(std::max(std::min(ua, ub), (float)first));
+			last = (int)ceilf(std::min(std::max(ua, ub), (float)last));
+		}
+		else if (v0 < vLow - 1 || v0 > vHigh + 2)
+			return;
+		for (int u = first; u <= last; ++u)
+		{
+			float t = u + 0.5f - u0;
+			float v = v0 + slope * t, z = z0 + zSlope * t;
+			// Antialiased lines split the pixel between the two rows around v
+			int below = (int)floorf(antialias ? v - 0.5f : v);
+			float share = antialias ? v - 0.5f - below : 0.0f;
+			for (int k = 0; k < (antialias ? 2 : 1); ++k)
+			{
+				int pv = below + k;
+				if (pv < vLow || pv > vHigh)
+					continue;
+				int x = (steep ? pv : u) - left, y = (steep ? u : pv) - top;
+				plot(tile, x, y, z, k ? share : 1.0f - share, l.color);
+			}
+		}
+	}
+};
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+#include <GL/freeglut.h>
+
+// Per-frame timing of the viewer: the CPU time of each stage of display(),
+// the interval between frames and the GPU time of the frame's commands from
+// GL_TIME_ELAPSED queries. The queries rotate through a small ring and a
+// result is only read once the GPU reports it available, a few frames later,
+// so reading never stalls the pipeline. Frames wait in a queue until their
+// result and those of all older frames are in, so statistics and the CSV file
+// see them in order. Statistics cover a sliding window of the last frames.
+
+enum FrameMetric
+{
+	MetricLights, // Light enables and positions
+	MetricDraw,	  // draw3dObject, with the per-group materials
+	MetricHud,	  // The overlay itself
+	MetricSwap,	  // glutSwapBuffers
+	MetricCpu,	  // Sum of the stages above
+	MetricGpu,	  // GL_TIME_ELAPSED of the frame's commands
+	MetricFrame,  // Interval since the previous frame started
+	MetricCount
+};
+
+const char *const frameMetricNames[MetricCount] = {"lights", "draw", "hud", "swap", "cpu", "gpu", "frame"};
+
+// Lines of text over the scene, drawn without lighting, texturing or depth
+// test. The first line starts `y` pixels above the bottom of the window and
+// the next ones go down from there.
+inline void drawOverlayText(const std::vector<std::string> &lines, int x, int y, float r, float g, float b)
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0, viewport[2], 0, viewport[3], -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glColor3f(r, g, b);
+	for (const std::string &line : lines)
+	{
+		glRasterPos2i(x, y);
+		glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char *)line.c_str());
+		y -= 15;
+	}
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+}
+
+struct MetricSummary
+{
+	double min = 0, avg = 0, p50 = 0, p95 = 0, p99 = 0, max = 0; // Milliseconds
+	size_t count = 0;
+};
+
+class FrameStats
+{
+public:
+	static const int queryRing = 4; // GPU queries in flight
+
+	// Statistics cover the last `window` frames (the default is 4 s at 60 fps)
+	explicit FrameStats(size_t windowSize = 240) { reset(windowSize); }
+
+	~FrameStats()
+	{
+		if (csv)
+			fclose(csv);
+	}
+
+	// Write one row per frame to `path`
+	bool openCsv(const std::string &path)
+	{
+		csv = fopen(path.c_str(), "w");
+		if (!csv)
+			return false;
+		fprintf(csv, "frame");
+		for (const char *name : frameMetricNames)
+			fprintf(csv, ",%s_ms", name);
+		fprintf(csv, "\n");
+		return true;
+	}
+
+	// Create the GPU queries, once a GL context is current. Without timer
+	// query support (GL 3.3 or ARB/EXT_timer_query) GPU time is left out.
+	void initGpu()
+	{
+		int major = 0, minor = 0;
+		const char *version = (const char *)glGetString(GL_VERSION);
+		if (version)
+			sscanf(version, "%d.%d", &major, &minor);
+		gpuTimers = major > 3 || (major == 3 && minor >= 3) || glutExtensionSupported("GL_ARB_timer_query") ||
+					glutExtensionSupported("GL_EXT_timer_query");
+		if (gpuTimers)
+			glGenQueries(queryRing, queries);
+		queriesStarted = false;
+	}
+
+	bool hasGpuTimers() const { return gpuTimers; }
+
+	// Forget every frame and start over with a new window size. Queries still
+	// in flight must have been collected first.
+	void reset(size_t windowSize)
+	{
+		window = std::max<size_t>(1, windowSize);
+		for (int m = 0; m < MetricCount; ++m)
+		{
+			samples[m].assign(window, 0.0);
+			counts[m] = 0;
+		}
+		pending.clear();
+		std::fill(queryBusy, queryBusy + queryRing, false);
+		frameNumber = 0;
+	}
+
+	// Start of display()
+	void beginFrame()
+	{
+		Clock::time_point now = Clock::now();
+		collectGpu(false);
+		for (double &v : current)
+			v = NAN;
+		current[MetricFrame] = frameNumber > 0 ? ms(frameStart, now) : NAN;
+		frameStart = lastMark = now;
+
+		// Time the frame's commands on the GPU, unless every query is still busy
+		activeQuery = -1;
+		if (gpuTimers && !queryBusy[frameNumber % queryRing])
+		{
+			activeQuery = (int)(frameNumber % queryRing);
+			glBeginQuery(GL_TIME_ELAPSED, queries[activeQuery]);
+		}
+	}
+
+	// The CPU time since the previous mark belongs to `stage`
+	void mark(FrameMetric stage)
+	{
+		Clock::time_point now = Clock::now();
+		current[stage] = ms(lastMark, now);
+		lastMark = now;
+	}
+
+	// End of the frame's GL commands, right before the buffer swap
+	void endCommands()
+	{
+		if (activeQuery >= 0)
+			glEndQuery(GL_TIME_ELAPSED);
+	}
+
+	// End of display(), after the swap
+	void endFrame()
+	{
+		current[MetricCpu] = ms(frameStart, Clock::now());
+		Pending p;
+		p.frame = frameNumber++;
+		p.query = activeQuery;
+		std::copy(current, current + MetricCount, p.values);
+		if (activeQuery >= 0)
+		{
+			queryBusy[activeQuery] = true;
+			// Some drivers (Mesa's llvmpipe) return the absolute time for the
+			// first query of a context
+			p.discardGpu = !queriesStarted;
+			queriesStarted = true;
+		}
+		pending.push_back(p);
+		// Without a query the frame is complete, unless older frames wait
+		flushFinished();
+	}
+
+	// Read the GPU results of every finished frame; with `wait` set, block
+	// until all of them are in (for the end of a benchmark)
+	void collectGpu(bool wait)
+	{
+		// Oldest frames first: queries complete in order
+		for (Pending &p : pending)
+		{
+			if (p.query < 0)
+				continue;
+			GLuint available = 0;
+			if (!wait)
+				glGetQueryObjectuiv(queries[p.query], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!wait && !available)
+				break;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[p.query], GL_QUERY_RESULT, &elapsed);
+			p.values[MetricGpu] = p.discardGpu ? NAN : elapsed / 1e6;
+			queryBusy[p.query] = false;
+			p.query = -1;
+		}
+		flushFinished();
+	}
+
+	// Statistics of one metric over the sliding window
+	MetricSummary summary(FrameMetric metric) const
+	{
+		MetricSummary s;
+		s.count = std::min(counts[metric], window);
+		if (s.count == 0)
+			return s;
+		std::vector<double> sorted(samples[metric].begin(), samples[metric].begin() + s.count);
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0;
+		for (double v : sorted)
+			sum += v;
+		auto percentile = [&](double p)
+		{ return sorted[std::min(s.count - 1, (size_t)std::ceil(p * s.count) - 1)]; };
+		s.min = sorted.front();
+		s.avg = sum / s.count;
+		s.p50 = percentile(0.50);
+		s.p95 = percentile(0.95);
+		s.p99 = percentile(0.99);
+		s.max = sorted.back();
+		return s;
+	}
+
+	// Text overlay with the statistics of every metric, in the top left
+	// corner, followed by `extraLines`
+	void drawHud(const std::vector<std::string> &extraLines = {}) const
+	{
+		std::vector<std::string> lines;
+		char line[128];
+		snprintf(line, sizeof(line), "%-9s %8s %8s %8s %8s  (ms, last %zu frames)", "", "min", "avg", "p95", "p99",
+				 std::min(counts[MetricFrame], window));
+		lines.push_back(line);
+		for (int m = 0; m < MetricCount; ++m)
+		{
+			if (m == MetricGpu && !gpuTimers)
+			{
+				lines.push_back("gpu       no timer queries");
+				continue;
+			}
+			MetricSummary s = summary((FrameMetric)m);
+			snprintf(line, sizeof(line), "%-9s %8.3f %8.3f %8.3f %8.3f", frameMetricNames[m], s.min, s.avg, s.p95, s.p99);
+			lines.push_back(line);
+		}
+		MetricSummary frame = summary(MetricFrame);
+		snprintf(line, sizeof(line), "%.1f fps", frame.avg > 0 ? 1000.0 / frame.avg : 0.0);
+		lines.push_back(line);
+		lines.insert(lines.end(), extraLines.begin(), extraLines.end());
+
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		drawOverlayText(lines, 10, viewport[3] - 18, 1.0f, 1.0f, 0.3f);
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Pending
+	{
+		unsigned long frame = 0;
+		double values[MetricCount];
+		int query = -1;			 // GPU query still to be read
+		bool discardGpu = false; // The first query of the context
+	};
+
+	size_t window;
+	std::vector<double> samples[MetricCount]; // Ring buffers of the last `window` values
+	size_t counts[MetricCount] = {};		  // Values ever pushed
+	double current[MetricCount];
+	std::deque<Pending> pending; // Frames not finished yet, oldest first
+	GLuint queries[queryRing] = {};
+	bool queryBusy[queryRing] = {};
+	int activeQuery = -1;
+	bool gpuTimers = false, queriesStarted = false;
+	unsigned long frameNumber = 0;
+	Clock::time_point frameStart, lastMark;
+	FILE *csv = nullptr;
+
+	static double ms(Clock::time_point a, Clock::time_point b)
+	{
+		return std::chrono::duration<double, std::milli>(b - a).count();
+	}
+
+	// Finish the oldest frames, up to the first one still waiting for the GPU
+	void flushFinished()
+	{
+		while (!pending.empty() && pending.front().query < 0)
+		{
+			finish(pending.front());
+			pending.pop_front();
+		}
+	}
+
+	// A frame is complete: add it to the window and the CSV
+	void finish(const Pending &p)
+	{
+		for (int m = 0; m < MetricCount; ++m)
+			if (!std::isnan(p.values[m]))
+				samples[m][counts[m]++ % window] = p.values[m];
+		if (csv)
+		{
+			fprintf(csv, "%lu", p.frame);
+			for (double v : p.values)
+				std::isnan(v) ? fprintf(csv, ",") : fprintf(csv, ",%.4f", v);
+			fprintf(csv, "\n");
+		}
+	}
+};
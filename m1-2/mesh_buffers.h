@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "obj_loader.h"
+
+// Interleaved vertex of the indexed render path
+struct Vertex
+{
+	float position[3];
+	float normal[3];
+	float texcoord[2];
+};
+
+// A simplified level of detail: a range of indices into the same vertices,
+// drawn as a range of groups
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; // Geometric error of the level, in model units
+	uint32_t firstGroup;
+	uint32_t groupCount;
+};
+
+// Triangles of one level drawn with one material: a range of the level's
+// indices (relative to its first index)
+struct MeshGroup
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t material; // Index into the mesh's material names, -1 = the default material
+};
+
+// Unique vertices plus an index triple per triangle, ready for glDrawElements.
+// The coarser levels of detail, if any, index the same vertices. Each level
+// is split into groups that cover its indices.
+struct IndexedMesh
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshGroup> groups;	  // Of the full mesh
+	std::vector<uint32_t> lodIndices; // Index buffers of all coarser levels, back to back
+	std::vector<MeshGroup> lodGroups; // Groups of all coarser levels, back to back
+	std::vector<MeshLod> lods;		  // Ranges of lodIndices and lodGroups, finest first
+	std::vector<std::string> materials; // Names used by the groups
+	std::vector<float> occlusion;		// Baked ambient occlusion of each vertex, or empty
+	std::string materialLibrary;		// The .mtl file, relative to the .obj
+	float bounds[6] = {0, 0, 0, 0, 0, 0}; // minX, minY, minZ, maxX, maxY, maxZ
+
+	size_t triangleCount() const { return indices.size() / 3; }
+};
+
+// Read-only pointers to the buffers of an IndexedMesh, either owned by one or
+// mapped from a cache file
+struct MeshView
+{
+	const Vertex *vertices = nullptr;
+	const uint32_t *indices = nullptr;
+	const uint32_t *lodIndices = nullptr;
+	const MeshLod *lods = nullptr;
+	const MeshGroup *groups = nullptr;
+	const MeshGroup *lodGroups = nullptr;
+	const float *occlusion = nullptr; // One per vertex, or null when not baked
+	size_t vertexCount = 0, indexCount = 0, lodIndexCount = 0, lodCount = 0, groupCount = 0, lodGroupCount = 0;
+	std::vector<std::string> materials;
+	std::string materialLibrary;
+	float bounds[6] = {0, 0, 0, 0, 0, 0};
+
+	MeshView() = default;
+	explicit MeshView(const IndexedMesh &mesh)
+		: vertices(mesh.vertices.data()), indices(mesh.indices.data()), lodIndices(mesh.lodIndices.data()),
+		  lods(mesh.lods.data()), groups(mesh.groups.data()), lodGroups(mesh.lodGroups.data()),
+		  occlusion(mesh.occlusion.empty() ? nullptr : mesh.occlusion.data()), vertexCount(mesh.vertices.size()), indexCount(mesh.indices.size()), lodIndexCount(mesh.lodIndices.size()),
+		  lodCount(mesh.lods.size()), groupCount(mesh.groups.size()), lodGroupCount(mesh.lodGroups.size()),
+		  materials(mesh.materials), materialLibrary(mesh.materialLibrary)
+	{
+		memcpy(bounds, mesh.bounds, sizeof(bounds));
+	}
+
+	size_t triangleCount() const { return indexCount / 3; }
+
+	// Number of levels of detail, the full mesh included
+	size_t levelCount() const { return 1 + lodCount; }
+
+	// Range of `level` in the index buffer made of `indices` followed by
+	// `lodIndices`, and in the groups numbered as `groups` followed by
+	// `lodGroups` (see group); level 0 is the full mesh
+	MeshLod level(size_t level) const
+	{
+		if (level == 0 || lodCount == 0)
+			return {0, (uint32_t)indexCount, 0.0f, 0, (uint32_t)groupCount};
+		const MeshLod &lod = lods[std::min(level, lodCount) - 1];
+		return {(uint32_t)indexCount + lod.firstIndex, lod.indexCount, lod.error,
+				(uint32_t)groupCount + lod.firstGroup, lod.groupCount};
+	}
+
+	const MeshGroup &group(size_t i) const { return i < groupCount ? groups[i] : lodGroups[i - groupCount]; }
+};
+
+// Weld the corners of `mesh` that share the same (v, vt, vn) tuple into one
+// vertex, using an open-addressing hash table sized from the corner count.
+// Texture coordinates are dropped (and do not split vertices) unless
+// `withTexcoords` is set. Corners without a normal get (0, 0, 1), the default
+// current normal of fixed-function GL. Triangles with an invalid vertex index
+// are skipped. The face groups carry over, in file order, minus the empty ones.
+inline IndexedMesh weldMesh(const Mesh &mesh, bool withTexcoords)
+{
+	IndexedMesh out;
+	float bounds[6] = {mesh.minX, mesh.minY, mesh.minZ, mesh.maxX, mesh.maxY, mesh.maxZ};
+	memcpy(out.bounds, bounds, sizeof(bounds));
+	out.materials = mesh.materials;
+	out.materialLibrary = mesh.materialLibrary;
+	size_t nextGroup = 0; // First face group not started yet
+
+	const size_t corners = mesh.faces.size();
+	size_t capacity = 16;
+	while (capacity < corners * 2) // Keep the load factor under 1/2
+		capacity <<= 1;
+	const uint32_t empty = UINT32_MAX;
+	std::vector<uint32_t> slots(capacity, empty);
+	std::vector<int> keys; // (v, vt, vn) of every unique vertex
+	keys.reserve(3 * std::min(corners, mesh.vertexCount() * 2));
+	out.vertices.reserve(keys.capacity() / 3);
+	out.indices.reserve(corners);
+
+	const int vertexCount = (int)mesh.vertexCount(), normalCount = (int)mesh.normalCount(),
+			  texcoordCount = (int)mesh.texcoordCount();
+	for (size_t c = 0; c + 2 < corners; c += 3)
+	{
+		for (; nextGroup < mesh.groups.size() && mesh.groups[nextGroup].firstTriangle <= c / 3; ++nextGroup)
+		{
+			uint32_t first = (uint32_t)out.indices.size();
+			if (!out.groups.empty() && out.groups.back().firstIndex == first)
+				out.groups.pop_back(); // Nothing welded since it started
+			out.groups.push_back({first, 0, mesh.groups[nextGroup].material});
+		}
+
+		bool valid = true;
+		for (int j = 0; j < 3; ++j)
+			valid = valid && mesh.faces[c + j] >= 0 && mesh.faces[c + j] < vertexCount;
+		if (!valid)
+			continue;
+
+		for (int j = 0; j < 3; ++j)
+		{
+			int vi = mesh.faces[c + j];
+			int ti = withTexcoords ? mesh.face_texcoords[c + j] : -1;
+			int ni = mesh.face_normals[c + j];
+			if (ti < 0 || ti >= texcoordCount)
+				ti = -1;
+			if (ni < 0 || ni >= normalCount)
+				ni = -1;
+
+			uint64_t h = (uint64_t)(uint32_t)vi * 0x9E3779B97F4A7C15ull ^ (uint64_t)(uint32_t)ti * 0xC2B2AE3D27D4EB4Full ^
+						 (uint64_t)(uint32_t)ni * 0x165667B19E3779F9ull;
+			size_t slot = (h ^ (h >> 29)) & (capacity - 1);
+			for (;; slot = (slot + 1) & (capacity - 1))
+			{
+				uint32_t index = slots[slot];
+				if (index == empty)
+				{
+					index = (uint32_t)out.vertices.size();
+					slots[slot] = index;
+					keys.insert(keys.end(), {vi, ti, ni});
+
+					Vertex v = {};
+					memcpy(v.position, &mesh.vertices[3 * vi], sizeof(v.position));
+					if (ni >= 0)
+						memcpy(v.normal, &mesh.normals[3 * ni], sizeof(v.normal));
+					else
+						v.normal[2] = 1.0f;
+					if (ti >= 0)
+						memcpy(v.texcoord, &mesh.texcoords[2 * ti], sizeof(v.texcoord));
+					out.vertices.push_back(v);
+					out.indices.push_back(index);
+					break;
+				}
+				if (keys[3 * index] == vi && keys[3 * index + 1] == ti && keys[3 * index + 2] == ni)
+				{
+					out.indices.push_back(index);
+					break;
+				}
+			}
+		}
+	}
+
+	// Close the groups; a mesh parsed without any still gets one
+	if (out.groups.empty() || out.groups.back().firstIndex == out.indices.size())
+	{
+		int material = out.groups.empty() ? -1 : out.groups.back().material;
+		if (!out.groups.empty())
+			out.groups.pop_back();
+		if (out.groups.empty())
+			out.groups.push_back({0, 0, material});
+	}
+	for (size_t g = 0; g < out.groups.size(); ++g)
+		out.groups[g].indexCount =
+			(g + 1 < out.groups.size() ? out.groups[g + 1].firstIndex : (uint32_t)out.indices.size()) -
+			out.groups[g].firstIndex;
+	return out;
+}
+
+// Merge the groups that share a material into one, with its triangles
+// contiguous in the index buffer: one draw per material. Groups are ordered
+// by material, default first, and keep their triangles in file order.
+inline void mergeGroupsByMaterial(IndexedMesh &mesh)
+{
+	std::vector<MeshGroup> order(mesh.groups);
+	std::stable_sort(order.begin(), order.end(), [](const MeshGroup &a, const MeshGroup &b)
+					 { return a.material < b.material; });
+	std::vector<uint32_t> indices;
+	indices.reserve(mesh.indices.size());
+	std::vector<MeshGroup> merged;
+	for (const MeshGroup &g : order)
+	{
+		if (merged.empty() || merged.back().material != g.material)
+			merged.push_back({(uint32_t)indices.size(), 0, g.material});
+		indices.insert(indices.end(), mesh.indices.begin() + g.firstIndex,
+					   mesh.indices.begin() + g.firstIndex + g.indexCount);
+		merged.back().indexCount += g.indexCount;
+	}
+	mesh.indices.swap(indices);
+	mesh.groups.swap(merged);
+}
@@ -0,0 +1,571 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "mesh_buffers.h"
+#include "parallel.h"
+
+// Closest triangle a ray hits
+struct RayHit
+{
+	uint32_t triangle = UINT32_MAX; // Triangle of the index buffer (UINT32_MAX = missed)
+	float distance = FLT_MAX;		// Along the ray, in lengths of its direction
+	float u = 0.0f, v = 0.0f;		// Weights of the second and third corners at the hit
+
+	bool hit() const { return triangle != UINT32_MAX; }
+};
+
+// Bounding volume hierarchy over the triangles of an index buffer, for ray
+// queries. It is built as a binary tree, each node split where the surface
+// area heuristic (SAH) over a few bins along each axis is lowest, then
+// flattened into nodes of four children so one SSE test covers all their
+// boxes.
+class MeshBvh
+{
+public:
+	static const int binCount = 16;		  // Candidate split planes per axis, minus one
+	static const int maxLeafTriangles = 8; // Larger nodes are always split
+
+	// Build over the `indexCount` / 3 triangles of `indices`. The top of the
+	// tree is split with the binning spread over `pool`, then the subtrees
+	// are built in parallel, one per task.
+	void build(const Vertex *vertices, const uint32_t *indices, size_t indexCount, ThreadPool &pool = threadPool())
+	{
+		nodes.clear();
+		triangles.clear();
+		size_t count = indexCount / 3;
+		if (count == 0)
+			return;
+
+		// Bounds and centroid of every triangle
+		std::vector<Primitive> prims(count);
+		pool.parallelFor((count + chunkSize - 1) / chunkSize, [&](size_t chunk)
+						 {
+							 size_t end = std::min(count, (chunk + 1) * chunkSize);
+							 for (size_t t = chunk * chunkSize; t < end; ++t)
+							 {
+								 Primitive &p = prims[t];
+								 p.box = Box();
+								 for (int c = 0; c < 3; ++c)
+									 p.box.grow(vertices[indices[3 * t + c]].position);
+								 for (int k = 0; k < 3; ++k)
+									 p.centroid[k] = 0.5f * (p.box.min[k] + p.box.max[k]);
+								 p.triangle = (uint32_t)t;
+							 } });
+
+		// Top of the tree, largest node first, until there is a subtree per task
+		std::vector<BuildNode> tree(1);
+		tree[0].first = 0;
+		tree[0].count = (uint32_t)count;
+		tree[0].box = rangeBox(prims, 0, count);
+		std::vector<uint32_t> pending = {0}, subtrees;
+		size_t wanted = 4 * (size_t)pool.size();
+		while (!pending.empty() && pending.size() + subtrees.size() < wanted)
+		{
+			auto largest = std::max_element(pending.begin(), pending.end(), [&](uint32_t a, uint32_t b)
+											{ return tree[a].count < tree[b].count; });
+			uint32_t index = *largest;
+			pending.erase(largest);
+			if (tree[index].count < parallelBinMin)
+			{
+				subtrees.push_back(index);
+				continue;
+			}
+			BuildNode left, right;
+			if (!split(prims, tree[index], left, right, &pool))
+				continue; // Became a leaf
+			tree[index].left = (uint32_t)tree.size();
+			tree.push_back(left);
+			tree.push_back(right);
+			pending.push_back(tree[index].left);
+			pending.push_back(tree[index].left + 1);
+		}
+		subtrees.insert(subtrees.end(), pending.begin(), pending.end());
+
+		// The rest of each subtree on its own, then appended to the tree
+		std::vector<std::vector<BuildNode>> built(subtrees.size());
+		pool.parallelFor(subtrees.size(), [&](size_t i)
+						 {
+							 std::vector<BuildNode> &local = built[i];
+							 local.push_back(tree[subtrees[i]]);
+							 buildSubtree(prims, local, 0); });
+		for (size_t i = 0; i < subtrees.size(); ++i)
+		{
+			uint32_t offset = (uint32_t)tree.size() - 1; // Local node 0 replaces the subtree root
+			for (BuildNode &node : built[i])
+				if (node.left)
+					node.left += offset;
+			tree[subtrees[i]] = built[i][0];
+			tree.insert(tree.end(), built[i].begin() + 1, built[i].end());
+		}
+
+		// Triangles in leaf order, as corner and two edges
+		triangles.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const uint32_t *corner = &indices[3 * prims[i].triangle];
+			const float *a = vertices[corner[0]].position, *b = vertices[corner[1]].position,
+						*c = vertices[corner[2]].position;
+			Triangle &t = triangles[i];
+			for (int k = 0; k < 3; ++k)
+			{
+				t.corner[k] = a[k];
+				t.edge1[k] = b[k] - a[k];
+				t.edge2[k] = c[k] - a[k];
+			}
+			t.index = prims[i].triangle;
+		}
+
+		binaryNodes = tree.size();
+		if (tree[0].left == 0)
+		{
+			// A single leaf: a root with one child
+			nodes.emplace_back();
+			setChild(nodes[0], 0, tree[0]);
+		}
+		else
+			collapse(tree, 0);
+	}
+
+	bool empty() const { return nodes.empty(); }
+	size_t nodeCount() const { return nodes.size(); }
+	size_t binaryNodeCount() const { return binaryNodes; }
+	size_t triangleCount() const { return triangles.size(); }
+	size_t memoryBytes() const { return nodes.size() * sizeof(Node) + triangles.size() * sizeof(Triangle); }
+
+	// Nearest triangle along the ray from `origin` in `direction`, hit from
+	// either side
+	RayHit intersect(const float origin[3], const float direction[3]) const
+	{
+		return traverse<false>(origin, direction, FLT_MAX);
+	}
+
+	// Whether any triangle lies along the ray closer than `maxDistance`
+	// (in lengths of `direction`). Stops at the first hit, so it is cheaper
+	// than intersect() for shadow and occlusion rays.
+	bool occluded(const float origin[3], const float direction[3], float maxDistance) const
+	{
+		return traverse<true>(origin, direction, maxDistance).hit();
+	}
+
+	// The same query against every triangle of `indices`, without the tree
+	static RayHit intersectAll(const Vertex *vertices, const uint32_t *indices, size_t indexCount, const float origin[3],
+							   const float direction[3])
+	{
+		RayHit best;
+		for (size_t t = 0; t < indexCount / 3; ++t)
+		{
+			Triangle tri;
+			const float *a = vertices[indices[3 * t]].position, *b = vertices[indices[3 * t + 1]].position,
+						*c = vertices[indices[3 * t + 2]].position;
+			for (int k = 0; k < 3; ++k)
+			{
+				tri.corner[k] = a[k];
+				tri.edge1[k] = b[k] - a[k];
+				tri.edge2[k] = c[k] - a[k];
+			}
+			tri.index = (uint32_t)t;
+			intersectTriangle(tri, origin, direction, best);
+		}
+		return best;
+	}
+
+private:
+	static const size_t chunkSize = 16384;		// Triangles per task when binning in parallel
+	static const uint32_t parallelBinMin = 65536; // Smaller nodes are left to one task
+	static const int stackSize = 256;
+
+	// Walk the tree nearest child first. Hits beyond `limit` are ignored, and
+	// with `anyHit` the walk ends at the first hit found.
+	template <bool anyHit>
+	RayHit traverse(const float origin[3], const float direction[3], float limit) const
+	{
+		RayHit best;
+		best.distance = limit;
+		if (nodes.empty())
+			return best;
+		// Finite even along an axis, so a box side through the origin gives
+		// 0 instead of 0 * infinity (NaN)
+		float inverse[3];
+		for (int k = 0; k < 3; ++k)
+			inverse[k] = 1.0f / (direction[k] != 0.0f ? direction[k] : 1e-30f);
+		uint32_t stack[stackSize];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node &node = nodes[stack[--top]];
+			float near[4];
+			int order[4], hits = 0;
+			unsigned mask = intersectBoxes(node, origin, inverse, best.distance, near);
+			for (int i = 0; i < 4; ++i)
+			{
+				if (!(mask & (1u << i)))
+					continue;
+				if (node.count[i])
+				{
+					for (uint32_t t = node.child[i]; t < node.child[i] + node.count[i]; ++t)
+					{
+						intersectTriangle(triangles[t], origin, direction, best);
+						if (anyHit && best.hit())
+							return best;
+					}
+					continue;
+				}
+				// Inner children sorted far to near, so the nearest is popped first
+				int j = hits++;
+				for (; j > 0 && near[order[j - 1]] < near[i]; --j)
+					order[j] = order[j - 1];
+				order[j] = i;
+			}
+			for (int j = 0; j < hits && top < stackSize; ++j)
+				if (near[order[j]] < best.distance)
+					stack[top++] = node.child[order[j]];
+		}
+		return best;
+	}
+
+	struct Box
+	{
+		float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+		float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+		void grow(const float p[3])
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				min[k] = std::min(min[k], p[k]);
+				max[k] = std::max(max[k], p[k]);
+			}
+		}
+		void grow(const Box &b)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				min[k] = std::min(min[k], b.min[k]);
+				max[k] = std::max(max[k], b.max[k]);
+			}
+		}
+		// Half the surface area, 0 for an empty box
+		float area() const
+		{
+			if (min[0] > max[0])
+				return 0.0f;
+			float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+			return dx * dy + dy * dz + dz * dx;
+		}
+	};
+
+	struct Primitive
+	{
+		Box box;
+		float centroid[3];
+		uint32_t triangle;
+	};
+
+	// Node of the binary tree: a leaf over prims [first, first + count) or
+	// an inner node whose children are left and left + 1
+	struct BuildNode
+	{
+		Box box;
+		uint32_t first = 0, count = 0;
+		uint32_t left = 0; // 0 = leaf
+	};
+
+	struct Bin
+	{
+		Box box;
+		uint32_t count = 0;
+	};
+
+	// Four children, their boxes one coordinate at a time. A child with a
+	// count is a leaf over triangles [child, child + count); one without is
+	// the node `child`. Unused slots hold a point box at FLT_MAX, which no ray
+	// reaches (an inverted box would pass the slab test everywhere).
+	struct alignas(16) Node
+	{
+		float minX[4], minY[4], minZ[4], maxX[4], maxY[4], maxZ[4];
+		uint32_t child[4];
+		uint8_t count[4];
+
+		Node()
+		{
+			std::fill(minX, minX + 4, FLT_MAX);
+			std::fill(minY, minY + 4, FLT_MAX);
+			std::fill(minZ, minZ + 4, FLT_MAX);
+			std::fill(maxX, maxX + 4, FLT_MAX);
+			std::fill(maxY, maxY + 4, FLT_MAX);
+			std::fill(maxZ, maxZ + 4, FLT_MAX);
+			std::fill(child, child + 4, 0);
+			std::fill(count, count + 4, 0);
+		}
+	};
+
+	struct Triangle
+	{
+		float corner[3], edge1[3], edge2[3];
+		uint32_t index; // In the index buffer
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Triangle> triangles;
+	size_t binaryNodes = 0;
+
+	static Box rangeBox(const std::vector<Primitive> &prims, size_t first, size_t count)
+	{
+		Box box;
+		for (size_t i = first; i < first + count; ++i)
+			box.grow(prims[i].box);
+		return box;
+	}
+
+	// Split `node` in two by the binned SAH, reordering its prims. False if it
+	// is cheaper as a leaf. With a pool, the prims are binned a chunk per task.
+	static bool split(std::vector<Primitive> &prims, const BuildNode &node, BuildNode &left, BuildNode &right,
+					  ThreadPool *pool)
+	{
+		if (node.count <= 1)
+			return false;
+		Box centroids;
+		for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			centroids.grow(prims[i].centroid);
+
+		int axis = -1;
+		size_t bestSplit = 0;
+		float bestCost = FLT_MAX;
+		for (int k = 0; k < 3; ++k)
+		{
+			float extent = centroids.max[k] - centroids.min[k];
+			if (!(extent > 0.0f))
+				continue;
+			float toBin = binCount * (1.0f - 1e-5f) / extent;
+			auto binOf = [&](const Primitive &p)
+			{ return std::min(binCount - 1, (int)((p.centroid[k] - centroids.min[k]) * toBin)); };
+
+			Bin bins[binCount];
+			if (pool && node.count >= parallelBinMin)
+			{
+				size_t chunks = (node.count + chunkSize - 1) / chunkSize;
+				std::vector<std::vector<Bin>> partial(chunks, std::vector<Bin>(binCount));
+				pool->parallelFor(chunks, [&](size_t chunk)
+								  {
+									  size_t end = std::min<size_t>(node.first + node.count, node.first + (chunk + 1) * chunkSize);
+									  for (size_t i = node.first + chunk * chunkSize; i < end; ++i)
+									  {
+										  Bin &bin = partial[chunk][binOf(prims[i])];
+										  bin.box.grow(prims[i].box);
+										  ++bin.count;
+									  } });
+				for (const std::vector<Bin> &part : partial)
+					for (int b = 0; b < binCount; ++b)
+					{
+						bins[b].box.grow(part[b].box);
+						bins[b].count += part[b].count;
+					}
+			}
+			else
+				for (uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					Bin &bin = bins[binOf(prims[i])];
+					bin.box.grow(prims[i].box);
+					++bin.count;
+				}
+
+			// Cost of each plane: the areas of both sides times their counts
+			float rightArea[binCount];
+			uint32_t rightCount[binCount];
+			Box sweep;
+			uint32_t counted = 0;
+			for (int b = binCount - 1; b > 0; --b)
+			{
+				sweep.grow(bins[b].box);
+				counted += bins[b].count;
+				rightArea[b] = sweep.area();
+				rightCount[b] = counted;
+			}
+			sweep = Box();
+			counted = 0;
+			for (int b = 0; b + 1 < binCount; ++b)
+			{
+				sweep.grow(bins[b].box);
+				counted += bins[b].count;
+				float cost = sweep.area() * counted + rightArea[b + 1] * rightCount[b + 1];
+				if (counted && rightCount[b + 1] && cost < bestCost)
+				{
+					bestCost = cost;
+					axis = k;
+					bestSplit = b + 1;
+				}
+			}
+		}
+
+		auto middle = prims.begin() + node.first + node.count / 2;
+		if (axis < 0)
+		{
+			// Every centroid in one spot: halves, if too many for a leaf
+			if (node.count <= (uint32_t)maxLeafTriangles)
+				return false;
+		}
+		else
+		{
+			// A leaf tests every triangle; a split one box and then a side
+			float leafCost = node.box.area() * node.count;
+			if (bestCost >= leafCost - node.box.area() && node.count <= (uint32_t)maxLeafTriangles)
+				return false;
+			float extent = centroids.max[axis] - centroids.min[axis];
+			float toBin = binCount * (1.0f - 1e-5f) / extent;
+			float minimum = centroids.min[axis];
+			middle = std::partition(prims.begin() + node.first, prims.begin() + node.first + node.count,
+									[&](const Primitive &p)
+									{ return std::min(binCount - 1, (int)((p.centroid[axis] - minimum) * toBin)) < (int)bestSplit; });
+		}
+
+		left.first = node.first;
+		left.count = (uint32_t)(middle - prims.begin()) - node.first;
+		right.first = left.first + left.count;
+		right.count = node.count - left.count;
+		left.box = rangeBox(prims, left.first, left.count);
+		right.box = rangeBox(prims, right.first, right.count);
+		return true;
+	}
+
+	// Split `tree[index]` down to its leaves, on the calling thread
+	static void buildSubtree(std::vector<Primitive> &prims, std::vector<BuildNode> &tree, uint32_t index)
+	{
+		std::vector<uint32_t> todo = {index};
+		while (!todo.empty())
+		{
+			uint32_t i = todo.back();
+			todo.pop_back();
+			BuildNode left, right;
+			if (!split(prims, tree[i], left, right, nullptr))
+				continue;
+			tree[i].left = (uint32_t)tree.size();
+			tree.push_back(left);
+			tree.push_back(right);
+			todo.push_back(tree[i].left);
+			todo.push_back(tree[i].left + 1);
+		}
+	}
+
+	// Store `child` in `slot`, its box grown by a hair: a ray running along a
+	// side (a zero direction coordinate) still enters it, as it touches the
+	// triangles on that side
+	void setChild(Node &node, int slot, const BuildNode &child)
+	{
+		float *mins[3] = {node.minX, node.minY, node.minZ}, *maxs[3] = {node.maxX, node.maxY, node.maxZ};
+		for (int k = 0; k < 3; ++k)
+		{
+			float pad = 1e-6f * (fabsf(child.box.min[k]) + fabsf(child.box.max[k])) + FLT_MIN;
+			mins[k][slot] = child.box.min[k] - pad;
+			maxs[k][slot] = child.box.max[k] + pad;
+		}
+		node.child[slot] = child.first;
+		node.count[slot] = (uint8_t)(child.left ? 0 : child.count);
+	}
+
+	// Make the four-wide node of inner binary node `index`: its two children,
+	// with the largest inner ones opened until there are four. Returns the
+	// new node's position.
+	uint32_t collapse(const std::vector<BuildNode> &tree, uint32_t index)
+	{
+		std::vector<uint32_t> children = {tree[index].left, tree[index].left + 1};
+		while (children.size() < 4)
+		{
+			int open = -1;
+			for (int i = 0; i < (int)children.size(); ++i)
+				if (tree[children[i]].left && (open < 0 || tree[children[i]].box.area() > tree[children[open]].box.area()))
+					open = i;
+			if (open < 0)
+				break;
+			uint32_t opened = children[open];
+			children[open] = tree[opened].left;
+			children.push_back(tree[opened].left + 1);
+		}
+
+		uint32_t position = (uint32_t)nodes.size();
+		nodes.emplace_back();
+		for (int slot = 0; slot < (int)children.size(); ++slot)
+		{
+			const BuildNode &child = tree[children[slot]];
+			setChild(nodes[position], slot, child);
+			if (child.left)
+			{
+				uint32_t below = collapse(tree, children[slot]);
+				nodes[position].child[slot] = below; // `nodes` may have moved
+			}
+		}
+		return position;
+	}
+
+	// Bit i set if the ray enters box i of `node` before `limit`, with the
+	// entry distance in near[i]
+	static unsigned intersectBoxes(const Node &node, const float origin[3], const float inverse[3], float limit,
+								   float near[4])
+	{
+#ifdef __SSE__
+		__m128 o[3] = {_mm_set1_ps(origin[0]), _mm_set1_ps(origin[1]), _mm_set1_ps(origin[2])};
+		__m128 inv[3] = {_mm_set1_ps(inverse[0]), _mm_set1_ps(inverse[1]), _mm_set1_ps(inverse[2])};
+		const float *mins[3] = {node.minX, node.minY, node.minZ}, *maxs[3] = {node.maxX, node.maxY, node.maxZ};
+		__m128 enter = _mm_setzero_ps(), leave = _mm_set1_ps(limit);
+		for (int k = 0; k < 3; ++k)
+		{
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(mins[k]), o[k]), inv[k]);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxs[k]), o[k]), inv[k]);
+			enter = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+			leave = _mm_min_ps(leave, _mm_max_ps(t0, t1));
+		}
+		_mm_storeu_ps(near, enter);
+		return (unsigned)_mm_movemask_ps(_mm_cmple_ps(enter, leave));
+#else
+		const float *mins[3] = {node.minX, node.minY, node.minZ}, *maxs[3] = {node.maxX, node.maxY, node.maxZ};
+		unsigned mask = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			float enter = 0.0f, leave = limit;
+			for (int k = 0; k < 3; ++k)
+			{
+				float t0 = (mins[k][i] - origin[k]) * inverse[k], t1 = (maxs[k][i] - origin[k]) * inverse[k];
+				enter = std::max(enter, std::min(t0, t1));
+				leave = std::min(leave, std::max(t0, t1));
+			}
+			near[i] = enter;
+			if (enter <= leave)
+				mask |= 1u << i;
+		}
+		return mask;
+#endif
+	}
+
+	// Möller-Trumbore: keep the hit in `best` if it is nearer
+	static void intersectTriangle(const Triangle &t, const float o[3], const float d[3], RayHit &best)
+	{
+		const float *e1 = t.edge1, *e2 = t.edge2;
+		float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+		float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (fabsf(det) < 1e-12f)
+			return;
+		float inv = 1.0f / det;
+		float s[3] = {o[0] - t.corner[0], o[1] - t.corner[1], o[2] - t.corner[2]};
+		float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+		if (u < 0.0f || u > 1.0f)
+			return;
+		float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+		float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+		if (v < 0.0f || u + v > 1.0f)
+			return;
+		float distance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+		if (distance <= 0.0f || distance >= best.distance)
+			return;
+		best.triangle = t.index;
+		best.distance = distance;
+		best.u = u;
+		best.v = v;
+	}
+};
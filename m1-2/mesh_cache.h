@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "obj_loader.h"
+#include "mesh_buffers.h"
+
+// Binary cache of a loaded mesh, written next to the source file as
+// <file>.obj.meshcache. It holds the welded, centered vertex buffer, the
+// triangle index buffer (after the optimizations recorded in buildFlags), the
+// index buffers of the levels of detail and the material groups of every
+// level, so all of them can be uploaded to GL straight from the mapping.
+// Layout:
+//   CacheHeader | CacheSection[sectionCount] | section data...
+// Every section starts on a 16-byte boundary so it can be used in place from
+// the mapping. The cache is only used when the source file still has the
+// recorded size, mtime and content hash, was built with the requested flags
+// and occlusion rays and the payload hash checks out.
+
+const char meshCacheMagic[8] = {'O', 'B', 'J', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t meshCacheVersion = 8;
+
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t sectionCount;
+	uint64_t sourceSize;
+	int64_t sourceMtimeNs;
+	uint64_t sourceHash;
+	uint64_t payloadHash;	// Hash of every byte after the header
+	float bounds[6];		// minX, minY, minZ, maxX, maxY, maxZ
+	uint32_t buildFlags;	// CacheBuildFlags the buffers were built with
+	uint32_t occlusionRays; // Rays per vertex of the occlusion bake (0 = none)
+};
+
+struct CacheSection
+{
+	uint32_t id;
+	uint32_t elementSize;
+	uint64_t offset; // From the start of the file
+	uint64_t count;	 // Number of elements
+};
+
+enum CacheSectionId : uint32_t
+{
+	SectionVertices = 1, // Vertex
+	SectionIndices,		 // uint32_t, 3 per triangle
+	SectionLodIndices,	 // uint32_t, every coarser level back to back
+	SectionLods,		 // MeshLod, ranges of SectionLodIndices and SectionLodGroups
+	SectionGroups,		 // MeshGroup, ranges of SectionIndices
+	SectionLodGroups,	 // MeshGroup, every coarser level's groups back to back
+	SectionMaterialNames, // char, the material library then every material name, each ending in '\0'
+	SectionOcclusion	  // float, baked ambient occlusion of each vertex
+};
+
+enum CacheBuildFlags : uint32_t
+{
+	BuildVertexCache = 1, // Triangles and vertices reordered by optimizeMesh
+	BuildOverdraw = 2,	  // ... including the overdraw pass
+	BuildLods = 4,		  // Levels of detail from buildLodChain
+	BuildAreaNormals = 8, // Generated normals weighted by area instead of angle
+	BuildBatched = 16,	  // Groups merged by mergeGroupsByMaterial
+	BuildCreaseShift = 16 // Bits 16..23: crease angle of generated normals, in degrees
+};
+
+// Fast 64-bit hash used to detect changed sources and damaged caches. Four
+// independent lanes over 8-byte words keep it close to memory bandwidth.
+inline uint64_t hashBytes(const void *data, size_t size)
+{
+	const uint64_t prime = 0x9E3779B97F4A7C15ull;
+	auto rotl = [](uint64_t x, int r)
+	{ return (x << r) | (x >> (64 - r)); };
+	auto mix = [&](uint64_t lane, uint64_t word)
+	{ return rotl(lane ^ (word * prime), 31) * 0xC2B2AE3D27D4EB4Full; };
+
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t lanes[4] = {prime, prime ^ 1, prime ^ 2, prime ^ 3};
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+	{
+		uint64_t words[4];
+		memcpy(words, p + i, 32);
+		for (int l = 0; l < 4; ++l)
+			lanes[l] = mix(lanes[l], words[l]);
+	}
+	uint64_t tail = 0;
+	for (size_t shift = 0; i < size; ++i, shift = (shift + 8) % 64)
+	{
+		tail ^= (uint64_t)p[i] << shift;
+		if (shift == 56)
+			lanes[0] = mix(lanes[0], tail), tail = 0;
+	}
+
+	uint64_t h = size * prime;
+	for (int l = 0; l < 4; ++l)
+		h = rotl(h ^ lanes[l], 27) * prime;
+	h = mix(h, tail);
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	return h;
+}
+
+inline std::string meshCachePath(const std::string &objPath) { return objPath + ".meshcache"; }
+
+// Size, mtime and content hash of a source file, as recorded in the cache
+struct SourceStamp
+{
+	uint64_t size = 0;
+	int64_t mtimeNs = 0;
+	uint64_t hash = 0;
+
+	bool read(const std::string &path)
+	{
+		struct stat st;
+		MappedFile file;
+		if (stat(path.c_str(), &st) != 0 || !file.open(path))
+			return false;
+		size = (uint64_t)st.st_size;
+		mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+		hash = hashBytes(file.data, file.size);
+		return true;
+	}
+};
+
+// A validated cache file mapped into memory
+class MeshCache
+{
+public:
+	// Map the cache of `objPath`. Returns false, leaving the cache closed, if
+	// it is missing, stale, built with other flags or occlusion rays or damaged
+	// in any way. `stamp` receives the source's stamp, ready to write a fresh
+	// cache with.
+	bool open(const std::string &objPath, SourceStamp &stamp, uint32_t buildFlags, uint32_t occlusionRays)
+	{
+		close();
+		if (!stamp.read(objPath) || !file.open(meshCachePath(objPath)) || file.size < sizeof(CacheHeader))
+			return fail();
+
+		memcpy(&header, file.data, sizeof(header));
+		if (memcmp(header.magic, meshCacheMagic, sizeof(meshCacheMagic)) != 0 || header.version != meshCacheVersion ||
+			header.sourceSize != stamp.size || header.sourceMtimeNs != stamp.mtimeNs || header.sourceHash != stamp.hash ||
+			header.buildFlags != buildFlags || header.occlusionRays != occlusionRays)
+			return fail();
+
+		size_t tableEnd = sizeof(CacheHeader) + (size_t)header.sectionCount * sizeof(CacheSection);
+		if (header.sectionCount > 64 || tableEnd > file.size ||
+			hashBytes(file.data + sizeof(CacheHeader), file.size - sizeof(CacheHeader)) != header.payloadHash)
+			return fail();
+
+		sections.resize(header.sectionCount);
+		memcpy(sections.data(), file.data + sizeof(CacheHeader), tableEnd - sizeof(CacheHeader));
+		for (const CacheSection &s : sections)
+			if (s.offset % 16 != 0 || s.offset < tableEnd || s.offset > file.size ||
+				s.count > (file.size - s.offset) / std::max<uint32_t>(1, s.elementSize))
+				return fail();
+		return true;
+	}
+
+	void close()
+	{
+		file.close();
+		sections.clear();
+	}
+
+	bool isOpen() const { return file.data != nullptr; }
+
+	// Pointer to a section's data and its element count, or nullptr if the
+	// section is missing or does not hold elements of type T
+	template <typename T>
+	const T *section(uint32_t id, size_t &count) const
+	{
+		for (const CacheSection &s : sections)
+			if (s.id == id && s.elementSize == sizeof(T))
+			{
+				count = (size_t)s.count;
+				return (const T *)(file.data + s.offset);
+			}
+		count = 0;
+		return nullptr;
+	}
+
+	MeshView view() const
+	{
+		MeshView v;
+		v.vertices = section<Vertex>(SectionVertices, v.vertexCount);
+		v.indices = section<uint32_t>(SectionIndices, v.indexCount);
+		v.indexCount -= v.indexCount % 3;
+		v.lodIndices = section<uint32_t>(SectionLodIndices, v.lodIndexCount);
+		v.lods = section<MeshLod>(SectionLods, v.lodCount);
+		v.groups = section<MeshGroup>(SectionGroups, v.groupCount);
+		v.lodGroups = section<MeshGroup>(SectionLodGroups, v.lodGroupCount);
+		for (size_t i = 0; i < v.lodCount; ++i)
+			if (v.lods[i].firstIndex > v.lodIndexCount || v.lods[i].indexCount > v.lodIndexCount - v.lods[i].firstIndex ||
+				v.lods[i].firstGroup > v.lodGroupCount || v.lods[i].groupCount > v.lodGroupCount - v.lods[i].firstGroup ||
+				!validGroups(v.lodGroups + v.lods[i].firstGroup, v.lods[i].groupCount, v.lods[i].indexCount))
+				v.lodCount = 0;
+		if (!validGroups(v.groups, v.groupCount, v.indexCount))
+			v.groupCount = 0;
+
+		// Names, split at their terminators; an unterminated one is dropped
+		size_t length;
+		const char *names = section<char>(SectionMaterialNames, length);
+		for (size_t i = 0, end; i < length; i = end + 1)
+		{
+			const char *stop = (const char *)memchr(names + i, '\0', length - i);
+			if (!stop)
+				break;
+			end = stop - names;
+			if (i == 0)
+				v.materialLibrary.assign(names, end);
+			else
+				v.materials.emplace_back(names + i, end - i);
+		}
+		size_t occlusionCount;
+		v.occlusion = section<float>(SectionOcclusion, occlusionCount);
+		if (occlusionCount != v.vertexCount)
+			v.occlusion = nullptr;
+		memcpy(v.bounds, header.bounds, sizeof(v.bounds));
+		return v;
+	}
+
+	size_t size() const { return file.size; }
+
+private:
+	MappedFile file;
+	CacheHeader header;
+	std::vector<CacheSection> sections;
+
+	bool fail()
+	{
+		close();
+		return false;
+	}
+
+	// True if every group lies within `indexCount` indices
+	static bool validGroups(const MeshGroup *groups, size_t count, size_t indexCount)
+	{
+		for (size_t i = 0; i < count; ++i)
+			if (groups[i].firstIndex > indexCount || groups[i].indexCount > indexCount - groups[i].firstIndex)
+				return false;
+		return true;
+	}
+};
+
+// Collects the sections of a cache file and writes it atomically
+class MeshCacheWriter
+{
+public:
+	template <typename T>
+	void add(uint32_t id, const T *data, size_t count)
+	{
+		entries.push_back({id, sizeof(T), (const char *)data, count});
+	}
+
+	// Write the cache of `objPath`. Failures (e.g. a read-only directory) are
+	// silent: the cache is only an optimization.
+	bool write(const std::string &objPath, const SourceStamp &stamp, const float bounds[6], uint32_t buildFlags,
+			   uint32_t occlusionRays) const
+	{
+		CacheHeader header = {};
+		memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+		header.version = meshCacheVersion;
+		header.sectionCount = (uint32_t)entries.size();
+		header.sourceSize = stamp.size;
+		header.sourceMtimeNs = stamp.mtimeNs;
+		header.sourceHash = stamp.hash;
+		memcpy(header.bounds, bounds, sizeof(header.bounds));
+		header.buildFlags = buildFlags;
+		header.occlusionRays = occlusionRays;
+
+		// Lay the sections out after the table, 16-byte aligned
+		std::vector<CacheSection> table;
+		size_t offset = sizeof(CacheHeader) + entries.size() * sizeof(CacheSection);
+		for (const Entry &e : entries)
+		{
+			offset = (offset + 15) & ~(size_t)15;
+			table.push_back({e.id, e.elementSize, offset, e.count});
+			offset += e.elementSize * e.count;
+		}
+
+		std::vector<char> payload(offset - sizeof(CacheHeader), 0);
+		memcpy(payload.data(), table.data(), table.size() * sizeof(CacheSection));
+		for (size_t i = 0; i < entries.size(); ++i)
+			if (entries[i].count)
+				memcpy(payload.data() + table[i].offset - sizeof(CacheHeader), entries[i].data,
+					   entries[i].elementSize * entries[i].count);
+		header.payloadHash = hashBytes(payload.data(), payload.size());
+
+		std::string path = meshCachePath(objPath);
+		std::string tmp = path + ".tmp." + std::to_string(getpid());
+		FILE *f = fopen(tmp.c_str(), "wb");
+		if (!f)
+			return false;
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+				  fwrite(payload.data(), 1, payload.size(), f) == payload.size();
+		ok = fclose(f) == 0 && ok;
+		if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+		{
+			remove(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+private:
+	struct Entry
+	{
+		uint32_t id;
+		uint32_t elementSize;
+		const char *data;
+		size_t count;
+	};
+	std::vector<Entry> entries;
+};
+
+// Write the cache for a welded, centered mesh
+inline bool writeMeshCache(const std::string &objPath, const SourceStamp &stamp, const IndexedMesh &mesh,
+						   uint32_t buildFlags, uint32_t occlusionRays)
+{
+	MeshCacheWriter writer;
+	writer.add(SectionVertices, mesh.vertices.data(), mesh.vertices.size());
+	writer.add(SectionIndices, mesh.indices.data(), mesh.indices.size());
+	writer.add(SectionLodIndices, mesh.lodIndices.data(), mesh.lodIndices.size());
+	writer.add(SectionLods, mesh.lods.data(), mesh.lods.size());
+	writer.add(SectionGroups, mesh.groups.data(), mesh.groups.size());
+	writer.add(SectionLodGroups, mesh.lodGroups.data(), mesh.lodGroups.size());
+	std::string names = mesh.materialLibrary + '\0';
+	for (const std::string &name : mesh.materials)
+		names += name + '\0';
+	writer.add(SectionMaterialNames, names.data(), names.size());
+	writer.add(SectionOcclusion, mesh.occlusion.data(), mesh.occlusion.size());
+	return writer.write(objPath, stamp, mesh.bounds, buildFlags, occlusionRays);
+}
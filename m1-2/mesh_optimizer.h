@@ -0,0 +1,332 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include "mesh_buffers.h"
+
+// Post-transform vertex cache statistics of an index buffer, simulated with a
+// FIFO cache like the one in most GPUs
+struct VertexCacheStats
+{
+	double acmr = 0; // Average cache miss ratio: transformed vertices per triangle (0.5 .. 3)
+	double atvr = 0; // Average transform to vertex ratio: transformed vertices per vertex (1 = ideal)
+};
+
+inline VertexCacheStats analyzeVertexCache(const uint32_t *indices, size_t indexCount, size_t vertexCount,
+										   unsigned cacheSize = 16)
+{
+	// A vertex is in the FIFO if it was pushed less than cacheSize pushes ago
+	std::vector<uint32_t> pushedAt(vertexCount, 0);
+	std::vector<char> used(vertexCount, 0);
+	uint32_t pushes = cacheSize + 1;
+	size_t misses = 0, unique = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		uint32_t v = indices[i];
+		if (pushes - pushedAt[v] > cacheSize)
+		{
+			pushedAt[v] = pushes++;
+			++misses;
+		}
+		if (!used[v])
+			used[v] = 1, ++unique;
+	}
+
+	VertexCacheStats stats;
+	if (indexCount >= 3)
+		stats.acmr = (double)misses / (indexCount / 3);
+	if (unique)
+		stats.atvr = (double)misses / unique;
+	return stats;
+}
+
+namespace vcache_detail
+{
+	const int cacheSize = 32; // LRU size assumed by the scoring function
+
+	// Vertex score of Tom Forsyth's "Linear-speed vertex cache optimisation":
+	// the last triangle's vertices get a fixed score, older ones decay with
+	// their cache position, and vertices with few triangles left get a boost
+	// so that no lone triangles are left behind.
+	inline float vertexScore(int cachePosition, uint32_t liveTriangles)
+	{
+		if (liveTriangles == 0)
+			return -1.0f;
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = std::pow(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+		}
+		return score + 2.0f / std::sqrt((float)liveTriangles);
+	}
+}
+
+// Reorder triangles for post-transform cache locality (Forsyth). The result
+// only depends on the input, ties are broken by the lowest triangle index.
+inline void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount)
+{
+	using namespace vcache_detail;
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Triangles of every vertex (CSR); the live ones are kept at the front
+	std::vector<uint32_t> offsets(vertexCount + 1, 0), live(vertexCount, 0);
+	for (uint32_t v : indices)
+		++live[v];
+	for (size_t v = 0; v < vertexCount; ++v)
+		offsets[v + 1] = offsets[v] + live[v];
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); ++i)
+			adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		vertexScores[v] = vertexScore(-1, live[v]);
+
+	std::vector<char> emitted(triangleCount, 0);
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	std::vector<uint32_t> cache, nextCache;
+	cache.reserve(cacheSize + 3);
+	nextCache.reserve(cacheSize + 3);
+
+	size_t best = 0, cursor = 0;
+	for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+	{
+		// No candidate in the cache: continue with the next unused triangle
+		if (best == SIZE_MAX)
+		{
+			while (emitted[cursor])
+				++cursor;
+			best = cursor;
+		}
+
+		const uint32_t *tri = &indices[3 * best];
+		emitted[best] = 1;
+		output.insert(output.end(), tri, tri + 3);
+
+		// Drop the triangle from its vertices' live lists
+		for (int j = 0; j < 3; ++j)
+		{
+			uint32_t v = tri[j];
+			uint32_t *list = &adjacency[offsets[v]];
+			uint32_t *found = std::find(list, list + live[v], (uint32_t)best);
+			std::swap(*found, list[--live[v]]);
+		}
+
+		// The triangle's vertices move to the front of the LRU cache
+		nextCache.assign(tri, tri + 3);
+		for (uint32_t v : cache)
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				nextCache.push_back(v);
+		for (size_t i = 0; i < nextCache.size(); ++i)
+		{
+			uint32_t v = nextCache[i];
+			cachePosition[v] = i < (size_t)cacheSize ? (int)i : -1;
+			vertexScores[v] = vertexScore(cachePosition[v], live[v]);
+		}
+		if (nextCache.size() > (size_t)cacheSize)
+			nextCache.resize(cacheSize);
+		cache.swap(nextCache);
+
+		// Rescore the live triangles around the cache and pick the best one
+		best = SIZE_MAX;
+		float bestScore = -INFINITY;
+		for (uint32_t v : cache)
+			for (uint32_t k = offsets[v]; k < offsets[v] + live[v]; ++k)
+			{
+				uint32_t t = adjacency[k];
+				const uint32_t *c = &indices[3 * t];
+				float score = vertexScores[c[0]] + vertexScores[c[1]] + vertexScores[c[2]];
+				if (score > bestScore || (score == bestScore && t < best))
+				{
+					bestScore = score;
+					best = t;
+				}
+			}
+	}
+	indices.swap(output);
+}
+
+// Reorder clusters of triangles so that the ones facing outwards are drawn
+// first, which lets early depth testing reject more of the hidden fragments.
+// Clusters are runs of the (cache optimized) order. A run ends where all
+// three vertices of a triangle miss the cache, or as soon as its own ACMR,
+// simulated from an empty cache, is within `threshold` of the whole mesh's,
+// so that reordering the runs costs little cache efficiency (Sander et al.,
+// "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+// Sorting is stable, keeping the output deterministic.
+inline void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices,
+							 float threshold = 1.05f)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	std::vector<size_t> clusterStart = {0};
+	{
+		const uint32_t cacheSize = 16;
+		double target = analyzeVertexCache(indices.data(), indices.size(), vertices.size(), cacheSize).acmr * threshold;
+		std::vector<uint32_t> pushedAt(vertices.size(), 0);
+		uint32_t pushes = cacheSize + 1;
+		size_t start = 0, clusterMisses = 0;
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			int misses = 0;
+			for (int j = 0; j < 3; ++j)
+			{
+				uint32_t v = indices[3 * t + j];
+				if (pushes - pushedAt[v] > cacheSize)
+					pushedAt[v] = pushes++, ++misses;
+			}
+			if (misses == 3 && t > start)
+			{
+				clusterStart.push_back(t);
+				start = t, clusterMisses = 0;
+			}
+			clusterMisses += misses;
+			if (clusterMisses <= target * (t - start + 1) && t + 1 < triangleCount)
+			{
+				clusterStart.push_back(t + 1);
+				start = t + 1, clusterMisses = 0;
+				pushes += cacheSize + 1; // Empty the cache
+			}
+		}
+		clusterStart.push_back(triangleCount);
+	}
+
+	// Mesh centroid, weighting every triangle by its area
+	auto triangleGeometry = [&](size_t t, float centroid[3], float normal[3])
+	{
+		const float *a = vertices[indices[3 * t]].position;
+		const float *b = vertices[indices[3 * t + 1]].position;
+		const float *c = vertices[indices[3 * t + 2]].position;
+		float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+		float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+		normal[0] = e1[1] * e2[2] - e1[2] * e2[1]; // Length is twice the area
+		normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		for (int k = 0; k < 3; ++k)
+			centroid[k] = (a[k] + b[k] + c[k]) / 3.0f;
+	};
+
+	double meshCenter[3] = {0, 0, 0}, meshArea = 0;
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		float centroid[3], normal[3];
+		triangleGeometry(t, centroid, normal);
+		double area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		for (int k = 0; k < 3; ++k)
+			meshCenter[k] += centroid[k] * area;
+		meshArea += area;
+	}
+	for (int k = 0; k < 3; ++k)
+		meshCenter[k] = meshArea > 0 ? meshCenter[k] / meshArea : 0;
+
+	// Sort key of a cluster: how far its surface points away from the center
+	size_t clusterCount = clusterStart.size() - 1;
+	std::vector<float> keys(clusterCount);
+	for (size_t c = 0; c < clusterCount; ++c)
+	{
+		double center[3] = {0, 0, 0}, normal[3] = {0, 0, 0}, area = 0;
+		for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; ++t)
+		{
+			float tc[3], tn[3];
+			triangleGeometry(t, tc, tn);
+			double a = std::sqrt(tn[0] * tn[0] + tn[1] * tn[1] + tn[2] * tn[2]);
+			for (int k = 0; k < 3; ++k)
+				center[k] += tc[k] * a, normal[k] += tn[k];
+			area += a;
+		}
+		double len = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (area <= 0 || len <= 0)
+			continue;
+		double dot = 0;
+		for (int k = 0; k < 3; ++k)
+			dot += (center[k] / area - meshCenter[k]) * normal[k] / len;
+		keys[c] = (float)dot;
+	}
+
+	std::vector<size_t> order(clusterCount);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+					 { return keys[a] > keys[b]; });
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (size_t c : order)
+		output.insert(output.end(), indices.begin() + 3 * clusterStart[c], indices.begin() + 3 * clusterStart[c + 1]);
+	indices.swap(output);
+}
+
+// Renumber the vertices in the order the index buffer first uses them, so
+// vertex fetches walk the buffer forwards. Unused vertices are dropped.
+inline void optimizeVertexFetch(IndexedMesh &mesh)
+{
+	std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (uint32_t &index : mesh.indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = (uint32_t)vertices.size();
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh.vertices.swap(vertices);
+}
+
+// Full optimization of a welded mesh: triangle order for the vertex cache,
+// optionally clustered for less overdraw, then vertex order for fetching.
+// Triangles are only reordered within their group. Each group is optimized
+// on a compact copy of the vertices it uses, so that many small groups do
+// not each pay for the whole vertex buffer.
+inline void optimizeMesh(IndexedMesh &mesh, bool overdraw)
+{
+	std::vector<uint32_t> local(mesh.vertices.size(), UINT32_MAX), used, range;
+	std::vector<Vertex> vertices;
+	for (const MeshGroup &g : mesh.groups)
+	{
+		uint32_t *indices = &mesh.indices[g.firstIndex];
+		used.clear();
+		range.resize(g.indexCount);
+		for (uint32_t i = 0; i < g.indexCount; ++i)
+		{
+			uint32_t &v = local[indices[i]];
+			if (v == UINT32_MAX)
+			{
+				v = (uint32_t)used.size();
+				used.push_back(indices[i]);
+			}
+			range[i] = v;
+		}
+
+		optimizeVertexCache(range, used.size());
+		if (overdraw)
+		{
+			vertices.clear();
+			for (uint32_t v : used)
+				vertices.push_back(mesh.vertices[v]);
+			optimizeOverdraw(range, vertices);
+		}
+
+		for (uint32_t i = 0; i < g.indexCount; ++i)
+			indices[i] = used[range[i]];
+		for (uint32_t v : used)
+			local[v] = UINT32_MAX;
+	}
+	optimizeVertexFetch(mesh);
+}
@@ -0,0 +1,688 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "mesh_buffers.h"
+#include "mtl_loader.h"
+#include "parallel.h"
+
+// Column-major 4x4 matrix with the operations of the GL matrix stack, so the
+// CPU renderer can place the model without a GL context
+struct SoftwareMatrix
+{
+	float m[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+
+	// this = this * o, as glMultMatrixf
+	void multiply(const float o[16])
+	{
+		float r[16];
+		for (int col = 0; col < 4; ++col)
+			for (int row = 0; row < 4; ++row)
+				r[4 * col + row] = m[row] * o[4 * col] + m[4 + row] * o[4 * col + 1] + m[8 + row] * o[4 * col + 2] +
+								   m[12 + row] * o[4 * col + 3];
+		std::copy(r, r + 16, m);
+	}
+
+	void translate(float x, float y, float z)
+	{
+		const float t[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, x, y, z, 1};
+		multiply(t);
+	}
+
+	void scale(float x, float y, float z)
+	{
+		const float s[16] = {x, 0, 0, 0, 0, y, 0, 0, 0, 0, z, 0, 0, 0, 0, 1};
+		multiply(s);
+	}
+
+	// `degrees` around the unit axis (x, y, z), as glRotatef
+	void rotate(float degrees, float x, float y, float z)
+	{
+		float a = degrees * (float)M_PI / 180.0f, c = cosf(a), s = sinf(a), t = 1.0f - c;
+		const float r[16] = {t * x * x + c, t * x * y + s * z, t * x * z - s * y, 0,
+							 t * x * y - s * z, t * y * y + c, t * y * z + s * x, 0,
+							 t * x * z + s * y, t * y * z - s * x, t * z * z + c, 0,
+							 0, 0, 0, 1};
+		multiply(r);
+	}
+
+	// The projection of gluPerspective, `fovy` in degrees
+	static SoftwareMatrix perspective(double fovy, double aspect, double zNear, double zFar)
+	{
+		SoftwareMatrix p;
+		double f = 1.0 / tan(fovy * M_PI / 360.0);
+		std::fill(p.m, p.m + 16, 0.0f);
+		p.m[0] = (float)(f / aspect);
+		p.m[5] = (float)f;
+		p.m[10] = (float)((zFar + zNear) / (zNear - zFar));
+		p.m[11] = -1.0f;
+		p.m[14] = (float)(2 * zFar * zNear / (zNear - zFar));
+		return p;
+	}
+};
+
+// Fixed-function light, in eye space (position w = 0 for a directional light)
+struct SoftwareLight
+{
+	float position[4];
+	float ambient[4], diffuse[4], specular[4];
+};
+
+// RGBA copy of a texture's base level, sampled bilinearly with wrap-around
+// (GL_LINEAR and GL_REPEAT)
+class SoftwareTexture
+{
+public:
+	bool empty() const { return rgba.empty(); }
+
+	// Copy rows of B, G, R(, A) texels, the bottom row first as GL uploads them
+	void assign(const unsigned char *bottomRow, ptrdiff_t rowStep, int w, int h, int bytesPerPixel)
+	{
+		width = w;
+		height = h;
+		rgba.resize((size_t)w * h * 4);
+		for (int y = 0; y < h; ++y)
+		{
+			const unsigned char *in = bottomRow + y * rowStep;
+			unsigned char *out = &rgba[(size_t)y * w * 4];
+			for (int x = 0; x < w; ++x, in += bytesPerPixel, out += 4)
+			{
+				out[0] = in[2];
+				out[1] = in[1];
+				out[2] = in[0];
+				out[3] = bytesPerPixel == 4 ? in[3] : 255;
+			}
+		}
+	}
+
+	void clear()
+	{
+		rgba.clear();
+		width = height = 0;
+	}
+
+	// Colour at (s, t), t = 0 being the bottom row, each channel in [0, 1]
+	void sample(float s, float t, float out[4]) const
+	{
+		float u = (s - floorf(s)) * width - 0.5f, v = (t - floorf(t)) * height - 0.5f;
+		float fu = floorf(u), fv = floorf(v);
+		float wu = u - fu, wv = v - fv;
+		int x0 = (int)fu, y0 = (int)fv;
+		int x1 = x0 + 1 >= width ? 0 : x0 + 1, y1 = y0 + 1 >= height ? 0 : y0 + 1;
+		x0 = x0 < 0 ? width - 1 : x0;
+		y0 = y0 < 0 ? height - 1 : y0;
+		const unsigned char *a = &rgba[((size_t)y0 * width + x0) * 4], *b = &rgba[((size_t)y0 * width + x1) * 4];
+		const unsigned char *c = &rgba[((size_t)y1 * width + x0) * 4], *d = &rgba[((size_t)y1 * width + x1) * 4];
+		for (int k = 0; k < 4; ++k)
+		{
+			float bottom = a[k] + (b[k] - a[k]) * wu, top = c[k] + (d[k] - c[k]) * wu;
+			out[k] = (bottom + (top - bottom) * wv) * (1.0f / 255.0f);
+		}
+	}
+
+private:
+	int width = 0, height = 0;
+	std::vector<unsigned char> rgba; // Bottom row first
+};
+
+// Range of indices drawn with one material
+struct SoftwareDraw
+{
+	const uint32_t *indices;
+	size_t indexCount;
+	const Material *material;
+};
+
+// CPU renderer for meshes, for hosts without a usable GL driver. It draws what
+// the fixed-function path draws: lighting is computed per vertex as GL does it
+// (two-sided, infinite viewer), the colours are interpolated with perspective
+// correction and modulated by the texture, with a depth test, and translucent
+// materials blend without writing depth.
+//
+// Work is split three ways on the thread pool: vertices are shaded in
+// batches, triangles are clipped, set up and sorted into the screen tiles
+// they touch in batches, and every tile is rasterized as its own task
+// against its own depth buffer. Tiles take their triangles batch after batch,
+// so the draw order is kept. The edge functions of four pixels are evaluated
+// at once with SSE2.
+class SoftwareRenderer
+{
+public:
+	static const int tileSize = 64;
+	static const size_t batchVertices = 16384;	 // Vertices per shading task
+	static constexpr size_t batchTriangles = 4096;	 // Triangles per setup task
+	static constexpr size_t batchesInFlight = 32;	 // Set up before the tiles rasterize them
+	static const int maxLights = 8;
+
+	void resize(int w, int h)
+	{
+		width = std::max(w, 1);
+		height = std::max(h, 1);
+		tilesX = (width + tileSize - 1) / tileSize;
+		tilesY = (height + tileSize - 1) / tileSize;
+		color.assign((size_t)tilesX * tilesY * tileSize * tileSize, 0);
+		depth.assign(color.size(), 1.0f);
+		for (Batch &batch : batches)
+			batch.bins.assign((size_t)tilesX * tilesY, {});
+	}
+
+	int imageWidth() const { return width; }
+	int imageHeight() const { return height; }
+	size_t rasterizedTriangles() const { return rasterized; } // Of the last draw, after clipping and culling
+
+	// Fill the colour buffer with `r, g, b` and the depth buffer with the far plane
+	void clear(unsigned char r, unsigned char g, unsigned char b)
+	{
+		std::fill(color.begin(), color.end(), (uint32_t)r | (uint32_t)g << 8 | (uint32_t)b << 16 | 0xff000000u);
+		std::fill(depth.begin(), depth.end(), 1.0f);
+	}
+
+	// Lights of the next draws, and the global ambient light (GL_LIGHT_MODEL_AMBIENT)
+	void setLights(const std::vector<SoftwareLight> &list, const float globalAmbient[4])
+	{
+		lights.assign(list.begin(), list.begin() + std::min<size_t>(list.size(), maxLights));
+		std::copy(globalAmbient, globalAmbient + 4, ambient);
+	}
+
+	// Texture modulating the next draws; nullptr draws them untextured
+	void setTexture(const SoftwareTexture *t) { texture = t && !t->empty() ? t : nullptr; }
+
+	// Baked ambient occlusion of each vertex (0 to 1) darkening the next
+	// draws, as 1 - occlusion; nullptr draws them without
+	void setOcclusion(const float *perVertex) { occlusion = perVertex; }
+
+	// Draw the triangles of `draws`, in order, with vertices placed by
+	// `modelView` and `projection` (column-major, as glLoadMatrixf)
+	void draw(const Vertex *vertices, size_t vertexCount, const std::vector<SoftwareDraw> &draws, const float modelView[16],
+			  const float projection[16], ThreadPool &pool)
+	{
+		rasterized = 0;
+		shadeVertices(vertices, vertexCount, draws, modelView, projection, pool);
+
+		// Batches of consecutive triangles of one draw, a window of them at a time
+		std::vector<BatchRange> ranges;
+		for (const SoftwareDraw &d : draws)
+			for (size_t first = 0; first < d.indexCount / 3; first += batchTriangles)
+				ranges.push_back({&d, first, std::min(batchTriangles, d.indexCount / 3 - first)});
+		if (batches.size() < batchesInFlight)
+		{
+			batches.resize(batchesInFlight);
+			for (Batch &batch : batches)
+				batch.bins.assign((size_t)tilesX * tilesY, {});
+		}
+
+		for (size_t start = 0; start < ranges.size(); start += batchesInFlight)
+		{
+			size_t count = std::min(batchesInFlight, ranges.size() - start);
+			pool.parallelFor(count, [&](size_t i)
+							 { setupBatch(vertices, ranges[start + i], batches[i]); });
+			pool.parallelFor((size_t)tilesX * tilesY, [&](size_t tile)
+							 {
+								 for (size_t i = 0; i < count; ++i)
+								 {
+									 Batch &batch = batches[i];
+									 for (uint32_t t : batch.bins[tile])
+										 rasterize(batch.triangles[t], (int)tile);
+									 batch.bins[tile].clear();
+								 } });
+			for (size_t i = 0; i < count; ++i)
+				rasterized += batches[i].triangles.size();
+		}
+	}
+
+	// Colour buffer as packed R, G, B rows, the bottom row first (the row
+	// order of glDrawPixels) unless `topDown`
+	void resolve(std::vector<unsigned char> &rgb, bool topDown = false) const
+	{
+		rgb.resize((size_t)width * height * 3);
+		for (int y = 0; y < height; ++y)
+		{
+			unsigned char *out = &rgb[(size_t)(topDown ? height - 1 - y : y) * width * 3];
+			for (int x = 0; x < width; ++x, out += 3)
+			{
+				uint32_t c = color[pixelIndex(x, y)];
+				out[0] = (unsigned char)c;
+				out[1] = (unsigned char)(c >> 8);
+				out[2] = (unsigned char)(c >> 16);
+			}
+		}
+	}
+
+	// Write the colour buffer as a binary PPM; false if the file cannot be written
+	bool writePpm(const std::string &path) const
+	{
+		std::vector<unsigned char> rgb;
+		resolve(rgb, true);
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file)
+			return false;
+		fprintf(file, "P6\n%d %d\n255\n", width, height);
+		bool ok = fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+		return fclose(file) == 0 && ok;
+	}
+
+private:
+	// A vertex after shading: clip-space position, its colour on either side
+	// with the material it was shaded with, and the light terms to shade it
+	// with another material
+	struct ShadedVertex
+	{
+		float clip[4];
+		float front[4], back[4];
+		const Material *material; // nullptr = not used by the draws
+	};
+
+	// Triangle ready to rasterize, in window coordinates (y up, as GL)
+	struct ScreenTriangle
+	{
+		// Edge function i is positive inside and zero on the edge opposite
+		// corner i; a pixel exactly on edge i is inside if bit i of `onEdge`
+		// is set (which holds for one of two triangles sharing the edge)
+		float a[3], b[3], c[3];
+		int onEdge;
+		float inverseArea; // Of the edge function of corner 0 at that corner
+		int x0, y0, x1, y1; // Pixel bounds, inclusive and clamped to the screen
+		float z[3];			// Window depth in [0, 1]
+		float w[3];			// 1 / clip w
+		float color[3][4];
+		float texcoord[3][2];
+		bool blend;
+	};
+
+	struct BatchRange
+	{
+		const SoftwareDraw *draw;
+		size_t firstTriangle, triangleCount;
+	};
+
+	struct Batch
+	{
+		std::vector<ScreenTriangle> triangles;
+		std::vector<std::vector<uint32_t>> bins; // Triangles touching each tile, in order
+	};
+
+	// Corner of a triangle being clipped: its position and weights of the
+	// original three corners
+	struct ClipVertex
+	{
+		float clip[4];
+		float weight[3];
+	};
+
+	int width = 0, height = 0, tilesX = 0, tilesY = 0;
+	std::vector<uint32_t> color; // R, G, B, A bytes; tile after tile, rows of each tile together
+	std::vector<float> depth;
+	std::vector<SoftwareLight> lights;
+	float ambient[4] = {0.2f, 0.2f, 0.2f, 1.0f};
+	const SoftwareTexture *texture = nullptr;
+	const float *occlusion = nullptr;
+	std::vector<ShadedVertex> shaded;
+	std::vector<float> lightTerms; // N.L then N.H per light, per vertex
+	std::vector<Batch> batches;
+	size_t rasterized = 0;
+
+	size_t pixelIndex(int x, int y) const
+	{
+		size_t tile = (size_t)(y / tileSize) * tilesX + x / tileSize;
+		return tile * tileSize * tileSize + (y % tileSize) * tileSize + x % tileSize;
+	}
+
+	// GL's lighting equation for one side (+1 front, -1 back) of a vertex with
+	// the light terms `terms`, clamped to [0, 1]
+	void lightVertex(const Material &m, const float *terms, float side, float out[4]) const
+	{
+		const int n = (int)lights.size();
+		for (int k = 0; k < 3; ++k)
+			out[k] = ambient[k] * m.ambient[k];
+		for (int l = 0; l < n; ++l)
+		{
+			const SoftwareLight &light = lights[l];
+			float diffuse = side * terms[l], specular = side * terms[n + l];
+			for (int k = 0; k < 3; ++k)
+				out[k] += light.ambient[k] * m.ambient[k];
+			if (diffuse <= 0.0f)
+				continue;
+			float highlight = specular > 0.0f ? powf(specular, m.shininess) : 0.0f;
+			for (int k = 0; k < 3; ++k)
+				out[k] += diffuse * light.diffuse[k] * m.diffuse[k] + highlight * light.specular[k] * m.specular[k];
+		}
+		for (int k = 0; k < 3; ++k)
+			out[k] = std::min(std::max(out[k], 0.0f), 1.0f);
+		out[3] = m.diffuse[3];
+	}
+
+	// Transform and light every vertex the draws use, with the material of
+	// the first draw that uses it
+	void shadeVertices(const Vertex *vertices, size_t vertexCount, const std::vector<SoftwareDraw> &draws,
+					   const float modelView[16], const float projection[16], ThreadPool &pool)
+	{
+		shaded.resize(vertexCount);
+		for (ShadedVertex &v : shaded)
+			v.material = nullptr;
+		for (const SoftwareDraw &d : draws)
+			for (size_t i = 0; i < d.indexCount; ++i)
+				if (d.indices[i] < vertexCount && !shaded[d.indices[i]].material)
+					shaded[d.indices[i]].material = d.material;
+
+		const int n = (int)lights.size();
+		lightTerms.resize(vertexCount * 2 * n);
+		const float *mv = modelView, *p = projection;
+		pool.parallelFor((vertexCount + batchVertices - 1) / batchVertices, [&](size_t batch)
+						 {
+							 size_t end = std::min(vertexCount, (batch + 1) * batchVertices);
+							 for (size_t i = batch * batchVertices; i < end; ++i)
+							 {
+								 ShadedVertex &out = shaded[i];
+								 if (!out.material)
+									 continue;
+								 const float *pos = vertices[i].position, *nrm = vertices[i].normal;
+								 float eye[4], normal[3];
+								 for (int r = 0; r < 4; ++r)
+									 eye[r] = mv[r] * pos[0] + mv[4 + r] * pos[1] + mv[8 + r] * pos[2] + mv[12 + r];
+								 for (int r = 0; r < 3; ++r)
+									 normal[r] = mv[r] * nrm[0] + mv[4 + r] * nrm[1] + mv[8 + r] * nrm[2];
+								 for (int r = 0; r < 4; ++r)
+									 out.clip[r] = p[r] * eye[0] + p[4 + r] * eye[1] + p[8 + r] * eye[2] + p[12 + r] * eye[3];
+								 normalize(normal);
+
+								 float *terms = lightTerms.data() + i * 2 * n;
+								 for (int l = 0; l < n; ++l)
+								 {
+									 const float *lp = lights[l].position;
+									 float toLight[3], half[3];
+									 for (int k = 0; k < 3; ++k)
+										 toLight[k] = lp[3] != 0.0f ? lp[k] / lp[3] - eye[k] / eye[3] : lp[k];
+									 normalize(toLight);
+									 for (int k = 0; k < 3; ++k)
+										 half[k] = toLight[k] + (k == 2 ? 1.0f : 0.0f); // Viewer at infinity along +Z
+									 normalize(half);
+									 terms[l] = dot(normal, toLight);
+									 terms[n + l] = dot(normal, half);
+								 }
+								 lightVertex(*out.material, terms, 1.0f, out.front);
+								 lightVertex(*out.material, terms, -1.0f, out.back);
+							 } });
+	}
+
+	static float dot(const float a[3], const float b[3]) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+	static void normalize(float v[3])
+	{
+		float length = sqrtf(dot(v, v));
+		if (length > 0.0f)
+			for (int k = 0; k < 3; ++k)
+				v[k] /= length;
+	}
+
+	// Edge function of the line through p and q, positive on the left of p->q.
+	// It is computed from the two points in a fixed order and negated as a
+	// whole, so the two triangles sharing an edge get exactly opposite values
+	// and no pixel on it is drawn twice or missed. `flipped` tells which
+	// order was used.
+	static void edgeFunction(const float p[2], const float q[2], float &a, float &b, float &c, bool &flipped)
+	{
+		flipped = q[1] < p[1] || (q[1] == p[1] && q[0] < p[0]);
+		const float *u = flipped ? q : p, *v = flipped ? p : q;
+		a = u[1] - v[1];
+		b = v[0] - u[0];
+		c = u[0] * v[1] - u[1] * v[0];
+		if (flipped)
+		{
+			a = -a;
+			b = -b;
+			c = -c;
+		}
+	}
+
+	// Clip, light and set up the triangles of `range` and sort them into tiles
+	void setupBatch(const Vertex *vertices, const BatchRange &range, Batch &batch)
+	{
+		batch.triangles.clear();
+		const SoftwareDraw &d = *range.draw;
+		const Material &material = *d.material;
+		const int n = (int)lights.size();
+		for (size_t t = range.firstTriangle; t < range.firstTriangle + range.triangleCount; ++t)
+		{
+			const uint32_t *corner = &d.indices[3 * t];
+			if (corner[0] >= shaded.size() || corner[1] >= shaded.size() || corner[2] >= shaded.size())
+				continue;
+			const ShadedVertex *v[3] = {&shaded[corner[0]], &shaded[corner[1]], &shaded[corner[2]]};
+
+			// Outside one plane of the view volume: nothing to draw
+			bool outside = false;
+			for (int axis = 0; axis < 3 && !outside; ++axis)
+				for (float sign = -1.0f; sign <= 1.0f && !outside; sign += 2.0f)
+					outside = sign * v[0]->clip[axis] > v[0]->clip[3] && sign * v[1]->clip[axis] > v[1]->clip[3] &&
+							  sign * v[2]->clip[axis] > v[2]->clip[3];
+			if (outside)
+				continue;
+
+			// Clip against the near plane (z > -w): up to four corners
+			ClipVertex in[3], out[4];
+			int count = 0;
+			for (int i = 0; i < 3; ++i)
+			{
+				std::copy(v[i]->clip, v[i]->clip + 4, in[i].clip);
+				for (int k = 0; k < 3; ++k)
+					in[i].weight[k] = i == k ? 1.0f : 0.0f;
+			}
+			for (int i = 0; i < 3; ++i)
+			{
+				const ClipVertex &a = in[i], &b = in[(i + 1) % 3];
+				float da = a.clip[2] + a.clip[3], db = b.clip[2] + b.clip[3];
+				if (da >= 0.0f)
+					out[count++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+				{
+					float s = da / (da - db);
+					ClipVertex &m = out[count++];
+					for (int k = 0; k < 4; ++k)
+						m.clip[k] = a.clip[k] + s * (b.clip[k] - a.clip[k]);
+					for (int k = 0; k < 3; ++k)
+						m.weight[k] = a.weight[k] + s * (b.weight[k] - a.weight[k]);
+				}
+			}
+			if (count < 3)
+				continue;
+
+			float window[4][3], inverseW[4];
+			for (int i = 0; i < count; ++i)
+			{
+				inverseW[i] = 1.0f / out[i].clip[3];
+				window[i][0] = (out[i].clip[0] * inverseW[i] + 1.0f) * 0.5f * width;
+				window[i][1] = (out[i].clip[1] * inverseW[i] + 1.0f) * 0.5f * height;
+				window[i][2] = (out[i].clip[2] * inverseW[i] + 1.0f) * 0.5f;
+			}
+			// Counter-clockwise on screen is the front (the clipped polygon is
+			// convex, so its first triangle tells)
+			float area = (window[1][0] - window[0][0]) * (window[2][1] - window[0][1]) -
+						 (window[2][0] - window[0][0]) * (window[1][1] - window[0][1]);
+			if (area == 0.0f)
+				continue;
+			bool front = area > 0.0f;
+
+			// Colours of the original corners on the visible side, lit again
+			// if the vertex was shaded with another material
+			float cornerColor[3][4];
+			for (int i = 0; i < 3; ++i)
+			{
+				if (v[i]->material == &material)
+					std::copy(front ? v[i]->front : v[i]->back, (front ? v[i]->front : v[i]->back) + 4, cornerColor[i]);
+				else
+					lightVertex(material, lightTerms.data() + corner[i] * 2 * n, front ? 1.0f : -1.0f, cornerColor[i]);
+				if (occlusion)
+					for (int k = 0; k < 3; ++k)
+						cornerColor[i][k] *= 1.0f - occlusion[corner[i]];
+			}
+
+			for (int fan = 1; fan + 1 < count; ++fan)
+			{
+				int ids[3] = {0, fan, fan + 1};
+				ScreenTriangle tri;
+				float minX = width, minY = height, maxX = 0, maxY = 0;
+				for (int i = 0; i < 3; ++i)
+				{
+					const ClipVertex &cv = out[ids[i]];
+					tri.z[i] = window[ids[i]][2];
+					tri.w[i] = inverseW[ids[i]];
+					for (int k = 0; k < 4; ++k)
+						tri.color[i][k] = cv.weight[0] * cornerColor[0][k] + cv.weight[1] * cornerColor[1][k] +
+										  cv.weight[2] * cornerColor[2][k];
+					for (int k = 0; k < 2; ++k)
+						tri.texcoord[i][k] = cv.weight[0] * vertices[corner[0]].texcoord[k] +
+											 cv.weight[1] * vertices[corner[1]].texcoord[k] +
+											 cv.weight[2] * vertices[corner[2]].texcoord[k];
+					minX = std::min(minX, window[ids[i]][0]);
+					maxX = std::max(maxX, window[ids[i]][0]);
+					minY = std::min(minY, window[ids[i]][1]);
+					maxY = std::max(maxY, window[ids[i]][1]);
+				}
+				// Pixels whose centre (x + 0.5, y + 0.5) may be inside
+				tri.x0 = (int)std::max(0.0f, ceilf(minX - 0.5f));
+				tri.y0 = (int)std::max(0.0f, ceilf(minY - 0.5f));
+				tri.x1 = (int)std::min((float)width - 1, floorf(maxX - 0.5f));
+				tri.y1 = (int)std::min((float)height - 1, floorf(maxY - 0.5f));
+				if (tri.x0 > tri.x1 || tri.y0 > tri.y1)
+					continue;
+
+				tri.onEdge = 0;
+				for (int i = 0; i < 3; ++i)
+				{
+					bool flipped;
+					edgeFunction(window[ids[(i + 1) % 3]], window[ids[(i + 2) % 3]], tri.a[i], tri.b[i], tri.c[i], flipped);
+					// Clockwise triangles are inside on the right of their edges
+					if (!front)
+					{
+						tri.a[i] = -tri.a[i];
+						tri.b[i] = -tri.b[i];
+						tri.c[i] = -tri.c[i];
+					}
+					if (flipped == !front)
+						tri.onEdge |= 1 << i;
+				}
+				float full = tri.a[0] * window[0][0] + (tri.b[0] * window[0][1] + tri.c[0]);
+				if (!(full > 0.0f))
+					continue;
+				tri.inverseArea = 1.0f / full;
+				tri.blend = material.translucent();
+
+				uint32_t index = (uint32_t)batch.triangles.size();
+				batch.triangles.push_back(tri);
+				for (int ty = tri.y0 / tileSize; ty <= tri.y1 / tileSize; ++ty)
+					for (int tx = tri.x0 / tileSize; tx <= tri.x1 / tileSize; ++tx)
+						batch.bins[(size_t)ty * tilesX + tx].push_back(index);
+			}
+		}
+	}
+
+	// Depth test and shade pixel (x, y) of its tile at `pixel`, with the
+	// edge function values `e` of the triangle there
+	void shade(const ScreenTriangle &tri, size_t pixel, const float e[3])
+	{
+		float l[3] = {e[0] * tri.inverseArea, e[1] * tri.inverseArea, e[2] * tri.inverseArea};
+		// Relative to the first corner: window depths crowd near 1, where the
+		// float steps are as coarse as the differences being compared
+		float z = tri.z[0] + l[1] * (tri.z[1] - tri.z[0]) + l[2] * (tri.z[2] - tri.z[0]);
+		if (z < 0.0f || z > 1.0f || z >= depth[pixel])
+			return;
+
+		// Perspective-correct weights of the corners
+		float pw[3] = {l[0] * tri.w[0], l[1] * tri.w[1], l[2] * tri.w[2]};
+		float scale = 1.0f / (pw[0] + pw[1] + pw[2]);
+		float rgba[4];
+		for (int k = 0; k < 4; ++k)
+			rgba[k] = (pw[0] * tri.color[0][k] + pw[1] * tri.color[1][k] + pw[2] * tri.color[2][k]) * scale;
+		if (texture)
+		{
+			float s = (pw[0] * tri.texcoord[0][0] + pw[1] * tri.texcoord[1][0] + pw[2] * tri.texcoord[2][0]) * scale;
+			float t = (pw[0] * tri.texcoord[0][1] + pw[1] * tri.texcoord[1][1] + pw[2] * tri.texcoord[2][1]) * scale;
+			float texel[4];
+			texture->sample(s, t, texel);
+			for (int k = 0; k < 4; ++k)
+				rgba[k] *= texel[k];
+		}
+
+		uint32_t &dst = color[pixel];
+		uint32_t packed = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			float value = rgba[k];
+			if (tri.blend)
+				value = value * rgba[3] + ((dst >> (8 * k)) & 0xff) * (1.0f / 255.0f) * (1.0f - rgba[3]);
+			packed |= (uint32_t)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f) << (8 * k);
+		}
+		dst = packed | 0xff000000u;
+		if (!tri.blend)
+			depth[pixel] = z;
+	}
+
+	// Draw the pixels of `tri` inside `tile`
+	void rasterize(const ScreenTriangle &tri, int tile)
+	{
+		int left = (tile % tilesX) * tileSize, bottom = (tile / tilesX) * tileSize;
+		int x0 = std::max(tri.x0, left), x1 = std::min(tri.x1, left + tileSize - 1);
+		int y0 = std::max(tri.y0, bottom), y1 = std::min(tri.y1, bottom + tileSize - 1);
+		size_t tileBase = (size_t)tile * tileSize * tileSize;
+		for (int y = y0; y <= y1; ++y)
+		{
+			float py = y + 0.5f;
+			// Every pixel evaluates a * x + (b * y + c), in this order, so the
+			// SIMD and scalar loops give the same bits
+			float row[3] = {tri.b[0] * py + tri.c[0], tri.b[1] * py + tri.c[1], tri.b[2] * py + tri.c[2]};
+			size_t rowBase = tileBase + (size_t)(y - bottom) * tileSize - left;
+			int x = x0;
+#ifdef __SSE2__
+			const __m128 zero = _mm_setzero_ps(), steps = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			__m128 a[3], r[3], onEdge[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				a[i] = _mm_set1_ps(tri.a[i]);
+				r[i] = _mm_set1_ps(row[i]);
+				onEdge[i] = _mm_castsi128_ps(_mm_set1_epi32(tri.onEdge >> i & 1 ? -1 : 0));
+			}
+			for (; x + 3 <= x1; x += 4)
+			{
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), steps);
+				__m128 e[3], inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (int i = 0; i < 3; ++i)
+				{
+					e[i] = _mm_add_ps(_mm_mul_ps(a[i], px), r[i]);
+					__m128 edge = _mm_or_ps(_mm_cmpgt_ps(e[i], zero), _mm_and_ps(_mm_cmpeq_ps(e[i], zero), onEdge[i]));
+					inside = _mm_and_ps(inside, edge);
+				}
+				int mask = _mm_movemask_ps(inside);
+				if (!mask)
+					continue;
+				alignas(16) float values[3][4];
+				for (int i = 0; i < 3; ++i)
+					_mm_store_ps(values[i], e[i]);
+				for (int lane = 0; lane < 4; ++lane)
+					if (mask >> lane & 1)
+					{
+						const float ev[3] = {values[0][lane], values[1][lane], values[2][lane]};
+						shade(tri, rowBase + x + lane, ev);
+					}
+			}
+#endif
+			for (; x <= x1; ++x)
+			{
+				float px = x + 0.5f, e[3];
+				bool inside = true;
+				for (int i = 0; i < 3; ++i)
+				{
+					e[i] = tri.a[i] * px + row[i];
+					inside = inside && (e[i] > 0.0f || (e[i] == 0.0f && (tri.onEdge >> i & 1)));
+				}
+				if (inside)
+					shade(tri, rowBase + x, e);
+			}
+		}
+	}
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Each side only writes its own index; the release store of
+// an index and the acquire load on the other side hand the slot over.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	// Producer: move `value` in, unless the queue is full (then it is left untouched)
+	bool tryPush(T &&value)
+	{
+		size_t tail = tailIndex.load(std::memory_order_relaxed);
+		if (tail - headIndex.load(std::memory_order_acquire) == Capacity)
+			return false;
+		slots[tail & (Capacity - 1)] = std::move(value);
+		tailIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer: move the oldest value out, if there is one
+	bool tryPop(T &value)
+	{
+		size_t head = headIndex.load(std::memory_order_relaxed);
+		if (head == tailIndex.load(std::memory_order_acquire))
+			return false;
+		value = std::move(slots[head & (Capacity - 1)]);
+		slots[head & (Capacity - 1)] = T(); // Drop what the slot still owns
+		headIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T slots[Capacity];
+	alignas(64) std::atomic<size_t> headIndex{0}; // Next slot to pop, written by the consumer
+	alignas(64) std::atomic<size_t> tailIndex{0}; // Next slot to push, written by the producer
+};
+
+// Background thread running the load jobs of one kind of asset. Jobs run one
+// at a time; a request made while another one is still waiting replaces it.
+// Every request gets a generation number, which the job tags its results
+// with and can check to stop early once a newer request made it stale.
+class LoadWorker
+{
+public:
+	using Job = std::function<void(const LoadWorker &worker, const std::string &path, unsigned generation)>;
+
+	explicit LoadWorker(Job job) : job(std::move(job)) {}
+
+	~LoadWorker() { stop(); }
+
+	LoadWorker(const LoadWorker &) = delete;
+	LoadWorker &operator=(const LoadWorker &) = delete;
+
+	// Queue a load of `path` and return its generation. The thread is started
+	// on the first request.
+	unsigned request(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingPath = path;
+		hasPending = true;
+		unsigned requested = ++generation;
+		if (!thread.joinable() && !stopping)
+			thread = std::thread([this]
+								 { run(); });
+		wake.notify_one();
+		return requested;
+	}
+
+	// Generation of the latest request
+	unsigned latest() const { return generation.load(); }
+
+	// True once a newer request was made or the worker is stopping
+	bool stale(unsigned requested) const { return requested != generation.load() || stopping.load(); }
+
+	// Drop the waiting request and wait for the running job to return
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		if (thread.joinable())
+			thread.join();
+	}
+
+private:
+	Job job;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::string pendingPath;
+	bool hasPending = false;
+	std::atomic<bool> stopping{false};
+	std::atomic<unsigned> generation{0};
+
+	void run()
+	{
+		for (;;)
+		{
+			std::string path;
+			unsigned requested;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]
+						  { return stopping || hasPending; });
+				if (stopping)
+					return;
+				path = std::move(pendingPath);
+				hasPending = false;
+				requested = generation;
+			}
+			job(*this, path, requested);
+		}
+	}
+};
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <GL/freeglut.h>
+#include "parallel.h"
+
+// Block-compressed texture formats (S3TC), as uploaded with glCompressedTexImage2D
+enum BlockFormat : uint32_t
+{
+	FormatBc1, // DXT1: opaque RGB, 8 bytes per 4x4 block
+	FormatBc3  // DXT5: RGB plus alpha, 16 bytes per 4x4 block
+};
+
+inline GLenum blockGlFormat(BlockFormat format)
+{
+	return format == FormatBc1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+inline const char *blockFormatName(BlockFormat format) { return format == FormatBc1 ? "BC1" : "BC3"; }
+
+inline size_t blockBytes(BlockFormat format) { return format == FormatBc1 ? 8 : 16; }
+
+// Bytes of a `width` x `height` image in `format`; partial blocks at the
+// right and top edges take a whole block
+inline size_t compressedSize(int width, int height, BlockFormat format)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+namespace bc_detail
+{
+	const int batchBlockRows = 4; // Rows of blocks per parallel task
+
+	// 5- and 6-bit channels widened to 8 bits, as the decoder does
+	inline int expand5(int v) { return (v << 3) | (v >> 2); }
+	inline int expand6(int v) { return (v << 2) | (v >> 4); }
+
+	// Nearest RGB565 color of an 8-bit one
+	inline uint16_t quantize(const float rgb[3])
+	{
+		int r = std::min(31, std::max(0, (int)(rgb[0] * (31.0f / 255.0f) + 0.5f)));
+		int g = std::min(63, std::max(0, (int)(rgb[1] * (63.0f / 255.0f) + 0.5f)));
+		int b = std::min(31, std::max(0, (int)(rgb[2] * (31.0f / 255.0f) + 0.5f)));
+		return (uint16_t)(r << 11 | g << 5 | b);
+	}
+
+	// The four colors of a block in four-color mode: both endpoints, then the
+	// points at 1/3 and 2/3 of the way from the first to the second
+	inline void palette(uint16_t c0, uint16_t c1, int colors[4][3])
+	{
+		const uint16_t ends[2] = {c0, c1};
+		for (int e = 0; e < 2; ++e)
+		{
+			colors[e][0] = expand5(ends[e] >> 11);
+			colors[e][1] = expand6((ends[e] >> 5) & 63);
+			colors[e][2] = expand5(ends[e] & 31);
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			colors[2][k] = (2 * colors[0][k] + colors[1][k]) / 3;
+			colors[3][k] = (colors[0][k] + 2 * colors[1][k]) / 3;
+		}
+	}
+
+	// Nearest color of every pixel, 2 bits per pixel (pixel 0 in the lowest
+	// bits). Returns the sum of the squared errors.
+	inline int chooseIndices(const int pixels[16][3], uint16_t c0, uint16_t c1, uint32_t &indices)
+	{
+		int colors[4][3];
+		palette(c0, c1, colors);
+		int error = 0;
+		indices = 0;
+		for (int i = 0; i < 16; ++i)
+		{
+			int best = 0, bestDistance = INT32_MAX;
+			for (int c = 0; c < 4; ++c)
+			{
+				int dr = pixels[i][0] - colors[c][0], dg = pixels[i][1] - colors[c][1], db = pixels[i][2] - colors[c][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < bestDistance)
+					best = c, bestDistance = distance;
+			}
+			indices |= (uint32_t)best << (2 * i);
+			error += bestDistance;
+		}
+		return error;
+	}
+
+	// Least-squares endpoints for the pixels given the colors they picked
+	// (the endpoint weights of the four colors are 1, 0, 2/3 and 1/3). False
+	// if every pixel picked the same weight, which leaves them undetermined.
+	inline bool refine(const int pixels[16][3], uint32_t indices, uint16_t &c0, uint16_t &c1)
+	{
+		const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+		float aa = 0, ab = 0, bb = 0, ax[3] = {}, bx[3] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			float w = weights[(indices >> (2 * i)) & 3], v = 1.0f - w;
+			aa += w * w, ab += w * v, bb += v * v;
+			for (int k = 0; k < 3; ++k)
+				ax[k] += w * pixels[i][k], bx[k] += v * pixels[i][k];
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) < 1e-4f)
+			return false;
+		float e0[3], e1[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			e0[k] = (bb * ax[k] - ab * bx[k]) / det;
+			e1[k] = (aa * bx[k] - ab * ax[k]) / det;
+		}
+		c0 = quantize(e0);
+		c1 = quantize(e1);
+		return true;
+	}
+
+	// Endpoints of one channel whose 1/3 point is closest to each 8-bit value,
+	// for blocks of a single color
+	struct SolidTable
+	{
+		uint8_t ends[256][2];
+
+		SolidTable(int bits)
+		{
+			int levels = 1 << bits;
+			for (int v = 0; v < 256; ++v)
+			{
+				int bestError = INT32_MAX;
+				for (int a = 0; a < levels; ++a)
+					for (int b = 0; b < levels; ++b)
+					{
+						int ea = bits == 5 ? expand5(a) : expand6(a), eb = bits == 5 ? expand5(b) : expand6(b);
+						int error = std::abs((2 * ea + eb) / 3 - v);
+						if (error < bestError)
+							bestError = error, ends[v][0] = (uint8_t)a, ends[v][1] = (uint8_t)b;
+					}
+			}
+		}
+	};
+
+	// BC1 block of 16 RGB pixels (rows of 4, bottom row first), always in
+	// four-color mode so it decodes the same inside BC3. The endpoints are the
+	// extreme pixels along the principal axis of the colors, then refitted to
+	// the colors the pixels picked while that lowers the error.
+	inline void encodeColorBlock(const int pixels[16][3], unsigned char *out)
+	{
+		uint16_t c0, c1;
+		uint32_t indices;
+		bool solid = true;
+		for (int i = 1; i < 16 && solid; ++i)
+			solid = pixels[i][0] == pixels[0][0] && pixels[i][1] == pixels[0][1] && pixels[i][2] == pixels[0][2];
+		if (solid)
+		{
+			// Every pixel at the 1/3 point of the closest pair of endpoints
+			static const SolidTable table5(5), table6(6);
+			const int *p = pixels[0];
+			c0 = (uint16_t)(table5.ends[p[0]][0] << 11 | table6.ends[p[1]][0] << 5 | table5.ends[p[2]][0]);
+			c1 = (uint16_t)(table5.ends[p[0]][1] << 11 | table6.ends[p[1]][1] << 5 | table5.ends[p[2]][1]);
+			indices = 0xAAAAAAAA;
+		}
+		else
+		{
+			float mean[3] = {}, low[3] = {255, 255, 255}, high[3] = {};
+			for (int i = 0; i < 16; ++i)
+				for (int k = 0; k < 3; ++k)
+				{
+					mean[k] += pixels[i][k] / 16.0f;
+					low[k] = std::min(low[k], (float)pixels[i][k]);
+					high[k] = std::max(high[k], (float)pixels[i][k]);
+				}
+			float cov[6] = {}; // rr, rg, rb, gg, gb, bb
+			for (int i = 0; i < 16; ++i)
+			{
+				float r = pixels[i][0] - mean[0], g = pixels[i][1] - mean[1], b = pixels[i][2] - mean[2];
+				cov[0] += r * r, cov[1] += r * g, cov[2] += r * b, cov[3] += g * g, cov[4] += g * b, cov[5] += b * b;
+			}
+
+			// Power iteration from the diagonal of the bounding box
+			float axis[3] = {high[0] - low[0], high[1] - low[1], high[2] - low[2]};
+			for (int it = 0; it < 4; ++it)
+			{
+				float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+				float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+				float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+				float scale = std::max(fabsf(x), std::max(fabsf(y), fabsf(z)));
+				if (scale < 1e-6f)
+					break;
+				axis[0] = x / scale, axis[1] = y / scale, axis[2] = z / scale;
+			}
+
+			int lo = 0, hi = 0;
+			float loDot = INFINITY, hiDot = -INFINITY;
+			for (int i = 0; i < 16; ++i)
+			{
+				float dot = pixels[i][0] * axis[0] + pixels[i][1] * axis[1] + pixels[i][2] * axis[2];
+				if (dot < loDot)
+					loDot = dot, lo = i;
+				if (dot > hiDot)
+					hiDot = dot, hi = i;
+			}
+			const float e0[3] = {(float)pixels[hi][0], (float)pixels[hi][1], (float)pixels[hi][2]};
+			const float e1[3] = {(float)pixels[lo][0], (float)pixels[lo][1], (float)pixels[lo][2]};
+			c0 = quantize(e0);
+			c1 = quantize(e1);
+			int error = chooseIndices(pixels, c0, c1, indices);
+
+			for (int pass = 0; pass < 2 && error > 0; ++pass)
+			{
+				uint16_t r0, r1;
+				uint32_t refined;
+				if (!refine(pixels, indices, r0, r1))
+					break;
+				int refinedError = chooseIndices(pixels, r0, r1, refined);
+				if (refinedError >= error)
+					break;
+				c0 = r0, c1 = r1, indices = refined, error = refinedError;
+			}
+		}
+
+		// Four-color mode needs c0 > c1: swapping the endpoints swaps colors 0
+		// with 1 and 2 with 3. With equal endpoints every color is c0.
+		if (c0 < c1)
+		{
+			std::swap(c0, c1);
+			indices ^= 0x55555555;
+		}
+		else if (c0 == c1)
+			indices = 0;
+		memcpy(out, &c0, 2);
+		memcpy(out + 2, &c1, 2);
+		memcpy(out + 4, &indices, 4);
+	}
+
+	// BC3 alpha block: the block's largest and smallest alpha and six values
+	// evenly between them, 3 bits per pixel
+	inline void encodeAlphaBlock(const int alpha[16], unsigned char *out)
+	{
+		int a0 = *std::max_element(alpha, alpha + 16), a1 = *std::min_element(alpha, alpha + 16);
+		int values[8] = {a0, a1};
+		for (int i = 1; i < 7; ++i)
+			values[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+		uint64_t indices = 0;
+		if (a0 != a1)
+			for (int i = 0; i < 16; ++i)
+			{
+				int best = 0;
+				for (int v = 1; v < 8; ++v)
+					if (std::abs(alpha[i] - values[v]) < std::abs(alpha[i] - values[best]))
+						best = v;
+				indices |= (uint64_t)best << (3 * i);
+			}
+		out[0] = (unsigned char)a0;
+		out[1] = (unsigned char)a1;
+		for (int b = 0; b < 6; ++b)
+			out[2 + b] = (unsigned char)(indices >> (8 * b));
+	}
+}
+
+// Compress a `width` x `height` image into `out` (compressedSize bytes):
+// rows of 4x4 blocks, starting with the block row of the bottom 4 pixel rows
+// as glCompressedTexImage2D expects. Pixels are B, G, R(, A) with
+// `bytesPerPixel` bytes and row y starts at bottom + y * stride, as in
+// buildMipChain. Blocks that cross the right or top edge repeat the last
+// column or row. The block rows are split into batches on `pool`.
+inline void compressImage(const unsigned char *bottom, ptrdiff_t stride, int width, int height, int bytesPerPixel,
+						  BlockFormat format, unsigned char *out, ThreadPool &pool = threadPool())
+{
+	int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	size_t bytes = blockBytes(format);
+	size_t batches = (blocksY + bc_detail::batchBlockRows - 1) / bc_detail::batchBlockRows;
+	pool.parallelFor(batches, [&](size_t batch)
+					 {
+						 int last = std::min(blocksY, (int)(batch + 1) * bc_detail::batchBlockRows);
+						 for (int by = (int)batch * bc_detail::batchBlockRows; by < last; ++by)
+							 for (int bx = 0; bx < blocksX; ++bx)
+							 {
+								 int pixels[16][3], alpha[16];
+								 for (int j = 0; j < 4; ++j)
+								 {
+									 const unsigned char *row = bottom + std::min(4 * by + j, height - 1) * stride;
+									 for (int i = 0; i < 4; ++i)
+									 {
+										 const unsigned char *p = row + std::min(4 * bx + i, width - 1) * bytesPerPixel;
+										 int *q = pixels[4 * j + i];
+										 q[0] = p[2], q[1] = p[1], q[2] = p[0];
+										 alpha[4 * j + i] = bytesPerPixel == 4 ? p[3] : 255;
+									 }
+								 }
+								 unsigned char *block = out + ((size_t)by * blocksX + bx) * bytes;
+								 if (format == FormatBc3)
+								 {
+									 bc_detail::encodeAlphaBlock(alpha, block);
+									 block += 8;
+								 }
+								 bc_detail::encodeColorBlock(pixels, block);
+							 } });
+}
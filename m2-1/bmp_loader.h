@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <GL/freeglut.h>
+#include "obj_loader.h" // MappedFile
+
+// A .bmp file mapped into memory. The header is checked when opening, and
+// the pixel rows stay in the mapping in the file's own layout: B, G, R(, A)
+// bytes, every row padded to 4 bytes, bottom row first unless the height is
+// negative. GL reads that layout directly, so uploading needs no copy or
+// byte swap. Only uncompressed 24- and 32-bit images are supported.
+class BmpImage
+{
+public:
+	int width() const { return sizeX; }
+	int height() const { return sizeY; }
+	int bytesPerPixel() const { return bitsPerPixel / 8; }
+	bool hasAlpha() const { return alpha; }
+	size_t size() const { return file.size; }
+
+	// First byte of the bottom row, and the distance from a row to the one above
+	const unsigned char *bottomRow() const { return topDown ? pixels + (sizeY - 1) * stride : pixels; }
+	ptrdiff_t rowStep() const { return topDown ? -(ptrdiff_t)stride : (ptrdiff_t)stride; }
+
+	GLenum internalFormat() const { return alpha ? GL_RGBA8 : GL_RGB8; }
+
+	// Map `path` and check its header. On failure `error` says why.
+	bool open(const std::string &path, std::string &error)
+	{
+		close();
+		if (!file.open(path))
+			return fail(error, "cannot open the file");
+		if (file.size < 54 || file.data[0] != 'B' || file.data[1] != 'M')
+			return fail(error, "not a BMP file");
+
+		uint32_t offset = read32(10), headerSize = read32(14), compression = read32(30);
+		int32_t w = (int32_t)read32(18), h = (int32_t)read32(22);
+		uint16_t planes = read16(26);
+		bitsPerPixel = read16(28);
+		if (headerSize < 40 || 14 + (size_t)headerSize > file.size)
+			return fail(error, "unsupported header (OS/2 or truncated)");
+		if (planes != 1 || (bitsPerPixel != 24 && bitsPerPixel != 32))
+			return fail(error, "only 24- and 32-bit images are supported");
+		if (w <= 0 || h == 0 || h == INT32_MIN || w > 32768 || std::abs(h) > 32768)
+			return fail(error, "invalid dimensions");
+
+		// BI_RGB, or BI_BITFIELDS with the masks of plain BGRA; the masks follow
+		// a 40-byte header and are part of the larger ones
+		const uint32_t biRgb = 0, biBitfields = 3;
+		alpha = false;
+		if (compression == biBitfields)
+		{
+			if (bitsPerPixel != 32 || file.size < 66 || read32(54) != 0x00FF0000 || read32(58) != 0x0000FF00 ||
+				read32(62) != 0x000000FF)
+				return fail(error, "unsupported channel masks");
+			alpha = headerSize >= 56 && file.size >= 70 && read32(66) == 0xFF000000;
+		}
+		else if (compression != biRgb)
+			return fail(error, "compressed images are not supported");
+
+		sizeX = w;
+		sizeY = std::abs(h);
+		topDown = h < 0;
+		stride = ((size_t)sizeX * bitsPerPixel / 8 + 3) & ~(size_t)3;
+		if (offset < 14 + headerSize || offset > file.size || stride * sizeY > file.size - offset)
+			return fail(error, "pixel data out of bounds");
+		pixels = (const unsigned char *)file.data + offset;
+		return true;
+	}
+
+	// Read one byte of every page of the pixels, so they are in memory before
+	// the upload (which then does not wait for the disk)
+	void touchPages() const
+	{
+		volatile unsigned char sink = 0;
+		for (size_t at = 0; at < stride * sizeY; at += 4096)
+			sink = sink + pixels[at];
+	}
+
+	void close()
+	{
+		file.close();
+		pixels = nullptr;
+		sizeX = sizeY = 0;
+	}
+
+	// glTexImage2D of the image into the bound GL_TEXTURE_2D, straight from the
+	// mapping: GL_BGR(A) matches the byte order and an unpack alignment of 4
+	// the row padding. A top-down image is uploaded a row at a time, flipped,
+	// since GL expects the bottom row first.
+	void texImage() const
+	{
+		GLenum format = bitsPerPixel == 32 ? GL_BGRA : GL_BGR;
+		GLenum internalFormat = this->internalFormat();
+		glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		if (!topDown)
+			glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, sizeX, sizeY, 0, format, GL_UNSIGNED_BYTE, pixels);
+		else
+		{
+			glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, sizeX, sizeY, 0, format, GL_UNSIGNED_BYTE, nullptr);
+			for (int row = 0; row < sizeY; ++row)
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, sizeY - 1 - row, sizeX, 1, format, GL_UNSIGNED_BYTE,
+								pixels + row * stride);
+		}
+		glPopClientAttrib();
+	}
+
+private:
+	MappedFile file;
+	const unsigned char *pixels = nullptr; // First row in the file, inside the mapping
+	int sizeX = 0, sizeY = 0;
+	int bitsPerPixel = 0;
+	size_t stride = 0;	  // Bytes per row, padding included
+	bool topDown = false; // The first row is the top one (negative height)
+	bool alpha = false;	  // The fourth byte is alpha rather than padding
+
+	// Little-endian fields at any alignment
+	uint32_t read32(size_t at) const
+	{
+		uint32_t v;
+		memcpy(&v, file.data + at, 4);
+		return v;
+	}
+	uint16_t read16(size_t at) const
+	{
+		uint16_t v;
+		memcpy(&v, file.data + at, 2);
+		return v;
+	}
+
+	bool fail(std::string &error, const char *reason)
+	{
+		close();
+		error = reason;
+		return false;
+	}
+};
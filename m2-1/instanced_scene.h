@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <GL/freeglut.h>
+
+// Many copies of the loaded model, each with its own model matrix. The
+// matrices live in a buffer object and feed a per-instance vertex attribute,
+// so the whole scene is one glDrawElementsInstanced call. A small vertex
+// shader applies the instance matrix and replays the fixed-function lighting
+// (the three lights, the material and two-sided lighting), so instanced
+// frames look like the single model's; texturing and the rest of the
+// fragment stage stay fixed-function.
+class InstancedScene
+{
+public:
+	static const GLuint matrixAttribute = 4; // Columns use 4..7, clear of the conventional attributes
+
+	~InstancedScene() { destroy(); }
+
+	// Compile the shader, once a GL context is current. Returns false if the
+	// context lacks instancing (GL 3.3) or the shader does not build; the
+	// per-object path still works then.
+	bool init()
+	{
+		int major = 0, minor = 0;
+		const char *version = (const char *)glGetString(GL_VERSION);
+		if (version)
+			sscanf(version, "%d.%d", &major, &minor);
+		if (major < 3 || (major == 3 && minor < 3))
+			return false;
+
+		GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(shader, 1, &vertexSource, nullptr);
+		glCompileShader(shader);
+		GLint ok = GL_FALSE;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+		if (!ok)
+		{
+			printLog(shader, false);
+			glDeleteShader(shader);
+			return false;
+		}
+		program = glCreateProgram();
+		glAttachShader(program, shader);
+		glBindAttribLocation(program, matrixAttribute, "instanceMatrix");
+		glLinkProgram(program);
+		glDeleteShader(shader); // Freed along with the program
+		glGetProgramiv(program, GL_LINK_STATUS, &ok);
+		if (!ok)
+		{
+			printLog(program, true);
+			glDeleteProgram(program);
+			program = 0;
+			return false;
+		}
+		lightOnUniform = glGetUniformLocation(program, "lightOn");
+		glGenBuffers(1, &matrixBuffer);
+		return true;
+	}
+
+	bool hasInstancing() const { return program != 0; }
+
+	void destroy()
+	{
+		if (program)
+			glDeleteProgram(program);
+		if (matrixBuffer)
+			glDeleteBuffers(1, &matrixBuffer);
+		program = matrixBuffer = 0;
+	}
+
+	// Lay out `count` copies of a model with the given bounds (minX, minY,
+	// minZ, maxX, maxY, maxZ) on a cubic grid, each turned by a random angle
+	// around Y. The copies are scaled down so the whole grid takes about the
+	// space of the single model. The layout only depends on `count` and `seed`.
+	void scatter(size_t count, const float bounds[6], uint32_t seed = 1)
+	{
+		matrices.assign(count * 16, 0.0f);
+		side = 1;
+		while ((size_t)side * side * side < count)
+			++side;
+		scale = 1.0f / side;
+		float cell[3];
+		for (int k = 0; k < 3; ++k)
+			cell[k] = std::max(bounds[k + 3] - bounds[k], 1e-6f) * (count > 1 ? 1.2f : 1.0f) * scale;
+
+		uint32_t random = seed;
+		for (size_t i = 0; i < count; ++i)
+		{
+			size_t grid[3] = {i % side, (i / side) % side, i / ((size_t)side * side)};
+			random = random * 1664525u + 1013904223u; // LCG, for a reproducible layout
+			float angle = count > 1 ? (random >> 8) * (6.2831853f / 16777216.0f) : 0.0f;
+			float c = std::cos(angle) * scale, s = std::sin(angle) * scale;
+
+			// Column-major, as glMultMatrixf and the shader read it
+			float *m = &matrices[16 * i];
+			m[0] = c, m[2] = -s;
+			m[5] = scale;
+			m[8] = s, m[10] = c;
+			for (int k = 0; k < 3; ++k)
+				m[12 + k] = (grid[k] - (side - 1) * 0.5f) * cell[k];
+			m[15] = 1.0f;
+		}
+		uploaded = false;
+	}
+
+	size_t size() const { return matrices.size() / 16; }
+
+	// Scale of every copy relative to the single model
+	float instanceScale() const { return scale; }
+
+	const float *matrix(size_t i) const { return &matrices[16 * i]; }
+
+	// Draw `indexCount` indices from `firstIndex` once per instance, with the
+	// vertex and index buffers and their client arrays already bound. Lights
+	// follow `lightOn` instead of the GL_LIGHTi enables, which GLSL cannot read.
+	void draw(uint32_t indexCount, uint32_t firstIndex, const bool lightOn[3])
+	{
+		if (!uploaded)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
+			glBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(float), matrices.data(), GL_STATIC_DRAW);
+			uploaded = true;
+		}
+		GLboolean twoSide = GL_FALSE;
+		glGetBooleanv(GL_LIGHT_MODEL_TWO_SIDE, &twoSide);
+
+		glUseProgram(program);
+		GLint on[3] = {lightOn[0], lightOn[1], lightOn[2]};
+		glUniform1iv(lightOnUniform, 3, on);
+		if (twoSide)
+			glEnable(GL_VERTEX_PROGRAM_TWO_SIDE);
+		glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
+		for (GLuint column = 0; column < 4; ++column)
+		{
+			glEnableVertexAttribArray(matrixAttribute + column);
+			glVertexAttribPointer(matrixAttribute + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float),
+								  (void *)(column * 4 * sizeof(float)));
+			glVertexAttribDivisor(matrixAttribute + column, 1);
+		}
+
+		glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)indexCount, GL_UNSIGNED_INT,
+								(void *)(firstIndex * sizeof(uint32_t)), (GLsizei)size());
+
+		for (GLuint column = 0; column < 4; ++column)
+		{
+			glVertexAttribDivisor(matrixAttribute + column, 0);
+			glDisableVertexAttribArray(matrixAttribute + column);
+		}
+		glDisable(GL_VERTEX_PROGRAM_TWO_SIDE);
+		glUseProgram(0);
+	}
+
+private:
+	std::vector<float> matrices; // 16 floats per instance
+	int side = 1;				 // Instances per grid edge
+	float scale = 1.0f;
+	GLuint program = 0, matrixBuffer = 0;
+	GLint lightOnUniform = -1;
+	bool uploaded = false; // matrixBuffer holds `matrices`
+
+	// Per-vertex lighting of fixed-function GL for positional lights without
+	// attenuation or spot cones and an infinite viewer, as initLighting sets
+	// them up; the back color uses the flipped normal
+	static constexpr const char *vertexSource = R"(#version 120
+attribute mat4 instanceMatrix;
+uniform bool lightOn[3];
+
+vec4 shade(vec3 position, vec3 normal, bool back)
+{
+	vec4 color = back ? gl_BackLightModelProduct.sceneColor : gl_FrontLightModelProduct.sceneColor;
+	float shininess = back ? gl_BackMaterial.shininess : gl_FrontMaterial.shininess;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (!lightOn[i])
+			continue;
+		vec3 toLight = normalize(gl_LightSource[i].position.xyz - position * gl_LightSource[i].position.w);
+		float diffuse = max(dot(normal, toLight), 0.0);
+		float specular = 0.0;
+		if (diffuse > 0.0)
+			specular = pow(max(dot(normal, normalize(toLight + vec3(0.0, 0.0, 1.0))), 0.0), shininess);
+		if (back)
+			color += gl_BackLightProduct[i].ambient + diffuse * gl_BackLightProduct[i].diffuse +
+					 specular * gl_BackLightProduct[i].specular;
+		else
+			color += gl_FrontLightProduct[i].ambient + diffuse * gl_FrontLightProduct[i].diffuse +
+					 specular * gl_FrontLightProduct[i].specular;
+	}
+	color.a = back ? gl_BackMaterial.diffuse.a : gl_FrontMaterial.diffuse.a;
+	return clamp(color, 0.0, 1.0);
+}
+
+void main()
+{
+	vec4 eye = gl_ModelViewMatrix * (instanceMatrix * gl_Vertex);
+	vec3 normal = normalize(gl_NormalMatrix * (mat3(instanceMatrix) * gl_Normal));
+	gl_FrontColor = shade(eye.xyz, normal, false);
+	gl_BackColor = shade(eye.xyz, -normal, true);
+	gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;
+	gl_Position = gl_ProjectionMatrix * eye;
+}
+)";
+
+	static void printLog(GLuint object, bool isProgram)
+	{
+		char log[1024] = "";
+		if (isProgram)
+			glGetProgramInfoLog(object, sizeof(log), nullptr, log);
+		else
+			glGetShaderInfoLog(object, sizeof(log), nullptr, log);
+		fprintf(stderr, "Instancing shader: %s\n", log);
+	}
+};
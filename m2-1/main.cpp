@@ -1,568 +1,3367 @@
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <sstream>
-#include <GL/freeglut.h>
-#include <math.h>
-using namespace std;
-
-// Global variables
-unsigned int model;
-unsigned int textureID;				// Texture handle
-vector<vector<float>> vertices;		// Vertex positions
-vector<vector<float>> normals;		// Vertex normals
-vector<vector<int>> face_texcoords; // Face texture coordinates
-vector<vector<float>> texcoords;	// Texture coordinates
-vector<vector<int>> faces;			// Faces as indices into the vertices
-vector<vector<int>> face_normals;	// Indices of normals for each face
-
-// Transformation and lighting states
-float rotY = 0.0f, rotX = 0.0f, rotZ = 0.0f; // Rotation angles
-float scale = 1.0f;
-float translateX = 0.0f, translateY = 0.0f, translateZ = -105.0f; // Z = Initial camera distance
-bool lights[3] = {true, true, true};							  // Toggle for 3 lights
-bool lightingFollowsModel = false;								  // false = fixed, true = follows model
-
-// Load a .bmp texture (24-bit only)
-struct BitMapFile
-{
-	int sizeX;
-	int sizeY;
-	unsigned char *data;
-};
-
-BitMapFile *getBMPData(string filename)
-{
-	BitMapFile *bmp = new BitMapFile;
-	unsigned int size, offset, headerSize;
-
-	ifstream infile(filename.c_str(), ios::binary);
-	if (!infile.is_open())
-	{
-		cerr << "Erro ao abrir o BMP: " << filename << endl;
-		return nullptr;
-	}
-
-	infile.seekg(10);
-	infile.read((char *)&offset, 4);
-	infile.seekg(14);
-	infile.read((char *)&headerSize, 4);
-	infile.seekg(18);
-	infile.read((char *)&bmp->sizeX, 4);
-	infile.read((char *)&bmp->sizeY, 4);
-
-	size = bmp->sizeX * bmp->sizeY * 3;
-	bmp->data = new unsigned char[size];
-	infile.seekg(offset);
-	infile.read((char *)bmp->data, size);
-
-	// Convert from BGR to RGB
-	for (int i = 0; i < size; i += 3)
-		swap(bmp->data[i], bmp->data[i + 2]);
-
-	return bmp;
-}
-
-void loadTexture(char *filename)
-{
-
-	BitMapFile *image = getBMPData(filename);
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image->sizeX, image->sizeY, 0, GL_RGB, GL_UNSIGNED_BYTE, image->data);
-	delete[] image->data;
-	delete image;
-}
-
-// Load a .obj file and parse vertices, normals, and face indices
-void loadObj(string fname)
-{
-	vertices.clear();
-	normals.clear();
-	texcoords.clear();
-	faces.clear();
-	face_normals.clear();
-	face_texcoords.clear();
-
-	ifstream file(fname);
-	if (!file.is_open())
-	{
-		cerr << "Failed to open file: " << fname << endl;
-		exit(1);
-	}
-
-	string line;
-	// Variables to compute bounding box for centering
-	float minX = INFINITY, minY = INFINITY, minZ = INFINITY;
-	float maxX = -INFINITY, maxY = -INFINITY, maxZ = -INFINITY;
-
-	while (getline(file, line))
-	{
-		istringstream ss(line);
-		string type;
-		ss >> type;
-
-		// Vertex position
-		if (type == "v")
-		{
-			float x, y, z;
-			ss >> x >> y >> z;
-			vertices.push_back({x, y, z});
-			minX = min(minX, x);
-			maxX = max(maxX, x);
-			minY = min(minY, y);
-			maxY = max(maxY, y);
-			minZ = min(minZ, z);
-			maxZ = max(maxZ, z);
-		}
-		// Vertex normal
-		else if (type == "vn")
-		{
-			float x, y, z;
-			ss >> x >> y >> z;
-			float len = sqrt(x * x + y * y + z * z); // Normalize the normal
-			if (len > 0.0f)
-			{
-				x /= len;
-				y /= len;
-				z /= len;
-			}
-			normals.push_back({x, y, z});
-		}
-		// Texture coordinate
-		else if (type == "vt")
-		{
-			float u, v;
-			ss >> u >> v;
-			texcoords.push_back({u, v});
-		}
-		// Face
-		else if (type == "f")
-		{
-			vector<int> vIndices, nIndices, tIndices;
-			string token;
-			while (ss >> token)
-			{
-				int vi = -1, ti = -1, ni = -1;
-				size_t slash1 = token.find('/');
-				size_t slash2 = token.find('/', slash1 + 1);
-
-				// Parse formatos: v, v/vt, v//vn ou v/vt/vn
-				if (slash1 == string::npos)
-					vi = stoi(token) - 1;
-				else if (slash2 == string::npos)
-				{
-					vi = stoi(token.substr(0, slash1)) - 1;
-					ti = stoi(token.substr(slash1 + 1)) - 1;
-				}
-				else if (slash2 == slash1 + 1)
-				{
-					vi = stoi(token.substr(0, slash1)) - 1;
-					ni = stoi(token.substr(slash2 + 1)) - 1;
-				}
-				else
-				{
-					vi = stoi(token.substr(0, slash1)) - 1;
-					ti = stoi(token.substr(slash1 + 1, slash2 - slash1 - 1)) - 1;
-					ni = stoi(token.substr(slash2 + 1)) - 1;
-				}
-
-				vIndices.push_back(vi);
-				tIndices.push_back(ti);
-				nIndices.push_back(ni);
-			}
-
-			// Convertendo polígonos para triângulos
-			for (size_t i = 1; i + 1 < vIndices.size(); ++i)
-			{
-				faces.push_back({vIndices[0], vIndices[i], vIndices[i + 1]});
-				face_texcoords.push_back({tIndices[0], tIndices[i], tIndices[i + 1]});
-				face_normals.push_back({nIndices[0], nIndices[i], nIndices[i + 1]});
-			}
-		}
-	}
-
-	file.close();
-
-	// Center the model
-	float centerX = (minX + maxX) / 2.0f;
-	float centerY = (minY + maxY) / 2.0f;
-	float centerZ = (minZ + maxZ) / 2.0f;
-	for (auto &v : vertices)
-	{
-		v[0] -= centerX;
-		v[1] -= centerY;
-		v[2] -= centerZ;
-	}
-
-	// Create OpenGL display list for fast rendering
-	model = glGenLists(1);
-
-	glNewList(model, GL_COMPILE);
-
-	// Enable textures
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glEnable(GL_TEXTURE_2D);
-
-	glBegin(GL_TRIANGLES);
-	for (size_t i = 0; i < faces.size(); ++i)
-	{
-		for (size_t j = 0; j < faces[i].size(); ++j)
-		{
-			int vi = faces[i][j];
-			int ti = face_texcoords[i][j];
-
-			if (ti >= 0 && ti < texcoords.size())
-				glTexCoord2f(texcoords[ti][0], texcoords[ti][1]);
-
-			if (vi >= 0 && vi < vertices.size())
-				glVertex3fv(vertices[vi].data());
-		}
-	}
-	glEnd();
-	glEndList();
-	cout << "Number of coordenates for texture found in .obj: " << texcoords.size() << endl;
-}
-
-// Set up 3-point lighting
-void initLighting()
-{
-	glEnable(GL_NORMALIZE);
-	glEnable(GL_LIGHTING);
-	glEnable(GL_DEPTH_TEST);
-	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
-
-	glDisable(GL_COLOR_MATERIAL); // Disable color-based materials — it will be set manually!
-
-	// Light positions: front, left, and top
-	GLfloat light_pos[3][4] = {
-		{0.0f, 0.0f, 150.0f, 1.0f},	 // Front (Z+)
-		{-150.0f, 0.0f, 0.0f, 1.0f}, // Left (X-)
-		{0.0f, 150.0f, 0.0f, 1.0f}	 // Top (Y+)
-	};
-
-	// Light 0 (Red) - primarily specular
-	GLfloat specular0[] = {1.0f, 0.0f, 0.0f, 1.0f};
-	GLfloat ambient0[] = {0.05f, 0.0f, 0.0f, 1.0f}; // Low ambient for red light
-	GLfloat diffuse0[] = {0.2f, 0.0f, 0.0f, 1.0f};	// Low diffuse for red light
-	// GLfloat ambient0[] = {0.0f, 0.0f, 0.0f, 1.0f}; // No ambient for red light
-	// GLfloat diffuse0[] = {0.0f, 0.0f, 0.0f, 1.0f}; // No diffuse for red light
-
-	// Light 1 (Green) - primarily diffuse
-	GLfloat diffuse1[] = {0.0f, 1.0f, 0.0f, 1.0f};
-	GLfloat ambient1[] = {0.0f, 0.05f, 0.0f, 1.0f}; // Low ambient for green light
-	GLfloat specular1[] = {0.0f, 0.2f, 0.0f, 1.0f}; // Low specular for green light
-	// GLfloat ambient1[] = {0.0f, 0.0f, 0.0f, 1.0f};	// No ambient for green light
-	// GLfloat specular1[] = {0.0f, 0.0f, 0.0f, 1.0f}; // No specular for green light
-
-	// Light 2 (Blue) - primarily ambient
-	GLfloat ambient2[] = {0.0f, 0.0f, 1.0f, 1.0f};
-	GLfloat diffuse2[] = {0.0f, 0.0f, 0.2f, 1.0f};	// Low diffuse for blue light
-	GLfloat specular2[] = {0.0f, 0.0f, 0.2f, 1.0f}; // Low specular for blue light
-	// GLfloat diffuse2[] = {0.0f, 0.0f, 0.0f, 1.0f}; // No diffuse for blue light
-	// GLfloat specular2[] = {0.0f, 0.0f, 0.0f, 1.0f}; // No specular for blue light
-
-	// Set up each light source
-	glLightfv(GL_LIGHT0, GL_POSITION, light_pos[0]);
-	glLightfv(GL_LIGHT0, GL_AMBIENT, ambient0);
-	glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuse0);
-	glLightfv(GL_LIGHT0, GL_SPECULAR, specular0);
-	glEnable(GL_LIGHT0);
-
-	glLightfv(GL_LIGHT1, GL_POSITION, light_pos[1]);
-	glLightfv(GL_LIGHT1, GL_AMBIENT, ambient1);
-	glLightfv(GL_LIGHT1, GL_DIFFUSE, diffuse1);
-	glLightfv(GL_LIGHT1, GL_SPECULAR, specular1);
-	glEnable(GL_LIGHT1);
-
-	glLightfv(GL_LIGHT2, GL_POSITION, light_pos[2]);
-	glLightfv(GL_LIGHT2, GL_AMBIENT, ambient2);
-	glLightfv(GL_LIGHT2, GL_DIFFUSE, diffuse2);
-	glLightfv(GL_LIGHT2, GL_SPECULAR, specular2);
-	glEnable(GL_LIGHT2);
-}
-
-// Render the 3D model
-void draw3dObject()
-{
-	glPushMatrix();
-	glTranslatef(translateX, translateY, translateZ);
-	glScalef(scale, scale, scale);
-	glRotatef(rotX, 1, 0, 0);
-	glRotatef(rotY, 0, 1, 0);
-	glRotatef(rotZ, 0, 0, 1);
-	glEnable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glCallList(model);
-	glPopMatrix();
-}
-
-void display()
-{
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glLoadIdentity();
-
-	// Reapply lighting positions based on mode
-	if (lightingFollowsModel)
-	{
-		// Position lights *after* transformation so they follow the model
-		glPushMatrix();
-		glTranslatef(translateX, translateY, translateZ);
-		glRotatef(rotX, 1, 0, 0);
-		glRotatef(rotY, 0, 1, 0);
-
-		GLfloat light_pos[3][4] = {
-			{0.0f, 0.0f, 150.0f, 1.0f},
-			{-150.0f, 0.0f, 0.0f, 1.0f},
-			{0.0f, 150.0f, 0.0f, 1.0f}};
-		for (int i = 0; i < 3; ++i)
-		{
-			if (lights[i])
-			{
-				glEnable(GL_LIGHT0 + i);
-				glLightfv(GL_LIGHT0 + i, GL_POSITION, light_pos[i]);
-			}
-			else
-			{
-				glDisable(GL_LIGHT0 + i);
-			}
-		}
-		glPopMatrix();
-	}
-	else
-	{
-		// Default: lights stay fixed in world space
-		for (int i = 0; i < 3; ++i)
-		{
-			if (lights[i])
-				glEnable(GL_LIGHT0 + i);
-			else
-				glDisable(GL_LIGHT0 + i);
-		}
-	}
-
-	// Set manual material properties for the object
-	GLfloat mat_ambient[] = {0.2f, 0.2f, 0.2f, 1.0f};  // How much ambient light it reflects
-	GLfloat mat_diffuse[] = {0.6f, 0.6f, 0.6f, 1.0f};  // Base color under light
-	GLfloat mat_specular[] = {1.0f, 1.0f, 1.0f, 1.0f}; // Strong specular (shiny white highlights)
-	GLfloat mat_shininess = 64.0f;					   // Sharpness of specular reflection
-
-	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient);
-	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
-	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, mat_specular);
-	glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, mat_shininess);
-
-	glColor3f(1.0f, 1.0f, 1.0f); // Object base color (set as white for texture mapping)
-	draw3dObject();
-
-	glutSwapBuffers();
-}
-
-// Adjust projection on window resize
-void reshape(int w, int h)
-{
-	if (h == 0)
-		h = 1;
-	glViewport(0, 0, w, h);
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(60, (float)w / (float)h, 1.0, 1000.0);
-	glMatrixMode(GL_MODELVIEW);
-}
-
-// Redraw periodically
-void timer(int value)
-{
-	glutPostRedisplay();
-	glutTimerFunc(16, timer, 0);
-}
-
-// Handles keyboard input for transforming the model and toggling lights
-// CONTROLS:
-// 'w', 's' - rotate up/down
-// 'a', 'd' - rotate left/right
-// 'z', 'x' - rotate counter-clockwise/clockwise around Z-axis
-// '+', '-' - zoom in/out
-// 'i', 'k' - translate vertically
-// 'j', 'l' - translate horizontally
-// 'u', 'o' - zoom in/out (move closer/further)
-// 'f' - Fix lighting in world space (default)
-// 'm' - Make lighting follow model rotation and position
-// '1', '2', '3' - toggle lights 0–2 (red, green, blue)
-// 'SPACE' - reset all transformations
-// 'ESC' - exit program
-void keyboard(unsigned char key, int x, int y)
-{
-	switch (key)
-	{
-	case 'a':
-		rotY -= 5;
-		cout << "Rotated left (Y-axis -5 degrees)" << endl;
-		break;
-	case 'd':
-		rotY += 5;
-		cout << "Rotated right (Y-axis +5 degrees)" << endl;
-		break;
-	case 'w':
-		rotX -= 5;
-		cout << "Rotated up (X-axis -5 degrees)" << endl;
-		break;
-	case 's':
-		rotX += 5;
-		cout << "Rotated down (X-axis +5 degrees)" << endl;
-		break;
-	case 'z': // Rotate counter-clockwise around Z-axis
-		rotZ -= 5;
-		cout << "Rotated counter-clockwise (Z-axis -5 degrees)" << endl;
-		break;
-	case 'x': // Rotate clockwise around Z-axis
-		rotZ += 5;
-		cout << "Rotated clockwise (Z-axis +5 degrees)" << endl;
-		break;
-	case '+':
-		scale += 0.1f;
-		cout << "Scaled up (current scale: " << scale << ")" << endl;
-		break;
-	case '-':
-		scale = max(0.1f, scale - 0.1f);
-		cout << "Scaled down (current scale: " << scale << ")" << endl;
-		break;
-	case 'j':
-		translateX -= 2.0f;
-		cout << "Translated left (X-axis -2 units)" << endl;
-		break;
-	case 'l':
-		translateX += 2.0f;
-		cout << "Translated right (X-axis +2 units)" << endl;
-		break;
-	case 'i':
-		translateY += 2.0f;
-		cout << "Translated up (Y-axis +2 units)" << endl;
-		break;
-	case 'k':
-		translateY -= 2.0f;
-		cout << "Translated down (Y-axis -2 units)" << endl;
-		break;
-	case 'u': // Translate closer (zoom in)
-		translateZ += 2.0f;
-		cout << "Moved closer (Z-axis +2 units)" << endl;
-		break;
-	case 'o': // Translate further (zoom out)
-		translateZ -= 2.0f;
-		cout << "Moved further (Z-axis -2 units)" << endl;
-		break;
-	case 'f':
-		lightingFollowsModel = false;
-		cout << "Lighting set to fixed (world space)" << endl;
-		break;
-	case 'm':
-		lightingFollowsModel = true;
-		cout << "Lighting set to follow model" << endl;
-		break;
-	case '1':
-		lights[0] = !lights[0];
-		cout << "Toggled Light 0 (Specular - Red): " << (lights[0] ? "ON" : "OFF") << endl;
-		break;
-	case '2':
-		lights[1] = !lights[1];
-		cout << "Toggled Light 1 (Diffuse - Green): " << (lights[1] ? "ON" : "OFF") << endl;
-		break;
-	case '3':
-		lights[2] = !lights[2];
-		cout << "Toggled Light 2 (Ambient - Blue): " << (lights[2] ? "ON" : "OFF") << endl;
-		break;
-	case ' ':
-		rotX = rotY = rotZ = 0.0f;
-		translateX = translateY = 0.0f;
-		translateZ = -105.0f;
-		scale = 1.0f;
-		cout << "Reset all transformations" << endl;
-		break;
-	case 27:
-		cout << "Exiting program (ESC key)" << endl;
-		exit(0);
-	}
-}
-
-// Mouse state tracking
-int lastMouseX, lastMouseY;
-bool leftButtonDown = false, rightButtonDown = false;
-
-// Handles mouse button input for rotating/translating the model or zooming
-// Left button  - activates rotation when dragging
-// Right button - activates translation when dragging
-// Scroll up/down - zoom in/out
-void mouseButton(int button, int state, int x, int y)
-{
-	if (button == GLUT_LEFT_BUTTON)
-		leftButtonDown = (state == GLUT_DOWN);
-	else if (button == GLUT_RIGHT_BUTTON)
-		rightButtonDown = (state == GLUT_DOWN);
-
-	lastMouseX = x;
-	lastMouseY = y;
-
-	// Zoom in/out with scroll wheel
-	if (button == 3)
-		scale += 0.1f;
-	else if (button == 4)
-		scale = max(0.1f, scale - 0.1f);
-}
-
-// Handles mouse motion when a button is held down
-// Left drag - rotates the model
-// Right drag - translates the model
-void motion(int x, int y)
-{
-	int dx = x - lastMouseX;
-	int dy = y - lastMouseY;
-
-	if (leftButtonDown)
-	{
-		rotY += dx * 0.5f;
-		rotX += dy * 0.5f;
-	}
-	else if (rightButtonDown)
-	{
-		translateX += dx * 0.1f;
-		translateY -= dy * 0.1f;
-	}
-
-	lastMouseX = x;
-	lastMouseY = y;
-}
-
-// Entry point
-int main(int argc, char **argv)
-{
-	glutInit(&argc, argv);
-	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-	glutInitWindowSize(900, 600);
-	glutCreateWindow("OBJ Loader - 3D Object with Lighting");
-
-	// Register callbacks
-	glutDisplayFunc(display);
-	glutReshapeFunc(reshape);
-	glutKeyboardFunc(keyboard);
-	glutMouseFunc(mouseButton);
-	glutMotionFunc(motion);
-	glutTimerFunc(16, timer, 0);
-
-	initLighting();
-
-	if (argc < 3)
-	{
-		std::cerr << "Usage: " << argv[0] << " <path_to_obj_file> <path_to_bpm_texture>\n";
-		exit(1);
-	}
-	loadTexture(argv[2]);
-	loadObj(argv[1]);
-
-	glutMainLoop();
-	return 0;
-}
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <optional>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#define GL_GLEXT_PROTOTYPES // Buffer object entry points (GL 1.5)
+#include <GL/freeglut.h>
+#include <math.h>
+#include "obj_loader.h"
+#include "mtl_loader.h"
+#include "bmp_loader.h"
+#include "mipmap.h"
+#include "texture_cache.h"
+#include "mesh_normals.h"
+#include "mesh_buffers.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+#include "mesh_bvh.h"
+#include "mesh_occlusion.h"
+#include "frame_stats.h"
+#include "offscreen_context.h"
+#include "async_loader.h"
+#include "instanced_scene.h"
+#include "tiled_lighting.h"
+#include "input_log.h"
+#include "software_renderer.h"
+using namespace std;
+
+// Global variables
+unsigned int model;
+unsigned int textureID;				// Texture handle
+bool useMipmaps = true;				// --no-mipmaps samples the full-size texture only (GL_LINEAR)
+float anisotropy = 1.0f;			// --anisotropy N: up to N anisotropic samples per fragment (1 = trilinear only)
+bool compressTextures = true;		// --no-texture-compression uploads the texels as they are instead of BC1/BC3 blocks
+MeshView meshView;				   // Geometry being rendered (points into `modelData`)
+unsigned int vertexBuffer, indexBuffer, occlusionBuffer; // Buffer objects of the indexed render path
+bool useCache = true;			   // --no-cache parses the .obj and encodes the texture on every launch
+bool useDisplayList = false;	   // --display-list renders through the old immediate-mode display list
+bool optimizeOrder = true;		   // --no-optimize keeps the triangle and vertex order of the .obj
+bool optimizeOverdrawOrder = false; // --overdraw also sorts triangle clusters to reduce overdraw
+bool buildLods = true;			   // --no-lod always draws the full mesh
+float lodPixelError = 1.0f;		   // --lod-error N: largest on-screen error of a level of detail, in pixels
+int creaseAngle = 0;				   // --crease N: generated normals do not smooth across edges sharper than N degrees
+bool areaNormals = false;		   // --area-normals weights generated normals by triangle area instead of angle
+size_t currentLod = 0;			   // Level of detail being drawn (0 = full mesh)
+FrameStats frameStats;			   // CPU/GPU time of every frame
+bool showHud = false;			   // 'h' shows the frame time overlay
+bool offscreen = false;			   // --bench renders into an EGL pbuffer instead of a GLUT window
+InstancedScene scene;			   // Copies of the model drawn instead of the model itself
+size_t instanceCount = 0;		   // --instances N: copies in the scene (0 = the model alone)
+bool useInstancing = true;		   // --no-instancing draws the copies one at a time
+bool batchMaterials = true;		   // --no-batching draws the groups in file order, setting the material for each
+size_t drawCalls = 0, drawnTriangles = 0, stateChanges = 0; // Of the last frame
+TiledLighting tiledLighting;	   // Per-pixel lighting path
+bool shaderLighting = false;	   // --shader-lighting shades per pixel in GLSL, with tiled light culling
+size_t lightCount = 3;			   // --lights N: the 3-point lights plus N - 3 point lights in the model (implies --shader-lighting)
+bool cullLights = true;			   // --no-light-culling shades every pixel with every light
+bool softwareRendering = false;	   // --software draws the model on the CPU (SoftwareRenderer) instead of through GL
+SoftwareRenderer softwareRenderer;
+int occlusionRays = 0;			   // --ao N: bake ambient occlusion into the vertices with N rays each (0 = none)
+bool showOcclusion = true;		   // 'c' toggles the baked occlusion
+unsigned int occlusionRamp;		   // 1D texture from white (open) to black (closed)
+InputLog inputLog;				   // --record file: every input event of the session, written at exit
+string inputLogPath;
+InputReplay inputReplay;		   // --replay file: a recorded session fed back to the callbacks
+int replayModifiers = 0;		   // glutGetModifiers() of the event being replayed
+
+// When frames are drawn: only after something changed (default), or
+// continuously as fast as possible (--uncapped) or once per refresh (--vsync)
+enum FrameLoop
+{
+	LoopOnDemand,
+	LoopUncapped,
+	LoopVsync
+};
+FrameLoop frameLoop = LoopOnDemand;
+
+// Transformation and lighting states
+float rotY = 0.0f, rotX = 0.0f, rotZ = 0.0f; // Rotation angles
+float scale = 1.0f;
+float translateX = 0.0f, translateY = 0.0f, translateZ = -105.0f; // Z = Initial camera distance
+const double fieldOfViewY = 60.0;								  // gluPerspective angle, in degrees
+int viewportWidth = 900, viewportHeight = 600;					  // Set in reshape
+bool lights[3] = {true, true, true};							  // Toggle for 3 lights
+bool lightingFollowsModel = false;								  // false = fixed, true = follows model
+
+// The 3-point lights of initLighting: front (Z+), left (X-) and top (Y+)
+const GLfloat lightPositions[3][4] = {{0.0f, 0.0f, 150.0f, 1.0f}, {-150.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 150.0f, 0.0f, 1.0f}};
+// Red: primarily specular, green: primarily diffuse, blue: primarily ambient
+const GLfloat lightAmbient[3][4] = {{0.05f, 0.0f, 0.0f, 1.0f}, {0.0f, 0.05f, 0.0f, 1.0f}, {0.0f, 0.0f, 1.0f, 1.0f}};
+const GLfloat lightDiffuse[3][4] = {{0.2f, 0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 0.2f, 1.0f}};
+const GLfloat lightSpecular[3][4] = {{1.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 0.2f, 0.0f, 1.0f}, {0.0f, 0.0f, 0.2f, 1.0f}};
+
+// The texture loader before BmpImage, kept as a baseline for --bench-textures:
+// reads a 24-bit bottom-up .bmp into a new buffer and swaps it to RGB
+struct BitMapFile
+{
+	int sizeX;
+	int sizeY;
+	unsigned char *data;
+};
+
+BitMapFile *getBMPData(string filename)
+{
+	unsigned int size, offset, headerSize;
+
+	ifstream infile(filename.c_str(), ios::binary);
+	if (!infile.is_open())
+	{
+		cerr << "Erro ao abrir o BMP: " << filename << endl;
+		return nullptr;
+	}
+	BitMapFile *bmp = new BitMapFile;
+
+	infile.seekg(10);
+	infile.read((char *)&offset, 4);
+	infile.seekg(14);
+	infile.read((char *)&headerSize, 4);
+	infile.seekg(18);
+	infile.read((char *)&bmp->sizeX, 4);
+	infile.read((char *)&bmp->sizeY, 4);
+
+	size = bmp->sizeX * bmp->sizeY * 3;
+	bmp->data = new unsigned char[size];
+	infile.seekg(offset);
+	infile.read((char *)bmp->data, size);
+
+	// Convert from BGR to RGB
+	for (int i = 0; i < size; i += 3)
+		swap(bmp->data[i], bmp->data[i + 2]);
+
+	return bmp;
+}
+
+// Texture mapped from its file, ready for upload
+struct TextureData
+{
+	string path;
+	BmpImage image;
+	vector<MipLevel> mips;		// Levels 1, 2, ... (empty with --no-mipmaps or compression)
+	CompressedTexture compressed; // Every level as BC1/BC3 blocks (empty with --no-texture-compression)
+};
+shared_ptr<TextureData> textureData; // Texture on screen, kept mapped for the software renderer
+SoftwareTexture softwareTexture;	 // RGBA copy of its base level, made on first use
+
+// Block-compress `data.image` and its whole mip chain, or map them from the
+// texture cache when it is still valid (writing a fresh cache otherwise). BC1
+// for opaque images, BC3 when they have an alpha channel.
+void compressTextureData(TextureData &data)
+{
+	BlockFormat format = data.image.hasAlpha() ? FormatBc3 : FormatBc1;
+	SourceStamp stamp;
+	if (useCache && data.compressed.openCache(data.path, stamp, format))
+		return;
+	const BmpImage &image = data.image;
+	vector<MipLevel> mips = buildMipChain(image.bottomRow(), image.rowStep(), image.width(), image.height(),
+										  image.bytesPerPixel());
+	data.compressed.encode(image.bottomRow(), image.rowStep(), image.width(), image.height(), image.bytesPerPixel(),
+						   mips, format);
+	if (useCache)
+		data.compressed.writeCache(data.path, stamp);
+}
+
+// Map a .bmp file into `data` and check it. Only touches `data`, so loader
+// threads can call it.
+bool loadTextureData(const string &filename, TextureData &data)
+{
+	string error;
+	if (!data.image.open(filename, error))
+	{
+		cerr << "Erro ao abrir o BMP: " << filename << " (" << error << ")" << endl;
+		return false;
+	}
+	data.path = filename;
+	if (compressTextures)
+	{
+		compressTextureData(data);
+		return true;
+	}
+	data.image.touchPages();
+	if (useMipmaps)
+		data.mips = buildMipChain(data.image.bottomRow(), data.image.rowStep(), data.image.width(),
+								  data.image.height(), data.image.bytesPerPixel());
+	return true;
+}
+
+// True if the context lists `name` among its extensions
+bool hasGlExtension(const char *name)
+{
+	const char *list = (const char *)glGetString(GL_EXTENSIONS);
+	size_t length = strlen(name);
+	for (const char *p = list; p && (p = strstr(p, name)); p += length)
+		if ((p == list || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+			return true;
+	return false;
+}
+
+// Sampling of the bound texture: trilinear between its levels when it has
+// mipmaps (bilinear otherwise), plus anisotropic filtering if `anisotropy`
+// asks for it and the driver supports it
+void setTextureFilter(bool mipmapped)
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if (hasGlExtension("GL_EXT_texture_filter_anisotropic"))
+	{
+		GLfloat maxAnisotropy = 1.0f;
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, max(1.0f, min(anisotropy, maxAnisotropy)));
+	}
+}
+
+// Replace the current texture with `data`
+void uploadTexture(const TextureData &data)
+{
+	glDeleteTextures(1, &textureID);
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// Without S3TC support the compressed levels are useless: fall back to
+	// the base image alone
+	const CompressedTexture &compressed = data.compressed;
+	if (!compressed.levels().empty() && hasGlExtension("GL_EXT_texture_compression_s3tc"))
+	{
+		compressed.texImage(useMipmaps ? compressed.levels().size() : 1);
+		setTextureFilter(useMipmaps && compressed.levels().size() > 1);
+		return;
+	}
+	data.image.texImage();
+	uploadMipChain(data.mips, data.image.internalFormat());
+	setTextureFilter(!data.mips.empty());
+}
+
+void loadTexture(char *filename)
+{
+	auto data = make_shared<TextureData>();
+	if (!loadTextureData(filename, *data))
+		return;
+	uploadTexture(*data);
+	textureData = data;
+	softwareTexture.clear();
+}
+
+// Optimizations applied to freshly parsed meshes, as recorded in the cache
+uint32_t meshBuildFlags()
+{
+	uint32_t flags = 0;
+	if (optimizeOrder)
+		flags |= BuildVertexCache;
+	if (optimizeOrder && optimizeOverdrawOrder)
+		flags |= BuildOverdraw;
+	if (buildLods)
+		flags |= BuildLods;
+	if (areaNormals)
+		flags |= BuildAreaNormals;
+	if (batchMaterials)
+		flags |= BuildBatched;
+	flags |= (uint32_t)creaseAngle << BuildCreaseShift;
+	return flags;
+}
+
+// Geometry of one model, ready for upload: welded in memory after parsing,
+// or mapped from its cache file. `view` points into one of the two.
+struct ModelData
+{
+	string path;
+	IndexedMesh mesh;
+	MeshCache cache;
+	MeshView view;
+	vector<Material> materials; // One per name in view.materials, then the default material
+	MeshBvh bvh;				// Triangles of the full mesh, for picking and the occlusion bake
+	chrono::steady_clock::time_point requested; // Start of the load
+
+	// Material of a group
+	const Material &material(int32_t index) const
+	{
+		return index >= 0 && (size_t)index + 1 < materials.size() ? materials[index] : materials.back();
+	}
+};
+shared_ptr<ModelData> modelData; // Model on screen, possibly still being uploaded
+size_t uploadedVertexCount = 0;	 // Vertices of `modelData` in the vertex buffer so far
+RayHit picked;					 // Triangle under the cursor at the last shift-click
+float pickedPoint[3];			 // Where the ray hit it, in model coordinates
+double pickMs = 0.0;			 // Time to unproject the click and find the triangle
+
+// Look up the materials named by `data.view` in its .mtl file, next to the
+// .obj. Names the file does not define (or all of them, without a file) get
+// the default material.
+void loadMaterials(ModelData &data)
+{
+	const MeshView &view = data.view;
+	vector<Material> library;
+	if (!view.materialLibrary.empty())
+	{
+		size_t slash = data.path.find_last_of('/');
+		string path = (slash == string::npos ? "" : data.path.substr(0, slash + 1)) + view.materialLibrary;
+		if (!parseMtlFile(path, library))
+			cerr << "Cannot open the material library " << path << ", using the default material" << endl;
+	}
+
+	data.materials.clear();
+	size_t missing = 0;
+	for (const string &name : view.materials)
+	{
+		auto found = find_if(library.begin(), library.end(), [&](const Material &m)
+							 { return m.name == name; });
+		data.materials.push_back(found != library.end() ? *found : Material());
+		data.materials.back().name = name;
+		missing += found == library.end();
+	}
+	data.materials.emplace_back();
+	if (missing && !library.empty())
+		cerr << missing << " materials missing from " << view.materialLibrary << ", using the default material" << endl;
+}
+
+// Build the picking BVH of the full mesh of `data`
+void buildModelBvh(ModelData &data)
+{
+	auto t0 = chrono::steady_clock::now();
+	data.bvh.build(data.view.vertices, data.view.indices, data.view.indexCount);
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	cout << "BVH of " << data.bvh.triangleCount() << " triangles built in " << ms << " ms (" << data.bvh.nodeCount()
+		 << " nodes)" << endl;
+}
+
+// Bake the ambient occlusion of every vertex of the freshly welded `data`
+// against its BVH, with rays reaching a tenth of the model's size
+void bakeModelOcclusion(ModelData &data)
+{
+	const float *b = data.mesh.bounds;
+	float radius = 0.1f * sqrtf((b[3] - b[0]) * (b[3] - b[0]) + (b[4] - b[1]) * (b[4] - b[1]) + (b[5] - b[2]) * (b[5] - b[2]));
+	data.mesh.occlusion.resize(data.mesh.vertices.size());
+	auto t0 = chrono::steady_clock::now();
+	size_t steals = bakeOcclusion(data.mesh.vertices.data(), data.mesh.vertices.size(), data.bvh, occlusionRays, radius,
+								  data.mesh.occlusion.data());
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	data.view.occlusion = data.mesh.occlusion.data();
+	cout << "Ambient occlusion of " << data.mesh.vertices.size() << " vertices baked with " << occlusionRays
+		 << " rays each in " << ms << " ms on " << threadPool().size() << " threads (" << steals << " steals)" << endl;
+}
+
+// Parse a .obj file into `data.mesh` and do everything meshBuildFlags()
+// asks for: normals, welding, material batching, vertex order, levels of
+// detail and the occlusion bake (which also builds the BVH). The result is
+// what the mesh cache holds under those flags.
+bool buildMeshData(const string &fname, ModelData &data)
+{
+	Mesh mesh;
+	if (!parseObjFile(fname, mesh))
+	{
+		cerr << "Failed to open file: " << fname << endl;
+		return false;
+	}
+	cout << "Number of coordenates for texture found in .obj: " << mesh.texcoordCount() << endl;
+
+	// Smooth normals where the .obj has none, so every normal is unit length
+	if (size_t generated = generateNormals(mesh, (float)creaseAngle, areaNormals ? WeightByArea : WeightByAngle))
+		cout << "Generated normals for " << generated << " face corners" << endl;
+
+	// Center the model
+	mesh.center();
+
+	// Merge corners sharing the same (v, vt, vn) into one vertex
+	data.mesh = weldMesh(mesh, true);
+
+	// One draw per material instead of one per group of the file
+	if (batchMaterials)
+	{
+		size_t groups = data.mesh.groups.size();
+		mergeGroupsByMaterial(data.mesh);
+		cout << "Batched " << groups << " groups into " << data.mesh.groups.size() << " by material" << endl;
+	}
+
+	// Reorder triangles and vertices for the post-transform cache
+	if (optimizeOrder)
+	{
+		VertexCacheStats before = analyzeVertexCache(data.mesh.indices.data(), data.mesh.indices.size(),
+													 data.mesh.vertices.size());
+		optimizeMesh(data.mesh, optimizeOverdrawOrder);
+		VertexCacheStats after = analyzeVertexCache(data.mesh.indices.data(), data.mesh.indices.size(),
+													data.mesh.vertices.size());
+		cout << "Vertex cache (FIFO 16): ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr
+			 << " -> " << after.atvr << endl;
+	}
+
+	// Simplified copies of the index buffer for when the model is small on screen
+	if (buildLods)
+		buildLodChain(data.mesh);
+
+	data.view = MeshView(data.mesh);
+	if (occlusionRays > 0)
+	{
+		buildModelBvh(data);
+		bakeModelOcclusion(data);
+	}
+	return true;
+}
+
+// Get the welded, centered and optimized geometry of a .obj file and its
+// levels of detail (and its baked occlusion, with --ao): straight
+// from its binary cache when that is still valid, otherwise by parsing the
+// text (and then writing a fresh cache for the next launch). Only touches
+// `data`, so loader threads can call it.
+bool loadMeshData(const string &fname, ModelData &data)
+{
+	SourceStamp stamp;
+	data.path = fname;
+	if (useCache && data.cache.open(fname, stamp, meshBuildFlags(), occlusionRays))
+	{
+		data.view = data.cache.view();
+		loadMaterials(data);
+		buildModelBvh(data);
+		return true;
+	}
+
+	if (!buildMeshData(fname, data))
+		return false;
+	loadMaterials(data);
+	if (occlusionRays == 0) // Otherwise the bake built it
+		buildModelBvh(data);
+	if (useCache)
+		writeMeshCache(fname, stamp, data.mesh, meshBuildFlags(), occlusionRays);
+	return true;
+}
+
+// Range of a level of detail drawn with one material
+struct DrawItem
+{
+	uint32_t firstIndex; // In the index buffer of all levels
+	uint32_t indexCount;
+	const Material *material;
+};
+
+// The uploaded groups of `lod` in draw order: opaque before translucent,
+// which blend over them, and by material when batching so that each one is
+// set once. A level without groups is drawn whole with the default material.
+const vector<DrawItem> &drawList(const MeshLod &lod)
+{
+	static vector<DrawItem> items;
+	static const Material defaultMaterial;
+	items.clear();
+	for (uint32_t i = 0; i < lod.groupCount; ++i)
+	{
+		const MeshGroup &g = meshView.group(lod.firstGroup + i);
+		if (g.firstIndex < lod.indexCount && g.indexCount > 0)
+			items.push_back({lod.firstIndex + g.firstIndex, min(g.indexCount, lod.indexCount - g.firstIndex),
+							 &modelData->material(g.material)});
+	}
+	if (lod.groupCount == 0 && lod.indexCount > 0)
+		items.push_back({lod.firstIndex, lod.indexCount, modelData ? &modelData->materials.back() : &defaultMaterial});
+
+	stable_sort(items.begin(), items.end(), [](const DrawItem &a, const DrawItem &b)
+				{
+					if (a.material->translucent() != b.material->translucent())
+						return b.material->translucent();
+					return batchMaterials && a.material < b.material; });
+	return items;
+}
+
+// Make `material` the current fixed-function material
+void applyMaterial(const Material &material)
+{
+	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, material.ambient);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, material.diffuse);
+	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, material.specular);
+	glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, material.shininess);
+}
+
+// Draw `items` in order through `draw`, setting up the material of each one
+// first: only when it changes with batching, for every item without. The
+// translucent ones blend without writing depth. Counts the state changes.
+template <typename Draw>
+void drawItems(const vector<DrawItem> &items, Draw draw)
+{
+	const Material *current = nullptr;
+	bool blending = false;
+	for (const DrawItem &item : items)
+	{
+		if (item.material->translucent() && !blending)
+		{
+			blending = true;
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glDepthMask(GL_FALSE);
+			++stateChanges;
+		}
+		if (item.material != current || !batchMaterials)
+		{
+			applyMaterial(*item.material);
+			current = item.material;
+			++stateChanges;
+		}
+		draw(item);
+	}
+	if (blending)
+	{
+		glDisable(GL_BLEND);
+		glDepthMask(GL_TRUE);
+	}
+}
+
+size_t listDraws = 0, listStateChanges = 0; // Inside the display list, per call
+
+// Compile the model into a display list with one glNormal3fv/glTexCoord2fv/glVertex3fv
+// call per triangle corner (the old render path, kept for comparisons), and
+// the materials between its groups. The baked occlusion, if any, goes to unit 2.
+void buildDisplayList(const MeshView &view)
+{
+	model = glGenLists(1);
+	glNewList(model, GL_COMPILE);
+
+	// The texture is bound by draw3dObject, so it can change after compiling
+	const vector<DrawItem> &items = drawList(view.level(0));
+	stateChanges = 0;
+	drawItems(items, [&](const DrawItem &item)
+			  {
+				  glBegin(GL_TRIANGLES);
+				  for (size_t i = item.firstIndex; i < item.firstIndex + item.indexCount; ++i)
+				  {
+					  const Vertex &v = view.vertices[view.indices[i]];
+					  glNormal3fv(v.normal);
+					  glTexCoord2fv(v.texcoord);
+					  if (view.occlusion)
+						  glMultiTexCoord1f(GL_TEXTURE2, view.occlusion[view.indices[i]]);
+					  glVertex3fv(v.position);
+				  }
+				  glEnd(); });
+	listDraws = items.size();
+	listStateChanges = stateChanges;
+	glEndList();
+}
+
+// Free the GL objects and the geometry of the current model
+void unloadObj()
+{
+	glDeleteLists(model, 1);
+	glDeleteBuffers(1, &vertexBuffer);
+	glDeleteBuffers(1, &indexBuffer);
+	glDeleteBuffers(1, &occlusionBuffer);
+	model = vertexBuffer = indexBuffer = occlusionBuffer = 0;
+	modelData.reset();
+	uploadedVertexCount = 0;
+	meshView = MeshView();
+	currentLod = 0;
+	picked = RayHit();
+}
+
+// Start showing `data`: free the previous model and allocate buffer objects
+// for the new one, which uploadModelRange then fills
+void beginModelUpload(const shared_ptr<ModelData> &data)
+{
+	unloadObj();
+	modelData = data;
+	meshView = data->view;
+	meshView.indexCount = 0; // Grows as the triangles arrive
+	meshView.lodCount = 0;	 // The levels come last
+	scene.scatter(instanceCount, meshView.bounds);
+	if (useDisplayList)
+		return; // Compiled once the model is complete
+
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, data->view.vertexCount * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+	glGenBuffers(1, &indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (data->view.indexCount + data->view.lodIndexCount) * sizeof(uint32_t), nullptr,
+				 GL_STATIC_DRAW);
+	if (data->view.occlusion)
+	{
+		glGenBuffers(1, &occlusionBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, occlusionBuffer);
+		glBufferData(GL_ARRAY_BUFFER, data->view.vertexCount * sizeof(float), nullptr, GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Upload the interleaved vertices (and their occlusion) up to `vertexEnd`
+// and the indices up to `indexEnd`; the triangles uploaded so far are drawn from the next frame on
+void uploadModelRange(size_t vertexEnd, size_t indexEnd)
+{
+	const MeshView &view = modelData->view;
+	if (!useDisplayList)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		if (vertexEnd > uploadedVertexCount)
+			glBufferSubData(GL_ARRAY_BUFFER, uploadedVertexCount * sizeof(Vertex),
+							(vertexEnd - uploadedVertexCount) * sizeof(Vertex), view.vertices + uploadedVertexCount);
+		if (occlusionBuffer && vertexEnd > uploadedVertexCount)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, occlusionBuffer);
+			glBufferSubData(GL_ARRAY_BUFFER, uploadedVertexCount * sizeof(float),
+							(vertexEnd - uploadedVertexCount) * sizeof(float), view.occlusion + uploadedVertexCount);
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+		if (indexEnd > meshView.indexCount)
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, meshView.indexCount * sizeof(uint32_t),
+							(indexEnd - meshView.indexCount) * sizeof(uint32_t), view.indices + meshView.indexCount);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	uploadedVertexCount = max(uploadedVertexCount, vertexEnd);
+	meshView.indexCount = max(meshView.indexCount, indexEnd);
+}
+
+// Every triangle is in: add the levels of detail (or compile the display
+// list) and report what was loaded
+void finishModelUpload()
+{
+	meshView = modelData->view;
+	if (useDisplayList)
+		buildDisplayList(meshView);
+	else
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, meshView.indexCount * sizeof(uint32_t),
+						meshView.lodIndexCount * sizeof(uint32_t), meshView.lodIndices);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	// GPU memory of both paths: the buffers hold every unique vertex once,
+	// the display list one copy of the attributes per triangle corner
+	double bufferKB =
+		(meshView.vertexCount * sizeof(Vertex) + (meshView.indexCount + meshView.lodIndexCount) * sizeof(uint32_t)) / 1024.0;
+	double displayListKB = meshView.indexCount * 8 * sizeof(float) / 1024.0;
+	cout << "Loaded " << meshView.triangleCount() << " triangles, " << meshView.vertexCount << " unique vertices "
+		 << (modelData->cache.isOpen() ? "from cache" : "from .obj") << " in "
+		 << chrono::duration<double, milli>(chrono::steady_clock::now() - modelData->requested).count() << " ms" << endl;
+	cout << "GPU memory: vertex buffers " << bufferKB << " KB" << (useDisplayList ? "" : " (in use)")
+		 << ", display list ~" << displayListKB << " KB" << (useDisplayList ? " (in use)" : "") << endl;
+
+	cout << "Levels of detail:";
+	for (size_t i = 0; i < meshView.levelCount(); ++i)
+		cout << (i ? ", " : " ") << meshView.level(i).indexCount / 3 << " triangles (error " << meshView.level(i).error << ")";
+	cout << endl;
+}
+
+// Draw the current level of detail from the buffer objects, one glDrawElements
+// per group (or per group and copy)
+void drawVertexBuffers()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (void *)offsetof(Vertex, position));
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glNormalPointer(GL_FLOAT, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (void *)offsetof(Vertex, texcoord));
+	if (occlusionBuffer)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, occlusionBuffer);
+		glClientActiveTexture(GL_TEXTURE2);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(1, GL_FLOAT, 0, nullptr);
+		glClientActiveTexture(GL_TEXTURE0);
+	}
+
+	MeshLod lod = meshView.level(currentLod);
+	const vector<DrawItem> &items = drawList(lod);
+	bool instanced = useInstancing && scene.hasInstancing();
+	drawItems(items, [&](const DrawItem &item)
+			  {
+				  void *offset = (void *)(item.firstIndex * sizeof(uint32_t));
+				  if (instanceCount == 0)
+					  glDrawElements(GL_TRIANGLES, (GLsizei)item.indexCount, GL_UNSIGNED_INT, offset);
+				  else if (instanced)
+					  scene.draw(item.indexCount, item.firstIndex, lights);
+				  else
+					  for (size_t i = 0; i < scene.size(); ++i)
+					  {
+						  glPushMatrix();
+						  glMultMatrixf(scene.matrix(i));
+						  glDrawElements(GL_TRIANGLES, (GLsizei)item.indexCount, GL_UNSIGNED_INT, offset);
+						  glPopMatrix();
+					  } });
+	drawCalls = items.size() * (instanceCount && !instanced ? scene.size() : 1);
+	drawnTriangles = lod.indexCount / 3 * max<size_t>(instanceCount, 1);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	if (occlusionBuffer)
+	{
+		glClientActiveTexture(GL_TEXTURE2);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glClientActiveTexture(GL_TEXTURE0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Load a .obj file and upload it for rendering, all at once
+void loadObj(string fname)
+{
+	auto data = make_shared<ModelData>();
+	data->requested = chrono::steady_clock::now();
+	if (!loadMeshData(fname, *data))
+		exit(1);
+	beginModelUpload(data);
+	uploadModelRange(data->view.vertexCount, data->view.indexCount);
+	finishModelUpload();
+}
+
+// Load a .obj file for the software renderer alone: nothing is uploaded, so
+// no GL context is needed
+void loadObjSoftware(string fname)
+{
+	auto data = make_shared<ModelData>();
+	data->requested = chrono::steady_clock::now();
+	if (!loadMeshData(fname, *data))
+		exit(1);
+	modelData = data;
+	meshView = data->view;
+	currentLod = 0;
+}
+
+// Map a .bmp file for the software renderer alone, without uploading it. It
+// samples the base level only, so no mipmaps or compressed blocks are made.
+void loadTextureSoftware(const string &filename)
+{
+	compressTextures = useMipmaps = false;
+	auto data = make_shared<TextureData>();
+	if (!loadTextureData(filename, *data))
+		exit(1);
+	textureData = data;
+	softwareTexture.clear();
+}
+
+// Something on screen changed: draw a new frame once the pending events are
+// handled. GLUT keeps one redisplay flag per window, which serves as the
+// scene's dirty flag: any number of changes before the next frame result in
+// a single frame, and nothing is drawn while the viewer is idle.
+void markDirty()
+{
+	if (!offscreen)
+		glutPostRedisplay();
+}
+
+// Background loading. One loader thread per kind of asset does the slow part
+// (parsing or mapping the cache, decoding the BMP) and hands the results to
+// the render thread through lock-free queues. The render thread uploads them
+// between frames within a time budget, a chunk of triangles at a time, so a
+// large model shows up progressively and the window keeps responding.
+
+// A prefix of a model's buffers, ready for upload
+struct ModelPart
+{
+	shared_ptr<ModelData> model; // nullptr if the load failed
+	unsigned generation = 0;	 // Request it answers
+	size_t vertexEnd = 0, indexEnd = 0;
+};
+
+// A mapped texture
+struct TexturePart
+{
+	shared_ptr<TextureData> texture; // nullptr if the load failed
+	unsigned generation = 0;
+};
+
+const size_t uploadChunkTriangles = 32768; // Triangles per model part
+const double uploadBudgetMs = 8.0;		   // Upload time per poll of the queues
+const int loaderPollMs = 10;			   // Interval between polls while loading
+
+SpscQueue<ModelPart, 64> modelQueue;
+SpscQueue<TexturePart, 4> textureQueue;
+
+// Loader thread: push `part`, waiting while the queue is full. Gives up once
+// the request went stale.
+template <typename Queue, typename Part>
+bool pushPart(Queue &queue, Part part, const LoadWorker &worker)
+{
+	while (!queue.tryPush(std::move(part)))
+	{
+		if (worker.stale(part.generation))
+			return false;
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+	return true;
+}
+
+// Loader thread: load a model and queue it in chunks of triangles. Vertices
+// are numbered by first use (optimizeVertexFetch), so a chunk needs only the
+// vertices up to the largest index seen so far.
+void loadModelJob(const LoadWorker &worker, const string &path, unsigned generation)
+{
+	auto data = make_shared<ModelData>();
+	data->requested = chrono::steady_clock::now();
+	if (!loadMeshData(path, *data))
+	{
+		pushPart(modelQueue, ModelPart{nullptr, generation, 0, 0}, worker);
+		return;
+	}
+
+	const MeshView &view = data->view;
+	size_t vertexEnd = 0;
+	for (size_t begin = 0;;)
+	{
+		if (worker.stale(generation))
+			return;
+		size_t end = min(view.indexCount, begin + 3 * uploadChunkTriangles);
+		for (size_t i = begin; i < end; ++i)
+			vertexEnd = max(vertexEnd, (size_t)view.indices[i] + 1);
+		vertexEnd = end == view.indexCount ? view.vertexCount : min(vertexEnd, view.vertexCount);
+		if (!pushPart(modelQueue, ModelPart{data, generation, vertexEnd, end}, worker) || end == view.indexCount)
+			return;
+		begin = end;
+	}
+}
+
+// Loader thread: decode a texture and queue it
+void loadTextureJob(const LoadWorker &worker, const string &path, unsigned generation)
+{
+	auto data = make_shared<TextureData>();
+	if (!loadTextureData(path, *data))
+		data.reset();
+	pushPart(textureQueue, TexturePart{data, generation}, worker);
+}
+
+LoadWorker modelLoader(loadModelJob), textureLoader(loadTextureJob);
+string modelPath, texturePath;		 // Latest requests
+string loadingModel, loadingTexture; // Requests still loading (empty = none)
+unsigned uploadingGeneration = 0;	 // Request of the model being uploaded
+bool pollingLoaders = false;		 // loaderTimer is scheduled
+
+// Upload what the loaders handed over, for up to uploadBudgetMs, and redraw.
+// Results of superseded requests are dropped. Returns true while loads are
+// still in flight.
+bool pollLoaders()
+{
+	auto start = chrono::steady_clock::now();
+
+	TexturePart texture;
+	while (textureQueue.tryPop(texture))
+	{
+		if (texture.generation != textureLoader.latest())
+			continue;
+		if (texture.texture)
+		{
+			uploadTexture(*texture.texture);
+			textureData = texture.texture;
+			softwareTexture.clear();
+		}
+		else
+			cerr << "Cannot load texture " << loadingTexture << endl;
+		loadingTexture.clear();
+		markDirty();
+	}
+
+	ModelPart part;
+	while (chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() < uploadBudgetMs &&
+		   modelQueue.tryPop(part))
+	{
+		if (part.generation != modelLoader.latest())
+			continue;
+		markDirty();
+		if (!part.model)
+		{
+			cerr << "Cannot load model " << loadingModel << endl;
+			loadingModel.clear();
+			continue;
+		}
+		if (part.model != modelData)
+		{
+			beginModelUpload(part.model);
+			uploadingGeneration = part.generation;
+		}
+		uploadModelRange(part.vertexEnd, part.indexEnd);
+		if (part.indexEnd == part.model->view.indexCount)
+		{
+			finishModelUpload();
+			loadingModel.clear();
+		}
+	}
+	return !loadingModel.empty() || !loadingTexture.empty();
+}
+
+// Poll the loaders from the event loop while they are busy
+void loaderTimer(int)
+{
+	pollingLoaders = pollLoaders();
+	if (pollingLoaders)
+		glutTimerFunc(loaderPollMs, loaderTimer, 0);
+}
+
+void startLoaderPolling()
+{
+	markDirty(); // Show the loading indicator
+	if (!pollingLoaders && !offscreen)
+	{
+		pollingLoaders = true;
+		glutTimerFunc(0, loaderTimer, 0);
+	}
+}
+
+// Load a model in the background; the current one stays on screen until the
+// first triangles of the new one arrive
+void requestModel(const string &path)
+{
+	modelPath = loadingModel = path;
+	modelLoader.request(path);
+	startLoaderPolling();
+}
+
+// Load a texture in the background; the current one is kept until then
+void requestTexture(const string &path)
+{
+	texturePath = loadingTexture = path;
+	textureLoader.request(path);
+	startLoaderPolling();
+}
+
+// Wait for the loader threads, before anything they use is destroyed
+void stopLoaders()
+{
+	modelLoader.stop();
+	textureLoader.stop();
+}
+
+// What is still loading, in the bottom left corner
+void drawLoadingIndicator()
+{
+	vector<string> lines;
+	if (!loadingModel.empty())
+	{
+		string line = "Loading " + loadingModel + "...";
+		if (modelData && uploadingGeneration == modelLoader.latest() && modelData->view.indexCount)
+			line += " " + to_string(100 * meshView.indexCount / modelData->view.indexCount) + "%";
+		lines.push_back(line);
+	}
+	if (!loadingTexture.empty())
+		lines.push_back("Loading " + loadingTexture + "...");
+	drawOverlayText(lines, 10, 10 + 15 * ((int)lines.size() - 1), 1.0f, 1.0f, 1.0f);
+}
+
+// Time from the start of the process to the first frame, to the first frame
+// with part of the model and to the first frame with all of it
+chrono::steady_clock::time_point processStart = chrono::steady_clock::now();
+
+void reportStartupTimes()
+{
+	static bool firstFrame = false, firstGeometry = false, complete = false;
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - processStart).count();
+	if (!firstFrame)
+	{
+		firstFrame = true;
+		cout << "First frame after " << ms << " ms" << endl;
+	}
+	if (!firstGeometry && meshView.indexCount > 0)
+	{
+		firstGeometry = true;
+		cout << "First frame with geometry after " << ms << " ms" << endl;
+	}
+	if (!complete && modelData && loadingModel.empty())
+	{
+		complete = true;
+		cout << "First frame with the complete model after " << ms << " ms" << endl;
+	}
+}
+
+// Draw `count` copies of the model (0 = the model alone)
+void setInstanceCount(size_t count)
+{
+	instanceCount = count;
+	scene.scatter(instanceCount, meshView.bounds);
+}
+
+// Pick the level of detail from the projected size of the model: the
+// coarsest level whose error covers at most `lodPixelError` pixels at the
+// model's distance, with the perspective set up in reshape. The current level
+// is only left once it is off by more than a hysteresis band, so the model
+// does not flicker between two levels near a threshold.
+void selectLod()
+{
+	const double band = 0.25;
+	double distance = max(1.0, sqrt((double)translateX * translateX + translateY * translateY + translateZ * translateZ));
+	double objectScale = scale * (instanceCount ? scene.instanceScale() : 1.0f);
+	double pixelsPerUnit = objectScale * viewportHeight / (2.0 * distance * tan(fieldOfViewY * M_PI / 360.0));
+	auto pixels = [&](size_t level)
+	{ return meshView.level(level).error * pixelsPerUnit; };
+
+	size_t target = 0;
+	while (target + 1 < meshView.levelCount() && pixels(target + 1) <= lodPixelError)
+		++target;
+	size_t next = currentLod;
+	if (target > currentLod)
+		while (next < target && pixels(next + 1) <= lodPixelError / (1 + band))
+			++next;
+	else if (target < currentLod && pixels(currentLod) > lodPixelError * (1 + band))
+		next = target;
+
+	if (next != currentLod)
+	{
+		currentLod = next;
+		cout << "Level of detail " << currentLod << " (" << meshView.level(currentLod).indexCount / 3 << " triangles)"
+			 << endl;
+	}
+}
+
+// Set up 3-point lighting
+void initLighting()
+{
+	glEnable(GL_LIGHTING);
+	glEnable(GL_DEPTH_TEST);
+	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+
+	glDisable(GL_COLOR_MATERIAL); // Disable color-based materials — it will be set manually!
+
+	// Set up each light source
+	for (int i = 0; i < 3; ++i)
+	{
+		glLightfv(GL_LIGHT0 + i, GL_POSITION, lightPositions[i]);
+		glLightfv(GL_LIGHT0 + i, GL_AMBIENT, lightAmbient[i]);
+		glLightfv(GL_LIGHT0 + i, GL_DIFFUSE, lightDiffuse[i]);
+		glLightfv(GL_LIGHT0 + i, GL_SPECULAR, lightSpecular[i]);
+		glEnable(GL_LIGHT0 + i);
+	}
+}
+
+// Multiply the model's placement, scale and rotation onto the modelview matrix
+void applyModelTransform()
+{
+	glTranslatef(translateX, translateY, translateZ);
+	glScalef(scale, scale, scale);
+	glRotatef(rotX, 1, 0, 0);
+	glRotatef(rotY, 0, 1, 0);
+	glRotatef(rotZ, 0, 0, 1);
+}
+
+// Corner of the picked triangle nearest to the hit point: the one with the
+// largest barycentric weight
+uint32_t pickedVertex()
+{
+	const uint32_t *corner = &modelData->view.indices[3 * picked.triangle];
+	float w0 = 1.0f - picked.u - picked.v;
+	return corner[w0 >= picked.u && w0 >= picked.v ? 0 : picked.u >= picked.v ? 1 : 2];
+}
+
+// Rotate `v` by `degrees` around the x, y or z axis, as glRotatef
+void rotateVector(float v[3], float degrees, int axis)
+{
+	float c = cosf(degrees * (float)M_PI / 180.0f), s = sinf(degrees * (float)M_PI / 180.0f);
+	int a = (axis + 1) % 3, b = (axis + 2) % 3; // The two coordinates that turn
+	float va = v[a], vb = v[b];
+	v[a] = c * va - s * vb;
+	v[b] = s * va + c * vb;
+}
+
+// Ray through the centre of window pixel (x, y) (y down, as GLUT reports
+// it), in model coordinates: unprojected through the gluPerspective of
+// reshape, from the eye at the origin, then through the inverse of
+// applyModelTransform, step by step in reverse order
+void pickRay(int x, int y, float origin[3], float direction[3])
+{
+	float aspect = (float)viewportWidth / viewportHeight;
+	float tanHalf = (float)tan(fieldOfViewY * M_PI / 360.0);
+	float ndcX = 2.0f * (x + 0.5f) / viewportWidth - 1.0f, ndcY = 1.0f - 2.0f * (y + 0.5f) / viewportHeight;
+	float eye[3] = {ndcX * tanHalf * aspect, ndcY * tanHalf, -1.0f};
+	float position[3] = {-translateX / scale, -translateY / scale, -translateZ / scale};
+	for (int k = 0; k < 3; ++k)
+		eye[k] /= scale;
+	const float angles[3] = {rotX, rotY, rotZ};
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		rotateVector(position, -angles[axis], axis);
+		rotateVector(eye, -angles[axis], axis);
+	}
+	copy(position, position + 3, origin);
+	copy(eye, eye + 3, direction);
+}
+
+// Find the triangle of the model under window pixel (x, y), and its vertex
+// nearest to where the ray hits it
+void pickAt(int x, int y)
+{
+	if (!modelData || modelData->bvh.empty())
+		return;
+	if (instanceCount)
+	{
+		cout << "Picking works on the model alone, without instances" << endl;
+		return;
+	}
+	auto t0 = chrono::steady_clock::now();
+	float origin[3], direction[3];
+	pickRay(x, y, origin, direction);
+	picked = modelData->bvh.intersect(origin, direction);
+	pickMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	if (!picked.hit())
+	{
+		cout << "Nothing under the cursor (" << pickMs << " ms)" << endl;
+		return;
+	}
+	for (int k = 0; k < 3; ++k)
+		pickedPoint[k] = origin[k] + picked.distance * direction[k];
+	uint32_t vertex = pickedVertex();
+	const float *p = modelData->view.vertices[vertex].position;
+	printf("Picked triangle %u, vertex %u (%.3f, %.3f, %.3f), point (%.3f, %.3f, %.3f) in %.3f ms\n", picked.triangle,
+		   vertex, p[0], p[1], p[2], pickedPoint[0], pickedPoint[1], pickedPoint[2], pickMs);
+	fflush(stdout);
+}
+
+// Outline the picked triangle and mark its nearest vertex and the hit point,
+// over the model
+void drawPick()
+{
+	if (!picked.hit() || !modelData || instanceCount)
+		return;
+	const Vertex *vertices = modelData->view.vertices;
+	const uint32_t *corner = &modelData->view.indices[3 * picked.triangle];
+	glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT | GL_LINE_BIT | GL_POINT_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_DEPTH_TEST);
+	glPushMatrix();
+	applyModelTransform();
+	glLineWidth(2.0f);
+	glColor3f(1.0f, 1.0f, 0.0f);
+	glBegin(GL_LINE_LOOP);
+	for (int c = 0; c < 3; ++c)
+		glVertex3fv(vertices[corner[c]].position);
+	glEnd();
+	glPointSize(6.0f);
+	glBegin(GL_POINTS);
+	glColor3f(1.0f, 0.0f, 0.0f);
+	glVertex3fv(vertices[pickedVertex()].position);
+	glColor3f(0.0f, 1.0f, 1.0f);
+	glVertex3fv(pickedPoint);
+	glEnd();
+	glPopMatrix();
+	glPopAttrib();
+}
+
+// True when the per-pixel path shades this frame. The instanced path keeps
+// its own shader, with the three fixed-function lights, and the software
+// renderer lights per vertex.
+bool usesShaderLighting()
+{
+	return shaderLighting && tiledLighting.available() && !softwareRendering &&
+		   !(instanceCount && useInstancing && scene.hasInstancing() && !useDisplayList);
+}
+
+// Hand this frame's lights to the per-pixel path, in eye space: the 3-point
+// lights that are on, read back from the fixed-function state (so the fixed
+// and follow-model modes carry over), then lightCount - 3 coloured point
+// lights scattered through the model's bounds, which move with it
+void updateShaderLights()
+{
+	vector<PointLight> list;
+	float ambient[3] = {0.0f, 0.0f, 0.0f};
+	for (int i = 0; i < 3; ++i)
+	{
+		if (!lights[i])
+			continue;
+		GLfloat position[4], lightAmbient[4], diffuse[4], specular[4];
+		glGetLightfv(GL_LIGHT0 + i, GL_POSITION, position);
+		glGetLightfv(GL_LIGHT0 + i, GL_AMBIENT, lightAmbient);
+		glGetLightfv(GL_LIGHT0 + i, GL_DIFFUSE, diffuse);
+		glGetLightfv(GL_LIGHT0 + i, GL_SPECULAR, specular);
+		float w = position[3] != 0.0f ? position[3] : 1.0f;
+		list.push_back({{position[0] / w, position[1] / w, position[2] / w}, 0.0f,
+						{diffuse[0], diffuse[1], diffuse[2]}, {specular[0], specular[1], specular[2]}});
+		for (int k = 0; k < 3; ++k)
+			ambient[k] += lightAmbient[k];
+	}
+
+	GLfloat model[16];
+	glPushMatrix();
+	glLoadIdentity();
+	applyModelTransform();
+	glGetFloatv(GL_MODELVIEW_MATRIX, model);
+	glPopMatrix();
+	const float *b = meshView.bounds;
+	float radius = 0.125f * sqrtf((b[3] - b[0]) * (b[3] - b[0]) + (b[4] - b[1]) * (b[4] - b[1]) + (b[5] - b[2]) * (b[5] - b[2]));
+	uint32_t random = 1;
+	auto next = [&]()
+	{
+		random = random * 1664525u + 1013904223u; // LCG, for the same lights every frame
+		return (random >> 8) * (1.0f / 16777216.0f);
+	};
+	for (size_t i = 3; i < lightCount; ++i)
+	{
+		float p[3], color[3];
+		for (int k = 0; k < 3; ++k)
+			p[k] = b[k] + next() * (b[k + 3] - b[k]);
+		for (int k = 0; k < 3; ++k)
+			color[k] = 0.2f + 0.6f * next();
+		PointLight light = {{}, radius * scale, {color[0], color[1], color[2]}, {color[0], color[1], color[2]}};
+		for (int k = 0; k < 3; ++k)
+			light.position[k] = model[k] * p[0] + model[4 + k] * p[1] + model[8 + k] * p[2] + model[12 + k];
+		list.push_back(light);
+	}
+
+	GLfloat projection[16];
+	GLint viewport[4];
+	glGetFloatv(GL_PROJECTION_MATRIX, projection);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	tiledLighting.setLights(list, ambient, projection, viewport[2], viewport[3], cullLights);
+}
+
+// Darken what is drawn until endOcclusion by the baked occlusion of the
+// model: its per-vertex value is texture coordinate s of unit 2, which looks
+// up a ramp modulating the lit (and textured) colour. The per-pixel lighting
+// shader reads the same coordinate. Returns false if there is none to show.
+bool beginOcclusion()
+{
+	if (!showOcclusion || !meshView.occlusion)
+		return false;
+	glActiveTexture(GL_TEXTURE2);
+	if (!occlusionRamp)
+	{
+		unsigned char ramp[256];
+		for (int i = 0; i < 256; ++i)
+			ramp[i] = (unsigned char)(255 - i);
+		glGenTextures(1, &occlusionRamp);
+		glBindTexture(GL_TEXTURE_1D, occlusionRamp);
+		glTexImage1D(GL_TEXTURE_1D, 0, GL_LUMINANCE, 256, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, ramp);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_1D, occlusionRamp);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	glEnable(GL_TEXTURE_1D);
+	glActiveTexture(GL_TEXTURE0);
+	return true;
+}
+
+void endOcclusion()
+{
+	glActiveTexture(GL_TEXTURE2);
+	glDisable(GL_TEXTURE_1D);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// Render the 3D model
+void draw3dObject()
+{
+	glPushMatrix();
+	applyModelTransform();
+	// Normals are unit length from loading on, and every scale is uniform:
+	// rescaling them is enough, and only needed when something is scaled
+	if (scale == 1.0f && instanceCount == 0)
+		glDisable(GL_RESCALE_NORMAL);
+	else
+		glEnable(GL_RESCALE_NORMAL);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	stateChanges = 0;
+	bool occluded = beginOcclusion();
+	bool perPixel = usesShaderLighting();
+	if (perPixel)
+		tiledLighting.begin();
+	if (useDisplayList)
+	{
+		// Display lists cannot be instanced: one call per copy
+		for (size_t i = 0; i < max<size_t>(scene.size(), 1); ++i)
+		{
+			glPushMatrix();
+			if (instanceCount)
+				glMultMatrixf(scene.matrix(i));
+			glCallList(model);
+			glPopMatrix();
+		}
+		size_t copies = max<size_t>(instanceCount, 1);
+		drawCalls = listDraws * copies;
+		stateChanges = listStateChanges * copies;
+		drawnTriangles = meshView.triangleCount() * copies;
+	}
+	else
+	{
+		selectLod();
+		drawVertexBuffers();
+	}
+	if (perPixel)
+		tiledLighting.end();
+	if (occluded)
+		endOcclusion();
+	glPopMatrix();
+}
+
+// Draw the model with the software renderer into its own framebuffer of
+// `width` x `height` pixels, as draw3dObject would with the three lights of
+// display(). No GL call is made. Instances and per-pixel lighting are left out.
+void renderSoftware(int width, int height)
+{
+	if (softwareRenderer.imageWidth() != width || softwareRenderer.imageHeight() != height)
+		softwareRenderer.resize(width, height);
+	softwareRenderer.clear(0, 0, 0);
+	drawCalls = stateChanges = drawnTriangles = 0;
+	if (!modelData)
+		return;
+
+	// The lights in eye space: fixed, or placed like the model without its scale
+	SoftwareMatrix lightMatrix;
+	if (lightingFollowsModel)
+	{
+		lightMatrix.translate(translateX, translateY, translateZ);
+		lightMatrix.rotate(rotX, 1, 0, 0);
+		lightMatrix.rotate(rotY, 0, 1, 0);
+	}
+	vector<SoftwareLight> list;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (!lights[i])
+			continue;
+		SoftwareLight light;
+		for (int r = 0; r < 4; ++r)
+			light.position[r] = lightMatrix.m[r] * lightPositions[i][0] + lightMatrix.m[4 + r] * lightPositions[i][1] +
+								lightMatrix.m[8 + r] * lightPositions[i][2] + lightMatrix.m[12 + r] * lightPositions[i][3];
+		copy(lightAmbient[i], lightAmbient[i] + 4, light.ambient);
+		copy(lightDiffuse[i], lightDiffuse[i] + 4, light.diffuse);
+		copy(lightSpecular[i], lightSpecular[i] + 4, light.specular);
+		list.push_back(light);
+	}
+	const float globalAmbient[4] = {0.2f, 0.2f, 0.2f, 1.0f}; // GL's default GL_LIGHT_MODEL_AMBIENT
+	softwareRenderer.setLights(list, globalAmbient);
+
+	if (textureData && softwareTexture.empty())
+	{
+		const BmpImage &image = textureData->image;
+		softwareTexture.assign(image.bottomRow(), image.rowStep(), image.width(), image.height(), image.bytesPerPixel());
+	}
+	softwareRenderer.setTexture(&softwareTexture);
+	softwareRenderer.setOcclusion(showOcclusion ? meshView.occlusion : nullptr);
+
+	SoftwareMatrix model;
+	model.translate(translateX, translateY, translateZ);
+	model.scale(scale, scale, scale);
+	model.rotate(rotX, 1, 0, 0);
+	model.rotate(rotY, 0, 1, 0);
+	model.rotate(rotZ, 0, 0, 1);
+	SoftwareMatrix projection = SoftwareMatrix::perspective(fieldOfViewY, (double)width / height, 1.0, 1000.0);
+
+	viewportHeight = height;
+	selectLod();
+	MeshLod lod = meshView.level(currentLod);
+	vector<SoftwareDraw> draws;
+	for (const DrawItem &item : drawList(lod))
+	{
+		// Levels after the first follow the full mesh in the index buffer
+		const uint32_t *indices = item.firstIndex < meshView.indexCount
+									  ? meshView.indices + item.firstIndex
+									  : meshView.lodIndices + (item.firstIndex - meshView.indexCount);
+		draws.push_back({indices, item.indexCount, item.material});
+	}
+	softwareRenderer.draw(meshView.vertices, meshView.vertexCount, draws, model.m, projection.m, threadPool());
+	drawCalls = draws.size();
+	drawnTriangles = lod.indexCount / 3;
+}
+
+// Show a frame of the software renderer in the window
+void drawSoftwareFrame()
+{
+	static vector<unsigned char> pixels;
+	renderSoftware(viewportWidth, viewportHeight);
+	softwareRenderer.resolve(pixels);
+
+	glPushAttrib(GL_ENABLE_BIT);
+	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+	glDisable(GL_TEXTURE_2D); // glDrawPixels fragments would be textured and depth tested
+	glDisable(GL_DEPTH_TEST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glWindowPos2i(0, 0);
+	glDrawPixels(viewportWidth, viewportHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	glPopClientAttrib();
+	glPopAttrib();
+}
+
+// Transformation a replay ends in, exactly, so two builds can be compared
+void printTransformState()
+{
+	float state[] = {rotX, rotY, rotZ, translateX, translateY, translateZ, scale};
+	printf("Rotation %.9g %.9g %.9g, translation %.9g %.9g %.9g, scale %.9g (state %016llx)\n", rotX, rotY, rotZ,
+		   translateX, translateY, translateZ, scale, (unsigned long long)stateHash(state, sizeof(state)));
+}
+
+// Report the replay once its last event has been drawn, and exit
+void finishReplay()
+{
+	inputReplay.print(stdout);
+	printTransformState();
+	fflush(stdout);
+	frameStats.collectGpu(true);
+	stopLoaders();
+	exit(0);
+}
+
+void display()
+{
+	inputReplay.beginFrame();
+	frameStats.beginFrame();
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glLoadIdentity();
+
+	// Reapply lighting positions based on mode
+	if (lightingFollowsModel)
+	{
+		// Position lights *after* transformation so they follow the model
+		glPushMatrix();
+		glTranslatef(translateX, translateY, translateZ);
+		glRotatef(rotX, 1, 0, 0);
+		glRotatef(rotY, 0, 1, 0);
+
+		for (int i = 0; i < 3; ++i)
+		{
+			if (lights[i])
+			{
+				glEnable(GL_LIGHT0 + i);
+				glLightfv(GL_LIGHT0 + i, GL_POSITION, lightPositions[i]);
+			}
+			else
+			{
+				glDisable(GL_LIGHT0 + i);
+			}
+		}
+		glPopMatrix();
+	}
+	else
+	{
+		// Default: lights stay fixed in world space
+		for (int i = 0; i < 3; ++i)
+		{
+			if (lights[i])
+				glEnable(GL_LIGHT0 + i);
+			else
+				glDisable(GL_LIGHT0 + i);
+		}
+	}
+	if (usesShaderLighting())
+		updateShaderLights();
+	frameStats.mark(MetricLights);
+
+	// The materials of the .mtl file are set per group, by draw3dObject
+	glColor3f(1.0f, 1.0f, 1.0f); // Object base color (set as white for texture mapping)
+	if (softwareRendering)
+		drawSoftwareFrame();
+	else
+		draw3dObject();
+	drawPick();
+	frameStats.mark(MetricDraw);
+
+	if (showHud)
+	{
+		string counts = to_string(drawCalls) + " draw calls, " + to_string(stateChanges) + " state changes, " +
+						to_string(drawnTriangles) + " triangles";
+		if (instanceCount)
+			counts += ", " + to_string(instanceCount) + " instances" +
+					  (useInstancing && scene.hasInstancing() && !useDisplayList ? " (instanced)" : "");
+		vector<string> lines = {counts};
+		if (usesShaderLighting())
+		{
+			char text[96];
+			snprintf(text, sizeof(text), "%zu lights per pixel, %.1f per tile (max %zu)%s", tiledLighting.lightCount(),
+					 tiledLighting.averageLightsPerTile(), tiledLighting.maxLightsPerTile(), cullLights ? "" : ", no culling");
+			lines.push_back(text);
+		}
+		if (picked.hit())
+		{
+			char text[96];
+			snprintf(text, sizeof(text), "Picked triangle %u, vertex %u in %.3f ms", picked.triangle, pickedVertex(), pickMs);
+			lines.push_back(text);
+		}
+		frameStats.drawHud(lines);
+	}
+	drawLoadingIndicator();
+	frameStats.mark(MetricHud);
+	frameStats.endCommands();
+
+	if (offscreen)
+		glFinish(); // Nothing to swap: wait for the frame instead, as a swap would
+	else
+		glutSwapBuffers();
+	frameStats.mark(MetricSwap);
+	frameStats.endFrame();
+	inputReplay.endFrame();
+	if (!offscreen)
+		reportStartupTimes();
+	if (inputReplay.finished())
+		finishReplay();
+}
+
+// Adjust projection on window resize
+void reshape(int w, int h)
+{
+	if (h == 0)
+		h = 1;
+	glViewport(0, 0, w, h);
+	viewportWidth = w;
+	viewportHeight = h;
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluPerspective(fieldOfViewY, (float)w / (float)h, 1.0, 1000.0);
+	glMatrixMode(GL_MODELVIEW);
+	markDirty();
+}
+
+// Next frame of the continuous frame loops, as soon as the events are handled
+void idle()
+{
+	glutPostRedisplay();
+}
+
+// Set the swap interval of the window (0 = uncapped, 1 = vsync) through the
+// GLX extension the driver offers. Returns false if none of them works.
+bool setSwapInterval(int interval)
+{
+	typedef int (*SwapIntervalMESA)(unsigned int);
+	typedef int (*SwapIntervalSGI)(int);
+	typedef void (*SwapIntervalEXT)(void *, unsigned long, int);
+	typedef void *(*GetCurrentDisplay)();
+	typedef unsigned long (*GetCurrentDrawable)();
+
+	auto mesa = (SwapIntervalMESA)glutGetProcAddress("glXSwapIntervalMESA");
+	if (mesa && mesa(interval) == 0)
+		return true;
+	auto sgi = (SwapIntervalSGI)glutGetProcAddress("glXSwapIntervalSGI");
+	if (sgi && interval > 0 && sgi(interval) == 0) // SGI cannot turn vsync off
+		return true;
+	auto ext = (SwapIntervalEXT)glutGetProcAddress("glXSwapIntervalEXT");
+	auto display = (GetCurrentDisplay)glutGetProcAddress("glXGetCurrentDisplay");
+	auto drawable = (GetCurrentDrawable)glutGetProcAddress("glXGetCurrentDrawable");
+	if (ext && display && drawable && display())
+	{
+		ext(display(), drawable(), interval);
+		return true;
+	}
+	return false;
+}
+
+// Files in `dir` ending with `extension`, as "dir/name", in name order
+vector<string> listFiles(const string &dir, const string &extension)
+{
+	vector<string> files;
+	if (DIR *handle = opendir(dir.c_str()))
+	{
+		while (dirent *entry = readdir(handle))
+		{
+			string name = entry->d_name;
+			if (name.size() > extension.size() &&
+				name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+				files.push_back(dir + "/" + name);
+		}
+		closedir(handle);
+	}
+	sort(files.begin(), files.end());
+	return files;
+}
+
+// The file `step` places after `path` among the files of its directory with
+// the same extension, wrapping around
+string siblingFile(const string &path, int step)
+{
+	size_t slash = path.find_last_of('/'), dot = path.find_last_of('.');
+	if (dot == string::npos || (slash != string::npos && dot < slash))
+		return path;
+	vector<string> files = listFiles(slash == string::npos ? "." : path.substr(0, slash), path.substr(dot));
+	if (files.empty())
+		return path;
+	string current = slash == string::npos ? "./" + path : path;
+	long index = find(files.begin(), files.end(), current) - files.begin();
+	if (index == (long)files.size())
+		index = step > 0 ? -1 : 0; // Not listed: start from either end
+	long count = (long)files.size();
+	return files[((index + step) % count + count) % count];
+}
+
+// Modifier keys held during the current input event
+int inputModifiers()
+{
+	return inputReplay.active() ? replayModifiers : glutGetModifiers();
+}
+
+// Add an event to the --record log
+void recordInput(InputEventType type, int key, int state, int x, int y)
+{
+	if (!inputLogPath.empty() && !inputReplay.active())
+		inputLog.record(type, key, state, x, y, type == InputMotion ? 0 : glutGetModifiers());
+}
+
+void saveInputLog()
+{
+	if (inputLog.save(inputLogPath))
+		cout << "Recorded " << inputLog.events().size() << " input events to " << inputLogPath << endl;
+	else
+		cerr << "Cannot write the input log " << inputLogPath << endl;
+}
+
+// Handles keyboard input for transforming the model and toggling lights
+// CONTROLS:
+// 'w', 's' - rotate up/down
+// 'a', 'd' - rotate left/right
+// 'z', 'x' - rotate counter-clockwise/clockwise around Z-axis
+// '+', '-' - zoom in/out
+// 'i', 'k' - translate vertically
+// 'j', 'l' - translate horizontally
+// 'u', 'o' - zoom in/out (move closer/further)
+// 'f' - Fix lighting in world space (default)
+// 'm' - Make lighting follow model rotation and position
+// '1', '2', '3' - toggle lights 0–2 (red, green, blue)
+// 'g' - toggle per-pixel lighting
+// '.', ',' - twice/half as many lights (per-pixel lighting)
+// 'r' - toggle the software renderer
+// 'c' - show/hide the baked ambient occlusion (--ao N)
+// 'h' - show/hide the frame time overlay
+// 'n', 'p' - load the next/previous .obj of the model's directory
+// 't' - load the next .bmp of the texture's directory
+// ']', '[' - ten times more/fewer copies of the model
+// 'SPACE' - reset all transformations
+// 'ESC' - exit program
+void keyboard(unsigned char key, int x, int y)
+{
+	recordInput(InputKeyboard, key, 0, x, y);
+	switch (key)
+	{
+	case 'a':
+		rotY -= 5;
+		cout << "Rotated left (Y-axis -5 degrees)" << endl;
+		break;
+	case 'd':
+		rotY += 5;
+		cout << "Rotated right (Y-axis +5 degrees)" << endl;
+		break;
+	case 'w':
+		rotX -= 5;
+		cout << "Rotated up (X-axis -5 degrees)" << endl;
+		break;
+	case 's':
+		rotX += 5;
+		cout << "Rotated down (X-axis +5 degrees)" << endl;
+		break;
+	case 'z': // Rotate counter-clockwise around Z-axis
+		rotZ -= 5;
+		cout << "Rotated counter-clockwise (Z-axis -5 degrees)" << endl;
+		break;
+	case 'x': // Rotate clockwise around Z-axis
+		rotZ += 5;
+		cout << "Rotated clockwise (Z-axis +5 degrees)" << endl;
+		break;
+	case '+':
+		scale += 0.1f;
+		cout << "Scaled up (current scale: " << scale << ")" << endl;
+		break;
+	case '-':
+		scale = max(0.1f, scale - 0.1f);
+		cout << "Scaled down (current scale: " << scale << ")" << endl;
+		break;
+	case 'j':
+		translateX -= 2.0f;
+		cout << "Translated left (X-axis -2 units)" << endl;
+		break;
+	case 'l':
+		translateX += 2.0f;
+		cout << "Translated right (X-axis +2 units)" << endl;
+		break;
+	case 'i':
+		translateY += 2.0f;
+		cout << "Translated up (Y-axis +2 units)" << endl;
+		break;
+	case 'k':
+		translateY -= 2.0f;
+		cout << "Translated down (Y-axis -2 units)" << endl;
+		break;
+	case 'u': // Translate closer (zoom in)
+		translateZ += 2.0f;
+		cout << "Moved closer (Z-axis +2 units)" << endl;
+		break;
+	case 'o': // Translate further (zoom out)
+		translateZ -= 2.0f;
+		cout << "Moved further (Z-axis -2 units)" << endl;
+		break;
+	case 'f':
+		lightingFollowsModel = false;
+		cout << "Lighting set to fixed (world space)" << endl;
+		break;
+	case 'm':
+		lightingFollowsModel = true;
+		cout << "Lighting set to follow model" << endl;
+		break;
+	case '1':
+		lights[0] = !lights[0];
+		cout << "Toggled Light 0 (Specular - Red): " << (lights[0] ? "ON" : "OFF") << endl;
+		break;
+	case '2':
+		lights[1] = !lights[1];
+		cout << "Toggled Light 1 (Diffuse - Green): " << (lights[1] ? "ON" : "OFF") << endl;
+		break;
+	case '3':
+		lights[2] = !lights[2];
+		cout << "Toggled Light 2 (Ambient - Blue): " << (lights[2] ? "ON" : "OFF") << endl;
+		break;
+	case 'g':
+		shaderLighting = !shaderLighting;
+		if (shaderLighting && !tiledLighting.available())
+			cout << "Per-pixel lighting needs GLSL 1.50, lighting stays fixed-function" << endl;
+		else
+			cout << "Per-pixel lighting: " << (shaderLighting ? "ON" : "OFF") << endl;
+		break;
+	case '.':
+	case ',':
+		lightCount = key == '.' ? min<size_t>(lightCount * 2, 1024) : max<size_t>(lightCount / 2, 3);
+		shaderLighting = true;
+		cout << "Lights: " << lightCount << endl;
+		break;
+	case 'r':
+		softwareRendering = !softwareRendering;
+		cout << "Software renderer: " << (softwareRendering ? "ON" : "OFF") << endl;
+		break;
+	case 'c':
+		showOcclusion = !showOcclusion;
+		if (!meshView.occlusion)
+			cout << "No baked occlusion, load the model with --ao N" << endl;
+		else
+			cout << "Ambient occlusion: " << (showOcclusion ? "ON" : "OFF") << endl;
+		break;
+	case 'h':
+		showHud = !showHud;
+		cout << "Frame time overlay: " << (showHud ? "ON" : "OFF") << endl;
+		break;
+	case 'n':
+	case 'p':
+		requestModel(siblingFile(modelPath, key == 'n' ? 1 : -1));
+		break;
+	case 't':
+		requestTexture(siblingFile(texturePath, 1));
+		break;
+	case ']':
+		setInstanceCount(instanceCount ? min<size_t>(instanceCount * 10, 100000) : 10);
+		cout << "Instances: " << instanceCount << endl;
+		break;
+	case '[':
+		setInstanceCount(instanceCount / 10 > 1 ? instanceCount / 10 : 0);
+		cout << "Instances: " << instanceCount << endl;
+		break;
+	case ' ':
+		rotX = rotY = rotZ = 0.0f;
+		translateX = translateY = 0.0f;
+		translateZ = -105.0f;
+		scale = 1.0f;
+		cout << "Reset all transformations" << endl;
+		break;
+	case 27:
+		cout << "Exiting program (ESC key)" << endl;
+		frameStats.collectGpu(true); // Complete the CSV rows still waiting for the GPU
+		stopLoaders();
+		exit(0);
+	default:
+		return;
+	}
+	markDirty();
+}
+
+// Mouse state tracking
+int lastMouseX, lastMouseY;
+bool leftButtonDown = false, rightButtonDown = false;
+
+// Handles mouse button input for rotating/translating the model or zooming
+// Left button  - activates rotation when dragging
+// Shift + left click - picks the triangle under the cursor
+// Right button - activates translation when dragging
+// Scroll up/down - zoom in/out
+void mouseButton(int button, int state, int x, int y)
+{
+	recordInput(InputMouseButton, button, state, x, y);
+	if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN && (inputModifiers() & GLUT_ACTIVE_SHIFT))
+	{
+		pickAt(x, y);
+		markDirty();
+		return;
+	}
+	if (button == GLUT_LEFT_BUTTON)
+		leftButtonDown = (state == GLUT_DOWN);
+	else if (button == GLUT_RIGHT_BUTTON)
+		rightButtonDown = (state == GLUT_DOWN);
+
+	lastMouseX = x;
+	lastMouseY = y;
+
+	// Zoom in/out with scroll wheel
+	if (button == 3)
+		scale += 0.1f;
+	else if (button == 4)
+		scale = max(0.1f, scale - 0.1f);
+	else
+		return;
+	markDirty();
+}
+
+// Handles mouse motion when a button is held down
+// Left drag - rotates the model
+// Right drag - translates the model
+void motion(int x, int y)
+{
+	recordInput(InputMotion, 0, 0, x, y);
+	int dx = x - lastMouseX;
+	int dy = y - lastMouseY;
+
+	if (leftButtonDown)
+	{
+		rotY += dx * 0.5f;
+		rotX += dy * 0.5f;
+	}
+	else if (rightButtonDown)
+	{
+		translateX += dx * 0.1f;
+		translateY -= dy * 0.1f;
+	}
+
+	lastMouseX = x;
+	lastMouseY = y;
+	if ((dx || dy) && (leftButtonDown || rightButtonDown))
+		markDirty();
+}
+
+// Call the callback an event was recorded for. ESC is left out: the end of
+// the log ends the replay.
+void dispatchInput(const InputEvent &e)
+{
+	replayModifiers = e.modifiers;
+	if (e.type == InputKeyboard && e.key != 27)
+		keyboard(e.key, e.x, e.y);
+	else if (e.type == InputMouseButton)
+		mouseButton(e.key, e.state, e.x, e.y);
+	else if (e.type == InputMotion)
+		motion(e.x, e.y);
+}
+
+// Original timing: send every event that is due, then sleep until the next.
+// The last event is followed by one more frame, which ends the replay.
+void replayTimer(int)
+{
+	while (const InputEvent *e = inputReplay.due())
+		dispatchInput(*e);
+	if (inputReplay.finished())
+		glutPostRedisplay();
+	else
+		glutTimerFunc(inputReplay.waitMs(), replayTimer, 0);
+}
+
+// Live input would change where the replay ends: only ESC still works, to
+// stop it early
+void replayKeyboard(unsigned char key, int x, int y)
+{
+	if (key == 27)
+		keyboard(key, x, y);
+}
+
+// As fast as possible: one event, then one frame
+void replayIdle()
+{
+	if (const InputEvent *e = inputReplay.due())
+		dispatchInput(*e);
+	glutPostRedisplay();
+}
+
+// Load a log written by --record and start feeding it to the callbacks in the
+// window size it was recorded in
+void startReplay(const string &path)
+{
+	if (!inputReplay.log.load(path))
+	{
+		cerr << "Cannot read the input log " << path << endl;
+		exit(1);
+	}
+	glutReshapeWindow(inputReplay.log.width, inputReplay.log.height);
+	glutKeyboardFunc(replayKeyboard);
+	glutMouseFunc(nullptr);
+	glutMotionFunc(nullptr);
+	inputReplay.start();
+	if (inputReplay.fast)
+		glutIdleFunc(replayIdle);
+	else
+		glutTimerFunc(inputReplay.waitMs(), replayTimer, 0);
+}
+
+// True if the legacy vector-of-vectors data holds the same geometry as `mesh`
+bool sameGeometry(const LegacyObjData &legacy, const Mesh &mesh)
+{
+	auto flatten = [](const auto &rows)
+	{
+		vector<typename decay_t<decltype(rows)>::value_type::value_type> flat;
+		for (const auto &row : rows)
+			flat.insert(flat.end(), row.begin(), row.end());
+		return flat;
+	};
+	return flatten(legacy.vertices) == mesh.vertices && flatten(legacy.normals) == mesh.normals &&
+		   flatten(legacy.texcoords) == mesh.texcoords && flatten(legacy.faces) == mesh.faces &&
+		   flatten(legacy.face_normals) == mesh.face_normals && flatten(legacy.face_texcoords) == mesh.face_texcoords;
+}
+
+bool sameGeometry(const Mesh &a, const Mesh &b)
+{
+	return a.vertices == b.vertices && a.normals == b.normals && a.texcoords == b.texcoords &&
+		   a.faces == b.faces && a.face_normals == b.face_normals && a.face_texcoords == b.face_texcoords &&
+		   a.minX == b.minX && a.maxX == b.maxX && a.minY == b.minY &&
+		   a.maxY == b.maxY && a.minZ == b.minZ && a.maxZ == b.maxZ;
+}
+
+// Compare the mmap parser with the legacy getline/istringstream one on each model
+// Usage: obj_viewer --bench-load <obj_file>...
+void benchLoad(const vector<string> &paths)
+{
+	const int runs = 5;
+	printf("%-32s %9s %12s %12s %8s  %s\n", "model", "size(KB)", "legacy(ms)", "mmap(ms)", "speedup", "same output");
+	for (const string &path : paths)
+	{
+		LegacyObjData legacy;
+		Mesh fast;
+		double legacyMs = INFINITY, fastMs = INFINITY;
+		for (int r = 0; r < runs; ++r)
+		{
+			auto t0 = chrono::steady_clock::now();
+			if (!parseObjLegacy(path, legacy))
+			{
+				cerr << "Failed to open file: " << path << endl;
+				exit(1);
+			}
+			auto t1 = chrono::steady_clock::now();
+			parseObjFile(path, fast);
+			auto t2 = chrono::steady_clock::now();
+			legacyMs = min(legacyMs, chrono::duration<double, milli>(t1 - t0).count());
+			fastMs = min(fastMs, chrono::duration<double, milli>(t2 - t1).count());
+		}
+
+		ifstream f(path, ios::binary | ios::ate);
+		printf("%-32s %9lld %12.2f %12.2f %7.1fx  %s\n", path.c_str(), (long long)f.tellg() / 1024,
+			   legacyMs, fastMs, legacyMs / fastMs,
+			   sameGeometry(legacy, fast) ? "yes" : "no (legacy leaves negative indices unresolved)");
+	}
+}
+
+// Time the chunked parser with 1..N threads (N = --threads, default: one per
+// core) and check every result against a single-threaded parse
+// Usage: obj_viewer --bench-threads [--threads N] <obj_file>...
+void benchThreads(const vector<string> &paths)
+{
+	const int runs = 5;
+	int maxThreads = threadCount() > 0 ? threadCount() : (int)max(1u, thread::hardware_concurrency());
+	printf("%-32s %8s %10s %8s  %s\n", "model", "threads", "parse(ms)", "speedup", "same as serial");
+	for (const string &path : paths)
+	{
+		Mesh serial;
+		ThreadPool single(1);
+		if (!parseObjFile(path, serial, single))
+		{
+			cerr << "Failed to open file: " << path << endl;
+			exit(1);
+		}
+
+		double serialMs = 0;
+		for (int threads = 1; threads <= maxThreads; ++threads)
+		{
+			ThreadPool pool(threads);
+			Mesh parsed;
+			double bestMs = INFINITY;
+			for (int r = 0; r < runs; ++r)
+			{
+				auto t0 = chrono::steady_clock::now();
+				parseObjFile(path, parsed, pool);
+				auto t1 = chrono::steady_clock::now();
+				bestMs = min(bestMs, chrono::duration<double, milli>(t1 - t0).count());
+			}
+			if (threads == 1)
+				serialMs = bestMs;
+			printf("%-32s %8d %10.2f %7.2fx  %s\n", path.c_str(), threads, bestMs, serialMs / bestMs,
+				   sameGeometry(parsed, serial) ? "yes" : "NO");
+		}
+	}
+}
+
+// Heap allocations made through operator new, counted for --bench-memory in
+// builds with -DCOUNT_ALLOCATIONS only, so the viewer itself allocates
+// through the standard operator new
+atomic<size_t> heapAllocations{0};
+
+#ifdef COUNT_ALLOCATIONS
+void *operator new(size_t size)
+{
+	heapAllocations.fetch_add(1, memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1))
+		return p;
+	throw bad_alloc();
+}
+
+// Kept out of line: once inlined, GCC flags the free() as mismatched with new
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+#endif
+
+// Heap allocations and peak RSS growth of loading each model with the legacy
+// vector-of-vectors loader and with Mesh. Each load runs in a forked child so
+// that the peak RSS of one does not hide the other. Allocations are only
+// counted in a build with -DCOUNT_ALLOCATIONS.
+// Usage: obj_viewer --bench-memory <obj_file>...
+void benchMemory(const vector<string> &paths)
+{
+	auto measure = [](auto load)
+	{
+		int fds[2];
+		if (pipe(fds) != 0)
+			return make_pair<size_t, long>(0, 0);
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			close(fds[0]);
+			close(fds[1]);
+			return make_pair<size_t, long>(0, 0);
+		}
+		if (pid == 0)
+		{
+			struct rusage before, after;
+			getrusage(RUSAGE_SELF, &before);
+			size_t allocs = heapAllocations;
+			load();
+			getrusage(RUSAGE_SELF, &after);
+			size_t result[2] = {heapAllocations - allocs, (size_t)(after.ru_maxrss - before.ru_maxrss)};
+			ssize_t written = write(fds[1], result, sizeof(result));
+			_exit(written == sizeof(result) ? 0 : 1);
+		}
+		// Without the write end, read() returns at once if the child dies
+		close(fds[1]);
+		size_t result[2] = {0, 0};
+		ssize_t got = read(fds[0], result, sizeof(result));
+		waitpid(pid, nullptr, 0);
+		close(fds[0]);
+		if (got != sizeof(result))
+			result[0] = result[1] = 0;
+		return make_pair(result[0], (long)result[1]);
+	};
+
+#ifndef COUNT_ALLOCATIONS
+	printf("Built without -DCOUNT_ALLOCATIONS: allocations are not counted\n");
+#endif
+	printf("%-32s %14s %14s %14s %14s\n", "model", "legacy allocs", "Mesh allocs", "legacy RSS(KB)", "Mesh RSS(KB)");
+	for (const string &path : paths)
+	{
+		auto legacy = measure([&]
+							  { LegacyObjData data; parseObjLegacy(path, data); });
+		auto flat = measure([&]
+							{ Mesh data; parseObjFile(path, data); });
+		printf("%-32s %14zu %14zu %14ld %14ld\n", path.c_str(), legacy.first, flat.first, legacy.second, flat.second);
+	}
+}
+
+// Startup cost of each model with and without its binary cache: reading and
+// hashing the source alone (the I/O floor), building the mesh from the text
+// as a launch without a cache does, and opening plus validating the cache
+// Usage: obj_viewer --bench-cache <obj_file>...
+void benchCache(const vector<string> &paths)
+{
+	const int runs = 5;
+	auto bestOf = [&](auto fn)
+	{
+		double best = INFINITY;
+		for (int r = 0; r < runs; ++r)
+		{
+			auto t0 = chrono::steady_clock::now();
+			fn();
+			best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+		}
+		return best;
+	};
+
+	printf("%-32s %14s %10s %10s %12s\n", "model", "read+hash(ms)", "load(ms)", "cache(ms)", "cache(KB)");
+	for (const string &path : paths)
+	{
+		SourceStamp stamp;
+		if (!stamp.read(path))
+		{
+			cerr << "Failed to open file: " << path << endl;
+			exit(1);
+		}
+		double hashMs = bestOf([&]
+							   { stamp.read(path); });
+		// Built by the same code as a launch without a cache, so the cache
+		// holds what its flags say
+		optional<ModelData> built;
+		double parseMs = bestOf([&]
+								{ buildMeshData(path, built.emplace()); });
+		writeMeshCache(path, stamp, built->mesh, meshBuildFlags(), occlusionRays);
+
+		MeshCache cache;
+		bool valid = true;
+		double cacheMs = bestOf([&]
+								{ valid = cache.open(path, stamp, meshBuildFlags(), occlusionRays) && valid; });
+		if (!valid)
+			printf("%-32s cache could not be written or read back\n", path.c_str());
+		else
+			printf("%-32s %14.2f %10.2f %10.2f %12zu\n", path.c_str(), hashMs, parseMs, cacheMs, cache.size() / 1024);
+	}
+}
+
+// Post-transform cache efficiency of each model in .obj order, after the
+// vertex cache pass and after the overdraw pass, for FIFO caches of 16 and 32
+// entries, plus the time each optimization takes
+// Usage: obj_viewer --bench-vcache <obj_file>...
+void benchVertexCache(const vector<string> &paths)
+{
+	printf("%-32s %-10s %8s %8s %8s %8s %10s\n", "model", "order", "ACMR16", "ATVR16", "ACMR32", "ATVR32", "time(ms)");
+	for (const string &path : paths)
+	{
+		Mesh parsed;
+		if (!parseObjFile(path, parsed))
+		{
+			cerr << "Failed to open file: " << path << endl;
+			exit(1);
+		}
+		parsed.center();
+		IndexedMesh original = weldMesh(parsed, true);
+
+		auto report = [&](const char *order, const IndexedMesh &mesh, double ms)
+		{
+			VertexCacheStats s16 = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), 16);
+			VertexCacheStats s32 = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), 32);
+			printf("%-32s %-10s %8.3f %8.3f %8.3f %8.3f %10.2f\n", path.c_str(), order, s16.acmr, s16.atvr,
+				   s32.acmr, s32.atvr, ms);
+		};
+		report("obj", original, 0);
+		for (bool overdraw : {false, true})
+		{
+			IndexedMesh mesh = original;
+			auto t0 = chrono::steady_clock::now();
+			optimizeMesh(mesh, overdraw);
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+			report(overdraw ? "overdraw" : "vcache", mesh, ms);
+		}
+	}
+}
+
+// Levels of detail of each model: triangles, error, the distance from which
+// each level is drawn at scale 1 in a 600 pixel high window, and the time to
+// build the chain
+// Usage: obj_viewer --bench-lod [--lod-error N] <obj_file>...
+void benchLod(const vector<string> &paths)
+{
+	printf("%-32s %6s %10s %12s %14s %10s\n", "model", "level", "triangles", "error", "from distance", "build(ms)");
+	for (const string &path : paths)
+	{
+		Mesh parsed;
+		if (!parseObjFile(path, parsed))
+		{
+			cerr << "Failed to open file: " << path << endl;
+			exit(1);
+		}
+		parsed.center();
+		IndexedMesh mesh = weldMesh(parsed, true);
+		optimizeMesh(mesh, false);
+
+		auto t0 = chrono::steady_clock::now();
+		buildLodChain(mesh);
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+
+		MeshView view(mesh);
+		for (size_t i = 0; i < view.levelCount(); ++i)
+		{
+			MeshLod lod = view.level(i);
+			double from = lod.error * 600 / (2.0 * tan(fieldOfViewY * M_PI / 360.0) * lodPixelError);
+			printf("%-32s %6zu %10u %12.5g %14.1f %10.2f\n", path.c_str(), i, lod.indexCount / 3, lod.error, from, ms);
+		}
+	}
+}
+
+// Normal generation on each model with its normals removed: scalar on one
+// thread, SSE on one thread and SSE on the pool, best of five runs each, plus
+// the largest angle between the SSE and scalar normals and the mean angle
+// between the generated normals and those of the .obj, if it has any
+// Usage: obj_viewer --bench-normals [--crease N] [--area-normals] <obj_file>...
+void benchNormals(const vector<string> &paths)
+{
+	const int runs = 5;
+	ThreadPool single(1);
+	NormalWeighting weighting = areaNormals ? WeightByArea : WeightByAngle;
+	// Largest and mean angle between the normals of the same corner in two meshes, in degrees
+	auto angles = [](const Mesh &a, const Mesh &b)
+	{
+		double worst = 0, sum = 0;
+		size_t count = 0;
+		for (size_t c = 0; c < a.faces.size(); ++c)
+		{
+			int i = a.face_normals[c], j = b.face_normals[c];
+			if (i < 0 || j < 0 || i >= (int)a.normalCount() || j >= (int)b.normalCount())
+				continue;
+			const float *n = &a.normals[3 * i], *m = &b.normals[3 * j];
+			double d = min(1.0, max(-1.0, (double)n[0] * m[0] + (double)n[1] * m[1] + (double)n[2] * m[2]));
+			worst = max(worst, acos(d) * 180.0 / M_PI);
+			sum += acos(d) * 180.0 / M_PI;
+			++count;
+		}
+		return make_pair(worst, count ? sum / count : 0.0);
+	};
+
+	printf("%-32s %10s %11s %11s %11s %11s %12s\n", "model", "triangles", "scalar(ms)", "sse(ms)", "threads(ms)",
+		   "sse-scalar", "obj(mean)");
+	for (const string &path : paths)
+	{
+		Mesh original;
+		if (!parseObjFile(path, original))
+		{
+			cerr << "Failed to open file: " << path << endl;
+			exit(1);
+		}
+		Mesh stripped = original;
+		stripped.normals.clear();
+		stripped.face_normals.assign(stripped.faces.size(), -1);
+
+		Mesh results[3];
+		auto bestOf = [&](Mesh &result, ThreadPool &pool, bool simd)
+		{
+			double best = INFINITY;
+			for (int r = 0; r < runs; ++r)
+			{
+				result = stripped;
+				auto t0 = chrono::steady_clock::now();
+				generateNormals(result, (float)creaseAngle, weighting, pool, simd);
+				best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+			}
+			return best;
+		};
+		double scalarMs = bestOf(results[0], single, false);
+		double sseMs = bestOf(results[1], single, true);
+		double threadsMs = bestOf(results[2], threadPool(), true);
+
+		char reference[32] = "-";
+		if (original.normalCount() > 0)
+			snprintf(reference, sizeof(reference), "%.2f", angles(results[2], original).second);
+		printf("%-32s %10zu %11.2f %11.2f %11.2f %11.5f %12s\n", path.c_str(), stripped.triangleCount(), scalarMs,
+			   sseMs, threadsMs, max(angles(results[1], results[0]).first, angles(results[2], results[0]).first), reference);
+	}
+}
+
+// Camera of the render benchmark at t in [0, 1): one full turn around Y while
+// tilting up and down and moving out to three times the initial distance and
+// back, so every level of detail gets drawn
+void benchCamera(double t)
+{
+	rotY = (float)(360.0 * t);
+	rotX = (float)(20.0 * sin(2.0 * M_PI * t));
+	rotZ = 0.0f;
+	scale = 1.0f;
+	translateX = translateY = 0.0f;
+	translateZ = (float)(-105.0 - 210.0 * (0.5 - 0.5 * cos(2.0 * M_PI * t)));
+}
+
+// JSON string literal of `text`
+string jsonString(const string &text)
+{
+	string out = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			out += '\\';
+		if ((unsigned char)c >= 0x20)
+			out += c;
+	}
+	return out + "\"";
+}
+
+// Render into an EGL pbuffer of the given size instead of a window, with the
+// same GL state the window gets
+void startOffscreen(OffscreenContext &context, int width, int height)
+{
+	if (!context.create(width, height))
+	{
+		cerr << "Cannot create an offscreen OpenGL context (EGL pbuffer)" << endl;
+		exit(1);
+	}
+	offscreen = true;
+	initLighting();
+	reshape(width, height);
+	frameStats.initGpu();
+	scene.init();
+	tiledLighting.init();
+}
+
+// Render every model offscreen along the scripted camera path of benchCamera
+// and report load time, frames per second and frame time percentiles, as a
+// table on stdout and as JSON in the report file. Without .obj files, every
+// .obj in 3d-models/ is used; a .bmp among the files textures all models.
+// Usage: obj_viewer --bench [--frames N] [--report file] [<obj_file>...] [<bmp_file>]
+void benchRender(const vector<string> &inputs, int frames, const string &reportPath)
+{
+	vector<string> paths, textures;
+	for (const string &input : inputs)
+		(input.size() > 4 && input.compare(input.size() - 4, 4, ".bmp") == 0 ? textures : paths).push_back(input);
+	if (paths.empty())
+		paths = listFiles("3d-models", ".obj");
+	if (paths.empty())
+	{
+		cerr << "No .obj files to render" << endl;
+		exit(1);
+	}
+
+	const int width = 900, height = 600;
+	OffscreenContext context;
+	startOffscreen(context, width, height);
+	frames = max(frames, 2);
+	if (!textures.empty())
+		loadTexture((char *)textures[0].c_str());
+
+	FILE *report = fopen(reportPath.c_str(), "w");
+	if (!report)
+	{
+		cerr << "Cannot write the report to " << reportPath << endl;
+		exit(1);
+	}
+	fprintf(report, "{\n  \"renderer\": %s,\n  \"version\": %s,\n", jsonString((const char *)glGetString(GL_RENDERER)).c_str(),
+			jsonString((const char *)glGetString(GL_VERSION)).c_str());
+	fprintf(report, "  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n  \"path\": %s,\n  \"models\": [", width,
+			height, frames, useDisplayList ? "\"display list\"" : "\"vertex buffers\"");
+
+	vector<string> rows;
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		const string &path = paths[i];
+		if (access(path.c_str(), R_OK) != 0)
+		{
+			cerr << "Failed to open file: " << path << endl;
+			exit(1);
+		}
+		auto t0 = chrono::steady_clock::now();
+		loadObj(path);
+		glFinish();
+		double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		bool fromCache = modelData->cache.isOpen();
+
+		// The first frame pays for lazy driver work and is reported on its own
+		benchCamera(0.0);
+		t0 = chrono::steady_clock::now();
+		display();
+		double firstFrameMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		frameStats.collectGpu(true);
+		frameStats.reset(frames);
+
+		t0 = chrono::steady_clock::now();
+		for (int f = 0; f < frames; ++f)
+		{
+			benchCamera((double)f / frames);
+			display();
+		}
+		double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		frameStats.collectGpu(true);
+		double fps = frames * 1000.0 / totalMs;
+
+		MetricSummary frame = frameStats.summary(MetricFrame);
+		auto metric = [&](const char *name, FrameMetric m)
+		{
+			MetricSummary s = frameStats.summary(m);
+			char text[256];
+			if (s.count == 0)
+				snprintf(text, sizeof(text), "\"%s_ms\": null", name);
+			else
+				snprintf(text, sizeof(text),
+						 "\"%s_ms\": {\"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+						 name, s.min, s.avg, s.p50, s.p95, s.p99, s.max);
+			return string(text);
+		};
+		fprintf(report, "%s\n    {\"model\": %s, \"triangles\": %zu, \"vertices\": %zu, \"levels\": %zu, \"from_cache\": %s,\n",
+				i ? "," : "", jsonString(path).c_str(), meshView.triangleCount(), meshView.vertexCount,
+				meshView.levelCount(), fromCache ? "true" : "false");
+		fprintf(report, "     \"load_ms\": %.4f, \"first_frame_ms\": %.4f, \"fps\": %.2f,\n", loadMs, firstFrameMs, fps);
+		fprintf(report, "     %s,\n     %s,\n     %s,\n     %s,\n     %s}", metric("frame", MetricFrame).c_str(),
+				metric("cpu", MetricCpu).c_str(), metric("draw", MetricDraw).c_str(), metric("swap", MetricSwap).c_str(),
+				metric("gpu", MetricGpu).c_str());
+
+		char row[256];
+		snprintf(row, sizeof(row), "%-32s %10.2f %10.2f %8.1f %10.3f %10.3f %10.3f %10.3f", path.c_str(), loadMs,
+				 firstFrameMs, fps, frame.avg, frame.p50, frame.p95, frame.p99);
+		rows.push_back(row);
+		unloadObj();
+	}
+	fprintf(report, "\n  ]\n}\n");
+	fclose(report);
+
+	printf("\n%-32s %10s %10s %8s %10s %10s %10s %10s\n", "model", "load(ms)", "first(ms)", "fps", "avg(ms)", "p50(ms)",
+		   "p95(ms)", "p99(ms)");
+	for (const string &row : rows)
+		printf("%s\n", row.c_str());
+	printf("Report written to %s\n", reportPath.c_str());
+}
+
+// Time to get each bitmap into a texture with the old loader (read into a new
+// buffer, swap to RGB, upload) and with BmpImage (map, check, upload the
+// mapped rows as BGR), best of five runs each, with glFinish after the
+// upload. Both textures are read back and compared. Without files, every
+// .bmp in 3d-models/textures/ is used.
+// Usage: obj_viewer --bench-textures [<bmp_file>...]
+void benchTextures(const vector<string> &inputs)
+{
+	vector<string> paths = inputs.empty() ? listFiles("3d-models/textures", ".bmp") : inputs;
+	compressTextures = useMipmaps = false; // Only the base level, as the old loader
+	OffscreenContext context;
+	startOffscreen(context, 64, 64);
+	const int runs = 5;
+	using Clock = chrono::steady_clock;
+	auto ms = [](Clock::time_point a, Clock::time_point b)
+	{ return chrono::duration<double, milli>(b - a).count(); };
+	GLuint textures[2];
+	glGenTextures(2, textures);
+
+	printf("%-36s %10s %10s %12s %10s %10s %12s %8s %6s\n", "bitmap", "size(KB)", "read(ms)", "upload(ms)",
+		   "map(ms)", "upload(ms)", "direct(ms)", "speedup", "same");
+	for (const string &path : paths)
+	{
+		double legacy[2] = {INFINITY, INFINITY}, direct[2] = {INFINITY, INFINITY};
+		int width = 0, height = 0;
+		size_t size = 0;
+		for (int r = 0; r < runs; ++r)
+		{
+			auto t0 = Clock::now();
+			BitMapFile *bmp = getBMPData(path);
+			auto t1 = Clock::now();
+			if (!bmp)
+				exit(1);
+			glBindTexture(GL_TEXTURE_2D, textures[0]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, bmp->sizeX, bmp->sizeY, 0, GL_RGB, GL_UNSIGNED_BYTE, bmp->data);
+			glFinish();
+			auto t2 = Clock::now();
+			delete[] bmp->data;
+			delete bmp;
+			legacy[0] = min(legacy[0], ms(t0, t1));
+			legacy[1] = min(legacy[1], ms(t1, t2));
+
+			t0 = Clock::now();
+			TextureData data;
+			if (!loadTextureData(path, data))
+				exit(1);
+			t1 = Clock::now();
+			glBindTexture(GL_TEXTURE_2D, textures[1]);
+			data.image.texImage();
+			glFinish();
+			t2 = Clock::now();
+			direct[0] = min(direct[0], ms(t0, t1));
+			direct[1] = min(direct[1], ms(t1, t2));
+			width = data.image.width(), height = data.image.height(), size = data.image.size();
+		}
+
+		// Both loaders should produce the same texels
+		vector<unsigned char> texels[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			texels[i].resize((size_t)width * height * 4);
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels[i].data());
+		}
+		printf("%-36s %10zu %10.3f %12.3f %10.3f %10.3f %12.3f %7.1fx %6s\n", path.c_str(), size / 1024, legacy[0],
+			   legacy[1], direct[0], direct[1], direct[0] + direct[1], (legacy[0] + legacy[1]) / (direct[0] + direct[1]),
+			   texels[0] == texels[1] ? "yes" : "no");
+	}
+	glDeleteTextures(2, textures);
+}
+
+// PSNR of a texture's base level, read back from the bound texture (as the
+// driver decodes it), against the texels of `image`, over R, G and B
+double texturePsnr(const BmpImage &image)
+{
+	int width = image.width(), height = image.height(), bytesPerPixel = image.bytesPerPixel();
+	vector<unsigned char> texels((size_t)width * height * 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_BYTE, texels.data());
+	double sum = 0;
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char *row = image.bottomRow() + y * image.rowStep();
+		for (int x = 0; x < width; ++x)
+			for (int k = 0; k < 3; ++k)
+			{
+				int d = row[bytesPerPixel * x + k] - texels[4 * ((size_t)y * width + x) + k];
+				sum += d * d;
+			}
+	}
+	double mse = sum / (3.0 * width * height);
+	return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+}
+
+// Block compression of each texture: the time to encode it and its mip
+// chain on the thread pool (best of 3), and the PSNR of its base level,
+// compared with the driver compressing the base level itself on upload. Then
+// the texel memory at 4 bytes per texel (as drivers store GL_RGB8) and
+// compressed, and the time from opening the file to the end of the upload
+// (best of 5): uncompressed with the mip chain built, and compressed with
+// every level mapped from the texture cache, which is written along the way.
+// Without files, every .bmp in 3d-models/textures/ is used.
+// Usage: obj_viewer --bench-compression [<bmp_file>...]
+void benchCompression(const vector<string> &inputs)
+{
+	vector<string> paths = inputs.empty() ? listFiles("3d-models/textures", ".bmp") : inputs;
+	OffscreenContext context;
+	startOffscreen(context, 64, 64);
+	if (!hasGlExtension("GL_EXT_texture_compression_s3tc"))
+	{
+		cerr << "S3TC texture compression is not supported by this driver" << endl;
+		exit(1);
+	}
+	useMipmaps = useCache = true;
+	using Clock = chrono::steady_clock;
+	auto ms = [](Clock::time_point a, Clock::time_point b)
+	{ return chrono::duration<double, milli>(b - a).count(); };
+	GLuint texture;
+	glGenTextures(1, &texture);
+
+	printf("Encoding on %d threads\n", threadPool().size());
+	printf("%-36s %6s %11s %9s %11s %9s %10s %10s %13s %12s\n", "bitmap", "format", "encode(ms)", "PSNR(dB)",
+		   "driver(ms)", "PSNR(dB)", "RGBA8(KB)", "BCn(KB)", "raw load(ms)", "cached(ms)");
+	for (const string &path : paths)
+	{
+		compressTextures = false;
+		TextureData source;
+		if (!loadTextureData(path, source))
+			exit(1);
+		const BmpImage &image = source.image;
+		BlockFormat format = image.hasAlpha() ? FormatBc3 : FormatBc1;
+
+		CompressedTexture compressed;
+		double encode = INFINITY;
+		for (int r = 0; r < 3; ++r)
+		{
+			auto t0 = Clock::now();
+			compressed.encode(image.bottomRow(), image.rowStep(), image.width(), image.height(), image.bytesPerPixel(),
+							  source.mips, format);
+			encode = min(encode, ms(t0, Clock::now()));
+		}
+		SourceStamp stamp;
+		if (!stamp.read(path) || !compressed.writeCache(path, stamp))
+			cerr << "Could not write " << textureCachePath(path) << endl;
+		glBindTexture(GL_TEXTURE_2D, texture);
+		compressed.texImage(1);
+		double psnr = texturePsnr(image);
+
+		// The driver's encoder, on the base level only (rows bottom first, also
+		// for top-down images)
+		size_t rowBytes = (size_t)abs(image.rowStep());
+		vector<unsigned char> rows(rowBytes * image.height());
+		for (int y = 0; y < image.height(); ++y)
+			memcpy(&rows[y * rowBytes], image.bottomRow() + y * image.rowStep(), rowBytes);
+		double driver = INFINITY;
+		for (int r = 0; r < 3; ++r)
+		{
+			auto t0 = Clock::now();
+			glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glTexImage2D(GL_TEXTURE_2D, 0, blockGlFormat(format), image.width(), image.height(), 0,
+						 image.bytesPerPixel() == 4 ? GL_BGRA : GL_BGR, GL_UNSIGNED_BYTE, rows.data());
+			glPopClientAttrib();
+			glFinish();
+			driver = min(driver, ms(t0, Clock::now()));
+		}
+		double driverPsnr = texturePsnr(image);
+
+		size_t texels = (size_t)image.width() * image.height();
+		for (const MipLevel &mip : source.mips)
+			texels += (size_t)mip.width * mip.height;
+
+		double load[2] = {INFINITY, INFINITY};
+		for (int r = 0; r < 5; ++r)
+			for (int c = 0; c < 2; ++c)
+			{
+				compressTextures = c == 1;
+				auto t0 = Clock::now();
+				TextureData data;
+				if (!loadTextureData(path, data))
+					exit(1);
+				uploadTexture(data);
+				glFinish();
+				load[c] = min(load[c], ms(t0, Clock::now()));
+			}
+		printf("%-36s %6s %11.2f %9.2f %11.2f %9.2f %10zu %10zu %13.3f %12.3f\n", path.c_str(), blockFormatName(format),
+			   encode, psnr, driver, driverPsnr, 4 * texels / 1024, compressed.size() / 1024, load[0], load[1]);
+	}
+	glDeleteTextures(1, &texture);
+}
+
+// Frame time of a textured model, without mipmaps (bilinear on the
+// full-size texture), trilinear, and trilinear with 16x anisotropic filtering,
+// as the texture gets minified:
+//   - "scale" rows shrink the model itself; it covers fewer pixels, each of
+//     them spanning more texels;
+//   - "texels" rows keep the model filling the window and multiply its
+//     texture coordinates instead (with the texture matrix), so each pixel
+//     spans as many texels as in a model scaled down by that factor while
+//     the number of textured pixels stays the same: the texture-bound case.
+// The model turns once around Y over the frames. "flicker" is the mean
+// difference of the pixels (0-255) between two frames 0.25 degrees apart,
+// which aliasing of the texture drives up. The mip chain build time is
+// reported too.
+// Usage: obj_viewer --bench-mipmaps [--frames N] [<obj_file>] [<bmp_file>]
+void benchMipmaps(const vector<string> &inputs, int frames)
+{
+	string path = "3d-models/tie-fighter.obj", texture = "3d-models/textures/trees.bmp";
+	for (const string &input : inputs)
+		(input.size() > 4 && input.compare(input.size() - 4, 4, ".bmp") == 0 ? texture : path) = input;
+
+	OffscreenContext context;
+	startOffscreen(context, 900, 600);
+	frames = max(frames, 2);
+	if (access(path.c_str(), R_OK) != 0)
+	{
+		cerr << "Failed to open file: " << path << endl;
+		exit(1);
+	}
+	loadObj(path);
+
+	useMipmaps = true;
+	compressTextures = false;
+	TextureData data;
+	if (!loadTextureData(texture, data))
+		exit(1);
+	auto t0 = chrono::steady_clock::now();
+	vector<MipLevel> single = buildMipChain(data.image.bottomRow(), data.image.rowStep(), data.image.width(),
+											 data.image.height(), data.image.bytesPerPixel(), threadPool(), false);
+	auto t1 = chrono::steady_clock::now();
+	data.mips = buildMipChain(data.image.bottomRow(), data.image.rowStep(), data.image.width(), data.image.height(),
+							  data.image.bytesPerPixel());
+	auto t2 = chrono::steady_clock::now();
+	bool same = single.size() == data.mips.size();
+	for (size_t i = 0; same && i < single.size(); ++i)
+		same = single[i].bgra == data.mips[i].bgra;
+	printf("%s: %d levels, built in %.3f ms scalar, %.3f ms SSE2 on %d threads (%s)\n", texture.c_str(),
+		   (int)data.mips.size() + 1, chrono::duration<double, milli>(t1 - t0).count(),
+		   chrono::duration<double, milli>(t2 - t1).count(), threadPool().size(),
+		   same ? "same result" : "results differ");
+	uploadTexture(data);
+	if (!hasGlExtension("GL_EXT_texture_filter_anisotropic"))
+		cout << "Anisotropic filtering unavailable, the 16x rows are plain trilinear" << endl;
+
+	struct Mode
+	{
+		const char *name;
+		bool mipmapped;
+		float anisotropy;
+	};
+	const Mode modes[] = {{"no mips", false, 1.0f}, {"trilinear", true, 1.0f}, {"aniso 16x", true, 16.0f}};
+	// Close enough for the model to fill the window
+	const float *b = meshView.bounds;
+	float radius = 0.5f * sqrtf((b[3] - b[0]) * (b[3] - b[0]) + (b[4] - b[1]) * (b[4] - b[1]) + (b[5] - b[2]) * (b[5] - b[2]));
+	float fillDistance = 0.6f * radius / (float)tan(fieldOfViewY * M_PI / 360.0);
+
+	// Mean difference between the frames at two angles
+	auto flicker = [](float angle, float step)
+	{
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		vector<unsigned char> frames[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			rotY = angle + i * step;
+			display();
+			frames[i].resize((size_t)viewport[2] * viewport[3] * 3);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glReadPixels(0, 0, viewport[2], viewport[3], GL_RGB, GL_UNSIGNED_BYTE, frames[i].data());
+		}
+		double sum = 0;
+		for (size_t i = 0; i < frames[0].size(); ++i)
+			sum += abs(frames[0][i] - frames[1][i]);
+		return sum / frames[0].size();
+	};
+
+	printf("\n%-7s %7s %-10s %10s %10s %10s %8s\n", "", "factor", "filter", "triangles", "avg(ms)", "p95(ms)",
+		   "flicker");
+	for (int texels = 0; texels < 2; ++texels)
+		for (float factor : {1.0f, 2.0f, 4.0f, 8.0f})
+			for (const Mode &mode : modes)
+			{
+				glBindTexture(GL_TEXTURE_2D, textureID);
+				anisotropy = mode.anisotropy;
+				setTextureFilter(mode.mipmapped);
+				benchCamera(0.0);
+				translateZ = -fillDistance;
+				scale = texels ? 1.0f : 1.0f / factor;
+				glMatrixMode(GL_TEXTURE);
+				glLoadIdentity();
+				glScalef(texels ? factor : 1.0f, texels ? factor : 1.0f, 1.0f);
+				glMatrixMode(GL_MODELVIEW);
+
+				display(); // Warms up the driver with the new filter
+				frameStats.collectGpu(true);
+				frameStats.reset(frames);
+				for (int f = 0; f < frames; ++f)
+				{
+					rotY = 360.0f * f / frames;
+					display();
+				}
+				frameStats.collectGpu(true);
+				MetricSummary frame = frameStats.summary(MetricFrame);
+				printf("%-7s %7.0f %-10s %10zu %10.3f %10.3f %8.3f\n", texels ? "texels" : "scale", factor, mode.name,
+					   drawnTriangles, frame.avg, frame.p95, flicker(30.0f, 0.25f));
+				fflush(stdout);
+			}
+	glMatrixMode(GL_TEXTURE);
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+}
+
+// Render growing numbers of copies of one model offscreen, instanced and one
+// draw call per copy, and report draw calls, triangles and frame times. The
+// camera follows benchCamera; the copies share one level of detail.
+// Usage: obj_viewer --bench-instances [--frames N] [--instances MAX] [<obj_file>] [<bmp_file>]
+void benchInstances(const vector<string> &inputs, int frames, size_t maxInstances)
+{
+	string path = "3d-models/teddy.obj", texture;
+	for (const string &input : inputs)
+		(input.size() > 4 && input.compare(input.size() - 4, 4, ".bmp") == 0 ? texture : path) = input;
+
+	OffscreenContext context;
+	startOffscreen(context, 900, 600);
+	frames = max(frames, 2);
+	if (!texture.empty())
+		loadTexture((char *)texture.c_str());
+	if (access(path.c_str(), R_OK) != 0)
+	{
+		cerr << "Failed to open file: " << path << endl;
+		exit(1);
+	}
+	loadObj(path);
+	if (!scene.hasInstancing())
+		cout << "GL 3.3 instancing unavailable, only the per-copy path is measured" << endl;
+
+	printf("\n%-10s %-10s %10s %12s %8s %10s %10s %10s %10s\n", "instances", "path", "draw calls", "triangles", "fps",
+		   "avg(ms)", "p95(ms)", "cpu(ms)", "gpu(ms)");
+	for (size_t count = 1; count <= max<size_t>(maxInstances, 1); count *= 10)
+		for (int instanced = 1; instanced >= 0; --instanced)
+		{
+			if (instanced && !scene.hasInstancing())
+				continue;
+			useInstancing = instanced;
+			setInstanceCount(count);
+			currentLod = 0;
+			benchCamera(0.0);
+			display(); // Uploads the matrices and warms up the driver
+			frameStats.collectGpu(true);
+			frameStats.reset(frames);
+
+			auto t0 = chrono::steady_clock::now();
+			size_t triangles = 0;
+			for (int f = 0; f < frames; ++f)
+			{
+				benchCamera((double)f / frames);
+				display();
+				triangles += drawnTriangles;
+			}
+			double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+			frameStats.collectGpu(true);
+			MetricSummary frame = frameStats.summary(MetricFrame), cpu = frameStats.summary(MetricCpu),
+						  gpu = frameStats.summary(MetricGpu);
+			char gpuText[32] = "-";
+			if (gpu.count)
+				snprintf(gpuText, sizeof(gpuText), "%.3f", gpu.avg);
+			printf("%-10zu %-10s %10zu %12zu %8.1f %10.3f %10.3f %10.3f %10s\n", count,
+				   instanced ? "instanced" : "per-copy", drawCalls, triangles / frames, frames * 1000.0 / totalMs,
+				   frame.avg, frame.p95, cpu.avg, gpuText);
+			fflush(stdout);
+		}
+}
+
+// Render one model offscreen with its groups batched by material and in file
+// order, and report draw calls, material and blend state changes and frame
+// times. The camera follows benchCamera; both draw the full mesh.
+// Usage: obj_viewer --bench-materials [--frames N] [<obj_file>]
+void benchMaterials(const vector<string> &inputs, int frames)
+{
+	string path = inputs.empty() ? "3d-models/porsche.obj" : inputs[0];
+	if (access(path.c_str(), R_OK) != 0)
+	{
+		cerr << "Failed to open file: " << path << endl;
+		exit(1);
+	}
+
+	OffscreenContext context;
+	startOffscreen(context, 900, 600);
+	frames = max(frames, 2);
+	useCache = false; // Each mode builds its own groups
+	buildLods = false;
+
+	printf("\n%-10s %8s %10s %14s %8s %10s %10s %10s\n", "mode", "groups", "draw calls", "state changes", "fps",
+		   "avg(ms)", "p95(ms)", "cpu(ms)");
+	for (int batched = 1; batched >= 0; --batched)
+	{
+		batchMaterials = batched;
+		loadObj(path);
+		benchCamera(0.0);
+		display(); // Warms up the driver
+		frameStats.collectGpu(true);
+		frameStats.reset(frames);
+
+		auto t0 = chrono::steady_clock::now();
+		for (int f = 0; f < frames; ++f)
+		{
+			benchCamera((double)f / frames);
+			display();
+		}
+		double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		frameStats.collectGpu(true);
+		MetricSummary frame = frameStats.summary(MetricFrame), cpu = frameStats.summary(MetricCpu);
+		printf("%-10s %8zu %10zu %14zu %8.1f %10.3f %10.3f %10.3f\n", batched ? "batched" : "file order",
+			   meshView.groupCount, drawCalls, stateChanges, frames * 1000.0 / totalMs, frame.avg, frame.p95, cpu.avg);
+		fflush(stdout);
+	}
+}
+
+// Render one model offscreen under 3 to 1024 lights, per pixel with and
+// without tiled culling (and with fixed-function lighting for the 3-point
+// setup alone), and report the lights shaded per tile and frame times. The
+// camera follows benchCamera.
+// Usage: obj_viewer --bench-lights [--frames N] [<obj_file>]
+void benchLights(const vector<string> &inputs, int frames)
+{
+	string path = inputs.empty() ? "3d-models/teddy.obj" : inputs[0];
+	if (access(path.c_str(), R_OK) != 0)
+	{
+		cerr << "Failed to open file: " << path << endl;
+		exit(1);
+	}
+
+	OffscreenContext context;
+	startOffscreen(context, 900, 600);
+	frames = max(frames, 2);
+	if (!tiledLighting.available())
+	{
+		cerr << "GLSL 1.50 unavailable, nothing to measure" << endl;
+		exit(1);
+	}
+	buildLods = false; // The same triangles in every row
+	loadObj(path);
+
+	printf("\n%-7s %-14s %10s %10s %8s %10s %10s\n", "lights", "path", "per tile", "max tile", "fps", "avg(ms)",
+		   "p95(ms)");
+	auto run = [&](size_t count, const char *name, bool perPixel, bool cull)
+	{
+		lightCount = count;
+		shaderLighting = perPixel;
+		cullLights = cull;
+		benchCamera(0.0);
+		display(); // Warms up the driver
+		frameStats.collectGpu(true);
+		frameStats.reset(frames);
+		auto t0 = chrono::steady_clock::now();
+		for (int f = 0; f < frames; ++f)
+		{
+			benchCamera((double)f / frames);
+			display();
+		}
+		double totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		frameStats.collectGpu(true);
+		MetricSummary frame = frameStats.summary(MetricFrame);
+		char perTile[16] = "-", maxTile[16] = "-";
+		if (perPixel)
+		{
+			snprintf(perTile, sizeof(perTile), "%.1f", tiledLighting.averageLightsPerTile());
+			snprintf(maxTile, sizeof(maxTile), "%zu", tiledLighting.maxLightsPerTile());
+		}
+		printf("%-7zu %-14s %10s %10s %8.1f %10.3f %10.3f\n", count, name, perTile, maxTile, frames * 1000.0 / totalMs,
+			   frame.avg, frame.p95);
+		fflush(stdout);
+	};
+	run(3, "fixed-function", false, true);
+	for (size_t count = 3; count <= tiledLighting.maxLights(); count = count == 3 ? 8 : count * 2)
+	{
+		run(count, "tiled", true, true);
+		run(count, "every light", true, false);
+	}
+}
+
+// Render every model along the camera path of benchCamera with the GL driver
+// (llvmpipe on hosts without a GPU), in an offscreen context, and with the
+// software renderer, and report the frames per second of both and how far
+// apart their first frames are. Without .obj files, every .obj in 3d-models/
+// is used; a .bmp among the files textures all models. Without any GL
+// context only the software renderer is measured.
+// Usage: obj_viewer --bench-software [--frames N] [--threads N] [<obj_file>...] [<bmp_file>]
+void benchSoftware(const vector<string> &inputs, int frames)
+{
+	vector<string> paths, textures;
+	for (const string &input : inputs)
+		(input.size() > 4 && input.compare(input.size() - 4, 4, ".bmp") == 0 ? textures : paths).push_back(input);
+	if (paths.empty())
+		paths = listFiles("3d-models", ".obj");
+	if (paths.empty())
+	{
+		cerr << "No .obj files to render" << endl;
+		exit(1);
+	}
+
+	const int width = 900, height = 600;
+	OffscreenContext context;
+	bool gl = context.create(width, height);
+	string driver = "GL";
+	if (gl)
+	{
+		offscreen = true;
+		initLighting();
+		reshape(width, height);
+		driver = (const char *)glGetString(GL_RENDERER);
+		driver = driver.substr(0, driver.find(' '));
+	}
+	else
+		cout << "No offscreen OpenGL context, measuring the software renderer alone" << endl;
+	frames = max(frames, 2);
+	if (!textures.empty())
+	{
+		if (gl)
+			loadTexture((char *)textures[0].c_str());
+		else
+			loadTextureSoftware(textures[0]);
+	}
+
+	printf("\n%-36s %10s %12s %14s %8s %10s\n", "model", "triangles", (driver + " fps").c_str(), "software fps", "ratio",
+		   "mean diff");
+	vector<unsigned char> glImage, softwareImage;
+	for (const string &path : paths)
+	{
+		if (access(path.c_str(), R_OK) != 0)
+		{
+			cerr << "Failed to open file: " << path << endl;
+			exit(1);
+		}
+		gl ? loadObj(path) : loadObjSoftware(path);
+
+		double glFps = 0.0;
+		if (gl)
+		{
+			softwareRendering = false;
+			benchCamera(0.0);
+			display(); // Warms up the driver, and is the reference image
+			glImage.resize((size_t)width * height * 3);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, glImage.data());
+			auto t0 = chrono::steady_clock::now();
+			for (int f = 0; f < frames; ++f)
+			{
+				benchCamera((double)f / frames);
+				display();
+			}
+			glFps = frames * 1000.0 / chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		}
+
+		softwareRendering = true;
+		benchCamera(0.0);
+		renderSoftware(width, height);
+		softwareRenderer.resolve(softwareImage);
+		auto t0 = chrono::steady_clock::now();
+		for (int f = 0; f < frames; ++f)
+		{
+			benchCamera((double)f / frames);
+			renderSoftware(width, height);
+		}
+		double softwareFps = frames * 1000.0 / chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+
+		double difference = 0.0;
+		for (size_t i = 0; gl && i < glImage.size(); ++i)
+			difference += abs((int)glImage[i] - (int)softwareImage[i]);
+		string name = path.substr(path.find_last_of('/') + 1);
+		if (gl)
+			printf("%-36s %10zu %12.1f %14.1f %8.2f %10.2f\n", name.c_str(), meshView.triangleCount(), glFps, softwareFps,
+				   softwareFps / glFps, difference / glImage.size());
+		else
+			printf("%-36s %10zu %12s %14.1f %8s %10s\n", name.c_str(), meshView.triangleCount(), "-", softwareFps, "-", "-");
+		fflush(stdout);
+	}
+	softwareRendering = false;
+}
+
+// Draw one frame of a model with the software renderer, from the initial
+// camera, and write it as a PPM. Needs no display or GL driver at all.
+// Usage: obj_viewer --render <ppm_file> [--threads N] <obj_file> [<bmp_file>]
+void renderToFile(const string &outputPath, const vector<string> &inputs)
+{
+	if (inputs.empty())
+	{
+		cerr << "No .obj file to render" << endl;
+		exit(1);
+	}
+	loadObjSoftware(inputs[0]);
+	if (inputs.size() > 1)
+		loadTextureSoftware(inputs[1]);
+	auto t0 = chrono::steady_clock::now();
+	renderSoftware(900, 600);
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	if (!softwareRenderer.writePpm(outputPath))
+	{
+		cerr << "Cannot write " << outputPath << endl;
+		exit(1);
+	}
+	cout << "Rendered " << softwareRenderer.rasterizedTriangles() << " triangles in " << ms << " ms to " << outputPath
+		 << endl;
+}
+
+// BVH build time and pick latency of each model. Each pick is a click on the
+// pixel of the centre of a random triangle, in a 900x600 window, from
+// cameras spread along the path of benchCamera; the first thousand are
+// checked against testing every triangle, which is also timed. Without
+// files, every .obj in 3d-models/ is used.
+// Usage: obj_viewer --bench-pick [--frames N] [--threads N] [<obj_file>...]
+void benchPick(const vector<string> &inputs, int picks)
+{
+	vector<string> paths = inputs;
+	if (paths.empty())
+		paths = listFiles("3d-models", ".obj");
+	viewportWidth = 900;
+	viewportHeight = 600;
+	const int checked = 1000, runs = 5;
+
+	printf("\n%-32s %10s %10s %8s %10s %10s %10s %8s %12s %10s\n", "model", "triangles", "build(ms)", "nodes", "pick(us)",
+		   "p99(us)", "max(us)", "hits", "all tris(us)", "mismatch");
+	for (const string &path : paths)
+	{
+		ModelData data;
+		if (!loadMeshData(path, data))
+			exit(1);
+		const MeshView &view = data.view;
+
+		double buildMs = 1e30;
+		for (int run = 0; run < runs; ++run)
+		{
+			MeshBvh bvh;
+			auto t0 = chrono::steady_clock::now();
+			bvh.build(view.vertices, view.indices, view.indexCount);
+			buildMs = min(buildMs, chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+		}
+
+		mt19937 generator(1);
+		vector<double> times;
+		size_t hits = 0, mismatches = 0;
+		double bruteUs = 0.0;
+		for (int i = 0; i < picks; ++i)
+		{
+			benchCamera((double)i / picks);
+			// The triangle's centre in eye space (as applyModelTransform), then its pixel
+			const uint32_t *corner = &view.indices[3 * (generator() % view.triangleCount())];
+			float eye[3];
+			for (int k = 0; k < 3; ++k)
+				eye[k] = (view.vertices[corner[0]].position[k] + view.vertices[corner[1]].position[k] +
+						  view.vertices[corner[2]].position[k]) / 3.0f;
+			rotateVector(eye, rotZ, 2);
+			rotateVector(eye, rotY, 1);
+			rotateVector(eye, rotX, 0);
+			const float offset[3] = {translateX, translateY, translateZ};
+			for (int k = 0; k < 3; ++k)
+				eye[k] = eye[k] * scale + offset[k];
+			float tanHalf = (float)tan(fieldOfViewY * M_PI / 360.0), aspect = (float)viewportWidth / viewportHeight;
+			int x = (int)floorf((eye[0] / -eye[2] / (tanHalf * aspect) + 1.0f) * 0.5f * viewportWidth);
+			int y = (int)floorf((1.0f - eye[1] / -eye[2] / tanHalf) * 0.5f * viewportHeight);
+			auto t0 = chrono::steady_clock::now();
+			float origin[3], direction[3];
+			pickRay(x, y, origin, direction);
+			RayHit hit = data.bvh.intersect(origin, direction);
+			times.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+			hits += hit.hit();
+			if (i < checked)
+			{
+				auto t1 = chrono::steady_clock::now();
+				RayHit all = MeshBvh::intersectAll(view.vertices, view.indices, view.indexCount, origin, direction);
+				bruteUs += chrono::duration<double, micro>(chrono::steady_clock::now() - t1).count();
+				// Another triangle at the same distance (a shared edge) is as good
+				if (all.hit() != hit.hit() || (hit.hit() && hit.triangle != all.triangle &&
+											   fabsf(hit.distance - all.distance) > 1e-4f * all.distance))
+					++mismatches;
+			}
+		}
+		sort(times.begin(), times.end());
+		double mean = 0.0;
+		for (double t : times)
+			mean += t / times.size();
+		string name = path.substr(path.find_last_of('/') + 1);
+		printf("%-32s %10zu %10.2f %8zu %10.2f %10.2f %10.2f %7.1f%% %12.1f %10zu\n", name.c_str(), view.triangleCount(),
+			   buildMs, data.bvh.nodeCount(), mean, times[times.size() * 99 / 100], times.back(), 100.0 * hits / picks,
+			   bruteUs / min(picks, checked), mismatches);
+		fflush(stdout);
+	}
+	cout << "BVH built on " << threadPool().size() << " threads" << endl;
+}
+
+// Time the ambient occlusion bake of each model against the thread count and
+// the rays per vertex. Every result must match the one of a single thread.
+// Usage: obj_viewer --bench-ao [--threads N] [<obj_file>...]
+void benchOcclusion(const vector<string> &inputs)
+{
+	vector<string> paths = inputs;
+	if (paths.empty())
+		paths = {"3d-models/elepham.obj", "3d-models/radar.obj"};
+	int maxThreads = threadCount() > 0 ? threadCount() : (int)max(1u, thread::hardware_concurrency());
+	vector<int> threadCounts; // 1, 2, 4... up to maxThreads
+	for (int threads = 1; threads < maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(maxThreads);
+	const int rayCounts[] = {16, 64, 256};
+	const int runs = 3;
+	occlusionRays = 0;
+
+	printf("\n%-16s %9s %5s %8s %10s %10s %8s %8s %10s %6s\n", "model", "vertices", "rays", "threads", "bake(ms)", "Mrays/s",
+		   "speedup", "steals", "mean AO", "same");
+	for (const string &path : paths)
+	{
+		ModelData data;
+		if (!loadMeshData(path, data))
+			exit(1);
+		const MeshView &view = data.view;
+		const float *b = view.bounds;
+		float radius = 0.1f * sqrtf((b[3] - b[0]) * (b[3] - b[0]) + (b[4] - b[1]) * (b[4] - b[1]) + (b[5] - b[2]) * (b[5] - b[2]));
+		string name = path.substr(path.find_last_of('/') + 1);
+		for (int rays : rayCounts)
+		{
+			vector<float> serial(view.vertexCount), occlusion(view.vertexCount);
+			double serialMs = 0.0;
+			for (int threads : threadCounts)
+			{
+				ThreadPool pool(threads);
+				double bestMs = INFINITY;
+				size_t steals = 0;
+				for (int r = 0; r < runs; ++r)
+				{
+					auto t0 = chrono::steady_clock::now();
+					steals = bakeOcclusion(view.vertices, view.vertexCount, data.bvh, rays, radius, occlusion.data(), pool);
+					bestMs = min(bestMs, chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+				}
+				if (threads == 1)
+				{
+					serial = occlusion;
+					serialMs = bestMs;
+				}
+				double mean = 0.0;
+				for (float o : occlusion)
+					mean += o / occlusion.size();
+				printf("%-16s %9zu %5d %8d %10.1f %10.2f %7.2fx %8zu %10.3f %6s\n", name.c_str(), view.vertexCount, rays,
+					   threads, bestMs, view.vertexCount * (double)rays / bestMs / 1e3, serialMs / bestMs, steals, mean,
+					   occlusion == serial ? "yes" : "NO");
+				fflush(stdout);
+			}
+		}
+	}
+}
+
+// Entry point
+int main(int argc, char **argv)
+{
+	// Options are read before glutInit so the benchmarks can run without a display
+	string benchMode;
+	vector<string> inputs;
+	string csvPath, reportPath = "bench-report.json";
+	int benchFrames = 0; // 0 = the benchmark's own default
+	string renderPath, replayPath;
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc)
+			threadCount() = atoi(argv[++i]);
+		else if (arg == "--no-cache")
+			useCache = false;
+		else if (arg == "--display-list")
+			useDisplayList = true;
+		else if (arg == "--no-optimize")
+			optimizeOrder = false;
+		else if (arg == "--overdraw")
+			optimizeOverdrawOrder = true;
+		else if (arg == "--no-lod")
+			buildLods = false;
+		else if (arg == "--lod-error" && i + 1 < argc)
+			lodPixelError = atof(argv[++i]);
+		else if (arg == "--crease" && i + 1 < argc)
+			creaseAngle = min(max(atoi(argv[++i]), 0), 180);
+		else if (arg == "--area-normals")
+			areaNormals = true;
+		else if (arg == "--ao" && i + 1 < argc)
+			occlusionRays = max(atoi(argv[++i]), 0);
+		else if (arg == "--no-mipmaps")
+			useMipmaps = false;
+		else if (arg == "--anisotropy" && i + 1 < argc)
+			anisotropy = atof(argv[++i]);
+		else if (arg == "--no-texture-compression")
+			compressTextures = false;
+		else if (arg == "--csv" && i + 1 < argc)
+			csvPath = argv[++i];
+		else if (arg == "--instances" && i + 1 < argc)
+			instanceCount = atoi(argv[++i]);
+		else if (arg == "--no-instancing")
+			useInstancing = false;
+		else if (arg == "--no-batching")
+			batchMaterials = false;
+		else if (arg == "--shader-lighting")
+			shaderLighting = true;
+		else if (arg == "--lights" && i + 1 < argc)
+		{
+			lightCount = min(max(atoi(argv[++i]), 3), 1024);
+			shaderLighting = true;
+		}
+		else if (arg == "--no-light-culling")
+			cullLights = false;
+		else if (arg == "--software")
+			softwareRendering = true;
+		else if (arg == "--render" && i + 1 < argc)
+			renderPath = argv[++i];
+		else if (arg == "--uncapped")
+			frameLoop = LoopUncapped;
+		else if (arg == "--vsync")
+			frameLoop = LoopVsync;
+		else if (arg == "--frames" && i + 1 < argc)
+			benchFrames = atoi(argv[++i]);
+		else if (arg == "--report" && i + 1 < argc)
+			reportPath = argv[++i];
+		else if (arg == "--record" && i + 1 < argc)
+			inputLogPath = argv[++i];
+		else if (arg == "--replay" && i + 1 < argc)
+			replayPath = argv[++i];
+		else if (arg == "--replay-fast")
+			inputReplay.fast = true;
+		else if (arg == "--bench-load" || arg == "--bench-threads" || arg == "--bench-memory" ||
+				 arg == "--bench-cache" || arg == "--bench-vcache" || arg == "--bench-lod" || arg == "--bench" ||
+				 arg == "--bench-instances" || arg == "--bench-normals" || arg == "--bench-textures" ||
+				 arg == "--bench-compression" || arg == "--bench-mipmaps" || arg == "--bench-materials" ||
+				 arg == "--bench-lights" || arg == "--bench-software" || arg == "--bench-pick" || arg == "--bench-ao")
+			benchMode = arg;
+		else
+			inputs.push_back(arg);
+	}
+
+	if (benchMode == "--bench-load")
+	{
+		benchLoad(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-threads")
+	{
+		benchThreads(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-memory")
+	{
+		benchMemory(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-cache")
+	{
+		benchCache(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-vcache")
+	{
+		benchVertexCache(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-lod")
+	{
+		benchLod(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-normals")
+	{
+		benchNormals(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-textures")
+	{
+		benchTextures(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-compression")
+	{
+		benchCompression(inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-mipmaps")
+	{
+		benchMipmaps(inputs, benchFrames ? benchFrames : 60);
+		return 0;
+	}
+	if (benchMode == "--bench-instances")
+	{
+		if (!csvPath.empty() && !frameStats.openCsv(csvPath))
+			cerr << "Cannot write frame times to " << csvPath << endl;
+		benchInstances(inputs, benchFrames ? benchFrames : 20, instanceCount ? instanceCount : 100000);
+		return 0;
+	}
+	if (benchMode == "--bench-lights")
+	{
+		benchLights(inputs, benchFrames ? benchFrames : 10);
+		return 0;
+	}
+	if (benchMode == "--bench-software")
+	{
+		benchSoftware(inputs, benchFrames ? benchFrames : 20);
+		return 0;
+	}
+	if (benchMode == "--bench-pick")
+	{
+		benchPick(inputs, max(benchFrames ? benchFrames : 10000, 1));
+		return 0;
+	}
+	if (benchMode == "--bench-ao")
+	{
+		benchOcclusion(inputs);
+		return 0;
+	}
+	if (!renderPath.empty())
+	{
+		renderToFile(renderPath, inputs);
+		return 0;
+	}
+	if (benchMode == "--bench-materials")
+	{
+		benchMaterials(inputs, benchFrames ? benchFrames : 100);
+		return 0;
+	}
+	if (benchMode == "--bench")
+	{
+		if (!csvPath.empty() && !frameStats.openCsv(csvPath))
+			cerr << "Cannot write frame times to " << csvPath << endl;
+		benchRender(inputs, benchFrames ? benchFrames : 300, reportPath);
+		return 0;
+	}
+
+	glutInit(&argc, argv);
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+	glutInitWindowSize(900, 600);
+	glutCreateWindow("OBJ Loader - 3D Object with Lighting");
+
+	// Register callbacks
+	glutDisplayFunc(display);
+	glutReshapeFunc(reshape);
+	glutKeyboardFunc(keyboard);
+	glutMouseFunc(mouseButton);
+	glutMotionFunc(motion);
+	if (frameLoop != LoopOnDemand)
+	{
+		glutIdleFunc(idle);
+		if (!setSwapInterval(frameLoop == LoopVsync ? 1 : 0))
+			cout << "Cannot change the swap interval, frames follow the driver's vsync setting" << endl;
+	}
+
+	initLighting();
+	frameStats.initGpu();
+	if (!scene.init())
+		cout << "GL 3.3 instancing unavailable, copies of the model are drawn one at a time" << endl;
+	if (!tiledLighting.init() && shaderLighting)
+		cout << "GLSL 1.50 unavailable, lighting stays fixed-function" << endl;
+	if (!frameStats.hasGpuTimers())
+		cout << "GL timer queries unavailable, GPU frame time is not measured" << endl;
+	if (!csvPath.empty() && !frameStats.openCsv(csvPath))
+		cerr << "Cannot write frame times to " << csvPath << endl;
+
+	if (inputs.size() < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <path_to_obj_file> <path_to_bpm_texture> [--threads N] [--no-cache] [--display-list] [--no-optimize] [--overdraw] [--no-lod] [--lod-error N] [--crease N] [--area-normals] [--ao N] [--no-mipmaps] [--anisotropy N] [--no-texture-compression] [--instances N] [--no-instancing] [--no-batching] [--shader-lighting] [--lights N] [--no-light-culling] [--software] [--csv file] [--uncapped | --vsync] [--record file] [--replay file [--replay-fast]]\n";
+		exit(1);
+	}
+	// Both load in the background while the window already draws frames
+	requestTexture(inputs[1]);
+	requestModel(inputs[0]);
+
+	if (!inputLogPath.empty())
+	{
+		inputLog.start(viewportWidth, viewportHeight);
+		atexit(saveInputLog);
+	}
+	if (!replayPath.empty())
+		startReplay(replayPath);
+
+	glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
+	glutMainLoop();
+	stopLoaders();
+	return 0;
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "obj_loader.h"
+#include "parallel.h"
+
+// How much each triangle around a vertex counts towards its smooth normal
+enum NormalWeighting
+{
+	WeightByAngle, // Angle of the triangle at the vertex, independent of tessellation
+	WeightByArea   // Triangle area, favours large faces
+};
+
+namespace normals_detail
+{
+	const size_t batchSize = 16384; // Triangles or positions per parallel task
+
+	// Unit normal of triangles [first, last) into faceNormal (3 floats each) and
+	// the weight of each of their corners into cornerWeight. Triangles with an
+	// invalid vertex index get a zero normal and weights.
+	inline void faceNormalsScalar(const Mesh &mesh, size_t first, size_t last, NormalWeighting weighting,
+								  float *faceNormal, float *cornerWeight)
+	{
+		const int vertexCount = (int)mesh.vertexCount();
+		for (size_t t = first; t < last; ++t)
+		{
+			const int *f = &mesh.faces[3 * t];
+			float *n = faceNormal + 3 * t, *w = cornerWeight + 3 * t;
+			if (f[0] < 0 || f[0] >= vertexCount || f[1] < 0 || f[1] >= vertexCount || f[2] < 0 || f[2] >= vertexCount)
+			{
+				n[0] = n[1] = n[2] = w[0] = w[1] = w[2] = 0.0f;
+				continue;
+			}
+			const float *p0 = &mesh.vertices[3 * f[0]], *p1 = &mesh.vertices[3 * f[1]], *p2 = &mesh.vertices[3 * f[2]];
+			float a[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]}; // p0 -> p1
+			float b[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]}; // p0 -> p2
+			float c[3] = {p2[0] - p1[0], p2[1] - p1[1], p2[2] - p1[2]}; // p1 -> p2
+			float x = a[1] * b[2] - a[2] * b[1], y = a[2] * b[0] - a[0] * b[2], z = a[0] * b[1] - a[1] * b[0];
+			float len = std::sqrt(x * x + y * y + z * z);
+			float inv = len > 0.0f ? 1.0f / len : 0.0f;
+			n[0] = x * inv, n[1] = y * inv, n[2] = z * inv;
+			if (weighting == WeightByArea)
+			{
+				w[0] = w[1] = w[2] = len;
+				continue;
+			}
+			float la = std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+			float lb = std::sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+			float lc = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+			float ra = la > 0.0f ? 1.0f / la : 0.0f, rb = lb > 0.0f ? 1.0f / lb : 0.0f, rc = lc > 0.0f ? 1.0f / lc : 0.0f;
+			float cosines[3] = {(a[0] * b[0] + a[1] * b[1] + a[2] * b[2]) * ra * rb,
+								-(a[0] * c[0] + a[1] * c[1] + a[2] * c[2]) * ra * rc,
+								(b[0] * c[0] + b[1] * c[1] + b[2] * c[2]) * rb * rc};
+			for (int k = 0; k < 3; ++k)
+				w[k] = std::acos(std::min(1.0f, std::max(-1.0f, cosines[k])));
+		}
+	}
+
+#ifdef __SSE__
+	// faceNormalsScalar for four triangles at a time: the positions are
+	// gathered into x, y, z lanes, the cross products and dot products run on
+	// the lanes and every length comes from one batched reciprocal square root
+	inline void faceNormalsSse(const Mesh &mesh, size_t first, size_t last, NormalWeighting weighting,
+							   float *faceNormal, float *cornerWeight)
+	{
+		const int vertexCount = (int)mesh.vertexCount();
+		const float zero[3] = {0.0f, 0.0f, 0.0f};
+		size_t t = first;
+		for (; t + 4 <= last; t += 4)
+		{
+			// Corner k of triangle t + j, or the origin for an invalid triangle
+			const float *p[3][4];
+			bool valid[4];
+			for (int j = 0; j < 4; ++j)
+			{
+				const int *f = &mesh.faces[3 * (t + j)];
+				valid[j] = f[0] >= 0 && f[0] < vertexCount && f[1] >= 0 && f[1] < vertexCount && f[2] >= 0 &&
+						   f[2] < vertexCount;
+				for (int k = 0; k < 3; ++k)
+					p[k][j] = valid[j] ? &mesh.vertices[3 * f[k]] : zero;
+			}
+			__m128 px[3], py[3], pz[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				px[k] = _mm_setr_ps(p[k][0][0], p[k][1][0], p[k][2][0], p[k][3][0]);
+				py[k] = _mm_setr_ps(p[k][0][1], p[k][1][1], p[k][2][1], p[k][3][1]);
+				pz[k] = _mm_setr_ps(p[k][0][2], p[k][1][2], p[k][2][2], p[k][3][2]);
+			}
+			__m128 ax = _mm_sub_ps(px[1], px[0]), ay = _mm_sub_ps(py[1], py[0]), az = _mm_sub_ps(pz[1], pz[0]);
+			__m128 bx = _mm_sub_ps(px[2], px[0]), by = _mm_sub_ps(py[2], py[0]), bz = _mm_sub_ps(pz[2], pz[0]);
+			__m128 x = _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+			__m128 y = _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz));
+			__m128 z = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+			__m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+			__m128 inv = obj_detail::rsqrt4(lenSq);
+
+			alignas(16) float out[3][4], weight[3][4];
+			_mm_store_ps(out[0], _mm_mul_ps(x, inv));
+			_mm_store_ps(out[1], _mm_mul_ps(y, inv));
+			_mm_store_ps(out[2], _mm_mul_ps(z, inv));
+			if (weighting == WeightByArea)
+			{
+				__m128 len = _mm_mul_ps(lenSq, inv); // |n|^2 / |n|
+				for (int k = 0; k < 3; ++k)
+					_mm_store_ps(weight[k], len);
+			}
+			else
+			{
+				__m128 cx = _mm_sub_ps(px[2], px[1]), cy = _mm_sub_ps(py[2], py[1]), cz = _mm_sub_ps(pz[2], pz[1]);
+				auto dot = [](__m128 ux, __m128 uy, __m128 uz, __m128 vx, __m128 vy, __m128 vz)
+				{ return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, vx), _mm_mul_ps(uy, vy)), _mm_mul_ps(uz, vz)); };
+				__m128 ra = obj_detail::rsqrt4(dot(ax, ay, az, ax, ay, az));
+				__m128 rb = obj_detail::rsqrt4(dot(bx, by, bz, bx, by, bz));
+				__m128 rc = obj_detail::rsqrt4(dot(cx, cy, cz, cx, cy, cz));
+				_mm_store_ps(weight[0], _mm_mul_ps(dot(ax, ay, az, bx, by, bz), _mm_mul_ps(ra, rb)));
+				_mm_store_ps(weight[1], _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), dot(ax, ay, az, cx, cy, cz)),
+												   _mm_mul_ps(ra, rc)));
+				_mm_store_ps(weight[2], _mm_mul_ps(dot(bx, by, bz, cx, cy, cz), _mm_mul_ps(rb, rc)));
+				for (int k = 0; k < 3; ++k)
+					for (int j = 0; j < 4; ++j)
+						weight[k][j] = std::acos(std::min(1.0f, std::max(-1.0f, weight[k][j])));
+			}
+			for (int j = 0; j < 4; ++j)
+			{
+				float *n = faceNormal + 3 * (t + j), *w = cornerWeight + 3 * (t + j);
+				for (int k = 0; k < 3; ++k)
+				{
+					n[k] = valid[j] ? out[k][j] : 0.0f;
+					w[k] = valid[j] ? weight[k][j] : 0.0f;
+				}
+			}
+		}
+		faceNormalsScalar(mesh, t, last, weighting, faceNormal, cornerWeight);
+	}
+#endif
+}
+
+// Give every face corner of `mesh` without a usable normal (vn missing or out
+// of range) a smooth one: the weighted sum of the unit normals of the
+// triangles around its vertex, scaled to unit length. With `creaseDegrees`
+// between 0 and 180 only the triangles whose normal is within that angle of
+// the corner's own triangle count, so sharp edges stay sharp; 0 smooths
+// across every edge. Corners of one vertex that end up with the same normal
+// share it. Triangles and vertices are processed in parallel on `pool`, and
+// with `simd` set four triangles at a time in SSE lanes. Corners that already
+// had a normal keep it. Returns the number of corners that got a normal.
+inline size_t generateNormals(Mesh &mesh, float creaseDegrees = 0.0f, NormalWeighting weighting = WeightByAngle,
+							  ThreadPool &pool = threadPool(), bool simd = true)
+{
+	using namespace normals_detail;
+
+	const size_t triangleCount = mesh.triangleCount(), vertexCount = mesh.vertexCount();
+	const int normalCount = (int)mesh.normalCount();
+	mesh.face_normals.resize(mesh.faces.size(), -1);
+	auto missing = [&](size_t corner)
+	{ return mesh.face_normals[corner] < 0 || mesh.face_normals[corner] >= normalCount; };
+	size_t missingCount = 0;
+	for (size_t c = 0; c < mesh.faces.size(); ++c)
+		missingCount += missing(c);
+	if (missingCount == 0)
+		return 0;
+
+	// 1. Unit normal of every triangle and weight of every corner
+	std::vector<float> faceNormal(3 * triangleCount), cornerWeight(3 * triangleCount);
+	size_t batches = (triangleCount + batchSize - 1) / batchSize;
+	pool.parallelFor(batches, [&](size_t b)
+					 {
+						 size_t first = b * batchSize, last = std::min(triangleCount, first + batchSize);
+#ifdef __SSE__
+						 if (simd)
+						 {
+							 faceNormalsSse(mesh, first, last, weighting, faceNormal.data(), cornerWeight.data());
+							 return;
+						 }
+#endif
+						 faceNormalsScalar(mesh, first, last, weighting, faceNormal.data(), cornerWeight.data()); });
+
+	// 2. Corners around every vertex position, as offsets into one list
+	std::vector<uint32_t> cornerStart(vertexCount + 1, 0), corners(3 * triangleCount);
+	auto validTriangle = [&](size_t t)
+	{
+		const int *f = &mesh.faces[3 * t];
+		return f[0] >= 0 && f[0] < (int)vertexCount && f[1] >= 0 && f[1] < (int)vertexCount && f[2] >= 0 &&
+			   f[2] < (int)vertexCount;
+	};
+	for (size_t t = 0; t < triangleCount; ++t)
+		if (validTriangle(t))
+			for (int k = 0; k < 3; ++k)
+				++cornerStart[mesh.faces[3 * t + k] + 1];
+	for (size_t v = 0; v < vertexCount; ++v)
+		cornerStart[v + 1] += cornerStart[v];
+	{
+		std::vector<uint32_t> fill(cornerStart.begin(), cornerStart.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t)
+			if (validTriangle(t))
+				for (int k = 0; k < 3; ++k)
+					corners[fill[mesh.faces[3 * t + k]]++] = (uint32_t)(3 * t + k);
+	}
+
+	// 3. Sum the normals of every vertex; the distinct sums of a vertex go to
+	// sums[3 * cornerStart[v]...] and each missing corner records which one it got
+	bool crease = creaseDegrees > 0.0f && creaseDegrees < 180.0f;
+	float cosCrease = std::cos(creaseDegrees * 3.14159265f / 180.0f);
+	std::vector<float> sums(3 * corners.size());
+	std::vector<uint32_t> distinct(vertexCount, 0), slot(mesh.faces.size(), 0);
+	batches = (vertexCount + batchSize - 1) / batchSize;
+	pool.parallelFor(batches, [&](size_t b)
+					 {
+						 size_t last = std::min(vertexCount, (b + 1) * batchSize);
+						 for (size_t v = b * batchSize; v < last; ++v)
+						 {
+							 float *vertexSums = &sums[3 * cornerStart[v]];
+							 uint32_t count = 0;
+							 for (uint32_t i = cornerStart[v]; i < cornerStart[v + 1]; ++i)
+							 {
+								 uint32_t corner = corners[i];
+								 if (!missing(corner))
+									 continue;
+								 // A degenerate triangle has no normal to compare with
+								 const float *own = &faceNormal[3 * (corner / 3)];
+								 bool limit = crease && (own[0] != 0.0f || own[1] != 0.0f || own[2] != 0.0f);
+								 float sum[3] = {0.0f, 0.0f, 0.0f};
+								 for (uint32_t j = cornerStart[v]; j < cornerStart[v + 1]; ++j)
+								 {
+									 const float *n = &faceNormal[3 * (corners[j] / 3)];
+									 if (limit && own[0] * n[0] + own[1] * n[1] + own[2] * n[2] < cosCrease)
+										 continue;
+									 float w = cornerWeight[corners[j]];
+									 sum[0] += w * n[0], sum[1] += w * n[1], sum[2] += w * n[2];
+								 }
+								 uint32_t s = 0;
+								 while (s < count && memcmp(&vertexSums[3 * s], sum, sizeof(sum)) != 0)
+									 ++s;
+								 if (s == count)
+									 memcpy(&vertexSums[3 * count++], sum, sizeof(sum));
+								 slot[corner] = s;
+							 }
+							 distinct[v] = count;
+						 } });
+
+	// 4. Append the distinct sums to the normals, scaled to unit length
+	std::vector<size_t> base(vertexCount + 1, normalCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		base[v + 1] = base[v] + distinct[v];
+	mesh.normals.resize(3 * base[vertexCount]);
+	pool.parallelFor(batches, [&](size_t b)
+					 {
+						 size_t last = std::min(vertexCount, (b + 1) * batchSize);
+						 for (size_t v = b * batchSize; v < last; ++v)
+						 {
+							 float *dst = &mesh.normals[3 * base[v]];
+							 memcpy(dst, &sums[3 * cornerStart[v]], 3 * distinct[v] * sizeof(float));
+							 for (uint32_t s = 0; s < distinct[v]; ++s)
+								 if (dst[3 * s] == 0.0f && dst[3 * s + 1] == 0.0f && dst[3 * s + 2] == 0.0f)
+									 dst[3 * s + 2] = 1.0f; // Only degenerate triangles around it
+							 for (uint32_t i = cornerStart[v]; i < cornerStart[v + 1]; ++i)
+								 if (missing(corners[i]))
+									 mesh.face_normals[corners[i]] = (int)(base[v] + slot[corners[i]]);
+						 }
+						 normalizeVectorsFast(&mesh.normals[3 * base[b * batchSize]], base[last] - base[b * batchSize]); });
+
+	// Corners of triangles with an invalid vertex index, which the renderer
+	// skips anyway, share the default normal
+	const int generated = (int)mesh.normalCount();
+	for (int &n : mesh.face_normals)
+		if (n < 0 || n >= generated)
+		{
+			if (mesh.normalCount() == (size_t)generated)
+				mesh.normals.insert(mesh.normals.end(), {0.0f, 0.0f, 1.0f});
+			n = generated;
+		}
+	return missingCount;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "mesh_buffers.h"
+#include "mesh_bvh.h"
+#include "parallel.h"
+
+namespace occlusion_detail
+{
+	const size_t grain = 64; // Vertices a thread takes from its share at a time
+
+	// Point i of n of the Hammersley set on the unit square
+	inline void hammersley(uint32_t i, uint32_t n, float &u, float &v)
+	{
+		uint32_t bits = i;
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+		bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+		bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+		bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+		u = (i + 0.5f) / n;
+		v = bits * 2.3283064365386963e-10f; // 2^-32
+	}
+
+	// Angle in [0, 2 pi) from a vertex index, to turn the same set of
+	// directions differently at neighbouring vertices so the banding of a
+	// fixed pattern turns into fine noise
+	inline float rotation(uint32_t i)
+	{
+		i ^= i >> 16;
+		i *= 0x7FEB352Du;
+		i ^= i >> 15;
+		i *= 0x846CA68Bu;
+		i ^= i >> 16;
+		return i * (6.2831853f / 4294967296.0f);
+	}
+}
+
+// Ambient occlusion of every vertex: the fraction of `rays` cosine weighted
+// directions over the hemisphere around its normal that hit the mesh within
+// `radius`. Written to occlusion[i] for vertex i, from 0 (open) to 1
+// (closed). The directions are the same on every run, so the bake is
+// deterministic whatever the thread count. Vertices in creases cost far more
+// than those on open surfaces, so threads steal work from each other rather
+// than keep fixed ranges. Returns the number of steals.
+inline size_t bakeOcclusion(const Vertex *vertices, size_t vertexCount, const MeshBvh &bvh, int rays, float radius,
+							float *occlusion, ThreadPool &pool = threadPool())
+{
+	using namespace occlusion_detail;
+	if (rays <= 0 || bvh.empty())
+	{
+		for (size_t i = 0; i < vertexCount; ++i)
+			occlusion[i] = 0.0f;
+		return 0;
+	}
+
+	// Directions around +z, cosine weighted so each ray counts the same
+	std::vector<float> hemisphere(3 * rays);
+	for (int r = 0; r < rays; ++r)
+	{
+		float u, v;
+		hammersley((uint32_t)r, (uint32_t)rays, u, v);
+		float s = std::sqrt(u), angle = 6.2831853f * v;
+		hemisphere[3 * r] = s * std::cos(angle);
+		hemisphere[3 * r + 1] = s * std::sin(angle);
+		hemisphere[3 * r + 2] = std::sqrt(std::max(0.0f, 1.0f - u));
+	}
+	const float offset = radius * 1e-3f; // Off the surface, so a ray does not hit its own triangles
+
+	return pool.parallelForStealing(vertexCount, grain, [&](size_t i)
+									{
+										const Vertex &vertex = vertices[i];
+										const float *n = vertex.normal;
+										float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+										if (length == 0.0f)
+										{
+											occlusion[i] = 0.0f;
+											return;
+										}
+										float z[3] = {n[0] / length, n[1] / length, n[2] / length};
+
+										// Tangent frame around the normal, turned by the vertex's angle
+										float x[3];
+										if (std::fabs(z[0]) < 0.9f)
+											x[0] = 0.0f, x[1] = z[2], x[2] = -z[1];
+										else
+											x[0] = -z[2], x[1] = 0.0f, x[2] = z[0];
+										float xl = std::sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+										for (int k = 0; k < 3; ++k)
+											x[k] /= xl;
+										float y[3] = {z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2], z[0] * x[1] - z[1] * x[0]};
+										float turn = rotation((uint32_t)i), c = std::cos(turn), s = std::sin(turn);
+										for (int k = 0; k < 3; ++k)
+										{
+											float t = c * x[k] + s * y[k];
+											y[k] = c * y[k] - s * x[k];
+											x[k] = t;
+										}
+
+										float origin[3];
+										for (int k = 0; k < 3; ++k)
+											origin[k] = vertex.position[k] + z[k] * offset;
+										int hits = 0;
+										for (int r = 0; r < rays; ++r)
+										{
+											const float *h = &hemisphere[3 * r];
+											float direction[3];
+											for (int k = 0; k < 3; ++k)
+												direction[k] = h[0] * x[k] + h[1] * y[k] + h[2] * z[k];
+											hits += bvh.occluded(origin, direction, radius);
+										}
+										occlusion[i] = (float)hits / rays; });
+}
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+#include "mesh_buffers.h"
+#include "mesh_optimizer.h"
+
+namespace simplify_detail
+{
+	// Sum of squared distances to a set of planes: Q(p) = p'Ap + 2b'p + c.
+	// Planes are not weighted by area, so that the small caps of thin parts
+	// weigh as much as their long sides and stop them from being flattened.
+	struct Quadric
+	{
+		double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+		double b0 = 0, b1 = 0, b2 = 0, c = 0;
+
+		// Plane n.p + d = 0 with a unit normal
+		void addPlane(double nx, double ny, double nz, double d)
+		{
+			a00 += nx * nx, a11 += ny * ny, a22 += nz * nz;
+			a01 += nx * ny, a02 += nx * nz, a12 += ny * nz;
+			b0 += nx * d, b1 += ny * d, b2 += nz * d;
+			c += d * d;
+		}
+
+		void add(const Quadric &q)
+		{
+			a00 += q.a00, a11 += q.a11, a22 += q.a22, a01 += q.a01, a02 += q.a02, a12 += q.a12;
+			b0 += q.b0, b1 += q.b1, b2 += q.b2, c += q.c;
+		}
+
+		double eval(const float *p) const
+		{
+			double x = p[0], y = p[1], z = p[2];
+			return a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+				   2 * (b0 * x + b1 * y + b2 * z) + c;
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t from, to;
+		double cost; // Sum of squared distances to the planes of both vertices
+	};
+
+	inline void triangleNormal(const float *a, const float *b, const float *c, double n[3])
+	{
+		double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+		double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+}
+
+// Quadric error metric simplification (Garland and Heckbert) by half-edge
+// collapses: a vertex is merged into one of its neighbours, so every level
+// keeps using the original vertex buffer and only needs its own indices.
+// Vertices on a border, on a non-manifold edge or on an attribute seam
+// (several welded vertices at one position) never move, which keeps holes
+// and normal/texture seams intact. So do the vertices on an edge between two
+// triangles with different tags (e.g. materials), which keeps every tag's
+// region in its place. Each pass sorts the candidate collapses by
+// cost and applies the cheapest ones whose neighbourhoods do not overlap,
+// rejecting the ones that would flip a triangle.
+class MeshSimplifier
+{
+public:
+	// `tags` holds one value per triangle of `indices`, or is empty (all alike)
+	MeshSimplifier(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+				   const std::vector<int32_t> &tags = {})
+		: vertices(vertices), position(vertices.size()), locked(vertices.size(), 0), quadrics(vertices.size())
+	{
+		using namespace simplify_detail;
+		const size_t n = vertices.size();
+
+		// Welded vertices sharing a position map to the first of them
+		size_t capacity = 16;
+		while (capacity < n * 2)
+			capacity <<= 1;
+		std::vector<uint32_t> slots(capacity, UINT32_MAX);
+		std::vector<uint32_t> wedges(n, 0);
+		for (size_t v = 0; v < n; ++v)
+		{
+			uint32_t bits[3];
+			memcpy(bits, vertices[v].position, sizeof(bits));
+			uint64_t h = bits[0] * 0x9E3779B97F4A7C15ull ^ bits[1] * 0xC2B2AE3D27D4EB4Full ^ bits[2] * 0x165667B19E3779F9ull;
+			for (size_t slot = (h ^ (h >> 29)) & (capacity - 1);; slot = (slot + 1) & (capacity - 1))
+			{
+				if (slots[slot] == UINT32_MAX)
+				{
+					slots[slot] = (uint32_t)v;
+					position[v] = (uint32_t)v;
+					break;
+				}
+				if (memcmp(vertices[slots[slot]].position, vertices[v].position, sizeof(bits)) == 0)
+				{
+					position[v] = slots[slot];
+					break;
+				}
+			}
+			++wedges[position[v]];
+		}
+
+		// Drop triangles that are already degenerate
+		current.reserve(indices.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			uint32_t a = position[indices[i]], b = position[indices[i + 1]], c = position[indices[i + 2]];
+			if (a != b && b != c && a != c)
+			{
+				current.insert(current.end(), &indices[i], &indices[i + 3]);
+				currentTags.push_back(i / 3 < tags.size() ? tags[i / 3] : 0);
+			}
+		}
+
+		// Edges not shared by exactly two triangles of the same tag lock their ends
+		std::vector<std::pair<uint64_t, int32_t>> edges;
+		edges.reserve(current.size());
+		for (size_t i = 0; i < current.size(); i += 3)
+			for (int j = 0; j < 3; ++j)
+			{
+				uint64_t a = position[current[i + j]], b = position[current[i + (j + 1) % 3]];
+				edges.push_back({a < b ? a << 32 | b : b << 32 | a, currentTags[i / 3]});
+			}
+		std::sort(edges.begin(), edges.end());
+		std::vector<char> lockedPosition(n, 0);
+		for (size_t i = 0, j; i < edges.size(); i = j)
+		{
+			for (j = i + 1; j < edges.size() && edges[j].first == edges[i].first; ++j)
+				;
+			if (j - i != 2 || edges[i].second != edges[i + 1].second)
+			{
+				uint64_t key = edges[i].first;
+				lockedPosition[key >> 32] = lockedPosition[key & 0xFFFFFFFF] = 1;
+			}
+		}
+		for (size_t v = 0; v < n; ++v)
+			locked[v] = lockedPosition[position[v]] || wedges[position[v]] > 1;
+
+		// Quadrics of the triangle planes, per position
+		for (size_t i = 0; i < current.size(); i += 3)
+		{
+			const float *a = vertices[current[i]].position, *b = vertices[current[i + 1]].position,
+						*c = vertices[current[i + 2]].position;
+			double nrm[3];
+			triangleNormal(a, b, c, nrm);
+			double len = std::sqrt(nrm[0] * nrm[0] + nrm[1] * nrm[1] + nrm[2] * nrm[2]);
+			if (len == 0)
+				continue;
+			for (double &x : nrm)
+				x /= len;
+			double d = -(nrm[0] * a[0] + nrm[1] * a[1] + nrm[2] * a[2]);
+			for (int j = 0; j < 3; ++j)
+				quadrics[position[current[i + j]]].addPlane(nrm[0], nrm[1], nrm[2], d);
+		}
+	}
+
+	// Collapse edges, cheapest first, until at most `targetIndexCount` indices
+	// are left or no collapse is possible. Returns the current index buffer.
+	const std::vector<uint32_t> &simplify(size_t targetIndexCount)
+	{
+		using namespace simplify_detail;
+		const size_t n = vertices.size();
+		std::vector<Collapse> candidates;
+		std::vector<uint32_t> offsets, adjacency, remap(n), touched(n, 0);
+		uint32_t pass = 0;
+
+		while (current.size() > targetIndexCount)
+		{
+			// Every directed edge out of a free vertex is a candidate. Free
+			// vertices only have manifold edges, so each direction of an edge
+			// is listed once, by the triangle with that winding.
+			candidates.clear();
+			for (size_t i = 0; i < current.size(); i += 3)
+				for (int j = 0; j < 3; ++j)
+				{
+					uint32_t a = current[i + j], b = current[i + (j + 1) % 3];
+					if (!locked[a])
+						candidates.push_back({a, b, cost(a, b)});
+				}
+			if (candidates.empty())
+				break;
+
+			// Only the cheapest candidates, up to index trianglesToRemove, are
+			// considered. Most collapses remove two triangles and most edges
+			// are listed in both directions, so that is roughly enough for the
+			// goal, and it keeps the pass from taking expensive collapses just
+			// because the cheaper ones around them are blocked.
+			size_t trianglesToRemove = (current.size() - targetIndexCount + 2) / 3, removed = 0;
+			auto cheaper = [](const Collapse &x, const Collapse &y)
+			{ return x.cost != y.cost ? x.cost < y.cost : x.from != y.from ? x.from < y.from : x.to < y.to; };
+			auto last = candidates.begin() + std::min(candidates.size() - 1, trianglesToRemove);
+			std::nth_element(candidates.begin(), last, candidates.end(), cheaper);
+			std::sort(candidates.begin(), last, cheaper);
+			candidates.erase(last + 1, candidates.end());
+
+			// Triangles around each vertex (CSR)
+			offsets.assign(n + 1, 0);
+			for (uint32_t v : current)
+				++offsets[v + 1];
+			for (size_t v = 0; v < n; ++v)
+				offsets[v + 1] += offsets[v];
+			adjacency.resize(current.size());
+			{
+				std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+				for (size_t i = 0; i < current.size(); ++i)
+					adjacency[fill[current[i]]++] = (uint32_t)(i / 3);
+			}
+
+			for (size_t v = 0; v < n; ++v)
+				remap[v] = (uint32_t)v;
+			++pass;
+			for (const Collapse &c : candidates)
+			{
+				if (removed >= trianglesToRemove)
+					break;
+				if (touched[position[c.from]] == pass || touched[position[c.to]] == pass)
+					continue;
+				size_t collapsed = trianglesRemoved(c, offsets, adjacency);
+				if (collapsed == 0)
+					continue;
+
+				remap[c.from] = c.to;
+				removed += collapsed;
+				quadrics[position[c.to]].add(quadrics[position[c.from]]);
+				maxCost = std::max(maxCost, c.cost);
+				for (uint32_t k = offsets[c.from]; k < offsets[c.from + 1]; ++k)
+					for (int j = 0; j < 3; ++j)
+						touched[position[current[3 * adjacency[k] + j]]] = pass;
+			}
+			if (removed == 0)
+				break;
+
+			// Apply the pass and drop the triangles that collapsed
+			size_t out = 0;
+			for (size_t i = 0; i < current.size(); i += 3)
+			{
+				uint32_t a = remap[current[i]], b = remap[current[i + 1]], c = remap[current[i + 2]];
+				if (position[a] != position[b] && position[b] != position[c] && position[a] != position[c])
+				{
+					currentTags[out / 3] = currentTags[i / 3];
+					current[out++] = a, current[out++] = b, current[out++] = c;
+				}
+			}
+			current.resize(out);
+			currentTags.resize(out / 3);
+		}
+		return current;
+	}
+
+	// Tag of every triangle of the current index buffer
+	const std::vector<int32_t> &tags() const { return currentTags; }
+
+	// Error of the collapses made so far, in model units: the square root of
+	// the largest cost, which bounds how far any surviving vertex is from the
+	// original planes it stands for
+	float error() const { return (float)std::sqrt(std::max(0.0, maxCost)); }
+
+private:
+	const std::vector<Vertex> &vertices;
+	std::vector<uint32_t> position; // First welded vertex with the same position
+	std::vector<char> locked;
+	std::vector<simplify_detail::Quadric> quadrics; // Per position
+	std::vector<uint32_t> current;
+	std::vector<int32_t> currentTags;
+	double maxCost = 0;
+
+	double cost(uint32_t from, uint32_t to) const
+	{
+		const float *p = vertices[to].position;
+		return std::max(0.0, quadrics[position[from]].eval(p) + quadrics[position[to]].eval(p));
+	}
+
+	// Number of triangles that collapsing `c` removes, or 0 if it would flip
+	// one of the remaining triangles around `c.from`
+	size_t trianglesRemoved(const simplify_detail::Collapse &c, const std::vector<uint32_t> &offsets,
+							const std::vector<uint32_t> &adjacency) const
+	{
+		using namespace simplify_detail;
+		size_t removed = 0;
+		for (uint32_t k = offsets[c.from]; k < offsets[c.from + 1]; ++k)
+		{
+			const uint32_t *tri = &current[3 * adjacency[k]];
+			if (position[tri[0]] == position[c.to] || position[tri[1]] == position[c.to] ||
+				position[tri[2]] == position[c.to])
+			{
+				++removed;
+				continue;
+			}
+			const float *p[3], *moved[3];
+			for (int j = 0; j < 3; ++j)
+			{
+				p[j] = vertices[tri[j]].position;
+				moved[j] = tri[j] == c.from ? vertices[c.to].position : p[j];
+			}
+			double before[3], after[3];
+			triangleNormal(p[0], p[1], p[2], before);
+			triangleNormal(moved[0], moved[1], moved[2], after);
+			if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0)
+				return 0;
+		}
+		return removed;
+	}
+};
+
+// Simplify `mesh` into a chain of coarser levels with about half the
+// triangles of the previous one each, down to `minTriangles`. The chain stops
+// early when the locked vertices keep a level from losing a quarter of its
+// triangles, or when its error passes a quarter of the model's radius (such a
+// level would only be drawn a few pixels wide). Material borders do not
+// move, and every level has one group per material, each reordered for the
+// vertex cache.
+inline void buildLodChain(IndexedMesh &mesh, size_t maxLevels = 5, size_t minTriangles = 256)
+{
+	mesh.lods.clear();
+	mesh.lodIndices.clear();
+	mesh.lodGroups.clear();
+	const float *b = mesh.bounds;
+	float radius = 0.5f * std::sqrt((b[3] - b[0]) * (b[3] - b[0]) + (b[4] - b[1]) * (b[4] - b[1]) + (b[5] - b[2]) * (b[5] - b[2]));
+
+	std::vector<int32_t> materials(mesh.triangleCount(), -1);
+	for (const MeshGroup &g : mesh.groups)
+		std::fill(materials.begin() + g.firstIndex / 3, materials.begin() + (g.firstIndex + g.indexCount) / 3, g.material);
+
+	MeshSimplifier simplifier(mesh.vertices, mesh.indices, materials);
+	size_t previous = mesh.indices.size();
+	while (mesh.lods.size() < maxLevels && previous / 6 >= minTriangles)
+	{
+		std::vector<uint32_t> level = simplifier.simplify(previous / 6 * 3);
+		if (level.size() > previous * 3 / 4 || simplifier.error() > 0.25f * radius)
+			break;
+
+		// Triangles sorted by material, keeping their order within one
+		const std::vector<int32_t> &tags = simplifier.tags();
+		std::vector<uint32_t> order(tags.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y)
+						 { return tags[x] < tags[y]; });
+		MeshLod lod = {(uint32_t)mesh.lodIndices.size(), (uint32_t)level.size(), simplifier.error(),
+					   (uint32_t)mesh.lodGroups.size(), 0};
+		for (size_t i = 0, j; i < order.size(); i = j)
+		{
+			std::vector<uint32_t> range;
+			for (j = i; j < order.size() && tags[order[j]] == tags[order[i]]; ++j)
+				range.insert(range.end(), &level[3 * order[j]], &level[3 * order[j] + 3]);
+			optimizeVertexCache(range, mesh.vertices.size());
+			mesh.lodGroups.push_back({(uint32_t)mesh.lodIndices.size() - lod.firstIndex, (uint32_t)range.size(),
+									  tags[order[i]]});
+			mesh.lodIndices.insert(mesh.lodIndices.end(), range.begin(), range.end());
+			++lod.groupCount;
+		}
+		mesh.lods.push_back(lod);
+		previous = level.size();
+	}
+}
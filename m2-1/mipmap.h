@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <GL/freeglut.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "parallel.h"
+
+// One level of a mip chain: tightly packed B, G, R, A rows, bottom row first
+struct MipLevel
+{
+	int width = 0, height = 0;
+	std::vector<unsigned char> bgra;
+};
+
+namespace mip_detail
+{
+	const int batchRows = 16; // Rows of a level per parallel task
+
+	// 2x2 box filter of two BGRA rows `a` and `b` into `width` pixels of `out`
+	// (rounded to nearest). With an odd source width the last column is left
+	// out, as the level sizes round down.
+	inline void halveRowPair(const unsigned char *a, const unsigned char *b, int width, unsigned char *out, bool simd)
+	{
+		int x = 0;
+#ifdef __SSE2__
+		if (simd)
+		{
+			const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+			for (; x + 4 <= width; x += 4)
+			{
+				// Eight source pixels of each row; 16-bit lanes hold two pixels per register
+				__m128i a0 = _mm_loadu_si128((const __m128i *)(a + 8 * x)), a1 = _mm_loadu_si128((const __m128i *)(a + 8 * x + 16));
+				__m128i b0 = _mm_loadu_si128((const __m128i *)(b + 8 * x)), b1 = _mm_loadu_si128((const __m128i *)(b + 8 * x + 16));
+				__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero)); // Pixels 0, 1
+				__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero)); // Pixels 2, 3
+				__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero)); // Pixels 4, 5
+				__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero)); // Pixels 6, 7
+				// Add each pixel to its right neighbour: 0+1, 2+3 and 4+5, 6+7
+				__m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+				__m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+				h0 = _mm_srli_epi16(_mm_add_epi16(h0, two), 2);
+				h1 = _mm_srli_epi16(_mm_add_epi16(h1, two), 2);
+				_mm_storeu_si128((__m128i *)(out + 4 * x), _mm_packus_epi16(h0, h1));
+			}
+		}
+#endif
+		for (; x < width; ++x)
+			for (int c = 0; c < 4; ++c)
+				out[4 * x + c] = (unsigned char)((a[8 * x + c] + a[8 * x + 4 + c] + b[8 * x + c] + b[8 * x + 4 + c] + 2) >> 2);
+	}
+
+	// Row `y` of a source image as BGRA: 4-byte pixels are used in place,
+	// 3-byte ones are widened into `scratch` (with an opaque alpha). A source
+	// one pixel wide is repeated, so the filter still has a pixel pair.
+	inline const unsigned char *sourceRow(const unsigned char *bottom, ptrdiff_t stride, int width,
+										  int bytesPerPixel, int y, std::vector<unsigned char> &scratch)
+	{
+		const unsigned char *row = bottom + y * stride;
+		if (bytesPerPixel == 4 && width > 1)
+			return row;
+		scratch.resize(4 * (size_t)std::max(width, 2));
+		for (int x = 0; x < width; ++x)
+		{
+			const unsigned char *p = row + bytesPerPixel * x;
+			unsigned char *q = &scratch[4 * x];
+			q[0] = p[0], q[1] = p[1], q[2] = p[2], q[3] = bytesPerPixel == 4 ? p[3] : 255;
+		}
+		if (width == 1)
+			std::copy(scratch.begin(), scratch.begin() + 4, scratch.begin() + 4);
+		return scratch.data();
+	}
+
+	// Next level of a source image, its rows split into batches on `pool`
+	inline MipLevel halve(const unsigned char *bottom, ptrdiff_t stride, int width, int height, int bytesPerPixel,
+						  ThreadPool &pool, bool simd)
+	{
+		MipLevel level;
+		level.width = std::max(1, width / 2);
+		level.height = std::max(1, height / 2);
+		level.bgra.resize(4 * (size_t)level.width * level.height);
+		size_t batches = (level.height + batchRows - 1) / batchRows;
+		pool.parallelFor(batches, [&](size_t batch)
+						 {
+							 std::vector<unsigned char> scratchA, scratchB;
+							 int last = std::min(level.height, (int)(batch + 1) * batchRows);
+							 for (int y = (int)batch * batchRows; y < last; ++y)
+							 {
+								 const unsigned char *a = sourceRow(bottom, stride, width, bytesPerPixel, std::min(2 * y, height - 1), scratchA);
+								 const unsigned char *b = sourceRow(bottom, stride, width, bytesPerPixel, std::min(2 * y + 1, height - 1), scratchB);
+								 halveRowPair(a, b, level.width, &level.bgra[4 * (size_t)y * level.width], simd);
+							 } });
+		return level;
+	}
+}
+
+// Every level below the base image, down to 1x1, each one a 2x2 box filter
+// of the level above it (sizes round down). The base is `height` rows of
+// `width` pixels with `bytesPerPixel` bytes (3 = BGR, 4 = BGRA); row y starts
+// at bottom + y * stride, so a top-down image passes its last row and a
+// negative stride. Levels depend on each other and are built in turn, the
+// rows of each one in parallel on `pool`; with `simd`, four pixels at a time
+// in SSE2 registers.
+inline std::vector<MipLevel> buildMipChain(const unsigned char *bottom, ptrdiff_t stride, int width, int height,
+										   int bytesPerPixel, ThreadPool &pool = threadPool(), bool simd = true)
+{
+	std::vector<MipLevel> chain;
+	while (width > 1 || height > 1)
+	{
+		chain.push_back(mip_detail::halve(bottom, stride, width, height, bytesPerPixel, pool, simd));
+		const MipLevel &level = chain.back();
+		bottom = level.bgra.data();
+		stride = 4 * (ptrdiff_t)level.width;
+		width = level.width, height = level.height;
+		bytesPerPixel = 4;
+	}
+	return chain;
+}
+
+// glTexImage2D of `chain` as levels 1, 2, ... of the bound GL_TEXTURE_2D, whose
+// base level is already set, and limit sampling to the levels uploaded
+inline void uploadMipChain(const std::vector<MipLevel> &chain, GLenum internalFormat)
+{
+	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	for (size_t i = 0; i < chain.size(); ++i)
+		glTexImage2D(GL_TEXTURE_2D, (GLint)i + 1, internalFormat, chain[i].width, chain[i].height, 0, GL_BGRA,
+					 GL_UNSIGNED_BYTE, chain[i].bgra.data());
+	glPopClientAttrib();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)chain.size());
+}
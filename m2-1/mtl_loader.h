@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "obj_loader.h"
+
+// Fixed-function material of a .mtl `newmtl` block. The defaults are the
+// material the viewer used for every model before it read .mtl files.
+struct Material
+{
+	std::string name;
+	float ambient[4] = {0.2f, 0.2f, 0.2f, 1.0f};  // Ka
+	float diffuse[4] = {0.6f, 0.6f, 0.6f, 1.0f};  // Kd, with the opacity (d) as alpha
+	float specular[4] = {1.0f, 1.0f, 1.0f, 1.0f}; // Ks
+	float shininess = 64.0f;					  // Ns, clamped to the 0..128 of glMaterialf
+
+	bool translucent() const { return diffuse[3] < 1.0f; }
+};
+
+// Parse the materials of a .mtl file and append them to `out`. Only the
+// parts fixed-function lighting can use are read: Ka, Kd, Ks, Ns and the
+// opacity (d, or its inverse Tr). Returns false if the file cannot be opened.
+inline bool parseMtlFile(const std::string &fname, std::vector<Material> &out)
+{
+	using namespace obj_detail;
+	MappedFile file;
+	if (!file.open(fname))
+		return false;
+
+	const char *p = file.data, *end = file.data + file.size;
+	Material *current = nullptr;
+	while (p < end)
+	{
+		const char *eol = endOfLine(p, end);
+		skipBlanks(p, eol);
+		// Up to three channels; the ones missing keep their value
+		auto color = [&](const char *q, float rgb[4])
+		{
+			for (int i = 0; i < 3 && parseFloat(q, eol, rgb[i]); ++i)
+				;
+		};
+		auto number = [&](const char *q, float low, float high, float &out)
+		{
+			float value;
+			if (!parseFloat(q, eol, value))
+				return false;
+			out = std::min(std::max(value, low), high);
+			return true;
+		};
+		if (hasKeyword(p, eol, "newmtl", 6))
+		{
+			out.emplace_back();
+			current = &out.back();
+			current->name = lineRest(p + 6, eol);
+		}
+		else if (!current)
+			; // Nothing to apply it to
+		else if (hasKeyword(p, eol, "Ka", 2))
+			color(p + 2, current->ambient);
+		else if (hasKeyword(p, eol, "Kd", 2))
+			color(p + 2, current->diffuse);
+		else if (hasKeyword(p, eol, "Ks", 2))
+			color(p + 2, current->specular);
+		else if (hasKeyword(p, eol, "Ns", 2))
+			number(p + 2, 0.0f, 128.0f, current->shininess);
+		else if (hasKeyword(p, eol, "d", 1))
+			number(p + 1, 0.0f, 1.0f, current->diffuse[3]);
+		else if (hasKeyword(p, eol, "Tr", 2) && number(p + 2, 0.0f, 1.0f, current->diffuse[3]))
+			current->diffuse[3] = 1.0f - current->diffuse[3];
+		p = eol + 1;
+	}
+	return true;
+}
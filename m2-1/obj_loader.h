@@ -0,0 +1,682 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "parallel.h"
+
+// A run of triangles started by a `g`, `o` or `usemtl` line, up to the next one
+struct FaceGroup
+{
+	size_t firstTriangle;
+	int material; // Index into Mesh::materials, -1 before any usemtl
+};
+
+// Geometry parsed from a .obj file. Every attribute lives in one packed,
+// contiguous buffer: vertices/normals hold x, y, z triples, texcoords hold
+// u, v pairs and the three index buffers hold one triple per triangle. Faces
+// are already triangulated (fan) and every index is 0-based; -1 marks a
+// missing vt/vn on a face corner.
+struct Mesh
+{
+	std::vector<float> vertices;	 // Vertex positions (3 floats each)
+	std::vector<float> normals;		 // Vertex normals, unit length (3 floats each)
+	std::vector<float> texcoords;	 // Texture coordinates (2 floats each)
+	std::vector<int> faces;			 // Vertex indices (3 per triangle)
+	std::vector<int> face_normals;	 // Normal indices (3 per triangle)
+	std::vector<int> face_texcoords; // Texture coordinate indices (3 per triangle)
+	std::vector<FaceGroup> groups;	 // In file order, the first one at triangle 0
+	std::vector<std::string> materials; // Names used by usemtl, in order of first use
+	std::string materialLibrary;		// First mtllib, relative to the .obj
+
+	// Bounding box of the vertex positions
+	float minX = INFINITY, minY = INFINITY, minZ = INFINITY;
+	float maxX = -INFINITY, maxY = -INFINITY, maxZ = -INFINITY;
+
+	size_t vertexCount() const { return vertices.size() / 3; }
+	size_t normalCount() const { return normals.size() / 3; }
+	size_t texcoordCount() const { return texcoords.size() / 2; }
+	size_t triangleCount() const { return faces.size() / 3; }
+
+	// Move the bounding box center to the origin
+	void center()
+	{
+		float c[3] = {(minX + maxX) / 2.0f, (minY + maxY) / 2.0f, (minZ + maxZ) / 2.0f};
+		for (size_t i = 0; i < vertices.size(); ++i)
+			vertices[i] -= c[i % 3];
+		minX -= c[0], maxX -= c[0];
+		minY -= c[1], maxY -= c[1];
+		minZ -= c[2], maxZ -= c[2];
+	}
+};
+
+// The vector-of-vectors layout the viewer used before Mesh, one heap block per
+// element. Only the legacy loader fills it, as a baseline for the benchmarks.
+struct LegacyObjData
+{
+	std::vector<std::vector<float>> vertices, normals, texcoords;
+	std::vector<std::vector<int>> faces, face_normals, face_texcoords;
+	float minX = INFINITY, minY = INFINITY, minZ = INFINITY;
+	float maxX = -INFINITY, maxY = -INFINITY, maxZ = -INFINITY;
+};
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+struct MappedFile
+{
+	const char *data = nullptr;
+	size_t size = 0;
+
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile() { close(); }
+
+	bool open(const std::string &fname)
+	{
+		close();
+		int fd = ::open(fname.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		size = (size_t)st.st_size;
+		if (size > 0)
+		{
+			void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED)
+			{
+				::close(fd);
+				size = 0;
+				return false;
+			}
+			madvise(p, size, MADV_SEQUENTIAL);
+			data = (const char *)p;
+		}
+		::close(fd); // The mapping stays valid after the descriptor is closed
+		return true;
+	}
+
+	void close()
+	{
+		if (data)
+			munmap((void *)data, size);
+		data = nullptr;
+		size = 0;
+	}
+};
+
+namespace obj_detail
+{
+	inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	inline void skipBlanks(const char *&p, const char *end)
+	{
+		while (p < end && isBlank(*p))
+			++p;
+	}
+
+	// Parse a float in place; from_chars does not accept a leading '+'
+	inline bool parseFloat(const char *&p, const char *end, float &out)
+	{
+		skipBlanks(p, end);
+		if (p < end && *p == '+')
+			++p;
+		auto res = std::from_chars(p, end, out);
+		if (res.ec != std::errc())
+			return false;
+		p = res.ptr;
+		return true;
+	}
+
+	inline bool parseInt(const char *&p, const char *end, int &out)
+	{
+		if (p < end && *p == '+')
+			++p;
+		auto res = std::from_chars(p, end, out);
+		if (res.ec != std::errc())
+			return false;
+		p = res.ptr;
+		return true;
+	}
+
+	// Number of v, vn, vt elements and triangles before some point of the file
+	struct Counts
+	{
+		size_t v = 0, vn = 0, vt = 0, tri = 0;
+	};
+
+	enum LineType
+	{
+		OtherLine,
+		VertexLine,
+		NormalLine,
+		TexcoordLine,
+		FaceLine,
+		GroupLine,	  // g or o
+		MaterialLine, // usemtl
+		LibraryLine	  // mtllib
+	};
+
+	// A group, material or library line of a chunk, with the number of
+	// triangles of the chunk before it
+	struct GroupMark
+	{
+		size_t triangle;
+		LineType type;
+		std::string name;
+	};
+
+	// True if the line at p starts with `keyword` followed by a blank
+	inline bool hasKeyword(const char *p, const char *eol, const char *keyword, size_t length)
+	{
+		return (size_t)(eol - p) > length && memcmp(p, keyword, length) == 0 && isBlank(p[length]);
+	}
+
+	// Classify the line starting at p and move p past its keyword
+	inline LineType lineType(const char *&p, const char *eol)
+	{
+		skipBlanks(p, eol);
+		if (p + 1 >= eol)
+			return OtherLine;
+		if (p[0] == 'v')
+		{
+			if (isBlank(p[1]))
+			{
+				p += 1;
+				return VertexLine;
+			}
+			if (p + 2 < eol && isBlank(p[2]) && (p[1] == 'n' || p[1] == 't'))
+			{
+				LineType type = p[1] == 'n' ? NormalLine : TexcoordLine;
+				p += 2;
+				return type;
+			}
+		}
+		else if (p[0] == 'f' && isBlank(p[1]))
+		{
+			p += 1;
+			return FaceLine;
+		}
+		else if ((p[0] == 'g' || p[0] == 'o') && isBlank(p[1]))
+		{
+			p += 1;
+			return GroupLine;
+		}
+		else if (hasKeyword(p, eol, "usemtl", 6))
+		{
+			p += 6;
+			return MaterialLine;
+		}
+		else if (hasKeyword(p, eol, "mtllib", 6))
+		{
+			p += 6;
+			return LibraryLine;
+		}
+		return OtherLine;
+	}
+
+	inline const char *endOfLine(const char *p, const char *end)
+	{
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		return eol ? eol : end;
+	}
+
+	// Turn a 1-based (or negative, relative) OBJ index into a 0-based one
+	inline int resolveIndex(int idx, size_t count)
+	{
+		if (idx > 0)
+			return idx - 1;
+		if (idx < 0)
+			return (int)count + idx;
+		return -1;
+	}
+
+	// Parse one face corner: v, v/vt, v//vn or v/vt/vn
+	inline bool parseCorner(const char *&p, const char *end, const Counts &seen, int &vi, int &ti, int &ni)
+	{
+		int raw;
+		vi = ti = ni = -1;
+		if (!parseInt(p, end, raw))
+			return false;
+		vi = resolveIndex(raw, seen.v);
+		if (p < end && *p == '/')
+		{
+			++p;
+			if (p < end && *p != '/' && parseInt(p, end, raw))
+				ti = resolveIndex(raw, seen.vt);
+			if (p < end && *p == '/')
+			{
+				++p;
+				if (parseInt(p, end, raw))
+					ni = resolveIndex(raw, seen.vn);
+			}
+		}
+		// Skip whatever is left of a malformed token
+		while (p < end && !isBlank(*p) && *p != '\n')
+			++p;
+		return true;
+	}
+
+	// Number of corners of the face whose corners start at p
+	inline size_t countCorners(const char *p, const char *eol)
+	{
+		Counts none;
+		size_t corners = 0;
+		for (;;)
+		{
+			skipBlanks(p, eol);
+			int vi, ti, ni;
+			if (p >= eol || !parseCorner(p, eol, none, vi, ti, ni))
+				return corners;
+			++corners;
+		}
+	}
+
+	// Rest of the line at p, without surrounding blanks
+	inline std::string lineRest(const char *p, const char *eol)
+	{
+		skipBlanks(p, eol);
+		while (eol > p && isBlank(eol[-1]))
+			--eol;
+		return std::string(p, eol);
+	}
+
+	// First pass over a chunk: count its v, vn and vt lines and the triangles
+	// its faces turn into, so the second pass can write everything in place.
+	// Group, material and library lines go to `marks`.
+	inline Counts countElements(const char *p, const char *end, std::vector<GroupMark> &marks)
+	{
+		Counts counts;
+		while (p < end)
+		{
+			const char *eol = endOfLine(p, end);
+			LineType type = lineType(p, eol);
+			switch (type)
+			{
+			case VertexLine:
+				++counts.v;
+				break;
+			case NormalLine:
+				++counts.vn;
+				break;
+			case TexcoordLine:
+				++counts.vt;
+				break;
+			case FaceLine:
+			{
+				size_t corners = countCorners(p, eol);
+				if (corners > 2)
+					counts.tri += corners - 2;
+				break;
+			}
+			case GroupLine:
+			case MaterialLine:
+			case LibraryLine:
+				marks.push_back({counts.tri, type, lineRest(p, eol)});
+				break;
+			default:
+				break;
+			}
+			p = eol + 1;
+		}
+		return counts;
+	}
+
+	inline void growBounds(Mesh &box, float x, float y, float z)
+	{
+		box.minX = std::min(box.minX, x);
+		box.maxX = std::max(box.maxX, x);
+		box.minY = std::min(box.minY, y);
+		box.maxY = std::max(box.maxY, y);
+		box.minZ = std::min(box.minZ, z);
+		box.maxZ = std::max(box.maxZ, z);
+	}
+
+	// Second pass over a chunk. Every element and triangle is written straight
+	// into its final slot of `out`, starting at `base`, which holds how many of
+	// each precede the chunk. The chunk's bounding box goes to `box`.
+	inline void parseChunk(const char *p, const char *end, Counts base, Mesh &out, Mesh &box)
+	{
+		Counts seen = base;
+		float *vertices = out.vertices.data();
+		float *normals = out.normals.data();
+		float *texcoords = out.texcoords.data();
+
+		while (p < end)
+		{
+			const char *eol = endOfLine(p, end);
+			switch (lineType(p, eol))
+			{
+			// Vertex position
+			case VertexLine:
+			{
+				float x = 0, y = 0, z = 0;
+				parseFloat(p, eol, x) && parseFloat(p, eol, y) && parseFloat(p, eol, z);
+				float *v = vertices + 3 * seen.v++;
+				v[0] = x, v[1] = y, v[2] = z;
+				growBounds(box, x, y, z);
+				break;
+			}
+			// Vertex normal
+			case NormalLine:
+			{
+				float x = 0, y = 0, z = 0;
+				parseFloat(p, eol, x) && parseFloat(p, eol, y) && parseFloat(p, eol, z);
+				float *n = normals + 3 * seen.vn++;
+				n[0] = x, n[1] = y, n[2] = z;
+				break;
+			}
+			// Texture coordinate
+			case TexcoordLine:
+			{
+				float u = 0, v = 0;
+				parseFloat(p, eol, u) && parseFloat(p, eol, v);
+				float *t = texcoords + 2 * seen.vt++;
+				t[0] = u, t[1] = v;
+				break;
+			}
+			// Face, converted to a triangle fan as its corners are read
+			case FaceLine:
+			{
+				int first[3], prev[3], corner[3];
+				for (int n = 0;; ++n)
+				{
+					skipBlanks(p, eol);
+					if (p >= eol || !parseCorner(p, eol, seen, corner[0], corner[1], corner[2]))
+						break;
+					if (n >= 2)
+					{
+						size_t t = 3 * seen.tri++;
+						out.faces[t] = first[0], out.faces[t + 1] = prev[0], out.faces[t + 2] = corner[0];
+						out.face_texcoords[t] = first[1], out.face_texcoords[t + 1] = prev[1], out.face_texcoords[t + 2] = corner[1];
+						out.face_normals[t] = first[2], out.face_normals[t + 1] = prev[2], out.face_normals[t + 2] = corner[2];
+					}
+					if (n == 0)
+						std::copy(corner, corner + 3, first);
+					std::copy(corner, corner + 3, prev);
+				}
+				break;
+			}
+			default:
+				break;
+			}
+			p = eol + 1;
+		}
+	}
+}
+
+namespace obj_detail
+{
+#ifdef __SSE__
+	// 1/sqrt(x) in four lanes: the 12-bit hardware estimate refined by one
+	// Newton-Raphson step to about 23 bits; 0 where x is (nearly) zero
+	inline __m128 rsqrt4(__m128 x)
+	{
+		__m128 r = _mm_rsqrt_ps(x);
+		__m128 halfX = _mm_mul_ps(_mm_set1_ps(0.5f), x);
+		r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfX, _mm_mul_ps(r, r))));
+		return _mm_and_ps(r, _mm_cmpgt_ps(x, _mm_set1_ps(1e-30f)));
+	}
+#endif
+}
+
+// Scale `count` x, y, z triples to unit length with an exact square root,
+// the same result as the legacy loader; zero vectors stay zero
+inline void normalizeVectors(float *xyz, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float *v = xyz + 3 * i;
+		float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		if (len > 0.0f)
+			v[0] /= len, v[1] /= len, v[2] /= len;
+	}
+}
+
+// normalizeVectors for normals computed here rather than read from a file,
+// where a last-bit difference does not matter. With SSE four vectors share
+// one batched reciprocal square root, within about 2e-7 of the exact result.
+inline void normalizeVectorsFast(float *xyz, size_t count)
+{
+	size_t i = 0;
+#ifdef __SSE__
+	for (; i + 4 <= count; i += 4)
+	{
+		float *v = xyz + 3 * i;
+		__m128 x = _mm_setr_ps(v[0], v[3], v[6], v[9]);
+		__m128 y = _mm_setr_ps(v[1], v[4], v[7], v[10]);
+		__m128 z = _mm_setr_ps(v[2], v[5], v[8], v[11]);
+		__m128 r = obj_detail::rsqrt4(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+		alignas(16) float out[3][4];
+		_mm_store_ps(out[0], _mm_mul_ps(x, r));
+		_mm_store_ps(out[1], _mm_mul_ps(y, r));
+		_mm_store_ps(out[2], _mm_mul_ps(z, r));
+		for (int k = 0; k < 4; ++k)
+			v[3 * k] = out[0][k], v[3 * k + 1] = out[1][k], v[3 * k + 2] = out[2][k];
+	}
+#endif
+	normalizeVectors(xyz + 3 * i, count - i);
+}
+
+// normalizeVectors split into batches run on `pool`
+inline void normalizeVectors(std::vector<float> &xyz, ThreadPool &pool)
+{
+	const size_t batch = 65536;
+	size_t count = xyz.size() / 3;
+	pool.parallelFor((count + batch - 1) / batch, [&](size_t b)
+					 { normalizeVectors(xyz.data() + 3 * b * batch, std::min(batch, count - b * batch)); });
+}
+
+// Parse an in-memory .obj buffer, scanning the bytes in place. The buffer is
+// split into chunks at line boundaries which are parsed on `pool`:
+//   1. every chunk counts its v/vn/vt lines and triangles, and notes its
+//      group, material and library lines;
+//   2. a prefix sum over those counts gives each chunk its global offsets, so
+//      relative (negative) face indices resolve exactly as in a serial parse,
+//      and sizes every buffer of the mesh exactly once; the noted lines, in
+//      file order, become the face groups;
+//   3. every chunk parses its lines, writing its elements at those offsets;
+//   4. the normals are scaled to unit length, in batches.
+// The result does not depend on the number of threads or chunks.
+inline void parseObjBuffer(const char *begin, const char *end, Mesh &out, ThreadPool &pool)
+{
+	using namespace obj_detail;
+
+	// A few chunks per thread keeps the threads busy when line density varies
+	const size_t minChunkBytes = 256 * 1024;
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool.size() * 4, (end - begin) / minChunkBytes));
+	if (pool.size() == 1)
+		chunkCount = 1;
+
+	std::vector<const char *> bounds(chunkCount + 1, end);
+	bounds[0] = begin;
+	for (size_t i = 1; i < chunkCount; ++i)
+	{
+		const char *p = std::max(bounds[i - 1], begin + (end - begin) * i / chunkCount);
+		const char *eol = p < end ? endOfLine(p, end) : end;
+		bounds[i] = eol < end ? eol + 1 : end;
+	}
+
+	std::vector<Counts> bases(chunkCount + 1);
+	std::vector<std::vector<GroupMark>> marks(chunkCount);
+	pool.parallelFor(chunkCount, [&](size_t i)
+					 { bases[i + 1] = countElements(bounds[i], bounds[i + 1], marks[i]); });
+	for (size_t i = 1; i <= chunkCount; ++i)
+	{
+		bases[i].v += bases[i - 1].v;
+		bases[i].vn += bases[i - 1].vn;
+		bases[i].vt += bases[i - 1].vt;
+		bases[i].tri += bases[i - 1].tri;
+	}
+
+	// Every g, o or usemtl line starts a group, which keeps the material of
+	// the one before unless it is a usemtl line
+	out.groups.push_back({0, -1});
+	for (size_t i = 0; i < chunkCount; ++i)
+		for (const GroupMark &mark : marks[i])
+		{
+			if (mark.type == LibraryLine)
+			{
+				if (out.materialLibrary.empty())
+					out.materialLibrary = mark.name;
+				continue;
+			}
+			int material = out.groups.back().material;
+			if (mark.type == MaterialLine)
+			{
+				auto known = std::find(out.materials.begin(), out.materials.end(), mark.name);
+				material = (int)(known - out.materials.begin());
+				if (known == out.materials.end())
+					out.materials.push_back(mark.name);
+			}
+			size_t triangle = bases[i].tri + mark.triangle;
+			if (out.groups.back().firstTriangle == triangle)
+				out.groups.back().material = material; // The previous group has no triangles
+			else
+				out.groups.push_back({triangle, material});
+		}
+
+	const Counts &total = bases[chunkCount];
+	out.vertices.resize(3 * total.v);
+	out.normals.resize(3 * total.vn);
+	out.texcoords.resize(2 * total.vt);
+	out.faces.resize(3 * total.tri);
+	out.face_normals.resize(3 * total.tri);
+	out.face_texcoords.resize(3 * total.tri);
+
+	std::vector<Mesh> boxes(chunkCount);
+	pool.parallelFor(chunkCount, [&](size_t i)
+					 { parseChunk(bounds[i], bounds[i + 1], bases[i], out, boxes[i]); });
+
+	normalizeVectors(out.normals, pool);
+
+	for (const Mesh &box : boxes)
+	{
+		out.minX = std::min(out.minX, box.minX);
+		out.maxX = std::max(out.maxX, box.maxX);
+		out.minY = std::min(out.minY, box.minY);
+		out.maxY = std::max(out.maxY, box.maxY);
+		out.minZ = std::min(out.minZ, box.minZ);
+		out.maxZ = std::max(out.maxZ, box.maxZ);
+	}
+}
+
+// Memory-map a .obj file and parse it. Returns false if it cannot be opened.
+inline bool parseObjFile(const std::string &fname, Mesh &out, ThreadPool &pool = threadPool())
+{
+	out = Mesh();
+	MappedFile file;
+	if (!file.open(fname))
+		return false;
+	parseObjBuffer(file.data, file.data + file.size, out, pool);
+	return true;
+}
+
+// The original getline/istringstream loader, kept only as the baseline for
+// --bench-load. Negative (relative) indices are not resolved here.
+inline bool parseObjLegacy(const std::string &fname, LegacyObjData &out)
+{
+	out = LegacyObjData();
+	std::ifstream file(fname);
+	if (!file.is_open())
+		return false;
+
+	std::string line;
+	while (getline(file, line))
+	{
+		std::istringstream ss(line);
+		std::string type;
+		ss >> type;
+
+		if (type == "v")
+		{
+			float x, y, z;
+			ss >> x >> y >> z;
+			out.vertices.push_back({x, y, z});
+			out.minX = std::min(out.minX, x);
+			out.maxX = std::max(out.maxX, x);
+			out.minY = std::min(out.minY, y);
+			out.maxY = std::max(out.maxY, y);
+			out.minZ = std::min(out.minZ, z);
+			out.maxZ = std::max(out.maxZ, z);
+		}
+		else if (type == "vn")
+		{
+			float x, y, z;
+			ss >> x >> y >> z;
+			float len = std::sqrt(x * x + y * y + z * z);
+			if (len > 0.0f)
+			{
+				x /= len;
+				y /= len;
+				z /= len;
+			}
+			out.normals.push_back({x, y, z});
+		}
+		else if (type == "vt")
+		{
+			float u, v;
+			ss >> u >> v;
+			out.texcoords.push_back({u, v});
+		}
+		else if (type == "f")
+		{
+			std::vector<int> vIndices, nIndices, tIndices;
+			std::string token;
+			while (ss >> token)
+			{
+				int vi = -1, ti = -1, ni = -1;
+				size_t slash1 = token.find('/');
+				size_t slash2 = token.find('/', slash1 + 1);
+
+				if (slash1 == std::string::npos)
+					vi = stoi(token) - 1;
+				else if (slash2 == std::string::npos)
+				{
+					vi = stoi(token.substr(0, slash1)) - 1;
+					ti = stoi(token.substr(slash1 + 1)) - 1;
+				}
+				else if (slash2 == slash1 + 1)
+				{
+					vi = stoi(token.substr(0, slash1)) - 1;
+					ni = stoi(token.substr(slash2 + 1)) - 1;
+				}
+				else
+				{
+					vi = stoi(token.substr(0, slash1)) - 1;
+					ti = stoi(token.substr(slash1 + 1, slash2 - slash1 - 1)) - 1;
+					ni = stoi(token.substr(slash2 + 1)) - 1;
+				}
+
+				vIndices.push_back(vi);
+				tIndices.push_back(ti);
+				nIndices.push_back(ni);
+			}
+
+			for (size_t i = 1; i + 1 < vIndices.size(); ++i)
+			{
+				out.faces.push_back({vIndices[0], vIndices[i], vIndices[i + 1]});
+				out.face_texcoords.push_back({tIndices[0], tIndices[i], tIndices[i + 1]});
+				out.face_normals.push_back({nIndices[0], nIndices[i], nIndices[i + 1]});
+			}
+		}
+	}
+	return true;
+}
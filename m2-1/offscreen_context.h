@@ -0,0 +1,79 @@
+#pragma once
+
+// Keep X11 out of the EGL headers, the viewer does not need it
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// OpenGL context rendering into an EGL pbuffer, for running without a window
+// or display. Mesa's surfaceless platform is tried first, which works on
+// machines without a GPU or X server (with the llvmpipe software renderer);
+// the default display is the fallback.
+class OffscreenContext
+{
+public:
+	~OffscreenContext() { destroy(); }
+
+	// Create the context and make it current. Returns false if EGL has no
+	// display, config or desktop OpenGL context to offer.
+	bool create(int width, int height)
+	{
+		destroy();
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display != EGL_NO_DISPLAY && !eglInitialize(display, nullptr, nullptr))
+			display = EGL_NO_DISPLAY;
+#endif
+		if (display == EGL_NO_DISPLAY)
+		{
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+			if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+				return fail();
+		}
+
+		const EGLint configAttribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+										EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+										EGL_DEPTH_SIZE, 24, EGL_NONE};
+		const EGLint surfaceAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+		EGLConfig config;
+		EGLint configCount = 0;
+		if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0 ||
+			!eglBindAPI(EGL_OPENGL_API))
+			return fail();
+		surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+		if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT ||
+			!eglMakeCurrent(display, surface, surface, context))
+			return fail();
+		return true;
+	}
+
+	void destroy()
+	{
+		if (display == EGL_NO_DISPLAY)
+			return;
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context != EGL_NO_CONTEXT)
+			eglDestroyContext(display, context);
+		if (surface != EGL_NO_SURFACE)
+			eglDestroySurface(display, surface);
+		eglTerminate(display);
+		display = EGL_NO_DISPLAY;
+		surface = EGL_NO_SURFACE;
+		context = EGL_NO_CONTEXT;
+	}
+
+private:
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLSurface surface = EGL_NO_SURFACE;
+	EGLContext context = EGL_NO_CONTEXT;
+
+	bool fail()
+	{
+		destroy();
+		return false;
+	}
+};
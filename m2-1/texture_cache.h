@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "bc_encoder.h"
+#include "mesh_cache.h" // hashBytes, SourceStamp
+#include "mipmap.h"
+
+// Block-compressed copy of a texture and its mip chain, written next to the
+// source as <file>.bmp.texcache, so later launches upload it with
+// glCompressedTexImage2D instead of encoding it again. Layout:
+//   TextureCacheHeader | TextureCacheLevel[levelCount] | level data...
+// Every level starts on a 16-byte boundary and is used in place from the
+// mapping. As with the mesh cache, the file is only used when the source
+// still has the recorded size, mtime and content hash, the format is the one
+// requested and the payload hash checks out.
+
+const char textureCacheMagic[8] = {'T', 'E', 'X', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t textureCacheVersion = 1;
+
+struct TextureCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t levelCount;
+	uint64_t sourceSize;
+	int64_t sourceMtimeNs;
+	uint64_t sourceHash;
+	uint64_t payloadHash; // Hash of every byte after the header
+	uint32_t format;	  // BlockFormat
+	uint32_t reserved;
+};
+
+struct TextureCacheLevel
+{
+	int32_t width, height;
+	uint64_t offset; // From the start of the file
+	uint64_t size;	 // Bytes
+};
+
+inline std::string textureCachePath(const std::string &bmpPath) { return bmpPath + ".texcache"; }
+
+// Block-compressed mip chain, base level first: freshly encoded, or mapped
+// from the texture cache
+class CompressedTexture
+{
+public:
+	struct Level
+	{
+		int width, height;
+		const unsigned char *data;
+		size_t size;
+	};
+
+	BlockFormat format() const { return blockFormat; }
+	const std::vector<Level> &levels() const { return levelList; }
+
+	// Bytes of every level
+	size_t size() const
+	{
+		size_t total = 0;
+		for (const Level &level : levelList)
+			total += level.size;
+		return total;
+	}
+
+	// Compress the base image (laid out as for buildMipChain) and `mips`, its
+	// levels 1, 2, ...
+	void encode(const unsigned char *bottom, ptrdiff_t stride, int width, int height, int bytesPerPixel,
+				const std::vector<MipLevel> &mips, BlockFormat format, ThreadPool &pool = threadPool())
+	{
+		clear();
+		blockFormat = format;
+		size_t total = compressedSize(width, height, format);
+		for (const MipLevel &mip : mips)
+			total += compressedSize(mip.width, mip.height, format);
+		storage.resize(total);
+
+		unsigned char *out = storage.data();
+		compressImage(bottom, stride, width, height, bytesPerPixel, format, out, pool);
+		levelList.push_back({width, height, out, compressedSize(width, height, format)});
+		for (const MipLevel &mip : mips)
+		{
+			out += levelList.back().size;
+			compressImage(mip.bgra.data(), 4 * (ptrdiff_t)mip.width, mip.width, mip.height, 4, format, out, pool);
+			levelList.push_back({mip.width, mip.height, out, compressedSize(mip.width, mip.height, format)});
+		}
+	}
+
+	// Map the cache of `bmpPath`. Returns false, leaving the texture empty, if
+	// it is missing, stale, in another format or damaged in any way. `stamp`
+	// receives the source's stamp, ready to write a fresh cache with.
+	bool openCache(const std::string &bmpPath, SourceStamp &stamp, BlockFormat format)
+	{
+		clear();
+		TextureCacheHeader header;
+		if (!stamp.read(bmpPath) || !file.open(textureCachePath(bmpPath)) || file.size < sizeof(header))
+			return fail();
+
+		memcpy(&header, file.data, sizeof(header));
+		size_t tableEnd = sizeof(header) + (size_t)header.levelCount * sizeof(TextureCacheLevel);
+		if (memcmp(header.magic, textureCacheMagic, sizeof(textureCacheMagic)) != 0 ||
+			header.version != textureCacheVersion || header.sourceSize != stamp.size ||
+			header.sourceMtimeNs != stamp.mtimeNs || header.sourceHash != stamp.hash || header.format != format ||
+			header.levelCount == 0 || header.levelCount > 32 || tableEnd > file.size ||
+			hashBytes(file.data + sizeof(header), file.size - sizeof(header)) != header.payloadHash)
+			return fail();
+
+		blockFormat = format;
+		for (uint32_t i = 0; i < header.levelCount; ++i)
+		{
+			TextureCacheLevel level;
+			memcpy(&level, file.data + sizeof(header) + i * sizeof(level), sizeof(level));
+			if (level.width <= 0 || level.height <= 0 || level.offset % 16 != 0 || level.offset < tableEnd ||
+				level.offset > file.size || level.size != compressedSize(level.width, level.height, format) ||
+				level.size > file.size - level.offset)
+				return fail();
+			levelList.push_back({level.width, level.height, (const unsigned char *)file.data + level.offset,
+								 (size_t)level.size});
+		}
+		return true;
+	}
+
+	// Write the cache of `bmpPath` atomically. Failures (e.g. a read-only
+	// directory) are silent: the cache is only an optimization.
+	bool writeCache(const std::string &bmpPath, const SourceStamp &stamp) const
+	{
+		TextureCacheHeader header = {};
+		memcpy(header.magic, textureCacheMagic, sizeof(textureCacheMagic));
+		header.version = textureCacheVersion;
+		header.levelCount = (uint32_t)levelList.size();
+		header.sourceSize = stamp.size;
+		header.sourceMtimeNs = stamp.mtimeNs;
+		header.sourceHash = stamp.hash;
+		header.format = blockFormat;
+
+		// Lay the levels out after the table, 16-byte aligned
+		std::vector<TextureCacheLevel> table;
+		size_t offset = sizeof(header) + levelList.size() * sizeof(TextureCacheLevel);
+		for (const Level &level : levelList)
+		{
+			offset = (offset + 15) & ~(size_t)15;
+			table.push_back({level.width, level.height, offset, level.size});
+			offset += level.size;
+		}
+
+		std::vector<char> payload(offset - sizeof(header), 0);
+		memcpy(payload.data(), table.data(), table.size() * sizeof(TextureCacheLevel));
+		for (size_t i = 0; i < levelList.size(); ++i)
+			memcpy(payload.data() + table[i].offset - sizeof(header), levelList[i].data, levelList[i].size);
+		header.payloadHash = hashBytes(payload.data(), payload.size());
+
+		std::string path = textureCachePath(bmpPath);
+		std::string tmp = path + ".tmp." + std::to_string(getpid());
+		FILE *f = fopen(tmp.c_str(), "wb");
+		if (!f)
+			return false;
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+				  fwrite(payload.data(), 1, payload.size(), f) == payload.size();
+		ok = fclose(f) == 0 && ok;
+		if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+		{
+			remove(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// glCompressedTexImage2D of the first `count` levels into the bound
+	// GL_TEXTURE_2D, and limit sampling to them
+	void texImage(size_t count) const
+	{
+		count = std::min(count, levelList.size());
+		for (size_t i = 0; i < count; ++i)
+			glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, blockGlFormat(blockFormat), levelList[i].width,
+								   levelList[i].height, 0, (GLsizei)levelList[i].size, levelList[i].data);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)count - 1);
+	}
+
+	void clear()
+	{
+		file.close();
+		storage.clear();
+		levelList.clear();
+	}
+
+private:
+	MappedFile file;					// The cache, when the levels come from it
+	std::vector<unsigned char> storage; // The levels, when freshly encoded
+	std::vector<Level> levelList;
+	BlockFormat blockFormat = FormatBc1;
+
+	bool fail()
+	{
+		clear();
+		return false;
+	}
+};
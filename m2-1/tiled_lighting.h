@@ -0,0 +1,395 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <GL/freeglut.h>
+
+// A point light in eye space, as the per-pixel path shades it. A light with
+// radius 0 reaches everything without falloff, like a fixed-function light;
+// the others fade out smoothly and reach nothing past their radius.
+struct PointLight
+{
+	float position[3];
+	float radius;
+	float diffuse[3];
+	float specular[3];
+};
+
+// Per-pixel lighting with tiled light culling (forward+). Every frame the CPU
+// bins the lights into screen tiles of tileSize pixels by the bounding
+// rectangle of their sphere of influence, and uploads the per-tile index
+// lists as a texture buffer. The fragment shader then only loops over the
+// lights of its own tile, so the cost of a pixel follows the lights that
+// can reach it rather than the total. The lights themselves live in a
+// uniform buffer. The material, the scene ambient, the texture (modulated,
+// when GL_TEXTURE_2D is on) and the baked occlusion (when GL_TEXTURE_1D is on
+// in unit 2) come from the fixed-function state, so the result matches the
+// fixed-function lights it replaces.
+class TiledLighting
+{
+public:
+	static const int tileSize = 16; // Pixels per tile edge
+
+	~TiledLighting() { destroy(); }
+
+	// Compile the shaders, once a GL context is current. Returns false if the
+	// context lacks GLSL 1.50 with the compatibility built-ins or a uniform
+	// block large enough for a few lights; fixed-function lighting still
+	// works then.
+	bool init()
+	{
+		int major = 0, minor = 0;
+		const char *version = (const char *)glGetString(GL_VERSION);
+		if (version)
+			sscanf(version, "%d.%d", &major, &minor);
+		if (major < 3 || (major == 3 && minor < 2))
+			return false;
+		GLint blockSize = 0;
+		glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &blockSize);
+		capacity = std::min<size_t>(maxLightCount, (size_t)blockSize / sizeof(GpuLight));
+		if (capacity < 8)
+			return false;
+
+		char header[96];
+		snprintf(header, sizeof(header), "#version 150 compatibility\n#define MAX_LIGHTS %zu\n#define TILE_SIZE %d\n",
+				 capacity, tileSize);
+		GLuint vertex = compile(GL_VERTEX_SHADER, header, vertexSource);
+		GLuint fragment = compile(GL_FRAGMENT_SHADER, header, fragmentSource);
+		if (vertex && fragment)
+		{
+			program = glCreateProgram();
+			glAttachShader(program, vertex);
+			glAttachShader(program, fragment);
+			glLinkProgram(program);
+		}
+		glDeleteShader(vertex); // Freed along with the program
+		glDeleteShader(fragment);
+		GLint ok = GL_FALSE;
+		if (program)
+			glGetProgramiv(program, GL_LINK_STATUS, &ok);
+		if (!ok)
+		{
+			if (program)
+				printLog(program, true);
+			destroy();
+			return false;
+		}
+
+		glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Lights"), 0);
+		tilesUniform = glGetUniformLocation(program, "tiles");
+		tilesXUniform = glGetUniformLocation(program, "tilesX");
+		ambientUniform = glGetUniformLocation(program, "lightAmbient");
+		texturedUniform = glGetUniformLocation(program, "textured");
+		twoSideUniform = glGetUniformLocation(program, "twoSide");
+		textureUniform = glGetUniformLocation(program, "colorTexture");
+		occludedUniform = glGetUniformLocation(program, "occluded");
+		glGenBuffers(1, &lightBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, lightBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, capacity * sizeof(GpuLight), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glGenBuffers(1, &tileBuffer);
+		glGenTextures(1, &tileTexture);
+		return true;
+	}
+
+	bool available() const { return program != 0; }
+
+	// Most lights setLights uploads; the rest are dropped
+	size_t maxLights() const { return capacity; }
+
+	void destroy()
+	{
+		if (program)
+			glDeleteProgram(program);
+		if (lightBuffer)
+			glDeleteBuffers(1, &lightBuffer);
+		if (tileBuffer)
+			glDeleteBuffers(1, &tileBuffer);
+		if (tileTexture)
+			glDeleteTextures(1, &tileTexture);
+		program = lightBuffer = tileBuffer = tileTexture = 0;
+	}
+
+	// Upload the lights of the next frames and bin them into the tiles of a
+	// `width` x `height` viewport seen through `projection` (column-major).
+	// `ambient` is the sum of the lights' ambient colors. Without `cull`,
+	// every tile lists every light.
+	void setLights(const std::vector<PointLight> &lights, const float ambient[3], const float projection[16], int width,
+				   int height, bool cull = true)
+	{
+		size_t count = std::min(lights.size(), capacity);
+		std::vector<GpuLight> gpu(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const PointLight &l = lights[i];
+			gpu[i] = {{l.position[0], l.position[1], l.position[2], l.radius},
+					  {l.diffuse[0], l.diffuse[1], l.diffuse[2], 1.0f},
+					  {l.specular[0], l.specular[1], l.specular[2], 1.0f}};
+		}
+		std::copy(ambient, ambient + 3, lightAmbient);
+
+		tilesX = std::max(1, (width + tileSize - 1) / tileSize);
+		tilesY = std::max(1, (height + tileSize - 1) / tileSize);
+		size_t tileCount = (size_t)tilesX * tilesY;
+
+		// Tile rectangle of every light (x0, y0, x1, y1, exclusive), empty if
+		// it cannot reach anything on screen
+		rects.assign(4 * count, 0);
+		for (size_t i = 0; i < count; ++i)
+		{
+			int *r = &rects[4 * i];
+			if (!cull || !screenRect(lights[i], projection, width, height, r))
+			{
+				if (cull && lights[i].radius > 0)
+					continue;
+				r[0] = r[1] = 0, r[2] = tilesX, r[3] = tilesY;
+			}
+		}
+
+		// Counting sort of the (tile, light) pairs: a header of (offset,
+		// count) per tile, then the light indices of every tile in turn
+		tileData.assign(2 * tileCount, 0);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const int *r = &rects[4 * i];
+			for (int y = r[1]; y < r[3]; ++y)
+				for (int x = r[0]; x < r[2]; ++x)
+					++tileData[2 * ((size_t)y * tilesX + x) + 1];
+		}
+		uint32_t offset = (uint32_t)(2 * tileCount);
+		maxPerTile = 0;
+		for (size_t t = 0; t < tileCount; ++t)
+		{
+			tileData[2 * t] = offset;
+			offset += tileData[2 * t + 1];
+			maxPerTile = std::max<size_t>(maxPerTile, tileData[2 * t + 1]);
+		}
+		pairs = offset - 2 * tileCount;
+		tileData.resize(offset);
+		std::vector<uint32_t> fill(tileCount);
+		for (size_t t = 0; t < tileCount; ++t)
+			fill[t] = tileData[2 * t];
+		for (size_t i = 0; i < count; ++i)
+		{
+			const int *r = &rects[4 * i];
+			for (int y = r[1]; y < r[3]; ++y)
+				for (int x = r[0]; x < r[2]; ++x)
+					tileData[fill[(size_t)y * tilesX + x]++] = (uint32_t)i;
+		}
+
+		glBindBuffer(GL_UNIFORM_BUFFER, lightBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, count * sizeof(GpuLight), gpu.data());
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBuffer(GL_TEXTURE_BUFFER, tileBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, tileData.size() * sizeof(uint32_t), tileData.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		uploadedLights = count;
+	}
+
+	// Shade what is drawn until end() with the lights of the last setLights
+	void begin()
+	{
+		GLint boundTexture = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+		bool textured = glIsEnabled(GL_TEXTURE_2D) && boundTexture != 0;
+		glActiveTexture(GL_TEXTURE2);
+		bool occluded = glIsEnabled(GL_TEXTURE_1D); // The occlusion ramp of the fixed-function path
+
+		glUseProgram(program);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, lightBuffer);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_BUFFER, tileTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, tileBuffer);
+		glActiveTexture(GL_TEXTURE0);
+		glUniform1i(tilesUniform, 1);
+		glUniform1i(textureUniform, 0);
+		glUniform1i(tilesXUniform, tilesX);
+		glUniform3fv(ambientUniform, 1, lightAmbient);
+		glUniform1i(texturedUniform, textured);
+		glUniform1i(occludedUniform, occluded);
+		GLboolean twoSide = GL_FALSE;
+		glGetBooleanv(GL_LIGHT_MODEL_TWO_SIDE, &twoSide);
+		glUniform1i(twoSideUniform, twoSide);
+	}
+
+	void end()
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glUseProgram(0);
+	}
+
+	// Of the last setLights: lights uploaded, (tile, light) pairs and the most
+	// lights any tile shades
+	size_t lightCount() const { return uploadedLights; }
+	double averageLightsPerTile() const { return (double)pairs / (tilesX * tilesY); }
+	size_t maxLightsPerTile() const { return maxPerTile; }
+
+private:
+	static constexpr size_t maxLightCount = 1024;
+
+	// std140 layout of one light in the uniform block
+	struct GpuLight
+	{
+		float position[4]; // xyz, radius
+		float diffuse[4];
+		float specular[4];
+	};
+
+	GLuint program = 0, lightBuffer = 0, tileBuffer = 0, tileTexture = 0;
+	GLint tilesUniform = -1, tilesXUniform = -1, ambientUniform = -1, texturedUniform = -1, textureUniform = -1,
+		  twoSideUniform = -1, occludedUniform = -1;
+	size_t capacity = 0, uploadedLights = 0, pairs = 0, maxPerTile = 0;
+	int tilesX = 1, tilesY = 1;
+	float lightAmbient[3] = {0, 0, 0};
+	std::vector<int> rects;
+	std::vector<uint32_t> tileData;
+
+	// Tiles covered by the light's sphere: the projection of the corners of
+	// its eye-space bounding box, which is conservative. False if the sphere
+	// is off screen or the light is unlimited; a sphere reaching behind the
+	// eye covers the whole screen.
+	bool screenRect(const PointLight &light, const float p[16], int width, int height, int r[4]) const
+	{
+		if (light.radius <= 0)
+			return false;
+		const float *c = light.position;
+		if (c[2] - light.radius > 0.0f)
+			return false; // Entirely behind the eye
+		float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+		for (int k = 0; k < 8; ++k)
+		{
+			float v[3] = {c[0] + (k & 1 ? light.radius : -light.radius), c[1] + (k & 2 ? light.radius : -light.radius),
+						  c[2] + (k & 4 ? light.radius : -light.radius)};
+			float x = p[0] * v[0] + p[4] * v[1] + p[8] * v[2] + p[12];
+			float y = p[1] * v[0] + p[5] * v[1] + p[9] * v[2] + p[13];
+			float w = p[3] * v[0] + p[7] * v[1] + p[11] * v[2] + p[15];
+			if (w <= 1e-6f)
+			{
+				r[0] = r[1] = 0, r[2] = tilesX, r[3] = tilesY;
+				return true;
+			}
+			minX = std::min(minX, x / w), maxX = std::max(maxX, x / w);
+			minY = std::min(minY, y / w), maxY = std::max(maxY, y / w);
+		}
+		if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+			return false;
+		auto tile = [](float ndc, int pixels)
+		{ return (int)std::floor((std::min(std::max(ndc, -1.0f), 1.0f) * 0.5f + 0.5f) * pixels / tileSize); };
+		r[0] = tile(minX, width), r[1] = tile(minY, height);
+		r[2] = std::min(tile(maxX, width) + 1, tilesX), r[3] = std::min(tile(maxY, height) + 1, tilesY);
+		return true;
+	}
+
+	GLuint compile(GLenum type, const char *header, const char *source)
+	{
+		GLuint shader = glCreateShader(type);
+		const char *sources[2] = {header, source};
+		glShaderSource(shader, 2, sources, nullptr);
+		glCompileShader(shader);
+		GLint ok = GL_FALSE;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+		if (!ok)
+		{
+			printLog(shader, false);
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+
+	static constexpr const char *vertexSource = R"(
+out vec3 eyePosition;
+out vec3 eyeNormal;
+
+void main()
+{
+	vec4 eye = gl_ModelViewMatrix * gl_Vertex;
+	eyePosition = eye.xyz / eye.w;
+	eyeNormal = gl_NormalMatrix * gl_Normal;
+	gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;
+	gl_TexCoord[2] = gl_MultiTexCoord2;
+	gl_Position = gl_ProjectionMatrix * eye;
+}
+)";
+
+	// Fixed-function lighting (infinite viewer, no spot cones) per pixel, over
+	// the lights of the pixel's tile. With two-sided lighting, back faces use
+	// the flipped normal.
+	static constexpr const char *fragmentSource = R"(
+struct Light
+{
+	vec4 position; // xyz, radius (0 = unlimited)
+	vec4 diffuse;
+	vec4 specular;
+};
+layout(std140) uniform Lights
+{
+	Light lights[MAX_LIGHTS];
+};
+uniform usamplerBuffer tiles; // (offset, count) per tile, then the light indices
+uniform int tilesX;
+uniform vec3 lightAmbient;
+uniform bool textured;
+uniform bool twoSide; // GL_LIGHT_MODEL_TWO_SIDE
+uniform sampler2D colorTexture;
+uniform bool occluded; // Baked ambient occlusion in the s coordinate of unit 2
+in vec3 eyePosition;
+in vec3 eyeNormal;
+
+void main()
+{
+	bool back = twoSide && !gl_FrontFacing;
+	vec3 normal = normalize(back ? -eyeNormal : eyeNormal);
+	vec4 ambient = back ? gl_BackMaterial.ambient : gl_FrontMaterial.ambient;
+	vec4 diffuse = back ? gl_BackMaterial.diffuse : gl_FrontMaterial.diffuse;
+	vec4 specular = back ? gl_BackMaterial.specular : gl_FrontMaterial.specular;
+	float shininess = back ? gl_BackMaterial.shininess : gl_FrontMaterial.shininess;
+	vec3 color = (back ? gl_BackLightModelProduct.sceneColor : gl_FrontLightModelProduct.sceneColor).rgb +
+				 lightAmbient * ambient.rgb;
+
+	int tile = int(gl_FragCoord.y) / TILE_SIZE * tilesX + int(gl_FragCoord.x) / TILE_SIZE;
+	int first = int(texelFetch(tiles, 2 * tile).r);
+	int count = int(texelFetch(tiles, 2 * tile + 1).r);
+	for (int i = first; i < first + count; ++i)
+	{
+		Light light = lights[texelFetch(tiles, i).r];
+		vec3 toLight = light.position.xyz - eyePosition;
+		float range = length(toLight);
+		float attenuation = 1.0;
+		if (light.position.w > 0.0)
+		{
+			float x = min(range / light.position.w, 1.0);
+			attenuation = (1.0 - x * x) * (1.0 - x * x);
+		}
+		toLight /= max(range, 1e-6);
+		float lambert = max(dot(normal, toLight), 0.0);
+		if (lambert <= 0.0 || attenuation <= 0.0)
+			continue;
+		float highlight = pow(max(dot(normal, normalize(toLight + vec3(0.0, 0.0, 1.0))), 0.0), shininess);
+		color += attenuation * (lambert * light.diffuse.rgb * diffuse.rgb + highlight * light.specular.rgb * specular.rgb);
+	}
+
+	vec4 result = clamp(vec4(color, diffuse.a), 0.0, 1.0);
+	if (textured)
+		result *= texture(colorTexture, gl_TexCoord[0].st);
+	if (occluded)
+		result.rgb *= 1.0 - clamp(gl_TexCoord[2].s, 0.0, 1.0);
+	gl_FragColor = result;
+}
+)";
+
+	static void printLog(GLuint object, bool isProgram)
+	{
+		char log[1024] = "";
+		if (isProgram)
+			glGetProgramInfoLog(object, sizeof(log), nullptr, log);
+		else
+			glGetShaderInfoLog(object, sizeof(log), nullptr, log);
+		fprintf(stderr, "Lighting shader: %s\n", log);
+	}
+};